@@ -0,0 +1,161 @@
+/*------------------------------------------------------------------------------//
+ImageStatisticsBenchmark.exe
+
+Description:
+This file is a utility for measuring the throughput of vtkImageMultiStatistics. It
+builds a randomly generated multi-component volume, optionally with a random mask,
+and times the statistics engine on a single thread and on the requested number of
+threads, reporting the voxel throughput of each and the largest difference between
+their results.
+
+Usage:\t [-size VoxelsPerSide] [-components NumberOfComponents] [-bins NumberOfBins]
+         [-threads NumberOfThreads] [-mask]
+
+//------------------------------------------------------------------------------*/
+
+#include "vtkImageData.h"
+#include "vtkImageMultiStatistics.h"
+#include "vtkMath.h"
+#include "vtkSmartPointer.h"
+#include "vtkTimerLog.h"
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+void showHelpMessage()
+{
+  std::cerr << "Usage:\t [-size VoxelsPerSide] [-components NumberOfComponents] [-bins NumberOfBins] " <<
+            "[-threads NumberOfThreads] [-mask]" << std::endl;
+}
+
+// Every statistic reported by the filter, in a fixed order, so that two runs can be compared.
+std::vector<double> gatherResults( vtkImageMultiStatistics* Statistics, int NumComponents )
+{
+  std::vector<double> Results;
+  Results.push_back( Statistics->GetTotalEntropy() );
+  for( int i = 0; i < NumComponents; i++ )
+  {
+    Results.push_back( Statistics->GetAverageMagnitude(i) );
+    Results.push_back( Statistics->GetMeanSquared(i) );
+    for( int j = 0; j < NumComponents; j++ )
+    {
+      Results.push_back( Statistics->GetCovariance(i, j) );
+      Results.push_back( Statistics->GetJointEntropy(i, j) );
+    }
+  }
+  return Results;
+}
+
+int main(int argc, char** argv)
+{
+  int Size = 128;
+  int NumComponents = 3;
+  int NumBins = 64;
+  int NumThreads = 4;
+  bool UseMask = false;
+
+  for( int i = 1; i < argc; i++ )
+  {
+    std::string Argument = std::string(argv[i]);
+    if( i+1 < argc && Argument == "-size" )
+    {
+      Size = atoi(argv[++i]);
+    }
+    else if( i+1 < argc && Argument == "-components" )
+    {
+      NumComponents = atoi(argv[++i]);
+    }
+    else if( i+1 < argc && Argument == "-bins" )
+    {
+      NumBins = atoi(argv[++i]);
+    }
+    else if( i+1 < argc && Argument == "-threads" )
+    {
+      NumThreads = atoi(argv[++i]);
+    }
+    else if( Argument == "-mask" )
+    {
+      UseMask = true;
+    }
+    else
+    {
+      showHelpMessage();
+      return 0;
+    }
+  }
+  if( Size < 1 || NumComponents < 1 || NumBins < 1 || NumThreads < 1 )
+  {
+    showHelpMessage();
+    return 0;
+  }
+
+  //generate a random volume with correlated components and an optional random mask
+  vtkMath::RandomSeed(0);
+  vtkIdType NumVoxels = (vtkIdType) Size * Size * Size;
+  vtkSmartPointer<vtkImageData> Image = vtkSmartPointer<vtkImageData>::New();
+  Image->SetExtent(0, Size-1, 0, Size-1, 0, Size-1);
+  Image->AllocateScalars(VTK_SHORT, NumComponents);
+  short* Ptr = (short*) Image->GetScalarPointer();
+  for( vtkIdType x = 0; x < NumVoxels; x++ )
+  {
+    double Base = vtkMath::Gaussian(1000.0, 200.0);
+    for( int c = 0; c < NumComponents; c++ )
+    {
+      Ptr[x * NumComponents + c] = (short) (Base + vtkMath::Gaussian(0.0, 50.0 * (c + 1)));
+    }
+  }
+
+  vtkSmartPointer<vtkImageMultiStatistics> Statistics = vtkSmartPointer<vtkImageMultiStatistics>::New();
+  Statistics->SetInputData(Image);
+  Statistics->SetEntropyResolution(NumBins);
+
+  vtkSmartPointer<vtkImageData> Mask = vtkSmartPointer<vtkImageData>::New();
+  if( UseMask )
+  {
+    Mask->SetExtent(0, Size-1, 0, Size-1, 0, Size-1);
+    Mask->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+    unsigned char* MaskPtr = (unsigned char*) Mask->GetScalarPointer();
+    for( vtkIdType x = 0; x < NumVoxels; x++ )
+    {
+      MaskPtr[x] = (vtkMath::Random() < 0.5) ? 1 : 0;
+    }
+    Statistics->AddInputDataObject(0, Mask);
+  }
+
+  std::cout << "Volume: " << Size << "^3, components: " << NumComponents << ", bins: " << NumBins
+            << (UseMask ? ", masked" : "") << std::endl;
+
+  //time the engine on a single thread, then on the requested number of threads
+  vtkSmartPointer<vtkTimerLog> Timer = vtkSmartPointer<vtkTimerLog>::New();
+  int ThreadCounts[2] = { 1, NumThreads };
+  double Seconds[2];
+  std::vector<double> Results[2];
+  for( int r = 0; r < 2; r++ )
+  {
+    Statistics->SetNumberOfThreads(ThreadCounts[r]);
+    Statistics->Modified();
+    Timer->StartTimer();
+    Statistics->Update();
+    Timer->StopTimer();
+    Seconds[r] = Timer->GetElapsedTime();
+    Results[r] = gatherResults(Statistics, NumComponents);
+
+    std::cout << ThreadCounts[r] << " thread(s): " << Seconds[r] * 1000.0 << " ms, "
+              << (double) NumVoxels / Seconds[r] / 1.0e6 << " Mvoxels/s, total entropy "
+              << Results[r][0] << std::endl;
+  }
+
+  double MaxDifference = 0.0;
+  for( size_t i = 0; i < Results[0].size(); i++ )
+  {
+    double Difference = fabs(Results[0][i] - Results[1][i]) / (fabs(Results[0][i]) > 1.0 ? fabs(Results[0][i]) : 1.0);
+    MaxDifference = (Difference > MaxDifference) ? Difference : MaxDifference;
+  }
+  std::cout << "Speedup: " << Seconds[0] / Seconds[1] << ", largest relative difference "
+            << MaxDifference << std::endl;
+
+  return 0;
+}
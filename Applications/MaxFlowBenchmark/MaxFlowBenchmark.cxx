@@ -0,0 +1,206 @@
+/*------------------------------------------------------------------------------//
+MaxFlowBenchmark.exe
+
+Description:
+This file is a utility for measuring the throughput of the CPU GHMF solver. It builds
+a flat hierarchy of randomly generated data terms and times the solver with and without
+the fused spatial flow kernels, reporting the time taken and the memory bandwidth
+achieved per iteration. It then repeats the solve with the spatial flows stored in
+each of the 16-bit formats, reporting the memory saved and how far the labels drift
+from those found in single precision.
+
+Usage:\t [-size VoxelsPerSide] [-labels NumberOfLabels] [-iterations NumberOfIterations]
+         [-threads NumberOfThreads]
+
+//------------------------------------------------------------------------------*/
+
+#include "vtkHierarchicalMaxFlowSegmentation.h"
+#include "vtkImageData.h"
+#include "vtkMath.h"
+#include "vtkMutableDirectedGraph.h"
+#include "vtkSmartPointer.h"
+#include "vtkTimerLog.h"
+#include "vtkTree.h"
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+void showHelpMessage()
+{
+  std::cerr << "Usage:\t [-size VoxelsPerSide] [-labels NumberOfLabels] [-iterations NumberOfIterations] " <<
+            "[-threads NumberOfThreads]" << std::endl;
+}
+
+// Number of full-volume float buffer reads and writes per iteration for a flat hierarchy,
+// following the kernels called in vtkHierarchicalMaxFlowSegmentation::SolveMaxFlow.
+double buffersMovedPerIteration( int numLeaves, bool fused )
+{
+  //gradient step, apply step, flow magnitude, projection and divergence as separate
+  //passes, or read sink, source and label and update the div and flow buffers in one
+  double spatial = fused ? 11.0 : 27.0;
+
+  //sink flow, constraint, label and source flow updates for each leaf, plus the
+  //initialization and division of the source working buffer
+  return numLeaves * (spatial + 17.0) + 3.0;
+}
+
+// Compare the labels from a reduced precision solve against those from the single precision
+// solve, reporting the mean and largest absolute differences and the fraction of voxels
+// whose most likely label changes.
+void reportAccuracy( const std::vector< vtkSmartPointer<vtkImageData> >& Reference,
+                     vtkHierarchicalMaxFlowSegmentation* Segmenter, int NumLabels )
+{
+  vtkIdType NumVoxels = Reference[0]->GetNumberOfPoints();
+  std::vector<float*> Labels;
+  for( int i = 0; i < NumLabels; i++ )
+  {
+    Labels.push_back( (float*) vtkImageData::SafeDownCast(Segmenter->GetOutputDataObject(i))->GetScalarPointer() );
+  }
+
+  double SumError = 0.0;
+  double MaxError = 0.0;
+  vtkIdType NumChanged = 0;
+  for( vtkIdType x = 0; x < NumVoxels; x++ )
+  {
+    int RefBest = 0;
+    int Best = 0;
+    for( int i = 0; i < NumLabels; i++ )
+    {
+      float* Ref = (float*) Reference[i]->GetScalarPointer();
+      double Error = fabs( (double) Labels[i][x] - (double) Ref[x] );
+      SumError += Error;
+      MaxError = (Error > MaxError) ? Error : MaxError;
+      RefBest = (Ref[x] > ((float*) Reference[RefBest]->GetScalarPointer())[x]) ? i : RefBest;
+      Best = (Labels[i][x] > Labels[Best][x]) ? i : Best;
+    }
+    NumChanged += (RefBest != Best) ? 1 : 0;
+  }
+
+  std::cout << "  mean label error " << SumError / ((double) NumVoxels * NumLabels)
+            << ", max label error " << MaxError
+            << ", voxels changing label " << 100.0 * (double) NumChanged / (double) NumVoxels << "%" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  int Size = 128;
+  int NumLabels = 8;
+  int NumIts = 50;
+  int NumThreads = 1;
+
+  for( int i = 1; i < argc; i++ )
+  {
+    std::string Argument = std::string(argv[i]);
+    if( i+1 < argc && Argument == "-size" )
+    {
+      Size = atoi(argv[++i]);
+    }
+    else if( i+1 < argc && Argument == "-labels" )
+    {
+      NumLabels = atoi(argv[++i]);
+    }
+    else if( i+1 < argc && Argument == "-iterations" )
+    {
+      NumIts = atoi(argv[++i]);
+    }
+    else if( i+1 < argc && Argument == "-threads" )
+    {
+      NumThreads = atoi(argv[++i]);
+    }
+    else
+    {
+      showHelpMessage();
+      return 0;
+    }
+  }
+  if( Size < 2 || NumLabels < 2 || NumIts < 1 || NumThreads < 1 )
+  {
+    showHelpMessage();
+    return 0;
+  }
+
+  //create a flat hierarchy with one leaf per label
+  vtkSmartPointer<vtkMutableDirectedGraph> Graph = vtkSmartPointer<vtkMutableDirectedGraph>::New();
+  vtkIdType Root = Graph->AddVertex();
+  std::vector<vtkIdType> Leaves;
+  for( int i = 0; i < NumLabels; i++ )
+  {
+    Leaves.push_back( Graph->AddChild(Root) );
+  }
+  vtkSmartPointer<vtkTree> Tree = vtkSmartPointer<vtkTree>::New();
+  Tree->CheckedShallowCopy(Graph);
+
+  vtkSmartPointer<vtkHierarchicalMaxFlowSegmentation> Segmenter =
+    vtkSmartPointer<vtkHierarchicalMaxFlowSegmentation>::New();
+  Segmenter->SetStructure(Tree);
+  Segmenter->SetNumberOfIterations(NumIts);
+  Segmenter->SetNumberOfThreads(NumThreads);
+
+  //generate random data terms
+  vtkMath::RandomSeed(0);
+  std::vector< vtkSmartPointer<vtkImageData> > DataTerms;
+  for( int i = 0; i < NumLabels; i++ )
+  {
+    vtkSmartPointer<vtkImageData> DataTerm = vtkSmartPointer<vtkImageData>::New();
+    DataTerm->SetExtent(0, Size-1, 0, Size-1, 0, Size-1);
+    DataTerm->AllocateScalars(VTK_FLOAT, 1);
+    float* Ptr = (float*) DataTerm->GetScalarPointer();
+    for( vtkIdType x = 0; x < (vtkIdType) Size*Size*Size; x++ )
+    {
+      Ptr[x] = (float) vtkMath::Random(0.0, 1.0);
+    }
+    Segmenter->SetDataInputDataObject(Leaves[i], DataTerm);
+    DataTerms.push_back(DataTerm);
+  }
+
+  std::cout << "Volume: " << Size << "^3, labels: " << NumLabels << ", iterations: " << NumIts
+            << ", threads: " << NumThreads << std::endl;
+
+  //time the solver with the separate and the fused spatial flow kernels
+  double VolumeBytes = (double) Size * Size * Size * sizeof(float);
+  vtkSmartPointer<vtkTimerLog> Timer = vtkSmartPointer<vtkTimerLog>::New();
+  for( int fused = 0; fused < 2; fused++ )
+  {
+    Segmenter->SetUseFusedKernels(fused);
+    Timer->StartTimer();
+    Segmenter->Update();
+    Timer->StopTimer();
+
+    double SecondsPerIteration = Timer->GetElapsedTime() / NumIts;
+    double BytesPerIteration = VolumeBytes * buffersMovedPerIteration(NumLabels, fused != 0);
+    std::cout << (fused ? "Fused:   " : "Unfused: ")
+              << SecondsPerIteration * 1000.0 << " ms/iteration, "
+              << BytesPerIteration / 1.0e9 << " GB/iteration, "
+              << BytesPerIteration / SecondsPerIteration / 1.0e9 << " GB/s" << std::endl;
+  }
+
+  //keep the single precision labels as the reference for the reduced precision solves
+  std::vector< vtkSmartPointer<vtkImageData> > Reference;
+  for( int i = 0; i < NumLabels; i++ )
+  {
+    vtkSmartPointer<vtkImageData> Labels = vtkSmartPointer<vtkImageData>::New();
+    Labels->DeepCopy( Segmenter->GetOutputDataObject(i) );
+    Reference.push_back(Labels);
+  }
+  vtkTypeInt64 ReferenceWorkingSet = Segmenter->GetPeakWorkingSetSize();
+
+  const char* FormatNames[2] = { "Float16: ", "BFloat16:" };
+  int Formats[2] = { VTK_MAXFLOW_FLOAT16_STORAGE, VTK_MAXFLOW_BFLOAT16_STORAGE };
+  for( int f = 0; f < 2; f++ )
+  {
+    Segmenter->SetFlowStorageFormat(Formats[f]);
+    Timer->StartTimer();
+    Segmenter->Update();
+    Timer->StopTimer();
+
+    std::cout << FormatNames[f] << " " << Timer->GetElapsedTime() / NumIts * 1000.0 << " ms/iteration, "
+              << Segmenter->GetPeakWorkingSetSize() / 1.0e6 << " MB peak vs "
+              << ReferenceWorkingSet / 1.0e6 << " MB in single precision" << std::endl;
+    reportAccuracy(Reference, Segmenter, NumLabels);
+  }
+
+  return 0;
+}
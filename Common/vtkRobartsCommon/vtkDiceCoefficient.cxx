@@ -6,7 +6,12 @@
 #include "vtkInformationVector.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
 
-#include "vtkImageCast.h"
+#include "vtkDoubleArray.h"
+#include "vtkIdTypeArray.h"
+#include "vtkIntArray.h"
+#include "vtkMultiThreader.h"
+#include "vtkSmartPointer.h"
+#include "vtkTable.h"
 
 #include <math.h>
 #include <float.h>
@@ -17,9 +22,10 @@ vtkStandardNewMacro(vtkDiceCoefficient);
 vtkDiceCoefficient::vtkDiceCoefficient()
 {
   this->LabelID = 0;
+  this->DiceCoefficient = 0.0;
 
   this->SetNumberOfInputPorts(2);
-  this->SetNumberOfThreads(1);
+  this->SetNumberOfOutputPorts(2);
 }
 
 //----------------------------------------------------------------------------
@@ -65,6 +71,7 @@ int vtkDiceCoefficient::RequestInformation (
   }
 
   outInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext,6);
+  vtkDataObject::SetPointDataActiveScalarInfo(outInfo, VTK_UNSIGNED_CHAR, 1);
 
   return 1;
 }
@@ -88,147 +95,280 @@ void vtkImageMathematicsClamp(TValue &value, TIvar ivar, vtkImageData *data)
 }
 
 //----------------------------------------------------------------------------
-// This templated function executes the filter for any type of data.
-// Handles the two input operations
-template <class T>
-void vtkDiceCoefficient::vtkDiceCoefficientExecute(vtkDiceCoefficient *self,
-    vtkImageData *in1Data, T *in1Ptr,
-    vtkImageData *in2Data, T *in2Ptr,
-    vtkImageData *outData, T *outPtr,
-    int outExt[6], int id)
-{
-  vtkImageCast *in1Cast = vtkImageCast::New();
-  vtkImageCast *in2Cast = vtkImageCast::New();
-
-  in1Cast->SetInputDataObject(in1Data);
-  in1Cast->SetOutputScalarTypeToUnsignedChar();
-  in1Cast->Update();
-  in2Cast->SetInputDataObject(in2Data);
-  in2Cast->SetOutputScalarTypeToUnsignedChar();
-  in2Cast->Update();
-
-  unsigned char* lbl1Buffer = (unsigned char*) in1Cast->GetOutput()->GetScalarPointer();
-  unsigned char* lbl2Buffer = (unsigned char*) in2Cast->GetOutput()->GetScalarPointer();
+namespace
+{
+  typedef std::map< std::pair<int,int>, vtkIdType > vtkDiceCoefficientMatrix;
 
-  // allocate output buffer
-  outData->DeepCopy(in1Cast->GetOutput());
+  struct vtkDiceCoefficientThreadStruct
+  {
+    vtkDiceCoefficient *Filter;
+    vtkImageData *In1Data;
+    vtkImageData *In2Data;
+    int Extent[6];
+    vtkDiceCoefficientMatrix *Matrices;
+  };
+}
 
-  int volumeSize = in2Cast->GetOutput()->GetDimensions()[0]*
-                   in2Cast->GetOutput()->GetDimensions()[1]*
-                   in2Cast->GetOutput()->GetDimensions()[2];
+//----------------------------------------------------------------------------
+// Accumulate the label confusion matrix over one thread's block of z-slices.
+// Consecutive voxels with the same label pair are counted as a run, so the map
+// is only touched at label boundaries.
+template <class T1, class T2>
+VTK_THREAD_RETURN_TYPE vtkDiceCoefficientThreadedExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkDiceCoefficientThreadStruct *str = static_cast<vtkDiceCoefficientThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  const int* ext = str->Extent;
+  int numSlices = ext[5] - ext[4] + 1;
+  int firstSlice = ext[4] + (int)(((vtkTypeInt64) numSlices * threadId) / threadCount);
+  int lastSlice = ext[4] + (int)(((vtkTypeInt64) numSlices * (threadId + 1)) / threadCount);
+  vtkDiceCoefficientMatrix& matrix = str->Matrices[threadId];
+
+  std::pair<int,int> run(0,0);
+  vtkIdType runLength = 0;
+  for(int idxZ = firstSlice; idxZ < lastSlice; idxZ++)
+  {
+    for(int idxY = ext[2]; !str->Filter->AbortExecute && idxY <= ext[3]; idxY++)
+    {
+      T1* lbl1Ptr = (T1*) str->In1Data->GetScalarPointer(ext[0], idxY, idxZ);
+      T2* lbl2Ptr = (T2*) str->In2Data->GetScalarPointer(ext[0], idxY, idxZ);
+      for(int idxX = ext[0]; idxX <= ext[1]; idxX++)
+      {
+        std::pair<int,int> pair((int) *(lbl1Ptr++), (int) *(lbl2Ptr++));
+        if( pair != run )
+        {
+          if( runLength )
+            matrix[run] += runLength;
+          run = pair;
+          runLength = 0;
+        }
+        runLength++;
+      }
+    }
+  }
+  if( runLength )
+    matrix[run] += runLength;
 
-  unsigned char* outBuffer =  (unsigned char*)outData->GetScalarPointer();
-  std::fill_n(outBuffer, volumeSize , 0.0f);
+  return VTK_THREAD_RETURN_VALUE;
+}
 
-  // Calculate Dice Coefficient
+//----------------------------------------------------------------------------
+template <class T1, class T2>
+vtkThreadFunctionType vtkDiceCoefficientGetMethod(T1 *vtkNotUsed(in1Ptr), T2 *vtkNotUsed(in2Ptr))
+{
+  return &vtkDiceCoefficientThreadedExecute<T1, T2>;
+}
 
-  unsigned int numVx1 = 0;
-  unsigned int numVx2 = 0;
-  unsigned int numVxOverlap = 0;
+template <class T1>
+void vtkDiceCoefficientStart(vtkDiceCoefficient *self, vtkImageData *in2Data, T1 *in1Ptr,
+                             vtkThreadFunctionType &method)
+{
+  switch (in2Data->GetScalarType())
+  {
+    vtkTemplateMacro(
+      method = vtkDiceCoefficientGetMethod(in1Ptr, static_cast<VTK_TT *>(0)));
+  default:
+    vtkErrorWithObjectMacro(self, << "Execute: Unknown ScalarType");
+    method = 0;
+    return;
+  }
+}
 
+//----------------------------------------------------------------------------
+// Request the whole of both inputs, since every label contributes to the table.
+int vtkDiceCoefficient::RequestUpdateExtent (
+  vtkInformation * vtkNotUsed(request),
+  vtkInformationVector **inputVector,
+  vtkInformationVector *vtkNotUsed(outputVector))
+{
+  for (int port = 0; port < 2; port++)
+  {
+    vtkInformation *inInfo = inputVector[port]->GetInformationObject(0);
+    if (!inInfo)
+    {
+      continue;
+    }
+    int ext[6];
+    inInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext);
+    inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),ext,6);
+  }
+  return 1;
+}
 
+//----------------------------------------------------------------------------
+// Build the label confusion matrix over the intersection of the inputs in a
+// single threaded pass, then derive all the overlap metrics from it.
+int vtkDiceCoefficient::RequestData(
+  vtkInformation * vtkNotUsed( request ),
+  vtkInformationVector ** inputVector,
+  vtkInformationVector * outputVector)
+{
+  vtkImageData* in1Data = vtkImageData::GetData(inputVector[0]);
+  vtkImageData* in2Data = vtkImageData::GetData(inputVector[1]);
+  vtkImageData* outData = vtkImageData::GetData(outputVector, 0);
+  vtkTable* outTable = vtkTable::GetData(outputVector, 1);
 
-  for(int idx = 0; idx < volumeSize; idx++)
+  if (!in1Data || !in2Data)
   {
+    vtkErrorMacro(
+      "ImageMathematics requested to perform a two input operation "
+      "with only one input\n");
+    return -1;
+  }
 
-    if (lbl1Buffer[idx] == this->LabelID)
-    {
-      numVx1++;
-    }
+  // this filter expects single component label maps
+  if (in1Data->GetNumberOfScalarComponents() != 1 ||
+      in2Data->GetNumberOfScalarComponents() != 1)
+  {
+    vtkErrorMacro( "Execute: input1 NumberOfScalarComponents, "
+                   << in1Data->GetNumberOfScalarComponents()
+                   << ", and input2 NumberOfScalarComponents, "
+                   << in2Data->GetNumberOfScalarComponents()
+                   << ", must both be 1");
+    return -1;
+  }
 
-    if (lbl2Buffer[idx] == this->LabelID)
-    {
-      numVx2++;
-    }
+  // allocate output buffer
+  int ext[6];
+  outputVector->GetInformationObject(0)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), ext);
+  outData->SetExtent(ext);
+  outData->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+  memset(outData->GetScalarPointer(), 0, outData->GetNumberOfPoints() * sizeof(unsigned char));
+
+  vtkThreadFunctionType method = 0;
+  switch (in1Data->GetScalarType())
+  {
+    vtkTemplateMacro(
+      vtkDiceCoefficientStart(this, in2Data, static_cast<VTK_TT *>(0), method));
+  default:
+    vtkErrorMacro( "Execute: Unknown ScalarType");
+    return -1;
+  }
+  if (!method)
+  {
+    return -1;
+  }
+
+  // accumulate a private confusion matrix in each thread and merge them
+  vtkDiceCoefficientThreadStruct str;
+  str.Filter = this;
+  str.In1Data = in1Data;
+  str.In2Data = in2Data;
+  for (int i = 0; i < 6; i++)
+  {
+    str.Extent[i] = ext[i];
+  }
+  str.Matrices = new vtkDiceCoefficientMatrix[this->NumberOfThreads];
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+  this->Threader->SetSingleMethod(method, &str);
+  this->Threader->SingleMethodExecute();
 
-    if (lbl1Buffer[idx] == this->LabelID && lbl2Buffer[idx] == this->LabelID)
+  this->ConfusionMatrix.clear();
+  for (int t = 0; t < this->NumberOfThreads; t++)
+  {
+    for (vtkDiceCoefficientMatrix::const_iterator it = str.Matrices[t].begin(); it != str.Matrices[t].end(); ++it)
     {
-      numVxOverlap++;
+      this->ConfusionMatrix[it->first] += it->second;
     }
-
   }
+  delete[] str.Matrices;
 
-  this->DiceCoefficient = ((double)(2*numVxOverlap))/(double)(numVx1+numVx2);
+  vtkIdType numVoxels = (vtkIdType) (ext[1]-ext[0]+1) * (ext[3]-ext[2]+1) * (ext[5]-ext[4]+1);
+  this->FillOverlapTable(outTable, numVoxels);
 
-  in1Cast->Delete();
-  in2Cast->Delete();
+  // keep the single label result for the selected label
+  this->DiceCoefficient = 0.0;
+  for (vtkIdType row = 0; row < outTable->GetNumberOfRows(); row++)
+  {
+    if (outTable->GetValueByName(row, "Label").ToInt() == this->LabelID)
+    {
+      this->DiceCoefficient = outTable->GetValueByName(row, "Dice").ToDouble();
+    }
+  }
 
-  return;
+  return 1;
 }
 
 //----------------------------------------------------------------------------
-// This method is passed a input and output datas, and executes the filter
-// algorithm to fill the output from the inputs.
-// It just executes a switch statement to call the correct function for
-// the datas data types.
-void vtkDiceCoefficient::ThreadedRequestData(
-  vtkInformation * vtkNotUsed( request ),
-  vtkInformationVector ** vtkNotUsed( inputVector ),
-  vtkInformationVector * vtkNotUsed( outputVector ),
-  vtkImageData ***inData,
-  vtkImageData **outData,
-  int outExt[6], int id)
+void vtkDiceCoefficient::FillOverlapTable(vtkTable* table, vtkIdType numVoxels)
 {
-  void *inPtr1;
-  void *inPtr2;
-  void *outPtr;
-
-  inPtr1 = inData[0][0]->GetScalarPointerForExtent(outExt);
-  inPtr2 = inData[1][0]->GetScalarPointerForExtent(outExt);
-  outPtr = outData[0]->GetScalarPointerForExtent(outExt);
-
-  if (!inData[1] || ! inData[1][0])
+  // gather the marginal volumes and overlap of every label
+  std::map<int,vtkIdType> refVolume;
+  std::map<int,vtkIdType> segVolume;
+  std::map<int,vtkIdType> overlap;
+  for (vtkDiceCoefficientMatrix::const_iterator it = this->ConfusionMatrix.begin(); it != this->ConfusionMatrix.end(); ++it)
   {
-    vtkErrorMacro(
-      "ImageMathematics requested to perform a two input operation "
-      "with only one input\n");
-    return;
+    refVolume[it->first.first] += it->second;
+    segVolume[it->first.second] += it->second;
+    overlap[it->first.first] += 0;
+    overlap[it->first.second] += 0;
+    if (it->first.first == it->first.second)
+    {
+      overlap[it->first.first] += it->second;
+    }
   }
 
-  // this filter expects that input is the same type as output.
-  if (inData[0][0]->GetScalarType() != outData[0]->GetScalarType())
+  vtkSmartPointer<vtkIntArray> labelArray = vtkSmartPointer<vtkIntArray>::New();
+  labelArray->SetName("Label");
+  vtkSmartPointer<vtkIdTypeArray> refArray = vtkSmartPointer<vtkIdTypeArray>::New();
+  refArray->SetName("ReferenceVolume");
+  vtkSmartPointer<vtkIdTypeArray> segArray = vtkSmartPointer<vtkIdTypeArray>::New();
+  segArray->SetName("SegmentationVolume");
+  vtkSmartPointer<vtkIdTypeArray> overlapArray = vtkSmartPointer<vtkIdTypeArray>::New();
+  overlapArray->SetName("Overlap");
+  const char* metricNames[5] = { "Dice", "Jaccard", "Sensitivity", "Specificity", "VolumeDifference" };
+  vtkSmartPointer<vtkDoubleArray> metricArrays[5];
+  for (int m = 0; m < 5; m++)
   {
-    vtkErrorMacro( "Execute: input1 ScalarType, "
-                   <<  inData[0][0]->GetScalarType()
-                   << ", must match output ScalarType "
-                   << outData[0]->GetScalarType());
-    return;
+    metricArrays[m] = vtkSmartPointer<vtkDoubleArray>::New();
+    metricArrays[m]->SetName(metricNames[m]);
   }
 
-  if (inData[1][0]->GetScalarType() != outData[0]->GetScalarType())
+  for (std::map<int,vtkIdType>::const_iterator it = overlap.begin(); it != overlap.end(); ++it)
   {
-    vtkErrorMacro( "Execute: input2 ScalarType, "
-                   << inData[1][0]->GetScalarType()
-                   << ", must match output ScalarType "
-                   << outData[0]->GetScalarType());
-    return;
+    double tp = (double) it->second;
+    double ref = (double) refVolume[it->first];
+    double seg = (double) segVolume[it->first];
+    double fp = seg - tp;
+    double tn = (double) numVoxels - ref - fp;
+
+    labelArray->InsertNextValue(it->first);
+    refArray->InsertNextValue(refVolume[it->first]);
+    segArray->InsertNextValue(segVolume[it->first]);
+    overlapArray->InsertNextValue(it->second);
+    metricArrays[0]->InsertNextValue((ref + seg > 0.0) ? 2.0 * tp / (ref + seg) : 0.0);
+    metricArrays[1]->InsertNextValue((ref + seg - tp > 0.0) ? tp / (ref + seg - tp) : 0.0);
+    metricArrays[2]->InsertNextValue((ref > 0.0) ? tp / ref : 0.0);
+    metricArrays[3]->InsertNextValue((tn + fp > 0.0) ? tn / (tn + fp) : 0.0);
+    metricArrays[4]->InsertNextValue((ref > 0.0) ? (seg - ref) / ref : 0.0);
   }
 
-  // this filter expects that inputs that have the same number of components
-  if (inData[0][0]->GetNumberOfScalarComponents() !=
-      inData[1][0]->GetNumberOfScalarComponents())
+  table->Initialize();
+  table->AddColumn(labelArray);
+  table->AddColumn(refArray);
+  table->AddColumn(segArray);
+  table->AddColumn(overlapArray);
+  for (int m = 0; m < 5; m++)
   {
-    vtkErrorMacro( "Execute: input1 NumberOfScalarComponents, "
-                   << inData[0][0]->GetNumberOfScalarComponents()
-                   << ", must match out input2 NumberOfScalarComponents "
-                   << inData[1][0]->GetNumberOfScalarComponents());
-    return;
+    table->AddColumn(metricArrays[m]);
   }
+}
 
-  switch (inData[0][0]->GetScalarType())
-  {
-    vtkTemplateMacro(
-      this->vtkDiceCoefficientExecute(this,inData[0][0],
-                                      static_cast<VTK_TT *>(inPtr1),
-                                      inData[1][0],
-                                      static_cast<VTK_TT *>(inPtr2),
-                                      outData[0],
-                                      static_cast<VTK_TT *>(outPtr), outExt,
-                                      id));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
-    return;
-  }
+//----------------------------------------------------------------------------
+vtkTable* vtkDiceCoefficient::GetOverlapTable()
+{
+  return vtkTable::SafeDownCast(this->GetOutputDataObject(1));
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkDiceCoefficient::GetConfusion(int reference, int segmentation)
+{
+  std::map< std::pair<int,int>, vtkIdType >::const_iterator it =
+    this->ConfusionMatrix.find(std::make_pair(reference, segmentation));
+  return (it == this->ConfusionMatrix.end()) ? 0 : it->second;
 }
 
 //----------------------------------------------------------------------------
@@ -240,8 +380,22 @@ int vtkDiceCoefficient::FillInputPortInformation(
   return 1;
 }
 
+//----------------------------------------------------------------------------
+int vtkDiceCoefficient::FillOutputPortInformation(
+  int port, vtkInformation* info)
+{
+  if (port == 1)
+  {
+    info->Set(vtkDataObject::DATA_TYPE_NAME(), "vtkTable");
+    return 1;
+  }
+  return this->Superclass::FillOutputPortInformation(port, info);
+}
+
 //----------------------------------------------------------------------------
 void vtkDiceCoefficient::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
+  os << indent << "LabelID: " << this->LabelID << "\n";
+  os << indent << "DiceCoefficient: " << this->DiceCoefficient << "\n";
 }
\ No newline at end of file
@@ -22,6 +22,9 @@
 
 #include <float.h>
 #include <limits.h>
+#include <map>
+
+class vtkTable;
 
 class vtkRobartsCommonExport vtkDiceCoefficient : public vtkThreadedImageAlgorithm
 {
@@ -42,8 +45,21 @@ public:
   vtkSetClampMacro(LabelID,int, 0, INT_MAX);
   vtkGetMacro(LabelID,int);
 
+  // Description:
+  // Get the Dice coefficient of the label selected by LabelID.
   vtkGetMacro(DiceCoefficient,double);
 
+  // Description:
+  // Get the overlap metrics of every label present in either input, computed from the
+  // label confusion matrix with the first input taken as the reference. The table has
+  // one row per label and the columns Label, ReferenceVolume, SegmentationVolume,
+  // Overlap, Dice, Jaccard, Sensitivity, Specificity and VolumeDifference.
+  vtkTable* GetOverlapTable();
+
+  // Description:
+  // Get the number of voxels labelled reference in the first input and segmentation
+  // in the second, as accumulated during the last update.
+  vtkIdType GetConfusion(int reference, int segmentation);
 
 protected:
   vtkDiceCoefficient();
@@ -53,24 +69,26 @@ protected:
 
   int LabelID;
   double DiceCoefficient;
+
+  // Sparse label confusion matrix, keyed by the (reference, segmentation) label pair
+  std::map< std::pair<int,int>, vtkIdType > ConfusionMatrix;
+
   virtual int RequestInformation (vtkInformation *,
                                   vtkInformationVector **,
                                   vtkInformationVector *);
 
-  virtual void ThreadedRequestData(vtkInformation *request,
-                                   vtkInformationVector **inputVector,
-                                   vtkInformationVector *outputVector,
-                                   vtkImageData ***inData,
-                                   vtkImageData **outData,
-                                   int extent[6], int threadId);
+  virtual int RequestUpdateExtent (vtkInformation *,
+                                   vtkInformationVector **,
+                                   vtkInformationVector *);
+
+  virtual int RequestData(vtkInformation *request,
+                          vtkInformationVector **inputVector,
+                          vtkInformationVector *outputVector);
 
   virtual int FillInputPortInformation(int port, vtkInformation* info);
+  virtual int FillOutputPortInformation(int port, vtkInformation* info);
 
-  template <class T> void vtkDiceCoefficientExecute(vtkDiceCoefficient *self,
-      vtkImageData *in1Data, T *in1Ptr,
-      vtkImageData *in2Data, T *in2Ptr,
-      vtkImageData *outData, T *outPtr,
-      int outExt[6], int id);
+  void FillOverlapTable(vtkTable* table, vtkIdType numVoxels);
 
 private:
   vtkDiceCoefficient(const vtkDiceCoefficient&);  // Not implemented.
@@ -41,6 +41,7 @@
 #include <assert.h>
 #include <float.h>
 #include <limits.h>
+#include <string.h>
 
 #include <set>
 #include <list>
@@ -59,9 +60,31 @@ vtkDirectedAcyclicGraphMaxFlowSegmentation::vtkDirectedAcyclicGraphMaxFlowSegmen
 
   //set algorithm mathematical parameters to defaults
   this->NumberOfIterations = 100;
+  this->ConvergenceCheckFrequency = 10;
+  this->ConvergenceTolerance = 0.0;
+  this->NumberOfIterationsPerformed = 0;
+  this->NumberOfLevels = 1;
+  this->NumberOfIterationsPerLevel = 50;
+  this->Residual = -1.0;
+  this->ComputeResidual = false;
+  this->ResidualSum = 0.0;
   this->StepSize = 0.1;
   this->CC = 0.25;
 
+  //run the CPU solver serially unless requested otherwise
+  this->NumberOfThreads = 1;
+  this->Threader = vtkMultiThreader::New();
+  this->UseFusedKernels = 1;
+  this->FlowStorageFormat = VTK_MAXFLOW_FLOAT32_STORAGE;
+  this->ActiveFlowStorageFormat = VTK_MAXFLOW_FLOAT32_STORAGE;
+  this->PackedFlowStride = 0;
+  this->WarmStarting = false;
+
+  //working buffers are allocated on the first update
+  this->CPUArena = 0;
+  this->CPUArenaSize = 0;
+  this->PeakWorkingSetSize = 0;
+
   //set up the input mapping structure
   this->InputDataPortMapping.clear();
   this->BackwardsInputDataPortMapping.clear();
@@ -88,6 +111,8 @@ vtkDirectedAcyclicGraphMaxFlowSegmentation::~vtkDirectedAcyclicGraphMaxFlowSegme
   {
     this->Structure->UnRegister(this);
   }
+  this->Threader->Delete();
+  this->ReleaseCPUBuffers();
   this->SmoothnessScalars.clear();
   this->LeafMap.clear();
   this->InputDataPortMapping.clear();
@@ -590,6 +615,11 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   VX = (Extent[1] - Extent[0] + 1);
   VY = (Extent[3] - Extent[2] + 1);
   VZ = (Extent[5] - Extent[4] + 1);
+  if( (vtkTypeInt64) VX * (vtkTypeInt64) VY * (vtkTypeInt64) VZ > (vtkTypeInt64) INT_MAX )
+  {
+    vtkErrorMacro("Volume has too many voxels. Cannot run algorithm.");
+    return -1;
+  }
   VolumeSize = VX * VY * VZ;
 
   //make a container for the total number of memory buffers
@@ -721,6 +751,10 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   }
 
 
+  //hold the spatial flows in a 16-bit format if asked to, and able to
+  this->ActiveFlowStorageFormat = this->SupportsPackedFlowStorage() ? this->FlowStorageFormat : VTK_MAXFLOW_FLOAT32_STORAGE;
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
+
   //allocate required memory buffers for the brach nodes
   int NumBuffersPerBranch = 8;
   int NumBuffersPerLeaf = 6;
@@ -739,7 +773,9 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   //        1 divergence buffer
   //        1 sink flow buffer
   //        1 incoming flow buffer
+  //where the spatial flows are packed, they are held in a separate part of the arena
   int NumberOfAdditionalCPUBuffersNeeded = 0;
+  int NumberOfInputOutputBuffers = TotalNumberOfBuffers;
 
   //source flow and working buffers
   std::list<float**> BufferPointerLocs;
@@ -749,9 +785,9 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   BufferPointerLocs.push_front(&sourceWorkingBuffer);
 
   //allocate those buffer pointers and put on list
-  NumberOfAdditionalCPUBuffersNeeded += NumBuffersPerBranch * NumBranches;
+  NumberOfAdditionalCPUBuffersNeeded += (NumBuffersPerBranch - (PackFlows ? 3 : 0)) * NumBranches;
   TotalNumberOfBuffers += NumBuffersPerBranch * NumBranches;
-  NumberOfAdditionalCPUBuffersNeeded += NumBuffersPerLeaf * NumLeaves;
+  NumberOfAdditionalCPUBuffersNeeded += (NumBuffersPerLeaf - (PackFlows ? 3 : 0)) * NumLeaves;
   TotalNumberOfBuffers += NumBuffersPerLeaf * NumLeaves;
   float** bufferPointers = new float* [NumBuffersPerBranch * NumBranches + NumBuffersPerLeaf * NumLeaves];
   float** tempPtr = bufferPointers;
@@ -771,15 +807,15 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   tempPtr += NumBranches;
   this->branchWorkingBuffers =  tempPtr;
   tempPtr += NumBranches;
-  for(int i = 0; i < NumBranches; i++ )
+  for(int i = 0; i < NumBranches && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(branchFlowXBuffers[i]));
   }
-  for(int i = 0; i < NumBranches; i++ )
+  for(int i = 0; i < NumBranches && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(branchFlowYBuffers[i]));
   }
-  for(int i = 0; i < NumBranches; i++ )
+  for(int i = 0; i < NumBranches && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(branchFlowZBuffers[i]));
   }
@@ -815,15 +851,15 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   tempPtr += NumLeaves;
   this->leafSinkBuffers =      tempPtr;
   tempPtr += NumLeaves;
-  for(int i = 0; i < NumLeaves; i++ )
+  for(int i = 0; i < NumLeaves && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(leafFlowXBuffers[i]));
   }
-  for(int i = 0; i < NumLeaves; i++ )
+  for(int i = 0; i < NumLeaves && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(leafFlowYBuffers[i]));
   }
-  for(int i = 0; i < NumLeaves; i++ )
+  for(int i = 0; i < NumLeaves && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(leafFlowZBuffers[i]));
   }
@@ -840,57 +876,55 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
     BufferPointerLocs.push_front(&(leafSourceBuffers[i]));
   }
 
-  //try to obtain required CPU buffers
-  while( NumberOfAdditionalCPUBuffersNeeded > 0 )
+  //obtain all the working buffers as a single aligned arena, reusing the last one if it
+  //is large enough
+  vtkTypeInt64 BufferStride = arenaBufferStride(VolumeSize);
+  vtkTypeInt64 ArenaSize = (vtkTypeInt64) NumberOfAdditionalCPUBuffersNeeded * BufferStride * (vtkTypeInt64) sizeof(float);
+  this->PackedFlowStride = 2 * arenaBufferStride((VolumeSize + 1) / 2);
+  if( PackFlows )
   {
-    int NumBuffersAcquired = (NumberOfAdditionalCPUBuffersNeeded < INT_MAX / VolumeSize) ?
-                             NumberOfAdditionalCPUBuffersNeeded : INT_MAX / VolumeSize;
-    for( ; NumBuffersAcquired > 0; NumBuffersAcquired--)
-    {
-      try
-      {
-        float* NewCPUBuffer = new float[VolumeSize*NumBuffersAcquired];
-        if( !NewCPUBuffer )
-        {
-          continue;
-        }
-        CPUBuffersAcquired.push_front( NewCPUBuffer );
-        CPUBuffersSize.push_front( NumBuffersAcquired );
-        NumberOfAdditionalCPUBuffersNeeded -= NumBuffersAcquired;
-        break;
-      }
-      catch( ... ) { };
-    }
-    if( NumBuffersAcquired == 0 )
-    {
-      break;
-    }
+    ArenaSize += (vtkTypeInt64) 3 * (NumBranches + NumLeaves) * this->PackedFlowStride * (vtkTypeInt64) sizeof(vtkTypeUInt16);
   }
+  float* Arena = acquireArena(&this->CPUArena, &this->CPUArenaSize, ArenaSize);
 
   //if we cannot obtain all required buffers, return an error and exit
-  if( NumberOfAdditionalCPUBuffersNeeded > 0 )
+  if( !Arena )
   {
-    while( CPUBuffersAcquired.size() > 0 )
-    {
-      float* tempBuffer = CPUBuffersAcquired.front();
-      delete[] tempBuffer;
-      CPUBuffersAcquired.pop_front();
-    }
+    delete[] bufferPointers;
     vtkErrorMacro("Not enough CPU memory. Cannot run algorithm.");
     return -1;
   }
 
   //put buffer pointers into given structures
-  std::list<float**>::iterator bufferNameIt = BufferPointerLocs.begin();
-  std::list<float*>::iterator bufferAllocIt = CPUBuffersAcquired.begin();
-  std::list<int>::iterator bufferSizeIt = CPUBuffersSize.begin();
-  for( ; bufferAllocIt != CPUBuffersAcquired.end(); bufferAllocIt++, bufferSizeIt++ )
+  vtkTypeInt64 bufferOffset = 0;
+  for( std::list<float**>::iterator bufferNameIt = BufferPointerLocs.begin(); bufferNameIt != BufferPointerLocs.end(); bufferNameIt++ )
   {
-    for( int i = 0; i < *bufferSizeIt; i++ )
-    {
-      *(*bufferNameIt) = (*bufferAllocIt) + VolumeSize*i;
-      bufferNameIt++;
-    }
+    *(*bufferNameIt) = Arena + bufferOffset;
+    bufferOffset += BufferStride;
+  }
+
+  //the packed spatial flows of each node follow, as x, y and z blocks in turn
+  vtkTypeUInt16** packedBufferPointers = new vtkTypeUInt16* [NumBranches + NumLeaves];
+  this->branchPackedFlowBuffers = packedBufferPointers;
+  this->leafPackedFlowBuffers = packedBufferPointers + NumBranches;
+  for(int i = 0; i < NumBranches + NumLeaves; i++ )
+  {
+    packedBufferPointers[i] = PackFlows ? (vtkTypeUInt16*) (Arena + bufferOffset) + 3 * i * this->PackedFlowStride : 0;
+  }
+  for(int i = 0; i < NumBranches && PackFlows; i++ )
+  {
+    branchFlowXBuffers[i] = branchFlowYBuffers[i] = branchFlowZBuffers[i] = 0;
+  }
+  for(int i = 0; i < NumLeaves && PackFlows; i++ )
+  {
+    leafFlowXBuffers[i] = leafFlowYBuffers[i] = leafFlowZBuffers[i] = 0;
+  }
+
+  //report the memory used over the course of the solve
+  this->PeakWorkingSetSize = ArenaSize + (vtkTypeInt64) NumberOfInputOutputBuffers * VolumeSize * (vtkTypeInt64) sizeof(float);
+  if( this->Debug )
+  {
+    vtkDebugMacro("Peak working set is " << this->PeakWorkingSetSize << " bytes, " << ArenaSize << " of which are working buffers.");
   }
 
   //if verbose, print progress
@@ -981,6 +1015,16 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   }
   Iterator->Delete();
 
+  //set up the threads used by the CPU buffer operations
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+
+  //find a starting point on the coarser levels, if requested
+  this->WarmStarting = false;
+  if( this->NumberOfLevels > 1 && this->SupportsMultiResolution() )
+  {
+    this->WarmStarting = (this->SolveCoarseLevels() == 1);
+  }
+
   //run algorithm proper
   if( this->Debug )
   {
@@ -991,20 +1035,13 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestData(vtkInformation *requ
   {
     vtkDebugMacro("Starting max-flow algorithm.");
   }
+  this->NumberOfIterationsPerformed = this->NumberOfIterations;
+  this->Residual = -1.0;
   this->RunAlgorithm();
 
-  //deallocate CPU buffers
-  while( CPUBuffersAcquired.size() > 0 )
-  {
-    float* tempBuffer = CPUBuffersAcquired.front();
-    delete[] tempBuffer;
-    CPUBuffersAcquired.pop_front();
-  }
-  CPUBuffersAcquired.clear();
-  CPUBuffersSize.clear();
-
   //deallocate structure that holds the pointers to the buffers
   delete[] bufferPointers;
+  delete[] packedBufferPointers;
   delete[] BranchNumParents;
   BranchNumParents = 0;
   delete[] BranchNumChildren;
@@ -1043,65 +1080,306 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::RequestDataObject(
   return 0;
 }
 
+void vtkDirectedAcyclicGraphMaxFlowSegmentation::ReleaseCPUBuffers()
+{
+  releaseArena(&this->CPUArena, &this->CPUArenaSize);
+}
+
+int vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveCoarseLevels()
+{
+  //find the dimensions of each level, coarsening while the largest side stays at 4 or more voxels
+  std::vector<int> Dims;
+  Dims.push_back(VX);
+  Dims.push_back(VY);
+  Dims.push_back(VZ);
+  int NumLevels = 1;
+  while( NumLevels < this->NumberOfLevels )
+  {
+    int* Fine = &(Dims[3*(NumLevels-1)]);
+    int Coarse[3] = { (Fine[0]+1)/2, (Fine[1]+1)/2, (Fine[2]+1)/2 };
+    if( Coarse[0] < 4 && Coarse[1] < 4 && Coarse[2] < 4 )
+    {
+      break;
+    }
+    Dims.insert(Dims.end(), Coarse, Coarse+3);
+    NumLevels++;
+  }
+  if( NumLevels < 2 )
+  {
+    return 0;
+  }
+
+  //gather the per-voxel buffers the solver uses: the spatial flows (which are scaled as they
+  //are carried between levels), the rest of the solver state, and the data and smoothness terms
+  enum { FLOW_BUFFER, STATE_BUFFER, INPUT_BUFFER };
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
+  std::vector<float**> Slots;
+  std::vector<int> SlotKinds;
+  std::vector<vtkTypeUInt16*> PackedSlots;
+  for(int i = 0; i < NumBranches + NumLeaves; i++ )
+  {
+    bool isLeaf = (i >= NumBranches);
+    int n = isLeaf ? i - NumBranches : i;
+    float** Flows[3] = { isLeaf ? &(leafFlowXBuffers[n]) : &(branchFlowXBuffers[n]),
+                         isLeaf ? &(leafFlowYBuffers[n]) : &(branchFlowYBuffers[n]),
+                         isLeaf ? &(leafFlowZBuffers[n]) : &(branchFlowZBuffers[n]) };
+    vtkTypeUInt16* Packed = isLeaf ? leafPackedFlowBuffers[n] : branchPackedFlowBuffers[n];
+    for(int a = 0; a < 3; a++ )
+    {
+      Slots.push_back(Flows[a]);
+      SlotKinds.push_back(FLOW_BUFFER);
+      PackedSlots.push_back( PackFlows ? Packed + a * this->PackedFlowStride : 0 );
+    }
+    Slots.push_back( isLeaf ? &(leafDivBuffers[n]) : &(branchDivBuffers[n]) );
+    Slots.push_back( isLeaf ? &(leafSinkBuffers[n]) : &(branchSinkBuffers[n]) );
+    Slots.push_back( isLeaf ? &(leafSourceBuffers[n]) : &(branchSourceBuffers[n]) );
+    Slots.push_back( isLeaf ? &(leafLabelBuffers[n]) : &(branchLabelBuffers[n]) );
+    SlotKinds.insert(SlotKinds.end(), 4, STATE_BUFFER);
+    if( !isLeaf )
+    {
+      Slots.push_back( &(branchWorkingBuffers[n]) );
+      SlotKinds.push_back(STATE_BUFFER);
+    }
+    float** Smoothness = isLeaf ? &(leafSmoothnessTermBuffers[n]) : &(branchSmoothnessTermBuffers[n]);
+    if( *Smoothness )
+    {
+      Slots.push_back(Smoothness);
+      SlotKinds.push_back(INPUT_BUFFER);
+    }
+    if( isLeaf )
+    {
+      Slots.push_back( &(leafDataTermBuffers[n]) );
+      SlotKinds.push_back(INPUT_BUFFER);
+    }
+    PackedSlots.resize(Slots.size(), 0);
+  }
+  Slots.push_back(&sourceFlowBuffer);
+  Slots.push_back(&sourceWorkingBuffer);
+  SlotKinds.insert(SlotKinds.end(), 2, STATE_BUFFER);
+  PackedSlots.resize(Slots.size(), 0);
+  int NumSlots = (int) Slots.size();
+
+  //put the buffers for every coarse level in one arena of their own, the full resolution
+  //level keeping its own buffers
+  std::vector<float*> LevelBuffers(NumLevels * NumSlots);
+  std::vector<vtkTypeInt64> LevelStrides(NumLevels, 0);
+  vtkTypeInt64 CoarseArenaSize = 0;
+  for(int l = 1; l < NumLevels; l++ )
+  {
+    LevelStrides[l] = arenaBufferStride(Dims[3*l] * Dims[3*l+1] * Dims[3*l+2]);
+    CoarseArenaSize += (vtkTypeInt64) NumSlots * LevelStrides[l];
+  }
+  char* CoarseArena = 0;
+  vtkTypeInt64 CoarseArenaCapacity = 0;
+  float* Coarse = acquireArena(&CoarseArena, &CoarseArenaCapacity, CoarseArenaSize * (vtkTypeInt64) sizeof(float));
+  if( !Coarse )
+  {
+    vtkWarningMacro("Not enough CPU memory for the coarse levels. Solving at full resolution only.");
+    return 0;
+  }
+
+  //the coarse levels are held alongside the full resolution buffers, so add them to the peak
+  this->PeakWorkingSetSize += CoarseArenaSize * (vtkTypeInt64) sizeof(float);
+  if( this->Debug )
+  {
+    vtkDebugMacro("Peak working set is " << this->PeakWorkingSetSize << " bytes, with " << CoarseArenaSize * (vtkTypeInt64) sizeof(float) << " for the coarse levels.");
+  }
+  for(int k = 0; k < NumSlots; k++ )
+  {
+    LevelBuffers[k] = *(Slots[k]);
+  }
+  for(int l = 1; l < NumLevels; l++ )
+  {
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      LevelBuffers[l*NumSlots + k] = Coarse;
+      Coarse += LevelStrides[l];
+    }
+  }
+
+  //average the data and smoothness terms down the pyramid
+  for(int l = 1; l < NumLevels; l++ )
+  {
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      if( SlotKinds[k] == INPUT_BUFFER )
+      {
+        downsampleBuffer(this->Threader, LevelBuffers[l*NumSlots + k], LevelBuffers[(l-1)*NumSlots + k],
+                         Dims[3*l-3], Dims[3*l-2], Dims[3*l-1]);
+      }
+    }
+  }
+
+  //solve from the coarsest level up, in single precision
+  int FullNumberOfIterations = this->NumberOfIterations;
+  int FullFlowStorageFormat = this->ActiveFlowStorageFormat;
+  this->ActiveFlowStorageFormat = VTK_MAXFLOW_FLOAT32_STORAGE;
+  for(int l = NumLevels-1; l > 0; l-- )
+  {
+    if( this->Debug )
+    {
+      vtkDebugMacro("Solving coarse level " << l << ".");
+    }
+
+    //point the solver at this level's buffers
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      *(Slots[k]) = LevelBuffers[l*NumSlots + k];
+    }
+    VX = Dims[3*l];
+    VY = Dims[3*l+1];
+    VZ = Dims[3*l+2];
+    VolumeSize = VX * VY * VZ;
+
+    //boundaries are measured in coarse voxels, so the smoothness is halved at each level to keep
+    //its balance with the data terms
+    float Scale = 1.0f / (float) (1 << l);
+    for(int i = 0; i < NumBranches; i++ )
+    {
+      branchSmoothnessConstants[i] *= Scale;
+    }
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      leafSmoothnessConstants[i] *= Scale;
+    }
+
+    //the coarsest level starts from scratch, the others from the level below
+    this->WarmStarting = (l < NumLevels-1);
+    this->NumberOfIterations = this->NumberOfIterationsPerLevel;
+    this->InitializeAlgorithm();
+    this->RunAlgorithm();
+
+    for(int i = 0; i < NumBranches; i++ )
+    {
+      branchSmoothnessConstants[i] /= Scale;
+    }
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      leafSmoothnessConstants[i] /= Scale;
+    }
+
+    //carry the solution up to the next finer level, doubling the spatial flows along with the
+    //bound on them
+    int* Fine = &(Dims[3*(l-1)]);
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      if( SlotKinds[k] == INPUT_BUFFER )
+      {
+        continue;
+      }
+      float FlowScale = (SlotKinds[k] == FLOW_BUFFER) ? 2.0f : 1.0f;
+      if( l == 1 && PackedSlots[k] )
+      {
+        prolongBuffer(this->Threader, PackedSlots[k], LevelBuffers[l*NumSlots + k], FlowScale,
+                      FullFlowStorageFormat == VTK_MAXFLOW_BFLOAT16_STORAGE, Fine[0], Fine[1], Fine[2]);
+      }
+      else
+      {
+        prolongBuffer(this->Threader, LevelBuffers[(l-1)*NumSlots + k], LevelBuffers[l*NumSlots + k], FlowScale,
+                      Fine[0], Fine[1], Fine[2]);
+      }
+    }
+  }
+
+  //point the solver back at the full resolution buffers
+  for(int k = 0; k < NumSlots; k++ )
+  {
+    *(Slots[k]) = LevelBuffers[k];
+  }
+  VX = Dims[0];
+  VY = Dims[1];
+  VZ = Dims[2];
+  VolumeSize = VX * VY * VZ;
+  this->NumberOfIterations = FullNumberOfIterations;
+  this->ActiveFlowStorageFormat = FullFlowStorageFormat;
+  releaseArena(&CoarseArena, &CoarseArenaCapacity);
+  return 1;
+}
+
 int vtkDirectedAcyclicGraphMaxFlowSegmentation::InitializeAlgorithm()
 {
+  //when starting from a solution carried up from a coarser level, the flows and labels carry
+  //on from there, with the leaf sink flows brought back under the data terms
+  if( this->WarmStarting )
+  {
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      constrainBuffer(this->Threader, leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
+    }
+    return 1;
+  }
 
-  //initalize all spatial flows and divergences to zero
+  //initalize all spatial flows and divergences to zero (all bits clear is zero in the packed formats too)
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
   for(int i = 0; i < NumBranches; i++ )
   {
-    zeroOutBuffer(branchFlowXBuffers[i], VolumeSize);
-    zeroOutBuffer(branchFlowYBuffers[i], VolumeSize);
-    zeroOutBuffer(branchFlowZBuffers[i], VolumeSize);
-    zeroOutBuffer(branchDivBuffers[i], VolumeSize);
+    if( PackFlows )
+    {
+      memset(branchPackedFlowBuffers[i], 0, 3 * this->PackedFlowStride * sizeof(vtkTypeUInt16));
+    }
+    else
+    {
+      zeroOutBuffer(this->Threader, branchFlowXBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, branchFlowYBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, branchFlowZBuffers[i], VolumeSize);
+    }
+    zeroOutBuffer(this->Threader, branchDivBuffers[i], VolumeSize);
   }
   for(int i = 0; i < NumLeaves; i++ )
   {
-    zeroOutBuffer(leafFlowXBuffers[i], VolumeSize);
-    zeroOutBuffer(leafFlowYBuffers[i], VolumeSize);
-    zeroOutBuffer(leafFlowZBuffers[i], VolumeSize);
-    zeroOutBuffer(leafDivBuffers[i], VolumeSize);
+    if( PackFlows )
+    {
+      memset(leafPackedFlowBuffers[i], 0, 3 * this->PackedFlowStride * sizeof(vtkTypeUInt16));
+    }
+    else
+    {
+      zeroOutBuffer(this->Threader, leafFlowXBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, leafFlowYBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, leafFlowZBuffers[i], VolumeSize);
+    }
+    zeroOutBuffer(this->Threader, leafDivBuffers[i], VolumeSize);
   }
 
   //initialize all leak sink flows to their constraints
   for(int i = 0; i < NumLeaves; i++ )
   {
-    copyBuffer(leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
+    copyBuffer(this->Threader, leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
   }
 
   //find the minimum sink flow
   for(int i = 1; i < NumLeaves; i++ )
   {
-    minBuffer(leafSinkBuffers[0], leafSinkBuffers[i], VolumeSize);
+    minBuffer(this->Threader, leafSinkBuffers[0], leafSinkBuffers[i], VolumeSize);
   }
 
   //copy minimum sink flow over all leaves and sum the resulting labels into the source flow buffer
-  lblBuffer(leafLabelBuffers[0], leafSinkBuffers[0], leafDataTermBuffers[0], VolumeSize);
-  copyBuffer(sourceFlowBuffer, leafLabelBuffers[0], VolumeSize);
+  lblBuffer(this->Threader, leafLabelBuffers[0], leafSinkBuffers[0], leafDataTermBuffers[0], VolumeSize);
+  copyBuffer(this->Threader, sourceFlowBuffer, leafLabelBuffers[0], VolumeSize);
   for(int i = 1; i < NumLeaves; i++ )
   {
-    copyBuffer(leafSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
-    copyBuffer(leafSourceBuffers[i], leafSinkBuffers[0], VolumeSize);
-    lblBuffer(leafLabelBuffers[i], leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
-    sumBuffer(sourceFlowBuffer, leafLabelBuffers[i], VolumeSize);
+    copyBuffer(this->Threader, leafSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
+    copyBuffer(this->Threader, leafSourceBuffers[i], leafSinkBuffers[0], VolumeSize);
+    lblBuffer(this->Threader, leafLabelBuffers[i], leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
+    sumBuffer(this->Threader, sourceFlowBuffer, leafLabelBuffers[i], VolumeSize);
   }
 
   //divide the labels out to constrain them to validity
   for(int i = 0; i < NumLeaves; i++ )
   {
-    divBuffer(leafLabelBuffers[i], sourceFlowBuffer, VolumeSize);
+    divBuffer(this->Threader, leafLabelBuffers[i], sourceFlowBuffer, VolumeSize);
   }
 
   //apply minimal sink flow over the remaining Structure
   for(int i = 0; i < NumBranches; i++ )
   {
-    copyBuffer(branchSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
-    copyBuffer(branchSourceBuffers[i], leafSinkBuffers[0], VolumeSize);
+    copyBuffer(this->Threader, branchSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
+    copyBuffer(this->Threader, branchSourceBuffers[i], leafSinkBuffers[0], VolumeSize);
   }
   for(int i = 0; i < NumLeaves; i++ )
   {
-    copyBuffer(leafSourceBuffers[i], leafSinkBuffers[0], VolumeSize);
+    copyBuffer(this->Threader, leafSourceBuffers[i], leafSinkBuffers[0], VolumeSize);
   }
-  copyBuffer(sourceFlowBuffer, leafSinkBuffers[0], VolumeSize);
+  copyBuffer(this->Threader, sourceFlowBuffer, leafSinkBuffers[0], VolumeSize);
 
   //propogate labels up the Structure
   PropogateLabels( );
@@ -1112,14 +1390,37 @@ int vtkDirectedAcyclicGraphMaxFlowSegmentation::InitializeAlgorithm()
 int vtkDirectedAcyclicGraphMaxFlowSegmentation::RunAlgorithm()
 {
   //Solve maximum flow problem in an iterative bottom-up manner
+  this->NumberOfIterationsPerformed = 0;
+  this->Residual = -1.0;
   for( int iteration = 0; iteration < this->NumberOfIterations; iteration++ )
   {
+    //the residual is accumulated by the leaf label updates on checked iterations
+    this->ComputeResidual = (iteration+1 == this->NumberOfIterations) ||
+                            (this->ConvergenceCheckFrequency > 0 && (iteration+1) % this->ConvergenceCheckFrequency == 0);
+    this->ResidualSum = 0.0;
+
     SolveMaxFlow();
+    this->NumberOfIterationsPerformed = iteration+1;
     if( this->Debug )
     {
       vtkDebugMacro("Finished iteration " << (iteration+1) << ".");
     }
+
+    //stop early if the labels have stopped changing
+    if( this->ComputeResidual )
+    {
+      this->Residual = this->ResidualSum / ((double) NumLeaves * (double) VolumeSize);
+      if( this->Debug )
+      {
+        vtkDebugMacro("Residual after iteration " << (iteration+1) << " is " << this->Residual << ".");
+      }
+      if( this->Residual < this->ConvergenceTolerance )
+      {
+        break;
+      }
+    }
   }
+  this->ComputeResidual = false;
   return 1;
 }
 
@@ -1142,19 +1443,19 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::PropogateLabels( )
     }
 
     //clear own label buffer
-    zeroOutBuffer(branchLabelBuffers[BranchMap[CurrNode]],VolumeSize);
+    zeroOutBuffer(this->Threader, branchLabelBuffers[BranchMap[CurrNode]],VolumeSize);
 
     //sum in weighted version of child's label
     for(vtkIdType i = 0; i < this->Structure->GetNumberOfChildren(CurrNode); i++ )
     {
       float W = Weights ? Weights->GetValue(this->Structure->GetOutEdge(CurrNode,i).Id) : 1.0f;
       if(this->Structure->IsLeaf(this->Structure->GetChild(CurrNode,i)))
-        sumScaledBuffer(branchLabelBuffers[BranchMap[CurrNode]],
+        sumScaledBuffer(this->Threader, branchLabelBuffers[BranchMap[CurrNode]],
                         leafLabelBuffers[LeafMap[this->Structure->GetChild(CurrNode,i)]],
                         W / LeafNumParents[LeafMap[this->Structure->GetChild(CurrNode,i)]],
                         VolumeSize);
       else
-        sumScaledBuffer(branchLabelBuffers[BranchMap[CurrNode]],
+        sumScaledBuffer(this->Threader, branchLabelBuffers[BranchMap[CurrNode]],
                         branchLabelBuffers[BranchMap[this->Structure->GetChild(CurrNode,i)]],
                         W / BranchNumParents[BranchMap[this->Structure->GetChild(CurrNode,i)]],
                         VolumeSize);
@@ -1173,65 +1474,7 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
   vtkFloatArray* Weights = vtkFloatArray::SafeDownCast(this->Structure->GetEdgeData()->GetArray("Weights"));
 
   //update spatial flows (order independant)
-  ForIterator->SetRootVertex(this->Structure->GetRoot());
-  ForIterator->Restart();
-  while(ForIterator->HasNext())
-  {
-    vtkIdType currNode = ForIterator->Next();
-    if( this->Structure->IsLeaf(currNode) )
-    {
-
-      //compute the gradient step amount (store in div buffer for now)
-      //std::cout << currNode << "\t Find gradient descent step size" << std::endl;
-      dagmf_flowGradientStep(leafSinkBuffers[LeafMap[currNode]], leafSourceBuffers[LeafMap[currNode]],
-                             leafDivBuffers[LeafMap[currNode]], leafLabelBuffers[LeafMap[currNode]],
-                             StepSize, CC, VolumeSize);
-
-      //apply gradient descent to the flows
-      //std::cout << currNode << "\t Update spatial flows part 1" << std::endl;
-      dagmf_applyStep(leafDivBuffers[LeafMap[currNode]], leafFlowXBuffers[LeafMap[currNode]],
-                      leafFlowYBuffers[LeafMap[currNode]], leafFlowZBuffers[LeafMap[currNode]],
-                      VX, VY, VZ, VolumeSize);
-
-      //std::cout << currNode << "\t Find Projection multiplier" << std::endl;
-      dagmf_computeFlowMag(leafDivBuffers[LeafMap[currNode]], leafFlowXBuffers[LeafMap[currNode]],
-                           leafFlowYBuffers[LeafMap[currNode]], leafFlowZBuffers[LeafMap[currNode]],
-                           leafSmoothnessTermBuffers[LeafMap[currNode]], leafSmoothnessConstants[LeafMap[currNode]],
-                           VX, VY, VZ, VolumeSize);
-
-      //project onto set and recompute the divergence
-      //std::cout << currNode << "\t Project flows into valid range and compute divergence" << std::endl;
-      dagmf_projectOntoSet(leafDivBuffers[LeafMap[currNode]], leafFlowXBuffers[LeafMap[currNode]],
-                           leafFlowYBuffers[LeafMap[currNode]], leafFlowZBuffers[LeafMap[currNode]],
-                           VX, VY, VZ, VolumeSize);
-
-    }
-    else if( currNode != this->Structure->GetRoot() )
-    {
-
-      //std::cout << currNode << "\t Find gradient descent step size" << std::endl;
-      dagmf_flowGradientStep(branchSinkBuffers[BranchMap[currNode]], branchSourceBuffers[BranchMap[currNode]],
-                             branchDivBuffers[BranchMap[currNode]], branchLabelBuffers[BranchMap[currNode]],
-                             StepSize, CC,VolumeSize);
-
-      //std::cout << currNode << "\t Update spatial flows part 1" << std::endl;
-      dagmf_applyStep(branchDivBuffers[BranchMap[currNode]], branchFlowXBuffers[BranchMap[currNode]],
-                      branchFlowYBuffers[BranchMap[currNode]], branchFlowZBuffers[BranchMap[currNode]],
-                      VX, VY, VZ, VolumeSize);
-
-      //compute the multiplier for projecting back onto the feasible flow set (and store in div buffer)
-      //std::cout << currNode << "\t Find Projection multiplier" << std::endl;
-      dagmf_computeFlowMag(branchDivBuffers[BranchMap[currNode]], branchFlowXBuffers[BranchMap[currNode]],
-                           branchFlowYBuffers[BranchMap[currNode]], branchFlowZBuffers[BranchMap[currNode]],
-                           branchSmoothnessTermBuffers[BranchMap[currNode]], branchSmoothnessConstants[BranchMap[currNode]],
-                           VX, VY, VZ, VolumeSize);
-
-      //project onto set and recompute the divergence
-      dagmf_projectOntoSet(branchDivBuffers[BranchMap[currNode]], branchFlowXBuffers[BranchMap[currNode]],
-                           branchFlowYBuffers[BranchMap[currNode]], branchFlowZBuffers[BranchMap[currNode]],
-                           VX, VY, VZ, VolumeSize);
-    }
-  }
+  UpdateSpatialFlows();
 
   //clear source buffers working down
   ForIterator->SetRootVertex(this->Structure->GetRoot());
@@ -1241,11 +1484,11 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
     vtkIdType currNode = ForIterator->Next();
     if(this->Structure->IsLeaf(currNode))
     {
-      zeroOutBuffer(leafSourceBuffers[LeafMap[currNode]],VolumeSize);
+      zeroOutBuffer(this->Threader, leafSourceBuffers[LeafMap[currNode]],VolumeSize);
     }
     else if(currNode != this->Structure->GetRoot() )
     {
-      zeroOutBuffer(branchSourceBuffers[BranchMap[currNode]],VolumeSize);
+      zeroOutBuffer(this->Threader, branchSourceBuffers[BranchMap[currNode]],VolumeSize);
     }
   }
 
@@ -1255,10 +1498,10 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
     vtkIdType Child = this->Structure->GetChild(this->Structure->GetRoot(),i);
     float W = Weights ? Weights->GetValue( this->Structure->GetOutEdge(this->Structure->GetRoot(),i).Id ) : 1.0f;
     if(this->Structure->IsLeaf(Child))
-      sumScaledBuffer(leafSourceBuffers[LeafMap[Child]],
+      sumScaledBuffer(this->Threader, leafSourceBuffers[LeafMap[Child]],
                       sourceFlowBuffer, W/this->LeafNumParents[LeafMap[Child]], VolumeSize);
     else
-      sumScaledBuffer(branchSourceBuffers[BranchMap[Child]],
+      sumScaledBuffer(this->Threader, branchSourceBuffers[BranchMap[Child]],
                       sourceFlowBuffer, W/this->BranchNumParents[BranchMap[Child]], VolumeSize);
   }
 
@@ -1277,16 +1520,16 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
       vtkIdType Child = this->Structure->GetChild(CurrNode,i);
       float W = Weights ? Weights->GetValue( this->Structure->GetOutEdge(CurrNode,i).Id ) : 1.0f;
       if(this->Structure->IsLeaf(Child))
-        sumScaledBuffer(leafSourceBuffers[LeafMap[Child]], branchSinkBuffers[BranchMap[CurrNode]],
+        sumScaledBuffer(this->Threader, leafSourceBuffers[LeafMap[Child]], branchSinkBuffers[BranchMap[CurrNode]],
                         W/this->LeafNumParents[LeafMap[Child]], VolumeSize);
       else
-        sumScaledBuffer(branchSourceBuffers[BranchMap[Child]], branchSinkBuffers[BranchMap[CurrNode]],
+        sumScaledBuffer(this->Threader, branchSourceBuffers[BranchMap[Child]], branchSinkBuffers[BranchMap[CurrNode]],
                         W/this->BranchNumParents[BranchMap[Child]], VolumeSize);
     }
   }
 
   //clear working buffers
-  translateBuffer(sourceWorkingBuffer,sourceFlowBuffer,1.0/this->CC,SourceWeightedNumChildren, VolumeSize);
+  translateBuffer(this->Threader, sourceWorkingBuffer,sourceFlowBuffer,1.0/this->CC,SourceWeightedNumChildren, VolumeSize);
   ForIterator->SetRootVertex(this->Structure->GetRoot());
   ForIterator->Restart();
   while(ForIterator->HasNext())
@@ -1296,7 +1539,7 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
     {
       continue;
     }
-    dagmf_storeSinkFlowInBuffer(branchWorkingBuffers[BranchMap[CurrNode]], branchSourceBuffers[BranchMap[CurrNode]],
+    dagmf_storeSinkFlowInBuffer(this->Threader, branchWorkingBuffers[BranchMap[CurrNode]], branchSourceBuffers[BranchMap[CurrNode]],
                                 branchDivBuffers[BranchMap[CurrNode]], branchLabelBuffers[BranchMap[CurrNode]],
                                 branchSinkBuffers[BranchMap[CurrNode]],this->BranchWeightedNumChildren[BranchMap[CurrNode]],
                                 CC, VolumeSize);
@@ -1312,10 +1555,10 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
     {
 
       //update state at this location (source, sink, labels)
-      updateLeafSinkFlow(leafSinkBuffers[LeafMap[CurrNode]], leafSourceBuffers[LeafMap[CurrNode]],
+      updateLeafSinkFlow(this->Threader, leafSinkBuffers[LeafMap[CurrNode]], leafSourceBuffers[LeafMap[CurrNode]],
                          leafDivBuffers[LeafMap[CurrNode]], leafLabelBuffers[LeafMap[CurrNode]],
                          CC, VolumeSize);
-      constrainBuffer(leafSinkBuffers[LeafMap[CurrNode]], leafDataTermBuffers[LeafMap[CurrNode]],
+      constrainBuffer(this->Threader, leafSinkBuffers[LeafMap[CurrNode]], leafDataTermBuffers[LeafMap[CurrNode]],
                       VolumeSize);
 
       //push up sink capacities
@@ -1324,27 +1567,32 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
         vtkIdType Parent = this->Structure->GetParent(CurrNode,i);
         float W = Weights ? Weights->GetValue(this->Structure->GetInEdge(CurrNode,i).Id) : 1.0f;
         if(Parent == this->Structure->GetRoot() )
-          dagmf_storeSourceFlowInBuffer(sourceWorkingBuffer, leafSinkBuffers[LeafMap[CurrNode]],
+          dagmf_storeSourceFlowInBuffer(this->Threader, sourceWorkingBuffer, leafSinkBuffers[LeafMap[CurrNode]],
                                         leafDivBuffers[LeafMap[CurrNode]], leafLabelBuffers[LeafMap[CurrNode]],
                                         leafSourceBuffers[LeafMap[CurrNode]],sourceFlowBuffer,
                                         CC, W/LeafNumParents[LeafMap[CurrNode]], VolumeSize);
         else
-          dagmf_storeSourceFlowInBuffer(branchWorkingBuffers[BranchMap[Parent]], leafSinkBuffers[LeafMap[CurrNode]],
+          dagmf_storeSourceFlowInBuffer(this->Threader, branchWorkingBuffers[BranchMap[Parent]], leafSinkBuffers[LeafMap[CurrNode]],
                                         leafDivBuffers[LeafMap[CurrNode]], leafLabelBuffers[LeafMap[CurrNode]],
                                         leafSourceBuffers[LeafMap[CurrNode]],branchSinkBuffers[BranchMap[Parent]],
                                         CC, W/LeafNumParents[LeafMap[CurrNode]], VolumeSize);
       }
 
-      updateLabel(leafSinkBuffers[LeafMap[CurrNode]], leafSourceBuffers[LeafMap[CurrNode]],
-                  leafDivBuffers[LeafMap[CurrNode]], leafLabelBuffers[LeafMap[CurrNode]],
-                  CC, VolumeSize);
+      if( this->ComputeResidual )
+        this->ResidualSum += updateLabelAndSumChange(this->Threader, leafSinkBuffers[LeafMap[CurrNode]], leafSourceBuffers[LeafMap[CurrNode]],
+                                                     leafDivBuffers[LeafMap[CurrNode]], leafLabelBuffers[LeafMap[CurrNode]],
+                                                     CC, VolumeSize);
+      else
+        updateLabel(this->Threader, leafSinkBuffers[LeafMap[CurrNode]], leafSourceBuffers[LeafMap[CurrNode]],
+                    leafDivBuffers[LeafMap[CurrNode]], leafLabelBuffers[LeafMap[CurrNode]],
+                    CC, VolumeSize);
 
     }
     else if(CurrNode != this->Structure->GetRoot())
     {
 
       //update state at this location (source, sink, labels)
-      divAndStoreBuffer(branchSinkBuffers[BranchMap[CurrNode]],branchWorkingBuffers[BranchMap[CurrNode]],
+      divAndStoreBuffer(this->Threader, branchSinkBuffers[BranchMap[CurrNode]],branchWorkingBuffers[BranchMap[CurrNode]],
                         this->BranchWeightedNumChildren[BranchMap[CurrNode]]+1.0f,VolumeSize);
 
       //push up sink capacities
@@ -1353,25 +1601,25 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
         vtkIdType Parent = this->Structure->GetParent(CurrNode,i);
         float W = Weights ? Weights->GetValue(this->Structure->GetInEdge(CurrNode,i).Id) : 1.0f;
         if(Parent == this->Structure->GetRoot() )
-          dagmf_storeSourceFlowInBuffer(sourceWorkingBuffer, branchSinkBuffers[BranchMap[CurrNode]],
+          dagmf_storeSourceFlowInBuffer(this->Threader, sourceWorkingBuffer, branchSinkBuffers[BranchMap[CurrNode]],
                                         branchDivBuffers[BranchMap[CurrNode]], branchLabelBuffers[BranchMap[CurrNode]],
                                         branchSourceBuffers[BranchMap[CurrNode]],sourceFlowBuffer,
                                         CC, W/BranchNumParents[BranchMap[CurrNode]], VolumeSize);
         else
-          dagmf_storeSourceFlowInBuffer(branchWorkingBuffers[BranchMap[Parent]], branchSinkBuffers[BranchMap[CurrNode]],
+          dagmf_storeSourceFlowInBuffer(this->Threader, branchWorkingBuffers[BranchMap[Parent]], branchSinkBuffers[BranchMap[CurrNode]],
                                         branchDivBuffers[BranchMap[CurrNode]], branchLabelBuffers[BranchMap[CurrNode]],
                                         branchSourceBuffers[BranchMap[CurrNode]],branchSinkBuffers[BranchMap[Parent]],
                                         CC, W/BranchNumParents[BranchMap[CurrNode]], VolumeSize);
       }
 
-      updateLabel(branchSinkBuffers[BranchMap[CurrNode]], branchSourceBuffers[BranchMap[CurrNode]],
+      updateLabel(this->Threader, branchSinkBuffers[BranchMap[CurrNode]], branchSourceBuffers[BranchMap[CurrNode]],
                   branchDivBuffers[BranchMap[CurrNode]], branchLabelBuffers[BranchMap[CurrNode]],
                   CC, VolumeSize);
 
     }
     else
     {
-      divAndStoreBuffer(sourceFlowBuffer,sourceWorkingBuffer, this->SourceWeightedNumChildren,VolumeSize);
+      divAndStoreBuffer(this->Threader, sourceFlowBuffer,sourceWorkingBuffer, this->SourceWeightedNumChildren,VolumeSize);
     }
 
   }
@@ -1379,3 +1627,88 @@ void vtkDirectedAcyclicGraphMaxFlowSegmentation::SolveMaxFlow( )
   ForIterator->Delete();
   BackIterator->Delete();
 }
+
+VTK_THREAD_RETURN_TYPE vtkDirectedAcyclicGraphMaxFlowSegmentationThreadedExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkDirectedAcyclicGraphMaxFlowSegmentation* self = static_cast<vtkDirectedAcyclicGraphMaxFlowSegmentation *>
+      (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  self->ThreadedUpdateSpatialFlows(threadId, threadCount);
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+void vtkDirectedAcyclicGraphMaxFlowSegmentation::ThreadedUpdateSpatialFlows( int threadId, int numThreads )
+{
+  for( int i = threadId; i < NumBranches + NumLeaves; i += numThreads )
+  {
+    UpdateSpatialFlow( i, true );
+  }
+}
+
+void vtkDirectedAcyclicGraphMaxFlowSegmentation::UpdateSpatialFlows( )
+{
+  int NumNonRootNodes = NumBranches + NumLeaves;
+
+  //with enough nodes to go around, give each thread whole nodes to update with the fused
+  //kernels, otherwise split each node's buffers between the threads (packed flows can only
+  //be updated by the fused kernels)
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
+  if( (this->UseFusedKernels || PackFlows) && this->NumberOfThreads > 1 && NumNonRootNodes >= this->NumberOfThreads )
+  {
+    this->Threader->SetSingleMethod(vtkDirectedAcyclicGraphMaxFlowSegmentationThreadedExecute, this);
+    this->Threader->SingleMethodExecute();
+    return;
+  }
+  bool fused = PackFlows || (this->UseFusedKernels && this->NumberOfThreads == 1);
+  for( int i = 0; i < NumNonRootNodes; i++ )
+  {
+    UpdateSpatialFlow( i, fused );
+  }
+}
+
+void vtkDirectedAcyclicGraphMaxFlowSegmentation::UpdateSpatialFlow( int nodeIndex, bool fused )
+{
+  //branches come first, followed by the leaves
+  bool isLeaf = (nodeIndex >= NumBranches);
+  int i = isLeaf ? nodeIndex - NumBranches : nodeIndex;
+  float* sink =   isLeaf ? leafSinkBuffers[i] : branchSinkBuffers[i];
+  float* source = isLeaf ? leafSourceBuffers[i] : branchSourceBuffers[i];
+  float* div =    isLeaf ? leafDivBuffers[i] : branchDivBuffers[i];
+  float* label =  isLeaf ? leafLabelBuffers[i] : branchLabelBuffers[i];
+  float* flowX =  isLeaf ? leafFlowXBuffers[i] : branchFlowXBuffers[i];
+  float* flowY =  isLeaf ? leafFlowYBuffers[i] : branchFlowYBuffers[i];
+  float* flowZ =  isLeaf ? leafFlowZBuffers[i] : branchFlowZBuffers[i];
+  float* smooth = isLeaf ? leafSmoothnessTermBuffers[i] : branchSmoothnessTermBuffers[i];
+  float alpha =   isLeaf ? leafSmoothnessConstants[i] : branchSmoothnessConstants[i];
+
+  if( this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE )
+  {
+    vtkTypeUInt16* packed = isLeaf ? leafPackedFlowBuffers[i] : branchPackedFlowBuffers[i];
+    dagmf_updateSpatialFlows(sink, source, div, label, packed, packed + PackedFlowStride, packed + 2 * PackedFlowStride,
+                             this->ActiveFlowStorageFormat == VTK_MAXFLOW_BFLOAT16_STORAGE, smooth, alpha,
+                             StepSize, CC, VX, VY, VZ, VolumeSize);
+    return;
+  }
+
+  if( fused )
+  {
+    dagmf_updateSpatialFlows(sink, source, div, label, flowX, flowY, flowZ, smooth, alpha,
+                             StepSize, CC, VX, VY, VZ, VolumeSize);
+    return;
+  }
+
+  //compute the gradient step amount (store in div buffer for now)
+  dagmf_flowGradientStep(this->Threader, sink, source, div, label, StepSize, CC, VolumeSize);
+
+  //apply gradient descent to the flows
+  dagmf_applyStep(this->Threader, div, flowX, flowY, flowZ, VX, VY, VZ, VolumeSize);
+
+  //compute the multiplier for projecting back onto the feasible flow set (and store in div buffer)
+  dagmf_computeFlowMag(this->Threader, div, flowX, flowY, flowZ, smooth, alpha, VX, VY, VZ, VolumeSize);
+
+  //project onto set and recompute the divergence
+  dagmf_projectOntoSet(this->Threader, div, flowX, flowY, flowZ, VX, VY, VZ, VolumeSize);
+}
@@ -30,6 +30,7 @@
 #include "vtkRobartsCommonExport.h"
 
 #include "vtkImageAlgorithm.h"
+#include "vtkMultiThreader.h"
 #include "vtkRootedDirectedAcyclicGraph.h"
 
 class vtkInformation;
@@ -40,6 +41,12 @@ class vtkInformationVector;
 #include <limits.h>
 #include <float.h>
 
+#ifndef VTK_MAXFLOW_FLOAT32_STORAGE
+#define VTK_MAXFLOW_FLOAT32_STORAGE  0
+#define VTK_MAXFLOW_FLOAT16_STORAGE  1
+#define VTK_MAXFLOW_BFLOAT16_STORAGE 2
+#endif
+
 class vtkRobartsCommonExport vtkDirectedAcyclicGraphMaxFlowSegmentation : public vtkImageAlgorithm
 {
 public:
@@ -59,11 +66,45 @@ public:
   void AddSmoothnessScalar( vtkIdType node, double alpha );
 
   // Description:
-  // Get and Set the number of iterations used by the algorithm (computing convergence term
-  // is too slow).
+  // Get and Set the maximum number of iterations used by the algorithm. Fewer are run if
+  // a ConvergenceTolerance is given and the solution converges first.
   vtkSetClampMacro(NumberOfIterations,int,0,INT_MAX);
   vtkGetMacro(NumberOfIterations,int);
 
+  // Description:
+  // Get and Set how often, in iterations, the convergence residual is computed, and the
+  // tolerance below which the algorithm stops early. The residual is the mean absolute
+  // change in the leaf labels over one iteration and is found during the label update,
+  // so costs no extra pass over the buffers. The residual is always computed on the final
+  // iteration. The default frequency is 10 and the default tolerance of 0 disables early
+  // termination.
+  vtkSetClampMacro(ConvergenceCheckFrequency,int,0,INT_MAX);
+  vtkGetMacro(ConvergenceCheckFrequency,int);
+  vtkSetClampMacro(ConvergenceTolerance,double,0.0,VTK_DOUBLE_MAX);
+  vtkGetMacro(ConvergenceTolerance,double);
+
+  // Description:
+  // Get the residual found at the last convergence check and the number of iterations
+  // actually performed during the last update. The residual is -1 if it was not computed.
+  vtkGetMacro(Residual,double);
+  vtkGetMacro(NumberOfIterationsPerformed,int);
+
+  // Description:
+  // Get and Set the number of resolution levels used by the CPU solver. With more than one
+  // level, the data and smoothness terms are averaged down by a factor of two in each
+  // direction per level, and the problem is solved from the coarsest level up, each
+  // solution being carried up to the next finer level as its starting point. Flow over long
+  // distances is then found cheaply, so far fewer iterations are needed at full resolution,
+  // where NumberOfIterations still applies. Coarsening stops once the largest side of the
+  // volume would drop below 4 voxels. The default is 1, which solves at full resolution only.
+  vtkSetClampMacro(NumberOfLevels,int,1,16);
+  vtkGetMacro(NumberOfLevels,int);
+
+  // Description:
+  // Get and Set the number of iterations run at each of the coarser levels. The default is 50.
+  vtkSetClampMacro(NumberOfIterationsPerLevel,int,0,INT_MAX);
+  vtkGetMacro(NumberOfIterationsPerLevel,int);
+
   // Description:
   // Get and Set the labeling constant, CC, of the algorithm. The default value is 0.25
   // and is unlikely to require modification.
@@ -76,6 +117,43 @@ public:
   vtkSetClampMacro(StepSize,float,0.0f,1.0f);
   vtkGetMacro(StepSize,float);
 
+  // Description:
+  // Get and Set the number of threads used by the CPU solver. With more than one
+  // thread, each buffer operation is split into slabs which are processed in parallel.
+  // The default is 1, which runs the original serial implementation.
+  vtkSetClampMacro(NumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads,int);
+
+  // Description:
+  // Get and Set whether the spatial flows of each node are updated in a single fused pass
+  // over its buffers, rather than one pass per kernel. The results are identical, but far
+  // less memory traffic is generated. With more than one thread, the nodes are shared out
+  // between the threads rather than each buffer being split. The default is on.
+  vtkSetMacro(UseFusedKernels,int);
+  vtkGetMacro(UseFusedKernels,int);
+  vtkBooleanMacro(UseFusedKernels,int);
+
+  // Description:
+  // Get and Set the format in which the CPU solver stores the spatial flows. The flows
+  // can be held as 16-bit half precision or bfloat16 values rather than single precision,
+  // halving the memory taken up by the three largest buffers of each node. All arithmetic
+  // is still carried out in single precision, with the flows rounded when stored, and the
+  // fused kernels are always used. Half precision keeps more significant bits, which is
+  // usually the better choice as the flows are bounded by the smoothness terms. The
+  // default is single precision. The GPU solvers ignore this setting.
+  vtkSetClampMacro(FlowStorageFormat,int,VTK_MAXFLOW_FLOAT32_STORAGE,VTK_MAXFLOW_BFLOAT16_STORAGE);
+  vtkGetMacro(FlowStorageFormat,int);
+  void SetFlowStorageFormatToFloat32() { this->SetFlowStorageFormat(VTK_MAXFLOW_FLOAT32_STORAGE); }
+  void SetFlowStorageFormatToFloat16() { this->SetFlowStorageFormat(VTK_MAXFLOW_FLOAT16_STORAGE); }
+  void SetFlowStorageFormatToBFloat16() { this->SetFlowStorageFormat(VTK_MAXFLOW_BFLOAT16_STORAGE); }
+
+  // Description:
+  // Get the peak number of bytes used by the last update, including the input and output
+  // images as well as the working buffers, and the buffers of the coarse levels when there is
+  // more than one level. The working buffers are held in a single allocation which is reused
+  // between updates, and the coarse levels in one of their own, freed after they are solved.
+  vtkGetMacro(PeakWorkingSetSize,vtkTypeInt64);
+
   // Description:
   // Get and Set the data cost for the objects. The algorithm only uses those which
   // correspond to leaf nodes due to the data term pushdown theorem. These must be
@@ -121,6 +199,11 @@ public:
                                  vtkInformationVector* outputVector);
   virtual int FillInputPortInformation(int i, vtkInformation* info);
 
+  // Description:
+  // Update the spatial flows of the nodes assigned to the given thread using the fused
+  // kernels. It is public so that the thread functions can call this method.
+  void ThreadedUpdateSpatialFlows( int threadId, int numThreads );
+
   // Description:
   // Bring this algorithm's outputs up-to-date.
   virtual void Update();
@@ -145,6 +228,21 @@ protected:
 
   void PropogateLabels( );
   void SolveMaxFlow( );
+  void UpdateSpatialFlows( );
+  void UpdateSpatialFlow( int nodeIndex, bool fused );
+  void ReleaseCPUBuffers( );
+
+  // Description:
+  // Whether this solver can hold the spatial flows in a 16-bit format. Subclasses which
+  // run the algorithm on the single precision buffers themselves should return 0.
+  virtual int SupportsPackedFlowStorage() { return 1; }
+
+  // Description:
+  // Solve the problem over the coarser levels of the resolution pyramid, leaving the solution
+  // prolonged into the full resolution buffers. Returns 1 if it did so. Subclasses which run the
+  // algorithm on buffers of their own should return 0 from SupportsMultiResolution.
+  int SolveCoarseLevels( );
+  virtual int SupportsMultiResolution() { return 1; }
 
   vtkRootedDirectedAcyclicGraph* Structure;
   std::map<vtkIdType,double> SmoothnessScalars;
@@ -156,8 +254,22 @@ protected:
   int    NumEdges;
 
   int NumberOfIterations;
+  int NumberOfIterationsPerformed;
+  int NumberOfLevels;
+  int NumberOfIterationsPerLevel;
+  int ConvergenceCheckFrequency;
+  double ConvergenceTolerance;
+  double Residual;
+  bool ComputeResidual;
+  double ResidualSum;
   float CC;
   float StepSize;
+  int NumberOfThreads;
+  int UseFusedKernels;
+  int FlowStorageFormat;
+  int ActiveFlowStorageFormat;
+  bool WarmStarting;
+  vtkMultiThreader* Threader;
   int VolumeSize;
   int VX, VY, VZ;
 
@@ -169,9 +281,11 @@ protected:
   int FirstUnusedSmoothnessPort;
 
   //pointers to variable structures, easier to keep as part of the class definition
-  std::list<float*> CPUBuffersAcquired;
-  std::list<int> CPUBuffersSize;
+  char* CPUArena;
+  vtkTypeInt64 CPUArenaSize;
+  vtkTypeInt64 PeakWorkingSetSize;
   int TotalNumberOfBuffers;
+  vtkTypeInt64 PackedFlowStride;
   float**  branchFlowXBuffers;
   float**  branchFlowYBuffers;
   float**  branchFlowZBuffers;
@@ -182,6 +296,7 @@ protected:
   float**  branchWorkingBuffers;
   float**  branchSmoothnessTermBuffers;
   float*  branchSmoothnessConstants;
+  vtkTypeUInt16** branchPackedFlowBuffers;
 
   float**  leafFlowXBuffers;
   float**  leafFlowYBuffers;
@@ -193,6 +308,7 @@ protected:
   float**  leafDataTermBuffers;
   float**  leafSmoothnessTermBuffers;
   float*  leafSmoothnessConstants;
+  vtkTypeUInt16** leafPackedFlowBuffers;
 
   float*  sourceFlowBuffer;
   float*  sourceWorkingBuffer;
@@ -38,10 +38,12 @@
 
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 #include <float.h>
 #include <limits.h>
 #include <set>
 #include <list>
+#include <vector>
 
 #define SQR(X) X*X
 
@@ -55,9 +57,40 @@ vtkHierarchicalMaxFlowSegmentation::vtkHierarchicalMaxFlowSegmentation()
 
   //set algorithm mathematical parameters to defaults
   this->NumberOfIterations = 100;
+  this->ConvergenceCheckFrequency = 10;
+  this->ConvergenceTolerance = 0.0;
+  this->NumberOfIterationsPerformed = 0;
+  this->NumberOfLevels = 1;
+  this->NumberOfIterationsPerLevel = 50;
+  this->Residual = -1.0;
+  this->ComputeResidual = false;
+  this->ResidualSum = 0.0;
   this->StepSize = 0.1;
   this->CC = 0.25;
 
+  //run the CPU solver serially unless requested otherwise
+  this->NumberOfThreads = 1;
+  this->Threader = vtkMultiThreader::New();
+  this->UseFusedKernels = 1;
+  this->FlowStorageFormat = VTK_MAXFLOW_FLOAT32_STORAGE;
+  this->ActiveFlowStorageFormat = VTK_MAXFLOW_FLOAT32_STORAGE;
+  this->PackedFlowStride = 0;
+
+  //solve from scratch on each update unless requested otherwise
+  this->WarmStart = 0;
+  this->WarmStarting = false;
+  this->WarmStartStructure = 0;
+  this->WarmStartStructureMTime = 0;
+  this->WarmStartFlowStorageFormat = VTK_MAXFLOW_FLOAT32_STORAGE;
+  this->CPUArena = 0;
+  this->CPUArenaSize = 0;
+  this->PeakWorkingSetSize = 0;
+  this->leafLabelBuffers = 0;
+  for( int i = 0; i < 6; i++ )
+  {
+    this->WarmStartExtent[i] = 0;
+  }
+
   //set up the input mapping structure
   this->InputDataPortMapping.clear();
   this->BackwardsInputDataPortMapping.clear();
@@ -79,6 +112,8 @@ vtkHierarchicalMaxFlowSegmentation::~vtkHierarchicalMaxFlowSegmentation()
   {
     this->Structure->UnRegister(this);
   }
+  this->Threader->Delete();
+  this->ReleaseCPUBuffers();
   this->SmoothnessScalars.clear();
   this->LeafMap.clear();
   this->InputDataPortMapping.clear();
@@ -563,7 +598,7 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   {
     return -1;
   }
-  int NumBranches = NumNodes - NumLeaves - 1;
+  NumBranches = NumNodes - NumLeaves - 1;
 
   if( this->Debug )
   {
@@ -578,8 +613,28 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   VX = (Extent[1] - Extent[0] + 1);
   VY = (Extent[3] - Extent[2] + 1);
   VZ = (Extent[5] - Extent[4] + 1);
+  if( (vtkTypeInt64) VX * (vtkTypeInt64) VY * (vtkTypeInt64) VZ > (vtkTypeInt64) INT_MAX )
+  {
+    vtkErrorMacro("Volume has too many voxels. Cannot run algorithm.");
+    return -1;
+  }
   VolumeSize = VX * VY * VZ;
 
+  //hold the spatial flows in a 16-bit format if asked to, and able to
+  this->ActiveFlowStorageFormat = this->SupportsPackedFlowStorage() ? this->FlowStorageFormat : VTK_MAXFLOW_FLOAT32_STORAGE;
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
+
+  //carry on from the previous solution if it was kept and matches this problem
+  this->WarmStarting = this->WarmStart && this->WarmStartStructure &&
+                       this->Structure == this->WarmStartStructure &&
+                       this->Structure->GetMTime() == this->WarmStartStructureMTime &&
+                       this->ActiveFlowStorageFormat == this->WarmStartFlowStorageFormat;
+  for( int i = 0; i < 6; i++ )
+  {
+    this->WarmStarting = this->WarmStarting && (Extent[i] == this->WarmStartExtent[i]);
+  }
+  this->WarmStartStructure = 0;
+
   //make a container for the total number of memory buffers
   TotalNumberOfBuffers = 0;
 
@@ -658,7 +713,7 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   iterator->Delete();
 
   //get the output buffers
-  this->leafLabelBuffers = new float* [NumLeaves];
+  float** outputLabelBuffers = new float* [NumLeaves];
   for(int i = 0; i < NumLeaves; i++ )
   {
     vtkInformation *outputInfo = outputVector->GetInformationObject(i);
@@ -666,10 +721,16 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
     outputBuffer->SetExtent(Extent);
     outputBuffer->Modified();
     outputBuffer->AllocateScalars(outputInfo);
-    leafLabelBuffers[i] = (float*) outputBuffer->GetScalarPointer();
+    outputLabelBuffers[i] = (float*) outputBuffer->GetScalarPointer();
     TotalNumberOfBuffers++;
   }
 
+  //the leaf labels are solved in place in the output unless they have to outlive it
+  if( !this->WarmStart )
+  {
+    this->leafLabelBuffers = outputLabelBuffers;
+  }
+
   //convert smoothness constants mapping to two mappings
   iterator = vtkTreeDFSIterator::New();
   iterator->SetTree(this->Structure);
@@ -709,6 +770,7 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   }
 
   //source flow and working buffers
+  int NumberOfInputOutputBuffers = TotalNumberOfBuffers;
   std::list<float**> BufferPointerLocs;
   int NumberOfAdditionalCPUBuffersNeeded = 2;
   TotalNumberOfBuffers += 2;
@@ -729,13 +791,20 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   //        1 divergence buffer
   //        1 sink flow buffer
   //        1 working temp buffer (ie: guk)
-  NumberOfAdditionalCPUBuffersNeeded += 7 * NumBranches;
+  //where the spatial flows are packed, they are held in a separate part of the arena
+  NumberOfAdditionalCPUBuffersNeeded += (PackFlows ? 4 : 7) * NumBranches;
   TotalNumberOfBuffers += 7*NumBranches;
-  NumberOfAdditionalCPUBuffersNeeded += 5 * NumLeaves;
+  NumberOfAdditionalCPUBuffersNeeded += (PackFlows ? 2 : 5) * NumLeaves;
   TotalNumberOfBuffers += 5 * NumLeaves;
 
+  //when keeping the solution between updates, the leaf labels need buffers of their own
+  //      per leaf node
+  //        1 label buffer
+  int NumberOfLeafLabelBuffers = this->WarmStart ? NumLeaves : 0;
+  NumberOfAdditionalCPUBuffersNeeded += NumberOfLeafLabelBuffers;
+
   //allocate those buffer pointers and put on list
-  float** bufferPointers = new float* [7 * NumBranches + 5 * NumLeaves];
+  float** bufferPointers = new float* [7 * NumBranches + 5 * NumLeaves + NumberOfLeafLabelBuffers];
   float** tempPtr = bufferPointers;
   this->branchFlowXBuffers =    tempPtr;
   tempPtr += NumBranches;
@@ -751,15 +820,15 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   tempPtr += NumBranches;
   this->branchWorkingBuffers =  tempPtr;
   tempPtr += NumBranches;
-  for(int i = 0; i < NumBranches; i++ )
+  for(int i = 0; i < NumBranches && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(branchFlowXBuffers[i]));
   }
-  for(int i = 0; i < NumBranches; i++ )
+  for(int i = 0; i < NumBranches && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(branchFlowYBuffers[i]));
   }
-  for(int i = 0; i < NumBranches; i++ )
+  for(int i = 0; i < NumBranches && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(branchFlowZBuffers[i]));
   }
@@ -789,15 +858,15 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   tempPtr += NumLeaves;
   this->leafSinkBuffers =      tempPtr;
   tempPtr += NumLeaves;
-  for(int i = 0; i < NumLeaves; i++ )
+  for(int i = 0; i < NumLeaves && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(leafFlowXBuffers[i]));
   }
-  for(int i = 0; i < NumLeaves; i++ )
+  for(int i = 0; i < NumLeaves && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(leafFlowYBuffers[i]));
   }
-  for(int i = 0; i < NumLeaves; i++ )
+  for(int i = 0; i < NumLeaves && !PackFlows; i++ )
   {
     BufferPointerLocs.push_front(&(leafFlowZBuffers[i]));
   }
@@ -809,58 +878,67 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   {
     BufferPointerLocs.push_front(&(leafSinkBuffers[i]));
   }
-
-  //try to obtain required CPU buffers
-  while( NumberOfAdditionalCPUBuffersNeeded > 0 )
+  if( NumberOfLeafLabelBuffers )
   {
-    int NumBuffersAcquired = (NumberOfAdditionalCPUBuffersNeeded < INT_MAX / VolumeSize) ?
-                             NumberOfAdditionalCPUBuffersNeeded : INT_MAX / VolumeSize;
-    for( ; NumBuffersAcquired > 0; NumBuffersAcquired--)
-    {
-      try
-      {
-        float* NewCPUBuffer = new float[VolumeSize*NumBuffersAcquired];
-        if( !NewCPUBuffer )
-        {
-          continue;
-        }
-        CPUBuffersAcquired.push_front( NewCPUBuffer );
-        CPUBuffersSize.push_front( NumBuffersAcquired );
-        NumberOfAdditionalCPUBuffersNeeded -= NumBuffersAcquired;
-        break;
-      }
-      catch( ... ) { };
-    }
-    if( NumBuffersAcquired == 0 )
+    this->leafLabelBuffers =    tempPtr;
+    tempPtr += NumLeaves;
+    for(int i = 0; i < NumLeaves; i++ )
     {
-      break;
+      BufferPointerLocs.push_front(&(leafLabelBuffers[i]));
     }
   }
 
+  //obtain all the working buffers as a single aligned arena, reusing the last one if it
+  //is large enough (so when warm starting, every pointer picks up the buffer it had before)
+  vtkTypeInt64 BufferStride = arenaBufferStride(VolumeSize);
+  vtkTypeInt64 ArenaSize = (vtkTypeInt64) NumberOfAdditionalCPUBuffersNeeded * BufferStride * (vtkTypeInt64) sizeof(float);
+  this->PackedFlowStride = 2 * arenaBufferStride((VolumeSize + 1) / 2);
+  if( PackFlows )
+  {
+    ArenaSize += (vtkTypeInt64) 3 * (NumBranches + NumLeaves) * this->PackedFlowStride * (vtkTypeInt64) sizeof(vtkTypeUInt16);
+  }
+  float* Arena = acquireArena(&this->CPUArena, &this->CPUArenaSize, ArenaSize);
+
   //if we cannot obtain all required buffers, return an error and exit
-  if( NumberOfAdditionalCPUBuffersNeeded > 0 )
+  if( !Arena )
   {
-    while( CPUBuffersAcquired.size() > 0 )
-    {
-      float* tempBuffer = CPUBuffersAcquired.front();
-      delete[] tempBuffer;
-      CPUBuffersAcquired.pop_front();
-    }
+    delete[] bufferPointers;
+    delete[] outputLabelBuffers;
+    this->leafLabelBuffers = 0;
     vtkErrorMacro("Not enough CPU memory. Cannot run algorithm.");
     return -1;
   }
 
   //put buffer pointers into given structures
-  std::list<float**>::iterator bufferNameIt = BufferPointerLocs.begin();
-  std::list<float*>::iterator bufferAllocIt = CPUBuffersAcquired.begin();
-  std::list<int>::iterator bufferSizeIt = CPUBuffersSize.begin();
-  for( ; bufferAllocIt != CPUBuffersAcquired.end(); bufferAllocIt++, bufferSizeIt++ )
+  vtkTypeInt64 bufferOffset = 0;
+  for( std::list<float**>::iterator bufferNameIt = BufferPointerLocs.begin(); bufferNameIt != BufferPointerLocs.end(); bufferNameIt++ )
   {
-    for( int i = 0; i < *bufferSizeIt; i++ )
-    {
-      *(*bufferNameIt) = (*bufferAllocIt) + VolumeSize*i;
-      bufferNameIt++;
-    }
+    *(*bufferNameIt) = Arena + bufferOffset;
+    bufferOffset += BufferStride;
+  }
+
+  //the packed spatial flows of each node follow, as x, y and z blocks in turn
+  vtkTypeUInt16** packedBufferPointers = new vtkTypeUInt16* [NumBranches + NumLeaves];
+  this->branchPackedFlowBuffers = packedBufferPointers;
+  this->leafPackedFlowBuffers = packedBufferPointers + NumBranches;
+  for(int i = 0; i < NumBranches + NumLeaves; i++ )
+  {
+    packedBufferPointers[i] = PackFlows ? (vtkTypeUInt16*) (Arena + bufferOffset) + 3 * i * this->PackedFlowStride : 0;
+  }
+  for(int i = 0; i < NumBranches && PackFlows; i++ )
+  {
+    branchFlowXBuffers[i] = branchFlowYBuffers[i] = branchFlowZBuffers[i] = 0;
+  }
+  for(int i = 0; i < NumLeaves && PackFlows; i++ )
+  {
+    leafFlowXBuffers[i] = leafFlowYBuffers[i] = leafFlowZBuffers[i] = 0;
+  }
+
+  //report the memory used over the course of the solve
+  this->PeakWorkingSetSize = ArenaSize + (vtkTypeInt64) NumberOfInputOutputBuffers * VolumeSize * (vtkTypeInt64) sizeof(float);
+  if( this->Debug )
+  {
+    vtkDebugMacro("Peak working set is " << this->PeakWorkingSetSize << " bytes, " << ArenaSize << " of which are working buffers.");
   }
 
   //if verbose, print progress
@@ -904,6 +982,16 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   }
   iterator->Delete();
 
+  //set up the threads used by the CPU buffer operations
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+
+  //find a starting point on the coarser levels, if requested and not already carrying on from
+  //the previous solution
+  if( !this->WarmStarting && this->NumberOfLevels > 1 && this->SupportsMultiResolution() )
+  {
+    this->WarmStarting = (this->SolveCoarseLevels() == 1);
+  }
+
   //run algorithm proper
   if( this->Debug )
   {
@@ -914,20 +1002,33 @@ int vtkHierarchicalMaxFlowSegmentation::RequestData(vtkInformation *request,
   {
     vtkDebugMacro("Starting max-flow algorithm.");
   }
+  this->NumberOfIterationsPerformed = this->NumberOfIterations;
+  this->Residual = -1.0;
   this->RunAlgorithm();
 
-  //deallocate CPU buffers
-  while( CPUBuffersAcquired.size() > 0 )
+  if( this->WarmStart )
   {
-    float* tempBuffer = CPUBuffersAcquired.front();
-    delete[] tempBuffer;
-    CPUBuffersAcquired.pop_front();
+    //copy the labels out, and mark the CPU buffers as the starting point for the next update
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      copyBuffer(this->Threader, outputLabelBuffers[i], leafLabelBuffers[i], VolumeSize);
+    }
+    for( int i = 0; i < 6; i++ )
+    {
+      this->WarmStartExtent[i] = Extent[i];
+    }
+    this->WarmStartStructure = this->Structure;
+    this->WarmStartStructureMTime = this->Structure->GetMTime();
+    this->WarmStartFlowStorageFormat = this->ActiveFlowStorageFormat;
   }
-  CPUBuffersAcquired.clear();
-  CPUBuffersSize.clear();
 
   //deallocate structure that holds the pointers to the buffers
   delete[] bufferPointers;
+  delete[] packedBufferPointers;
+  delete[] outputLabelBuffers;
+
+  //the leaf labels pointed into one of those, or into the output when not warm starting
+  this->leafLabelBuffers = 0;
 
   return 1;
 }
@@ -970,59 +1071,330 @@ int vtkHierarchicalMaxFlowSegmentation::RequestDataObject(
 // CPU VERSION OF THE ALGORITHM
 //----------------------------------------------------------------------------
 
+void vtkHierarchicalMaxFlowSegmentation::ReleaseCPUBuffers()
+{
+  releaseArena(&this->CPUArena, &this->CPUArenaSize);
+  this->leafLabelBuffers = 0;
+  this->WarmStartStructure = 0;
+}
+
+int vtkHierarchicalMaxFlowSegmentation::SolveCoarseLevels()
+{
+  //find the dimensions of each level, coarsening while the largest side stays at 4 or more voxels
+  std::vector<int> Dims;
+  Dims.push_back(VX);
+  Dims.push_back(VY);
+  Dims.push_back(VZ);
+  int NumLevels = 1;
+  while( NumLevels < this->NumberOfLevels )
+  {
+    int* Fine = &(Dims[3*(NumLevels-1)]);
+    int Coarse[3] = { (Fine[0]+1)/2, (Fine[1]+1)/2, (Fine[2]+1)/2 };
+    if( Coarse[0] < 4 && Coarse[1] < 4 && Coarse[2] < 4 )
+    {
+      break;
+    }
+    Dims.insert(Dims.end(), Coarse, Coarse+3);
+    NumLevels++;
+  }
+  if( NumLevels < 2 )
+  {
+    return 0;
+  }
+
+  //gather the per-voxel buffers the solver uses: the spatial flows (which are scaled as they
+  //are carried between levels), the rest of the solver state, and the data and smoothness terms
+  enum { FLOW_BUFFER, STATE_BUFFER, INPUT_BUFFER };
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
+  std::vector<float**> Slots;
+  std::vector<int> SlotKinds;
+  std::vector<vtkTypeUInt16*> PackedSlots;
+  for(int i = 0; i < NumBranches + NumLeaves; i++ )
+  {
+    bool isLeaf = (i >= NumBranches);
+    int n = isLeaf ? i - NumBranches : i;
+    float** Flows[3] = { isLeaf ? &(leafFlowXBuffers[n]) : &(branchFlowXBuffers[n]),
+                         isLeaf ? &(leafFlowYBuffers[n]) : &(branchFlowYBuffers[n]),
+                         isLeaf ? &(leafFlowZBuffers[n]) : &(branchFlowZBuffers[n]) };
+    vtkTypeUInt16* Packed = isLeaf ? leafPackedFlowBuffers[n] : branchPackedFlowBuffers[n];
+    for(int a = 0; a < 3; a++ )
+    {
+      Slots.push_back(Flows[a]);
+      SlotKinds.push_back(FLOW_BUFFER);
+      PackedSlots.push_back( PackFlows ? Packed + a * this->PackedFlowStride : 0 );
+    }
+    Slots.push_back( isLeaf ? &(leafDivBuffers[n]) : &(branchDivBuffers[n]) );
+    Slots.push_back( isLeaf ? &(leafSinkBuffers[n]) : &(branchSinkBuffers[n]) );
+    Slots.push_back( isLeaf ? &(leafLabelBuffers[n]) : &(branchLabelBuffers[n]) );
+    SlotKinds.insert(SlotKinds.end(), 3, STATE_BUFFER);
+    if( !isLeaf )
+    {
+      Slots.push_back( &(branchWorkingBuffers[n]) );
+      SlotKinds.push_back(STATE_BUFFER);
+    }
+    float** Smoothness = isLeaf ? &(leafSmoothnessTermBuffers[n]) : &(branchSmoothnessTermBuffers[n]);
+    if( *Smoothness )
+    {
+      Slots.push_back(Smoothness);
+      SlotKinds.push_back(INPUT_BUFFER);
+    }
+    if( isLeaf )
+    {
+      Slots.push_back( &(leafDataTermBuffers[n]) );
+      SlotKinds.push_back(INPUT_BUFFER);
+    }
+    PackedSlots.resize(Slots.size(), 0);
+  }
+  Slots.push_back(&sourceFlowBuffer);
+  Slots.push_back(&sourceWorkingBuffer);
+  SlotKinds.insert(SlotKinds.end(), 2, STATE_BUFFER);
+  PackedSlots.resize(Slots.size(), 0);
+  int NumSlots = (int) Slots.size();
+
+  //put the buffers for every coarse level in one arena of their own, the full resolution
+  //level keeping its own buffers
+  std::vector<float*> LevelBuffers(NumLevels * NumSlots);
+  std::vector<vtkTypeInt64> LevelStrides(NumLevels, 0);
+  vtkTypeInt64 CoarseArenaSize = 0;
+  for(int l = 1; l < NumLevels; l++ )
+  {
+    LevelStrides[l] = arenaBufferStride(Dims[3*l] * Dims[3*l+1] * Dims[3*l+2]);
+    CoarseArenaSize += (vtkTypeInt64) NumSlots * LevelStrides[l];
+  }
+  char* CoarseArena = 0;
+  vtkTypeInt64 CoarseArenaCapacity = 0;
+  float* Coarse = acquireArena(&CoarseArena, &CoarseArenaCapacity, CoarseArenaSize * (vtkTypeInt64) sizeof(float));
+  if( !Coarse )
+  {
+    vtkWarningMacro("Not enough CPU memory for the coarse levels. Solving at full resolution only.");
+    return 0;
+  }
+
+  //the coarse levels are held alongside the full resolution buffers, so add them to the peak
+  this->PeakWorkingSetSize += CoarseArenaSize * (vtkTypeInt64) sizeof(float);
+  if( this->Debug )
+  {
+    vtkDebugMacro("Peak working set is " << this->PeakWorkingSetSize << " bytes, with " << CoarseArenaSize * (vtkTypeInt64) sizeof(float) << " for the coarse levels.");
+  }
+  for(int k = 0; k < NumSlots; k++ )
+  {
+    LevelBuffers[k] = *(Slots[k]);
+  }
+  for(int l = 1; l < NumLevels; l++ )
+  {
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      LevelBuffers[l*NumSlots + k] = Coarse;
+      Coarse += LevelStrides[l];
+    }
+  }
+
+  //the incoming flows alias sink buffers, so are redirected along with them
+  std::map<float*,int> SlotOfBuffer;
+  for(int k = 0; k < NumSlots; k++ )
+  {
+    SlotOfBuffer[LevelBuffers[k]] = k;
+  }
+  std::vector<int> IncSlots(NumBranches + NumLeaves);
+  for(int i = 0; i < NumBranches + NumLeaves; i++ )
+  {
+    IncSlots[i] = SlotOfBuffer[ (i < NumBranches) ? branchIncBuffers[i] : leafIncBuffers[i - NumBranches] ];
+  }
+
+  //average the data and smoothness terms down the pyramid
+  for(int l = 1; l < NumLevels; l++ )
+  {
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      if( SlotKinds[k] == INPUT_BUFFER )
+      {
+        downsampleBuffer(this->Threader, LevelBuffers[l*NumSlots + k], LevelBuffers[(l-1)*NumSlots + k],
+                         Dims[3*l-3], Dims[3*l-2], Dims[3*l-1]);
+      }
+    }
+  }
+
+  //solve from the coarsest level up, in single precision
+  int FullNumberOfIterations = this->NumberOfIterations;
+  int FullFlowStorageFormat = this->ActiveFlowStorageFormat;
+  this->ActiveFlowStorageFormat = VTK_MAXFLOW_FLOAT32_STORAGE;
+  for(int l = NumLevels-1; l > 0; l-- )
+  {
+    if( this->Debug )
+    {
+      vtkDebugMacro("Solving coarse level " << l << ".");
+    }
+
+    //point the solver at this level's buffers
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      *(Slots[k]) = LevelBuffers[l*NumSlots + k];
+    }
+    for(int i = 0; i < NumBranches; i++ )
+    {
+      branchIncBuffers[i] = LevelBuffers[l*NumSlots + IncSlots[i]];
+    }
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      leafIncBuffers[i] = LevelBuffers[l*NumSlots + IncSlots[NumBranches + i]];
+    }
+    VX = Dims[3*l];
+    VY = Dims[3*l+1];
+    VZ = Dims[3*l+2];
+    VolumeSize = VX * VY * VZ;
+
+    //boundaries are measured in coarse voxels, so the smoothness is halved at each level to keep
+    //its balance with the data terms
+    float Scale = 1.0f / (float) (1 << l);
+    for(int i = 0; i < NumBranches; i++ )
+    {
+      branchSmoothnessConstants[i] *= Scale;
+    }
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      leafSmoothnessConstants[i] *= Scale;
+    }
+
+    //the coarsest level starts from scratch, the others from the level below
+    this->WarmStarting = (l < NumLevels-1);
+    this->NumberOfIterations = this->NumberOfIterationsPerLevel;
+    this->InitializeAlgorithm();
+    this->RunAlgorithm();
+
+    for(int i = 0; i < NumBranches; i++ )
+    {
+      branchSmoothnessConstants[i] /= Scale;
+    }
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      leafSmoothnessConstants[i] /= Scale;
+    }
+
+    //carry the solution up to the next finer level, doubling the spatial flows along with the
+    //bound on them
+    int* Fine = &(Dims[3*(l-1)]);
+    for(int k = 0; k < NumSlots; k++ )
+    {
+      if( SlotKinds[k] == INPUT_BUFFER )
+      {
+        continue;
+      }
+      float FlowScale = (SlotKinds[k] == FLOW_BUFFER) ? 2.0f : 1.0f;
+      if( l == 1 && PackedSlots[k] )
+      {
+        prolongBuffer(this->Threader, PackedSlots[k], LevelBuffers[l*NumSlots + k], FlowScale,
+                      FullFlowStorageFormat == VTK_MAXFLOW_BFLOAT16_STORAGE, Fine[0], Fine[1], Fine[2]);
+      }
+      else
+      {
+        prolongBuffer(this->Threader, LevelBuffers[(l-1)*NumSlots + k], LevelBuffers[l*NumSlots + k], FlowScale,
+                      Fine[0], Fine[1], Fine[2]);
+      }
+    }
+  }
+
+  //point the solver back at the full resolution buffers
+  for(int k = 0; k < NumSlots; k++ )
+  {
+    *(Slots[k]) = LevelBuffers[k];
+  }
+  for(int i = 0; i < NumBranches; i++ )
+  {
+    branchIncBuffers[i] = LevelBuffers[IncSlots[i]];
+  }
+  for(int i = 0; i < NumLeaves; i++ )
+  {
+    leafIncBuffers[i] = LevelBuffers[IncSlots[NumBranches + i]];
+  }
+  VX = Dims[0];
+  VY = Dims[1];
+  VZ = Dims[2];
+  VolumeSize = VX * VY * VZ;
+  this->NumberOfIterations = FullNumberOfIterations;
+  this->ActiveFlowStorageFormat = FullFlowStorageFormat;
+  releaseArena(&CoarseArena, &CoarseArenaCapacity);
+  return 1;
+}
+
 int vtkHierarchicalMaxFlowSegmentation::InitializeAlgorithm()
 {
-  //initalize all spatial flows and divergences to zero
+  //when warm starting, the flows and labels carry on from the previous solution, with
+  //the leaf sink flows brought back under the (possibly changed) data terms
+  if( this->WarmStarting )
+  {
+    for(int i = 0; i < NumLeaves; i++ )
+    {
+      constrainBuffer(this->Threader, leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
+    }
+    return 1;
+  }
+
+  //initalize all spatial flows and divergences to zero (all bits clear is zero in the packed formats too)
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
   for(int i = 0; i < NumBranches; i++ )
   {
-    zeroOutBuffer(branchFlowXBuffers[i], VolumeSize);
-    zeroOutBuffer(branchFlowYBuffers[i], VolumeSize);
-    zeroOutBuffer(branchFlowZBuffers[i], VolumeSize);
-    zeroOutBuffer(branchDivBuffers[i], VolumeSize);
+    if( PackFlows )
+    {
+      memset(branchPackedFlowBuffers[i], 0, 3 * this->PackedFlowStride * sizeof(vtkTypeUInt16));
+    }
+    else
+    {
+      zeroOutBuffer(this->Threader, branchFlowXBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, branchFlowYBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, branchFlowZBuffers[i], VolumeSize);
+    }
+    zeroOutBuffer(this->Threader, branchDivBuffers[i], VolumeSize);
   }
   for(int i = 0; i < NumLeaves; i++ )
   {
-    zeroOutBuffer(leafFlowXBuffers[i], VolumeSize);
-    zeroOutBuffer(leafFlowYBuffers[i], VolumeSize);
-    zeroOutBuffer(leafFlowZBuffers[i], VolumeSize);
-    zeroOutBuffer(leafDivBuffers[i], VolumeSize);
+    if( PackFlows )
+    {
+      memset(leafPackedFlowBuffers[i], 0, 3 * this->PackedFlowStride * sizeof(vtkTypeUInt16));
+    }
+    else
+    {
+      zeroOutBuffer(this->Threader, leafFlowXBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, leafFlowYBuffers[i], VolumeSize);
+      zeroOutBuffer(this->Threader, leafFlowZBuffers[i], VolumeSize);
+    }
+    zeroOutBuffer(this->Threader, leafDivBuffers[i], VolumeSize);
   }
 
   //initialize all leak sink flows to their constraints
   for(int i = 0; i < NumLeaves; i++ )
   {
-    copyBuffer(leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
+    copyBuffer(this->Threader, leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
   }
 
   //find the minimum sink flow
   for(int i = 1; i < NumLeaves; i++ )
   {
-    minBuffer(leafSinkBuffers[0], leafSinkBuffers[i], VolumeSize);
+    minBuffer(this->Threader, leafSinkBuffers[0], leafSinkBuffers[i], VolumeSize);
   }
 
   //copy minimum sink flow over all leaves and sum the resulting labels into the source working buffer
-  zeroOutBuffer(sourceWorkingBuffer, VolumeSize);
-  lblBuffer(leafLabelBuffers[0], leafSinkBuffers[0], leafDataTermBuffers[0], VolumeSize);
-  sumBuffer(sourceWorkingBuffer, leafLabelBuffers[0], VolumeSize);
+  zeroOutBuffer(this->Threader, sourceWorkingBuffer, VolumeSize);
+  lblBuffer(this->Threader, leafLabelBuffers[0], leafSinkBuffers[0], leafDataTermBuffers[0], VolumeSize);
+  sumBuffer(this->Threader, sourceWorkingBuffer, leafLabelBuffers[0], VolumeSize);
   for(int i = 1; i < NumLeaves; i++ )
   {
-    copyBuffer(leafSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
-    lblBuffer(leafLabelBuffers[i], leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
-    sumBuffer(sourceWorkingBuffer, leafLabelBuffers[i], VolumeSize);
+    copyBuffer(this->Threader, leafSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
+    lblBuffer(this->Threader, leafLabelBuffers[i], leafSinkBuffers[i], leafDataTermBuffers[i], VolumeSize);
+    sumBuffer(this->Threader, sourceWorkingBuffer, leafLabelBuffers[i], VolumeSize);
   }
 
   //divide the labels out to constrain them to validity
   for(int i = 0; i < NumLeaves; i++ )
   {
-    divBuffer(leafLabelBuffers[i], sourceWorkingBuffer, VolumeSize);
+    divBuffer(this->Threader, leafLabelBuffers[i], sourceWorkingBuffer, VolumeSize);
   }
 
   //apply minimal sink flow over the remaining hierarchy
   for(int i = 0; i < NumBranches; i++ )
   {
-    copyBuffer(branchSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
+    copyBuffer(this->Threader, branchSinkBuffers[i], leafSinkBuffers[0], VolumeSize);
   }
-  copyBuffer(sourceFlowBuffer, leafSinkBuffers[0], VolumeSize);
+  copyBuffer(this->Threader, sourceFlowBuffer, leafSinkBuffers[0], VolumeSize);
 
   //propogate labels up the hierarchy
   PropogateLabels( this->Structure->GetRoot() );
@@ -1033,14 +1405,38 @@ int vtkHierarchicalMaxFlowSegmentation::InitializeAlgorithm()
 int vtkHierarchicalMaxFlowSegmentation::RunAlgorithm()
 {
   //Solve maximum flow problem in an iterative bottom-up manner
+  this->NumberOfIterationsPerformed = 0;
+  this->Residual = -1.0;
   for( int iteration = 0; iteration < this->NumberOfIterations; iteration++ )
   {
+    //the residual is accumulated by the leaf label updates on checked iterations
+    this->ComputeResidual = (iteration+1 == this->NumberOfIterations) ||
+                            (this->ConvergenceCheckFrequency > 0 && (iteration+1) % this->ConvergenceCheckFrequency == 0);
+    this->ResidualSum = 0.0;
+
+    UpdateSpatialFlows();
     SolveMaxFlow( this->Structure->GetRoot() );
+    this->NumberOfIterationsPerformed = iteration+1;
     if( this->Debug )
     {
       vtkDebugMacro( "Finished iteration " << (iteration+1) << ".");
     }
+
+    //stop early if the labels have stopped changing
+    if( this->ComputeResidual )
+    {
+      this->Residual = this->ResidualSum / ((double) NumLeaves * (double) VolumeSize);
+      if( this->Debug )
+      {
+        vtkDebugMacro("Residual after iteration " << (iteration+1) << " is " << this->Residual << ".");
+      }
+      if( this->Residual < this->ConvergenceTolerance )
+      {
+        break;
+      }
+    }
   }
+  this->ComputeResidual = false;
   return 1;
 }
 
@@ -1051,7 +1447,7 @@ void vtkHierarchicalMaxFlowSegmentation::PropogateLabels( vtkIdType currNode )
   //clear own label buffer if not a leaf
   if( NumKids > 0 )
   {
-    zeroOutBuffer(branchLabelBuffers[BranchMap[currNode]],VolumeSize);
+    zeroOutBuffer(this->Threader, branchLabelBuffers[BranchMap[currNode]],VolumeSize);
   }
 
   //update graph for all kids
@@ -1076,7 +1472,7 @@ void vtkHierarchicalMaxFlowSegmentation::PropogateLabels( vtkIdType currNode )
                                currVal = this->branchLabelBuffers[this->BranchMap[currNode]];
 
   //sum value into parent (if parent exists and is not the root)
-  sumBuffer(branchLabelBuffers[parentIndex],currVal,VolumeSize);
+  sumBuffer(this->Threader, branchLabelBuffers[parentIndex],currVal,VolumeSize);
 
 }
 
@@ -1101,69 +1497,16 @@ void vtkHierarchicalMaxFlowSegmentation::SolveMaxFlow( vtkIdType currNode )
     //std::cout << currNode << "\t Clear working buffer" << std::endl;
     if( isBranch )
     {
-      zeroOutBuffer(workingBufferUsed,VolumeSize);
+      zeroOutBuffer(this->Threader, workingBufferUsed,VolumeSize);
     }
     else
     {
-      setBufferToValue(workingBufferUsed,1.0f/CC,VolumeSize);
+      setBufferToValue(this->Threader, workingBufferUsed,1.0f/CC,VolumeSize);
     }
 
   }
 
-  // BL: Update spatial flow
-  if( isLeaf )
-  {
-
-    //compute the gradient step amount (store in div buffer for now)
-    //std::cout << currNode << "\t Find gradient descent step size" << std::endl;
-    ghmf_flowGradientStep(leafSinkBuffers[LeafMap[currNode]], leafIncBuffers[LeafMap[currNode]],
-                          leafDivBuffers[LeafMap[currNode]], leafLabelBuffers[LeafMap[currNode]],
-                          StepSize, CC, VolumeSize);
-
-    //apply gradient descent to the flows
-    //std::cout << currNode << "\t Update spatial flows part 1" << std::endl;
-    ghmf_applyStep(leafDivBuffers[LeafMap[currNode]], leafFlowXBuffers[LeafMap[currNode]],
-                   leafFlowYBuffers[LeafMap[currNode]], leafFlowZBuffers[LeafMap[currNode]],
-                   VX, VY, VZ, VolumeSize);
-
-    //std::cout << currNode << "\t Find Projection multiplier" << std::endl;
-    ghmf_computeFlowMag(leafDivBuffers[LeafMap[currNode]], leafFlowXBuffers[LeafMap[currNode]],
-                        leafFlowYBuffers[LeafMap[currNode]], leafFlowZBuffers[LeafMap[currNode]],
-                        leafSmoothnessTermBuffers[LeafMap[currNode]], leafSmoothnessConstants[LeafMap[currNode]],
-                        VX, VY, VZ, VolumeSize);
-
-    //project onto set and recompute the divergence
-    //std::cout << currNode << "\t Project flows into valid range and compute divergence" << std::endl;
-    ghmf_projectOntoSet(leafDivBuffers[LeafMap[currNode]], leafFlowXBuffers[LeafMap[currNode]],
-                        leafFlowYBuffers[LeafMap[currNode]], leafFlowZBuffers[LeafMap[currNode]],
-                        VX, VY, VZ, VolumeSize);
-
-  }
-  else if( isBranch )
-  {
-
-    //std::cout << currNode << "\t Find gradient descent step size" << std::endl;
-    ghmf_flowGradientStep(branchSinkBuffers[BranchMap[currNode]], branchIncBuffers[BranchMap[currNode]],
-                          branchDivBuffers[BranchMap[currNode]], branchLabelBuffers[BranchMap[currNode]],
-                          StepSize, CC,VolumeSize);
-
-    //std::cout << currNode << "\t Update spatial flows part 1" << std::endl;
-    ghmf_applyStep(branchDivBuffers[BranchMap[currNode]], branchFlowXBuffers[BranchMap[currNode]],
-                   branchFlowYBuffers[BranchMap[currNode]], branchFlowZBuffers[BranchMap[currNode]],
-                   VX, VY, VZ, VolumeSize);
-
-    //compute the multiplier for projecting back onto the feasible flow set (and store in div buffer)
-    //std::cout << currNode << "\t Find Projection multiplier" << std::endl;
-    ghmf_computeFlowMag(branchDivBuffers[BranchMap[currNode]], branchFlowXBuffers[BranchMap[currNode]],
-                        branchFlowYBuffers[BranchMap[currNode]], branchFlowZBuffers[BranchMap[currNode]],
-                        branchSmoothnessTermBuffers[BranchMap[currNode]], branchSmoothnessConstants[BranchMap[currNode]],
-                        VX, VY, VZ, VolumeSize);
-
-    //project onto set and recompute the divergence
-    ghmf_projectOntoSet(branchDivBuffers[BranchMap[currNode]], branchFlowXBuffers[BranchMap[currNode]],
-                        branchFlowYBuffers[BranchMap[currNode]], branchFlowZBuffers[BranchMap[currNode]],
-                        VX, VY, VZ, VolumeSize);
-  }
+  // BL: Spatial flows have already been updated for this iteration (see UpdateSpatialFlows)
 
   //RB : Update everything for the children
   for(int kid = 0; kid < NumKids; kid++)
@@ -1175,7 +1518,7 @@ void vtkHierarchicalMaxFlowSegmentation::SolveMaxFlow( vtkIdType currNode )
   if( isBranch )
   {
     //std::cout << currNode << "\t Add sink potential to working buffer" << std::endl;
-    storeSinkFlowInBuffer(branchWorkingBuffers[BranchMap[currNode]], branchIncBuffers[BranchMap[currNode]],
+    storeSinkFlowInBuffer(this->Threader, branchWorkingBuffers[BranchMap[currNode]], branchIncBuffers[BranchMap[currNode]],
                           branchDivBuffers[BranchMap[currNode]], branchLabelBuffers[BranchMap[currNode]],
                           CC, VolumeSize);
 
@@ -1185,7 +1528,7 @@ void vtkHierarchicalMaxFlowSegmentation::SolveMaxFlow( vtkIdType currNode )
   if( isBranch )
   {
     //std::cout << currNode << "\t Update sink flow" << std::endl;
-    divAndStoreBuffer(branchWorkingBuffers[BranchMap[currNode]],branchSinkBuffers[BranchMap[currNode]],
+    divAndStoreBuffer(this->Threader, branchWorkingBuffers[BranchMap[currNode]],branchSinkBuffers[BranchMap[currNode]],
                       (float)(NumKids+1),VolumeSize);
 
   }
@@ -1194,7 +1537,7 @@ void vtkHierarchicalMaxFlowSegmentation::SolveMaxFlow( vtkIdType currNode )
   if( isRoot )
   {
     //std::cout << currNode << "\t Update sink flow" << std::endl;
-    divAndStoreBuffer(sourceWorkingBuffer,sourceFlowBuffer,(float)NumKids,VolumeSize);
+    divAndStoreBuffer(this->Threader, sourceWorkingBuffer,sourceFlowBuffer,(float)NumKids,VolumeSize);
 
   }
 
@@ -1202,10 +1545,10 @@ void vtkHierarchicalMaxFlowSegmentation::SolveMaxFlow( vtkIdType currNode )
   if( isLeaf )
   {
     //std::cout << currNode << "\t Update sink flow" << std::endl;
-    updateLeafSinkFlow(leafSinkBuffers[LeafMap[currNode]], leafIncBuffers[LeafMap[currNode]],
+    updateLeafSinkFlow(this->Threader, leafSinkBuffers[LeafMap[currNode]], leafIncBuffers[LeafMap[currNode]],
                        leafDivBuffers[LeafMap[currNode]], leafLabelBuffers[LeafMap[currNode]],
                        CC, VolumeSize);
-    constrainBuffer(leafSinkBuffers[LeafMap[currNode]], leafDataTermBuffers[LeafMap[currNode]],
+    constrainBuffer(this->Threader, leafSinkBuffers[LeafMap[currNode]], leafDataTermBuffers[LeafMap[currNode]],
                     VolumeSize);
   }
 
@@ -1226,19 +1569,106 @@ void vtkHierarchicalMaxFlowSegmentation::SolveMaxFlow( vtkIdType currNode )
     //std::cout << currNode << "\t Add source potential to parent working buffer" << std::endl;
     if( isBranch )
     {
-      storeSourceFlowInBuffer(workingBuffer, branchSinkBuffers[BranchMap[currNode]],
+      storeSourceFlowInBuffer(this->Threader, workingBuffer, branchSinkBuffers[BranchMap[currNode]],
                               branchDivBuffers[BranchMap[currNode]], branchLabelBuffers[BranchMap[currNode]],
                               CC, VolumeSize);
     }
     else
     {
-      storeSourceFlowInBuffer(workingBuffer, leafSinkBuffers[LeafMap[currNode]],
+      storeSourceFlowInBuffer(this->Threader, workingBuffer, leafSinkBuffers[LeafMap[currNode]],
                               leafDivBuffers[LeafMap[currNode]], leafLabelBuffers[LeafMap[currNode]],
                               CC, VolumeSize);
     }
   }
 }
 
+VTK_THREAD_RETURN_TYPE vtkHierarchicalMaxFlowSegmentationThreadedExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkHierarchicalMaxFlowSegmentation* self = static_cast<vtkHierarchicalMaxFlowSegmentation *>
+      (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  self->ThreadedUpdateSpatialFlows(threadId, threadCount);
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+void vtkHierarchicalMaxFlowSegmentation::ThreadedUpdateSpatialFlows( int threadId, int numThreads )
+{
+  for( int i = threadId; i < NumBranches + NumLeaves; i += numThreads )
+  {
+    UpdateSpatialFlow( i, true );
+  }
+}
+
+void vtkHierarchicalMaxFlowSegmentation::UpdateSpatialFlows( )
+{
+  //the spatial flow of each node depends only on its own buffers and on the sink and label
+  //buffers from the previous iteration, so all of them can be updated up front in any order
+  int NumNonRootNodes = NumBranches + NumLeaves;
+
+  //with enough nodes to go around, give each thread whole nodes to update with the fused
+  //kernels, otherwise split each node's buffers between the threads (packed flows can only
+  //be updated by the fused kernels)
+  bool PackFlows = (this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE);
+  if( (this->UseFusedKernels || PackFlows) && this->NumberOfThreads > 1 && NumNonRootNodes >= this->NumberOfThreads )
+  {
+    this->Threader->SetSingleMethod(vtkHierarchicalMaxFlowSegmentationThreadedExecute, this);
+    this->Threader->SingleMethodExecute();
+    return;
+  }
+  bool fused = PackFlows || (this->UseFusedKernels && this->NumberOfThreads == 1);
+  for( int i = 0; i < NumNonRootNodes; i++ )
+  {
+    UpdateSpatialFlow( i, fused );
+  }
+}
+
+void vtkHierarchicalMaxFlowSegmentation::UpdateSpatialFlow( int nodeIndex, bool fused )
+{
+  //branches come first, followed by the leaves
+  bool isLeaf = (nodeIndex >= NumBranches);
+  int i = isLeaf ? nodeIndex - NumBranches : nodeIndex;
+  float* sink =   isLeaf ? leafSinkBuffers[i] : branchSinkBuffers[i];
+  float* inc =    isLeaf ? leafIncBuffers[i] : branchIncBuffers[i];
+  float* div =    isLeaf ? leafDivBuffers[i] : branchDivBuffers[i];
+  float* label =  isLeaf ? leafLabelBuffers[i] : branchLabelBuffers[i];
+  float* flowX =  isLeaf ? leafFlowXBuffers[i] : branchFlowXBuffers[i];
+  float* flowY =  isLeaf ? leafFlowYBuffers[i] : branchFlowYBuffers[i];
+  float* flowZ =  isLeaf ? leafFlowZBuffers[i] : branchFlowZBuffers[i];
+  float* smooth = isLeaf ? leafSmoothnessTermBuffers[i] : branchSmoothnessTermBuffers[i];
+  float alpha =   isLeaf ? leafSmoothnessConstants[i] : branchSmoothnessConstants[i];
+
+  if( this->ActiveFlowStorageFormat != VTK_MAXFLOW_FLOAT32_STORAGE )
+  {
+    vtkTypeUInt16* packed = isLeaf ? leafPackedFlowBuffers[i] : branchPackedFlowBuffers[i];
+    ghmf_updateSpatialFlows(sink, inc, div, label, packed, packed + PackedFlowStride, packed + 2 * PackedFlowStride,
+                            this->ActiveFlowStorageFormat == VTK_MAXFLOW_BFLOAT16_STORAGE, smooth, alpha,
+                            StepSize, CC, VX, VY, VZ, VolumeSize);
+    return;
+  }
+
+  if( fused )
+  {
+    ghmf_updateSpatialFlows(sink, inc, div, label, flowX, flowY, flowZ, smooth, alpha,
+                            StepSize, CC, VX, VY, VZ, VolumeSize);
+    return;
+  }
+
+  //compute the gradient step amount (store in div buffer for now)
+  ghmf_flowGradientStep(this->Threader, sink, inc, div, label, StepSize, CC, VolumeSize);
+
+  //apply gradient descent to the flows
+  ghmf_applyStep(this->Threader, div, flowX, flowY, flowZ, VX, VY, VZ, VolumeSize);
+
+  //compute the multiplier for projecting back onto the feasible flow set (and store in div buffer)
+  ghmf_computeFlowMag(this->Threader, div, flowX, flowY, flowZ, smooth, alpha, VX, VY, VZ, VolumeSize);
+
+  //project onto set and recompute the divergence
+  ghmf_projectOntoSet(this->Threader, div, flowX, flowY, flowZ, VX, VY, VZ, VolumeSize);
+}
+
 void vtkHierarchicalMaxFlowSegmentation::UpdateLabel( vtkIdType node )
 {
   int NumKids = this->Structure->GetNumberOfChildren(node);
@@ -1248,12 +1678,16 @@ void vtkHierarchicalMaxFlowSegmentation::UpdateLabel( vtkIdType node )
   }
 
   //std::cout << node << "\t Update labels" << std::endl;
-  if( NumKids == 0 )
-    updateLabel(leafSinkBuffers[LeafMap[node]], leafIncBuffers[LeafMap[node]],
+  if( NumKids == 0 && this->ComputeResidual )
+    this->ResidualSum += updateLabelAndSumChange(this->Threader, leafSinkBuffers[LeafMap[node]], leafIncBuffers[LeafMap[node]],
+                                                 leafDivBuffers[LeafMap[node]], leafLabelBuffers[LeafMap[node]],
+                                                 CC, VolumeSize);
+  else if( NumKids == 0 )
+    updateLabel(this->Threader, leafSinkBuffers[LeafMap[node]], leafIncBuffers[LeafMap[node]],
                 leafDivBuffers[LeafMap[node]], leafLabelBuffers[LeafMap[node]],
                 CC, VolumeSize);
   else
-    updateLabel(branchSinkBuffers[BranchMap[node]], branchIncBuffers[BranchMap[node]],
+    updateLabel(this->Threader, branchSinkBuffers[BranchMap[node]], branchIncBuffers[BranchMap[node]],
                 branchDivBuffers[BranchMap[node]], branchLabelBuffers[BranchMap[node]],
                 CC, VolumeSize);
 }
@@ -14,7 +14,7 @@ namespace
   {
     vtkImage2DHistogram *Filter;
     vtkImageData   *inData;
-    vtkImageData   *outData;
+    int            **Histograms;
   };
 }
 
@@ -24,6 +24,8 @@ vtkImage2DHistogram::vtkImage2DHistogram()
 {
   this->Resolution[0] = 100;
   this->Resolution[1] = 100;
+  this->BinMinimum[0] = this->BinMinimum[1] = 0.0;
+  this->InverseBinWidth[0] = this->InverseBinWidth[1] = 0.0;
   this->Threader = vtkMultiThreader::New();
   this->NumberOfThreads = 10;
 }
@@ -33,53 +35,67 @@ vtkImage2DHistogram::~vtkImage2DHistogram()
   this->Threader->Delete();
 }
 
-void vtkImage2DHistogram::ThreadedExecute(vtkImageData *inData, vtkImageData *outData, int threadId, int numThreads)
+void vtkImage2DHistogram::ThreadedExecute(vtkImageData *inData, int *histogram, int threadId, int numThreads)
 {
   //cast the call down to handle the input data differences properly
   switch (inData->GetScalarType())
   {
     vtkTemplateMacro(
-      ThreadedExecuteCasted<VTK_TT>(inData, outData, threadId, numThreads));
+      ThreadedExecuteCasted<VTK_TT>(inData, histogram, threadId, numThreads));
     default:
       if(threadId == 0) vtkErrorMacro( "Execute: Unknown input ScalarType");
       return;
   }
-
-  //configure the input ports
-  this->SetNumberOfInputPorts(1);
-  this->SetNumberOfInputConnections(0,1);
 }
 
 template< class T >
-void vtkImage2DHistogram::ThreadedExecuteCasted(vtkImageData *inData, vtkImageData *outData, int threadId, int numThreads)
+void vtkImage2DHistogram::ThreadedExecuteCasted(vtkImageData *inData, int *histogram, int threadId, int numThreads)
 {
-  //find the total volume size
-  int totalVolumeSize = inData->GetDimensions()[0] * inData->GetDimensions()[1] * inData->GetDimensions()[2];
-  int* outPtr = (int*) outData->GetScalarPointer();
+  //find the contiguous slab of the volume this thread is responsible for
+  vtkIdType totalVolumeSize = (vtkIdType) inData->GetDimensions()[0] * inData->GetDimensions()[1] * inData->GetDimensions()[2];
+  vtkIdType firstVoxel = (totalVolumeSize * threadId) / numThreads;
+  vtkIdType lastVoxel = (totalVolumeSize * (threadId + 1)) / numThreads;
   T* inPtr = (T*) inData->GetScalarPointer();
-  int numIComp = inData->GetNumberOfScalarComponents();
 
-  double* OutSpacing = outData->GetSpacing();
-  double* OutMinimum = outData->GetOrigin();
+  const int res0 = this->Resolution[0];
+  const int res1 = this->Resolution[1];
+  const double min0 = this->BinMinimum[0];
+  const double min1 = this->BinMinimum[1];
+  const double scale0 = this->InverseBinWidth[0];
+  const double scale1 = this->InverseBinWidth[1];
 
-  //clear all the bins to 0
-  memset( (void*) outPtr, 0, this->Resolution[0]*this->Resolution[1]*sizeof(int) );
+  //clear the private bins (touched by this thread first so they stay local to it)
+  memset( (void*) histogram, 0, res0*res1*sizeof(int) );
 
-  //iterate over all the pixels we're responsible for and fill the histogram bins
-  int idInUse = threadId;
-  while( idInUse < totalVolumeSize )
+  //iterate over all the pixels in the slab and fill the histogram bins
+  for( vtkIdType idx = firstVoxel; idx < lastVoxel; idx++ )
   {
-    //find the index of the appropriate bin
-    T value1 = inPtr[idInUse*2];
-    T value2 = inPtr[idInUse*2+1];
-    int bin1 = ((double) value1 - OutMinimum[0]) / OutSpacing[0];
-    int bin2 = ((double) value2 - OutMinimum[1]) / OutSpacing[1];
+    //find the index of the appropriate bin, clamping values outside the range
+    int bin1 = (int) (((double) inPtr[idx*2] - min0) * scale0);
+    int bin2 = (int) (((double) inPtr[idx*2+1] - min1) * scale1);
+    bin1 = (bin1 < 0) ? 0 : ((bin1 >= res0) ? res0 - 1 : bin1);
+    bin2 = (bin2 < 0) ? 0 : ((bin2 >= res1) ? res1 - 1 : bin2);
 
     //increment that bin
-    outPtr[bin1 + this->Resolution[0]*bin2] ++;
+    histogram[bin1 + res0*bin2] ++;
+  }
+}
+
+void vtkImage2DHistogram::ThreadedReduce(int **histograms, int threadId, int numThreads)
+{
+  //each thread sums a disjoint range of bins so no two threads write the same location
+  int totalBins = this->Resolution[0] * this->Resolution[1];
+  int firstBin = (int) (((vtkTypeInt64) totalBins * threadId) / numThreads);
+  int lastBin = (int) (((vtkTypeInt64) totalBins * (threadId + 1)) / numThreads);
 
-    //move to the next pixel we're responsible for
-    idInUse += numThreads;
+  int* outPtr = histograms[0];
+  for( int h = 1; h < numThreads; h++ )
+  {
+    const int* inPtr = histograms[h];
+    for( int bin = firstBin; bin < lastBin; bin++ )
+    {
+      outPtr[bin] += inPtr[bin];
+    }
   }
 }
 
@@ -94,7 +110,23 @@ VTK_THREAD_RETURN_TYPE vtkImage2DHistogramThreadedExecute( void *arg )
   str = static_cast<vtkImage2DHistogramThreadStruct *>
   (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
 
-  str->Filter->ThreadedExecute(str->inData, str->outData, threadId, threadCount);
+  str->Filter->ThreadedExecute(str->inData, str->Histograms[threadId], threadId, threadCount);
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+VTK_THREAD_RETURN_TYPE vtkImage2DHistogramThreadedReduce( void *arg )
+{
+  vtkImage2DHistogramThreadStruct *str;
+  int threadId, threadCount;
+
+  threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+
+  str = static_cast<vtkImage2DHistogramThreadStruct *>
+  (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  str->Filter->ThreadedReduce(str->Histograms, threadId, threadCount);
 
   return VTK_THREAD_RETURN_VALUE;
 }
@@ -105,8 +137,15 @@ int vtkImage2DHistogram::RequestInformation(
   vtkInformationVector* outputVector)
 {
   vtkInformation* outputInfo = outputVector->GetInformationObject(0);
-  vtkImageData* outData = vtkImageData::SafeDownCast(outputInfo->Get(vtkDataObject::DATA_OBJECT()));
-    vtkDataObject::SetPointDataActiveScalarInfo(outputInfo, VTK_INT, 1);
+
+  //one output voxel per bin
+  int OutputExtent[6];
+  OutputExtent[0] = OutputExtent[2] = OutputExtent[4] = OutputExtent[5] = 0;
+  OutputExtent[1] = this->Resolution[0] - 1;
+  OutputExtent[3] = this->Resolution[1] - 1;
+  outputInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),OutputExtent,6);
+
+  vtkDataObject::SetPointDataActiveScalarInfo(outputInfo, VTK_INT, 1);
   return 1;
 }
 
@@ -117,15 +156,14 @@ int vtkImage2DHistogram::RequestUpdateExtent(
 {
   vtkInformation* inputInfo = (inputVector[0])->GetInformationObject(0);
   vtkInformation* outputInfo = outputVector->GetInformationObject(0);
-  vtkImageData* inData = vtkImageData::SafeDownCast(inputInfo->Get(vtkDataObject::DATA_OBJECT()));
-  vtkImageData* outData = vtkImageData::SafeDownCast(outputInfo->Get(vtkDataObject::DATA_OBJECT()));
 
-  int OutputExtent[6];
-  OutputExtent[0] = OutputExtent[2] = OutputExtent[4] = OutputExtent[5] = 0;
-  OutputExtent[1] = this->Resolution[0];
-  OutputExtent[2] = this->Resolution[1];
+  //every bin depends on the whole input
+  int InputExtent[6];
+  inputInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),InputExtent);
+  inputInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),InputExtent,6);
 
-  outputInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),OutputExtent,6);
+  int OutputExtent[6];
+  outputInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),OutputExtent);
   outputInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),OutputExtent,6);
 
   return 1;
@@ -153,31 +191,58 @@ int vtkImage2DHistogram::RequestData(vtkInformation* request,
   outData->AllocateScalars(VTK_INT, 1);
 
   //set all the spacing and origin parameters
-  double* Range1 = inData->GetPointData()->GetScalars()->GetRange(0);
-  double* Range2 = inData->GetPointData()->GetScalars()->GetRange(1);
+  //(GetRange(comp) returns a shared buffer, so copy each range out)
+  double Range1[2], Range2[2];
+  inData->GetPointData()->GetScalars()->GetRange(Range1, 0);
+  inData->GetPointData()->GetScalars()->GetRange(Range2, 1);
   outData->SetSpacing( (Range1[1]-Range1[0]) / (Resolution[0]-1), (Range2[1]-Range2[0]) / (Resolution[1]-1),0 );
   outData->SetOrigin( Range1[0], Range2[0], 0 );
 
+  //precompute the reciprocal bin widths used by the threads
+  double* OutSpacing = outData->GetSpacing();
+  this->BinMinimum[0] = Range1[0];
+  this->BinMinimum[1] = Range2[0];
+  this->InverseBinWidth[0] = (OutSpacing[0] > 0.0) ? 1.0 / OutSpacing[0] : 0.0;
+  this->InverseBinWidth[1] = (OutSpacing[1] > 0.0) ? 1.0 / OutSpacing[1] : 0.0;
+
+  //give each thread a private histogram, with the output serving as the first
+  int numBins = this->Resolution[0]*this->Resolution[1];
+  int** Histograms = new int*[this->NumberOfThreads];
+  Histograms[0] = (int*) outData->GetScalarPointer();
+  for( int i = 1; i < this->NumberOfThreads; i++ )
+  {
+    Histograms[i] = new int[numBins];
+  }
+
   //set up the threader
   vtkImage2DHistogramThreadStruct str;
   str.Filter = this;
   str.inData = inData;
-  str.outData = outData;
+  str.Histograms = Histograms;
   this->Threader->SetNumberOfThreads(this->NumberOfThreads);
-  this->Threader->SetSingleMethod(vtkImage2DHistogramThreadedExecute, &str);
 
   // always shut off debugging to avoid threading problems with GetMacros
   bool debug = this->Debug;
   this->Debug = false;
+  this->Threader->SetSingleMethod(vtkImage2DHistogramThreadedExecute, &str);
+  this->Threader->SingleMethodExecute();
+  this->Threader->SetSingleMethod(vtkImage2DHistogramThreadedReduce, &str);
   this->Threader->SingleMethodExecute();
   this->Debug = debug;
 
+  for( int i = 1; i < this->NumberOfThreads; i++ )
+  {
+    delete[] Histograms[i];
+  }
+  delete[] Histograms;
+
   return 1;
 }
 
 void vtkImage2DHistogram::SetResolution( int res[2] ){
-  if( res[0] > 0 && res[1] > 0 ){
+  if( res[0] > 0 && res[1] > 0 && (res[0] != this->Resolution[0] || res[1] != this->Resolution[1]) ){
     this->Resolution[0] = res[0];
     this->Resolution[1] = res[1];
+    this->Modified();
   }
 }
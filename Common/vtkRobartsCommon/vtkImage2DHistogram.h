@@ -50,16 +50,26 @@ public:
                                    vtkInformationVector** inputVector,
                                    vtkInformationVector* outputVector);
 
-  void ThreadedExecute(vtkImageData *inData, vtkImageData *outData, int threadId, int numThreads);
+  // Description:
+  // Fill the private histogram of one thread from its contiguous slab of voxels
+  void ThreadedExecute(vtkImageData *inData, int *histogram, int threadId, int numThreads);
+
+  // Description:
+  // Add the private histograms of all threads into the first one over one thread's range of bins
+  void ThreadedReduce(int **histograms, int threadId, int numThreads);
 
 protected:
 
   // The method that starts the multi-threading
   template< class T >
-  void ThreadedExecuteCasted(vtkImageData *inData, vtkImageData *outData, int threadId, int numThreads);
+  void ThreadedExecuteCasted(vtkImageData *inData, int *histogram, int threadId, int numThreads);
 
   int Resolution[2];
 
+  // Lower bound and reciprocal width of the bins along each axis
+  double BinMinimum[2];
+  double InverseBinWidth[2];
+
   vtkImage2DHistogram();
   virtual ~vtkImage2DHistogram();
 
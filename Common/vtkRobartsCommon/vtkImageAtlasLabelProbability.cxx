@@ -31,9 +31,13 @@ PURPOSE.  See the above copyright notice for more information.
 #include "vtkInformationVector.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
 
+#include <algorithm>
 #include <math.h>
 #include <float.h>
 
+// Label IDs spanning more than this many values are searched rather than
+// looked up in a table.
+#define VTK_ATLAS_LABEL_MAX_TABLE_SIZE 65536
 
 vtkStandardNewMacro(vtkImageAtlasLabelProbability);
 
@@ -41,11 +45,13 @@ vtkStandardNewMacro(vtkImageAtlasLabelProbability);
 vtkImageAtlasLabelProbability::vtkImageAtlasLabelProbability()
 {
   this->NormalizeDataTerm = 0;
-  this->LabelID = 1.0;
+  this->LabelIDs.push_back(1);
   this->Entropy = false;
   this->SetNumberOfInputPorts(1);
   this->SetNumberOfThreads(10);
   this->MaxValueToGive = 100.0;
+  this->LabelIndexTableMinimum = 0;
+  this->TablesReady = false;
 }
 
 vtkImageAtlasLabelProbability::~vtkImageAtlasLabelProbability(){
@@ -60,13 +66,7 @@ int vtkImageAtlasLabelProbability::RequestInformation (
   vtkInformationVector *outputVector)
 {
   // get the info objects
-  vtkInformation* outInfo = outputVector->GetInformationObject(0);
   vtkInformation *inInfo = inputVector[0]->GetInformationObject(0);
-  vtkDataObject::SetPointDataActiveScalarInfo(outInfo, VTK_FLOAT, 1);
-
-  int numLabelMaps = 0;
-  for(int i = 0; i < inputVector[0]->GetNumberOfInformationObjects(); i++)
-    numLabelMaps++;
 
   int ext[6], ext2[6], idx;
 
@@ -74,7 +74,7 @@ int vtkImageAtlasLabelProbability::RequestInformation (
 
   for(int i = 0; i < inputVector[0]->GetNumberOfInformationObjects(); i++){
     vtkInformation *inInfo2 = inputVector[0]->GetInformationObject(i);
-    inInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext2);
+    inInfo2->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext2);
     for (idx = 0; idx < 3; ++idx)
     {
       if (ext2[idx*2] > ext[idx*2])
@@ -88,68 +88,203 @@ int vtkImageAtlasLabelProbability::RequestInformation (
     }
   }
 
-  outInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext,6);
+  // every label ID has an output of the same size
+  for(int port = 0; port < outputVector->GetNumberOfInformationObjects(); port++)
+  {
+    vtkInformation* outInfo = outputVector->GetInformationObject(port);
+    vtkDataObject::SetPointDataActiveScalarInfo(outInfo, VTK_FLOAT, 1);
+    outInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext,6);
+  }
 
   return 1;
 }
 
 //----------------------------------------------------------------------------
+// Find the output port of a label value, or -1 if it is not one of the label IDs.
+static inline int vtkImageAtlasLabelProbabilityFindLabel(int value, const int *indexTable,
+                                                         unsigned int indexTableSize, int indexTableMinimum,
+                                                         const int *labelIDs, int numLabelIDs)
+{
+  if( indexTable )
+  {
+    unsigned int offset = (unsigned int) value - (unsigned int) indexTableMinimum;
+    return (offset < indexTableSize) ? indexTable[offset] : -1;
+  }
+  for(int k = 0; k < numLabelIDs; k++)
+  {
+    if( labelIDs[k] == value )
+      return k;
+  }
+  return -1;
+}
+
 //----------------------------------------------------------------------------
-// This templated function executes the filter for any type of data.
-// Handles the two input operations
+// This templated function executes the filter for any type of data. Each row
+// of every label map is read once, counting the agreement for all the label IDs
+// together, before the counts are converted into the value of each output.
 template <class T>
-void vtkImageAtlasLabelProbabilityExecute(vtkImageAtlasLabelProbability *self,
-                                          vtkImageData **inData, T *inPtr,
-                                          vtkImageData *outData, float *outPtr,
-                                          int outExt[6], int numLabels, int id)
+void vtkImageAtlasLabelProbabilityExecute(vtkImageAtlasLabelProbability *vtkNotUsed(self),
+                                          vtkImageData **labelData, T *vtkNotUsed(labelPtr), int numLabelMaps,
+                                          vtkImageData **outData, int numOutputs,
+                                          int outExt[6], const int *labelIDs,
+                                          const int *indexTable, unsigned int indexTableSize,
+                                          int indexTableMinimum, const float *valueTable)
 {
+  int rowLength = outExt[1] - outExt[0] + 1;
+  vtkIdType incX, incY, incZ;
 
-  T* inputBuffer = (T*) inData[0]->GetScalarPointer();
-  int volumeSize = inData[0]->GetDimensions()[0]*
-    inData[0]->GetDimensions()[1]*
-    inData[0]->GetDimensions()[2];
+  std::vector<T*> labelPtrs(numLabelMaps);
+  std::vector<vtkIdType> labelIncY(numLabelMaps), labelIncZ(numLabelMaps);
+  for(int m = 0; m < numLabelMaps; m++)
+  {
+    labelPtrs[m] = static_cast<T*>(labelData[m]->GetScalarPointerForExtent(outExt));
+    labelData[m]->GetContinuousIncrements(outExt, incX, incY, incZ);
+    labelIncY[m] = incY;
+    labelIncZ[m] = incZ;
+  }
 
-  float* outBuffer =  (float*)outData->GetScalarPointer();
-  //std::fill_n(outBuffer, volumeSize , 0.0f);
+  std::vector<float*> outPtrs(numOutputs);
+  std::vector<vtkIdType> outIncY(numOutputs), outIncZ(numOutputs);
+  for(int k = 0; k < numOutputs; k++)
+  {
+    outPtrs[k] = static_cast<float*>(outData[k]->GetScalarPointerForExtent(outExt));
+    outData[k]->GetContinuousIncrements(outExt, incX, incY, incZ);
+    outIncY[k] = incY;
+    outIncZ[k] = incZ;
+  }
+
+  std::vector<int> counts(numOutputs*rowLength);
+
+  for (int idxZ = outExt[4]; idxZ <= outExt[5]; idxZ++)
+  {
+    for (int idxY = outExt[2]; idxY <= outExt[3]; idxY++)
+    {
+      //count the agreement on each label ID along the row
+      std::fill(counts.begin(), counts.end(), 0);
+      for(int m = 0; m < numLabelMaps; m++)
+      {
+        T* labelRow = labelPtrs[m];
+        for(int idxX = 0; idxX < rowLength; idxX++)
+        {
+          int k = vtkImageAtlasLabelProbabilityFindLabel((int) labelRow[idxX], indexTable, indexTableSize,
+                                                         indexTableMinimum, labelIDs, numOutputs);
+          if( k >= 0 )
+            counts[k*rowLength+idxX]++;
+        }
+        labelPtrs[m] += rowLength + labelIncY[m];
+      }
 
-  //find the actual number of non-null labels
-  int actualNumLabels = 0;
-  for(int label = 0; label < numLabels; label++ ){
-    if( inData[label] ) actualNumLabels++;
+      //convert the agreement into probability or entropy
+      for(int k = 0; k < numOutputs; k++)
+      {
+        float* outRow = outPtrs[k];
+        const int* countRow = &(counts[k*rowLength]);
+        for(int idxX = 0; idxX < rowLength; idxX++)
+          outRow[idxX] = valueTable[countRow[idxX]];
+        outPtrs[k] += rowLength + outIncY[k];
+      }
+    }
+    for(int m = 0; m < numLabelMaps; m++)
+      labelPtrs[m] += labelIncZ[m];
+    for(int k = 0; k < numOutputs; k++)
+      outPtrs[k] += outIncZ[k];
   }
+}
 
+//----------------------------------------------------------------------------
+// Check the inputs and build the tables shared by the threads once, before the
+// superclass splits the output extent among the threads.
+int vtkImageAtlasLabelProbability::RequestData(
+  vtkInformation *request,
+  vtkInformationVector **inputVector,
+  vtkInformationVector *outputVector)
+{
+  this->TablesReady = false;
 
-  for(int idx = id; idx < volumeSize; idx+=self->GetNumberOfThreads() ){
+  if( this->LabelIDs.empty() )
+  {
+    vtkErrorMacro( "At least one label ID is required." );
+    return -1;
+  }
+
+  std::vector<vtkImageData*> labelData;
+  for(int i = 0; i < inputVector[0]->GetNumberOfInformationObjects(); i++)
+  {
+    vtkImageData* label = vtkImageData::SafeDownCast(
+      inputVector[0]->GetInformationObject(i)->Get(vtkDataObject::DATA_OBJECT()));
+    if( label )
+    {
+      labelData.push_back(label);
+    }
+  }
+
+  if (labelData.empty()) 
+  {
+    vtkErrorMacro( "At least one label map is required." );
+    return -1;
+  }
 
-    //find the number of agreed on pixels
-    int agree = 0;
-    for(int label = 0; label < numLabels; label++ ){
-      if( inData[label] )
-        if( (int) ((T*)inData[label]->GetScalarPointer())[idx] == self->GetLabelID() )
-          agree++;
+  // this filter expects the label maps to be of the same type
+  int LabelType = labelData[0]->GetScalarType();
+  for(unsigned int i = 0; i < labelData.size(); i++)
+  {
+    if (labelData[i]->GetScalarType() != LabelType) 
+    {
+      vtkErrorMacro( "Label maps must be of same type." );
+      return -1;
+    }
+    if ( labelData[i]->GetNumberOfScalarComponents() != 1 ) 
+    {
+      vtkErrorMacro( "Label map can only have 1 component." );
+      return -1;
     }
+  }
+
+  // map label values onto output ports
+  int minID = *std::min_element(this->LabelIDs.begin(), this->LabelIDs.end());
+  int maxID = *std::max_element(this->LabelIDs.begin(), this->LabelIDs.end());
+  this->LabelIndexTable.clear();
+  this->LabelIndexTableMinimum = minID;
+  if( (vtkTypeInt64) maxID - (vtkTypeInt64) minID < VTK_ATLAS_LABEL_MAX_TABLE_SIZE )
+  {
+    this->LabelIndexTable.assign(maxID - minID + 1, -1);
+    for(unsigned int k = 0; k < this->LabelIDs.size(); k++)
+      this->LabelIndexTable[this->LabelIDs[k] - minID] = (int) k;
+  }
+
+  // the output only depends on how many label maps agree, so tabulate it
+  int numLabelMaps = (int) labelData.size();
+  this->AgreementValueTable.resize(numLabelMaps + 1);
+  for(int agree = 0; agree <= numLabelMaps; agree++)
+  {
+    float entropy = log((float)numLabelMaps) - log((float)agree);
+    float value;
 
     //there is no agreement, assign the maximum value
     if( agree == 0 ){
-      if( self->GetEntropy() && self->GetNormalizeDataTerm() == 1 )
-        outBuffer[idx] = 1.0f;
-      else if( self->GetEntropy() )
-        self->GetMaxValueToGive();
+      if( this->Entropy && this->NormalizeDataTerm == 1 )
+        value = 1.0f;
+      else if( this->Entropy )
+        value = this->MaxValueToGive;
       else
-        outBuffer[idx] = 0.0f;
+        value = 0.0f;
     }else{
-      if( self->GetEntropy() && self->GetNormalizeDataTerm() == 1 )
-        outBuffer[idx] = (log((float)actualNumLabels) - log((float)agree) < self->GetMaxValueToGive()) ?
-        (log((float)actualNumLabels) - log((float)agree)) / self->GetMaxValueToGive() : 1.0f ;
-      else if( self->GetEntropy() )
-        outBuffer[idx] = log((float)actualNumLabels) - log((float)agree);
+      if( this->Entropy && this->NormalizeDataTerm == 1 )
+        value = (entropy < this->MaxValueToGive) ? entropy / this->MaxValueToGive : 1.0f;
+      else if( this->Entropy )
+        value = entropy;
       else
-        outBuffer[idx] = (float) agree / (float) actualNumLabels;
+        value = (float) agree / (float) numLabelMaps;
     }
+    this->AgreementValueTable[agree] = value;
   }
-  return;
-}
+  this->TablesReady = true;
+
+  int retVal = this->Superclass::RequestData(request, inputVector, outputVector);
 
+  this->TablesReady = false;
+  return retVal;
+}
 
 //----------------------------------------------------------------------------
 // This method is passed an input and output image, and executes the filter
@@ -162,79 +297,48 @@ void vtkImageAtlasLabelProbability::ThreadedRequestData(
   vtkInformationVector * outputVector,
   vtkImageData ***inData,
   vtkImageData **outData,
-  int outExt[6], int id)
+  int outExt[6], int vtkNotUsed( id ))
 {
-  void *inPtr1;
-  void *outPtr;
-
-  inPtr1 = inData[0][0]->GetScalarPointerForExtent(outExt);
-  outPtr = outData[0]->GetScalarPointerForExtent(outExt);
-  outData[0]->SetScalarType(VTK_FLOAT, outputVector->GetInformationObject(0));
+  // errors have already been reported by RequestData
+  if( !this->TablesReady )
+  {
+    return;
+  }
 
-  int numLabelMaps = 0;
+  std::vector<vtkImageData*> labelData;
   for(int i = 0; i < inputVector[0]->GetNumberOfInformationObjects(); i++)
   {
     if(inData[0][i])
     {
-      numLabelMaps++;
+      labelData.push_back(inData[0][i]);
     }
   }
 
-  if (numLabelMaps == 0) {
-    vtkErrorMacro( "At least one label map is required." );
-    return;
-  }
-
-  // TODO: why is this check here if the above always sets it to float?
-  // this filter expects the output datatype to be float.
-  if (outData[0]->GetScalarType() != VTK_FLOAT)
+  // this filter expects the output data-type to be float.
+  int numOutputs = outputVector->GetNumberOfInformationObjects();
+  for(int k = 0; k < numOutputs; k++)
   {
-    vtkErrorMacro( "Output data type must be float." );
-    return;
-  }
-
-  // this filter expects the label map to be of type char
-  int LabelType = -1;
-  for(int i = 0; i < inputVector[0]->GetNumberOfInformationObjects(); i++)
-  {
-    if( !inData[0][i] ) 
-      continue;
-    if( LabelType == -1 ) 
-      LabelType = inData[0][i]->GetScalarType();
-    if (inData[0][i]->GetScalarType() != LabelType) 
+    if (outData[k]->GetScalarType() != VTK_FLOAT)
     {
-      vtkErrorMacro( "Label maps must be of same type." );
-      return;
-    }
-    if ( inData[0][i]->GetNumberOfScalarComponents() != 1 ) 
-    {
-      vtkErrorMacro( "Label map can only have 1 component." );
+      vtkErrorMacro( "Output data type must be float." );
       return;
     }
   }
 
-  // this filter expects that inputs that have the same number of components
-  if (inData[0][0]->GetNumberOfScalarComponents() != 1 )
-  {
-    vtkErrorMacro( "Execute: Image can only have one component.");
-    return;
-  }
+  const int* indexTable = this->LabelIndexTable.empty() ? 0 : &(this->LabelIndexTable[0]);
 
-  switch (inData[0][0]->GetScalarType())
+  switch (labelData[0]->GetScalarType())
   {
     vtkTemplateMacro(
-      vtkImageAtlasLabelProbabilityExecute(this,inData[0],
-      static_cast<VTK_TT *>(inPtr1),
-      outData[0],
-      static_cast<float *>(outPtr), outExt,
-      inputVector[0]->GetNumberOfInformationObjects(),
-      id));
+      vtkImageAtlasLabelProbabilityExecute(this, &(labelData[0]),
+      static_cast<VTK_TT *>(0), (int) labelData.size(),
+      outData, numOutputs, outExt, &(this->LabelIDs[0]),
+      indexTable, (unsigned int) this->LabelIndexTable.size(),
+      this->LabelIndexTableMinimum, &(this->AgreementValueTable[0])));
   default:
     vtkErrorMacro( "Execute: Unknown ScalarType");
     return;
   }
-
-
 }
 
 //----------------------------------------------------------------------------
@@ -250,6 +354,62 @@ int vtkImageAtlasLabelProbability::FillInputPortInformation(
 void vtkImageAtlasLabelProbability::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
+  os << indent << "LabelIDs:";
+  for(unsigned int k = 0; k < this->LabelIDs.size(); k++)
+    os << " " << this->LabelIDs[k];
+  os << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkImageAtlasLabelProbability::SetLabelID(int labelID)
+{
+  labelID = (labelID < 0) ? 0 : labelID;
+  if( this->LabelIDs.size() == 1 && this->LabelIDs[0] == labelID )
+    return;
+  this->LabelIDs.assign(1, labelID);
+  this->SetNumberOfOutputPorts(1);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageAtlasLabelProbability::GetLabelID()
+{
+  return this->GetLabelID(0);
+}
+
+//----------------------------------------------------------------------------
+void vtkImageAtlasLabelProbability::AddLabelID(int labelID)
+{
+  labelID = (labelID < 0) ? 0 : labelID;
+  if( std::find(this->LabelIDs.begin(), this->LabelIDs.end(), labelID) != this->LabelIDs.end() )
+    return;
+  this->LabelIDs.push_back(labelID);
+  this->SetNumberOfOutputPorts((int) this->LabelIDs.size());
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageAtlasLabelProbability::RemoveAllLabelIDs()
+{
+  if( this->LabelIDs.empty() )
+    return;
+  this->LabelIDs.clear();
+  this->SetNumberOfOutputPorts(1);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageAtlasLabelProbability::GetNumberOfLabelIDs()
+{
+  return (int) this->LabelIDs.size();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageAtlasLabelProbability::GetLabelID(int port)
+{
+  if( port < 0 || port >= (int) this->LabelIDs.size() )
+    return -1;
+  return this->LabelIDs[port];
 }
 
 //----------------------------------------------------------------------------
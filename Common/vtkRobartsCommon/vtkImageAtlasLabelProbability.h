@@ -34,6 +34,7 @@
 
 #include <float.h>
 #include <limits.h>
+#include <vector>
 
 class vtkRobartsCommonExport vtkImageAtlasLabelProbability : public vtkThreadedImageAlgorithm
 {
@@ -60,9 +61,19 @@ public:
   int GetNormalizeDataTerm();
 
   // Description:
-  // Determine which label is being used as the seed.
-  vtkSetClampMacro(LabelID,int, 0, INT_MAX);
-  vtkGetMacro(LabelID,int);
+  // Determine which label is being used as the seed. Setting a single label ID
+  // discards any others that have been added.
+  void SetLabelID(int labelID);
+  int GetLabelID();
+
+  // Description:
+  // Compute the data terms for several labels at once. Each label ID has its
+  // own output port, in the order they were added, and all of them are filled
+  // in a single pass over the label maps. Duplicate label IDs are ignored.
+  void AddLabelID(int labelID);
+  void RemoveAllLabelIDs();
+  int GetNumberOfLabelIDs();
+  int GetLabelID(int port);
 
   // Description:
   // Determine whether or not to use entropy rather than probability in the output
@@ -83,16 +94,31 @@ protected:
   vtkImageAtlasLabelProbability();
   ~vtkImageAtlasLabelProbability();
 
-  int LabelID;
+  std::vector<int> LabelIDs;
   int NormalizeDataTerm;
   bool Entropy;
   int NumberOfLabelMaps;
   double MaxValueToGive;
 
+  // Description:
+  // Tables shared by all the threads, built once in RequestData. The index table
+  // maps a label value (offset by its minimum) to an output port, or to -1 if the
+  // value is not one of the label IDs; it is left empty if the label IDs are too
+  // spread out, in which case they are searched. The value table maps the number
+  // of agreeing label maps to the output value.
+  std::vector<int> LabelIndexTable;
+  int LabelIndexTableMinimum;
+  std::vector<float> AgreementValueTable;
+  bool TablesReady;
+
   virtual int RequestInformation (vtkInformation *,
                                   vtkInformationVector **,
                                   vtkInformationVector *);
 
+  virtual int RequestData(vtkInformation *request,
+                          vtkInformationVector **inputVector,
+                          vtkInformationVector *outputVector);
+
   virtual void ThreadedRequestData(vtkInformation *request,
                                    vtkInformationVector **inputVector,
                                    vtkInformationVector *outputVector,
@@ -4,8 +4,39 @@
 #include "vtkInformation.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
 
+#include <math.h>
+
 vtkStandardNewMacro(vtkImageBasicAffinityFilter);
 
+//----------------------------------------------------------------------------
+// Single precision exp for non-positive arguments (Cephes expf): range reduction
+// by ln(2), a degree 6 polynomial, and the power of two built directly in the
+// exponent bits. Arguments below -87 flush to 0. The clamping and flushing are
+// done with bit masks rather than branches so that loops over it vectorize.
+static inline float vtkImageBasicAffinityFilterExp( float x ){
+  union { vtkTypeInt32 i; float f; } clamped, bound, scale, result;
+  vtkTypeInt32 keep = -(vtkTypeInt32) ( x > -87.0f );
+  clamped.f = x;
+  bound.f = -87.0f;
+  clamped.i = ( clamped.i & keep ) | ( bound.i & ~keep );
+
+  float n = (float) (vtkTypeInt32) ( clamped.f * 1.44269504088896341f - 0.5f );
+  float r = clamped.f - n * 0.693359375f + n * 2.12194440e-4f;
+
+  float p = 1.9875691500E-4f;
+  p = p * r + 1.3981999507E-3f;
+  p = p * r + 8.3334519073E-3f;
+  p = p * r + 4.1665795894E-2f;
+  p = p * r + 1.6666665459E-1f;
+  p = p * r + 5.0000001201E-1f;
+  p = p * r * r + r + 1.0f;
+
+  scale.i = ( (vtkTypeInt32) n + 127 ) << 23;
+  result.f = p * scale.f;
+  result.i &= keep;
+  return result.f;
+}
+
 void vtkImageBasicAffinityFilter::ThreadedExecute(vtkImageData *inData, vtkImageData *outData, int threadId, int numThreads){
 
   //cast the call down to handle the input data differences properly
@@ -22,65 +53,82 @@ void vtkImageBasicAffinityFilter::ThreadedExecute(vtkImageData *inData, vtkImage
 template< class T >
 void vtkImageBasicAffinityFilter::ThreadedExecuteCasted(vtkImageData *inData, vtkImageData *outData, int threadId, int numThreads){
 
-  //find the total volume size
-  int totalVolumeSize = inData->GetDimensions()[0] * inData->GetDimensions()[1] * inData->GetDimensions()[2];
-  float* outPtr = (float*) outData->GetScalarPointer();
+  //hoist the geometry of the volume and the constant spacing terms out of the loops
+  const int dimX = inData->GetDimensions()[0];
+  const int dimY = inData->GetDimensions()[1];
+  const int dimZ = inData->GetDimensions()[2];
+  const int numIComp = inData->GetNumberOfScalarComponents();
+  const vtkIdType rowStride = (vtkIdType) dimX * numIComp;
+  const vtkIdType sliceStride = rowStride * dimY;
+  const double* spacing = inData->GetSpacing();
+  const double distanceTerm[3] = { this->DistanceWeight * spacing[0] * spacing[0],
+                                   this->DistanceWeight * spacing[1] * spacing[1],
+                                   this->DistanceWeight * spacing[2] * spacing[2] };
+  const double intensityWeight = this->IntensityWeight;
+  const bool fast = this->UseFastExponential;
   T* inPtr = (T*) inData->GetScalarPointer();
-  int numIComp = inData->GetNumberOfScalarComponents();
-
-  //iterate over all the pixels we're responsible for and generate the affinity images
-  int idInUse = threadId;
-  while( idInUse < totalVolumeSize ){
-
-    //find our co-ordinates in voxel space
-    int coordinates[3];
-    coordinates[0] = idInUse % inData->GetDimensions()[0] + inData->GetExtent()[0];
-    coordinates[2] = idInUse / inData->GetDimensions()[0];
-    coordinates[1] = coordinates[2] % inData->GetDimensions()[1] + inData->GetExtent()[2];
-    coordinates[2] = coordinates[2] / inData->GetDimensions()[1] + inData->GetExtent()[4];
-
-    //if we are not the last in the X direction, update the X affinity
-    float xAffinity = 0.0f;
-    if( coordinates[0] != inData->GetExtent()[1] ){
-      float dataDifference = 0;
-      for( int i = 0; i < numIComp; i++ ){
-        float singleDiff = (float) inPtr[numIComp*idInUse+i] - (float) inPtr[numIComp*(idInUse+1)+i];
-        dataDifference += singleDiff*singleDiff;
+  float* outPtr = (float*) outData->GetScalarPointer();
+
+  //find the contiguous slab of z-slices we're responsible for
+  int firstSlice = (int) (((vtkTypeInt64) dimZ * threadId) / numThreads);
+  int lastSlice = (int) (((vtkTypeInt64) dimZ * (threadId + 1)) / numThreads);
+
+  //per-row squared intensity differences and affinities, one array per direction
+  float* difference = new float[3*dimX];
+  float* affinity = new float[3*dimX];
+
+  for( int z = firstSlice; z < lastSlice; z++ ){
+    for( int y = 0; y < dimY; y++ ){
+      const T* inRow = inPtr + z * sliceStride + y * rowStride;
+      float* outRow = outPtr + 3 * ((vtkIdType) z * dimX * dimY + (vtkIdType) y * dimX);
+
+      //the last voxel in each direction has no neighbour, so only fill the valid range
+      const int numX = dimX - 1;
+      const int numY = (y != dimY - 1) ? dimX : 0;
+      const int numZ = (z != dimZ - 1) ? dimX : 0;
+      const int numValid[3] = { numX, numY, numZ };
+      const vtkIdType neighbour[3] = { numIComp, rowStride, sliceStride };
+      for( int d = 0; d < 3; d++ ){
+        float* diff = difference + d * dimX;
+        const T* nbRow = inRow + neighbour[d];
+        for( int x = 0; x < numValid[d]; x++ ){
+          float dataDifference = 0;
+          for( int i = 0; i < numIComp; i++ ){
+            float singleDiff = (float) inRow[numIComp*x+i] - (float) nbRow[numIComp*x+i];
+            dataDifference += singleDiff*singleDiff;
+          }
+          diff[x] = dataDifference;
+        }
       }
-      xAffinity = exp( -1 * ( this->DistanceWeight * inData->GetSpacing()[0]*inData->GetSpacing()[0] +
-                  this->IntensityWeight * dataDifference ) );
-    }
-    ((float*)outData->GetScalarPointer())[3*idInUse] = xAffinity;
-
-    //if we are not the last in the Y direction, update the Y affinity
-    float yAffinity = 0.0f;
-    if( coordinates[1] != inData->GetExtent()[3] ){
-      float dataDifference = 0;
-      for( int i = 0; i < numIComp; i++ ){
-        float singleDiff = (float) inPtr[numIComp*idInUse+i] - (float) inPtr[numIComp*(idInUse+inData->GetDimensions()[0])+i];
-        dataDifference += singleDiff*singleDiff;
+
+      //evaluate the affinities over each contiguous run
+      for( int d = 0; d < 3; d++ ){
+        const float* diff = difference + d * dimX;
+        float* aff = affinity + d * dimX;
+        if( fast ){
+          const float distance = (float) distanceTerm[d];
+          const float weight = (float) intensityWeight;
+          for( int x = 0; x < numValid[d]; x++ )
+            aff[x] = vtkImageBasicAffinityFilterExp( -( distance + weight * diff[x] ) );
+        }else{
+          for( int x = 0; x < numValid[d]; x++ )
+            aff[x] = exp( -1 * ( distanceTerm[d] + intensityWeight * diff[x] ) );
+        }
+        for( int x = numValid[d]; x < dimX; x++ )
+          aff[x] = 0.0f;
       }
-      yAffinity = exp( -1 * ( this->DistanceWeight * inData->GetSpacing()[1]*inData->GetSpacing()[1] +
-                  this->IntensityWeight * dataDifference ) );
-    }
-    ((float*)outData->GetScalarPointer())[3*idInUse+1] = yAffinity;
-
-    //if we are not the last in the Z direction, update the Z affinity
-    float zAffinity = 0.0f;
-    if( coordinates[2] != inData->GetExtent()[5] ){
-      float dataDifference = 0;
-      for( int i = 0; i < numIComp; i++ ){
-        float singleDiff = (float) inPtr[numIComp*idInUse+i] - (float) inPtr[numIComp*(idInUse+inData->GetDimensions()[0]*inData->GetDimensions()[1])+i];
-        dataDifference += singleDiff*singleDiff;
+
+      //interleave the three affinities into the output
+      for( int x = 0; x < dimX; x++ ){
+        outRow[3*x  ] = affinity[x];
+        outRow[3*x+1] = affinity[dimX+x];
+        outRow[3*x+2] = affinity[2*dimX+x];
       }
-      zAffinity = exp( -1 * ( this->DistanceWeight * inData->GetSpacing()[2]*inData->GetSpacing()[2] +
-                  this->IntensityWeight * dataDifference ) );
     }
-    ((float*)outData->GetScalarPointer())[3*idInUse+2] = zAffinity;
-
-    //move to the next pixel we're responsible for
-    idInUse += numThreads;
   }
+
+  delete[] difference;
+  delete[] affinity;
 }
 
 struct vtkImageBasicAffinityFilterThreadStruct {
@@ -150,6 +198,7 @@ int vtkImageBasicAffinityFilter::RequestData(vtkInformation* request,
 vtkImageBasicAffinityFilter::vtkImageBasicAffinityFilter() {
   this->DistanceWeight = 0;
   this->IntensityWeight = 0;
+  this->UseFastExponential = false;
   this->Threader = vtkMultiThreader::New();
   this->NumberOfThreads = 10;
 }
@@ -42,6 +42,13 @@ public:
   vtkSetClampMacro( IntensityWeight, double, 0.0, 1000000.0 );
   vtkGetMacro( IntensityWeight, double );
 
+  // Description:
+  // Use single precision arithmetic and a vectorizable polynomial approximation of
+  // exp, at the cost of a relative error of a few 1e-6 in the affinities (off by default)
+  vtkSetMacro( UseFastExponential, bool );
+  vtkGetMacro( UseFastExponential, bool );
+  vtkBooleanMacro( UseFastExponential, bool );
+
   // The method that starts the multithreading
   template< class T >
   void ThreadedExecuteCasted(vtkImageData *inData, vtkImageData *outData, int threadId, int numThreads);
@@ -64,6 +71,7 @@ private:
 
   double DistanceWeight;
   double IntensityWeight;
+  bool UseFastExponential;
 
 };
 
@@ -28,11 +28,20 @@ PURPOSE.  See the above copyright notice for more information.
 #include "vtkImageData.h"
 #include "vtkInformation.h"
 #include "vtkInformationVector.h"
+#include "vtkMultiThreader.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
 
+#include <algorithm>
 #include <math.h>
 #include <float.h>
+#include <vector>
 
+// Label IDs spanning more than this many values are searched rather than
+// looked up in a table.
+#define VTK_LOG_LIKELIHOOD_MAX_TABLE_SIZE 65536
+
+// Number of voxels whose agreement is counted together in the seeding phase.
+#define VTK_LOG_LIKELIHOOD_SEED_CHUNK 4096
 
 vtkStandardNewMacro(vtkImageLogLikelihood);
 
@@ -40,15 +49,17 @@ vtkStandardNewMacro(vtkImageLogLikelihood);
 vtkImageLogLikelihood::vtkImageLogLikelihood()
 {
   this->NormalizeDataTerm = 0;
-  this->LabelID = 1.0;
+  this->LabelIDs.push_back(1);
   this->HistogramResolution = 1.0f;
   this->RequiredAgreement = 0.8;
+  this->OutOfRangeCost = 0.0f;
+  this->HistogramReady = false;
   this->SetNumberOfInputPorts(2);
-  this->SetNumberOfThreads(1);
 }
 
 vtkImageLogLikelihood::~vtkImageLogLikelihood(){
-
+  for(unsigned int k = 0; k < this->CostTables.size(); k++)
+    delete[] this->CostTables[k];
 }
 
 //----------------------------------------------------------------------------
@@ -59,9 +70,7 @@ int vtkImageLogLikelihood::RequestInformation (
   vtkInformationVector *outputVector)
 {
   // get the info objects
-  vtkInformation* outInfo = outputVector->GetInformationObject(0);
   vtkInformation *inInfo = inputVector[0]->GetInformationObject(0);
-  vtkDataObject::SetPointDataActiveScalarInfo(outInfo, VTK_FLOAT, 1);
 
   int numLabelMaps = 0;
   for(int i = 0; i < inputVector[1]->GetNumberOfInformationObjects(); i++)
@@ -95,244 +104,511 @@ int vtkImageLogLikelihood::RequestInformation (
     }
   }
 
-  outInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext,6);
+  // every label ID has an output of the same size
+  for(int port = 0; port < outputVector->GetNumberOfInformationObjects(); port++)
+  {
+    vtkInformation* outInfo = outputVector->GetInformationObject(port);
+    vtkDataObject::SetPointDataActiveScalarInfo(outInfo, VTK_FLOAT, 1);
+    outInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),ext,6);
+  }
 
   return 1;
 }
 
 //----------------------------------------------------------------------------
+namespace
+{
+  struct vtkImageLogLikelihoodThreadStruct
+  {
+    vtkImageLogLikelihood *Filter;
+    vtkImageData *InData;
+    void **LabelBuffers;
+    int NumberOfLabelMaps;
+    int NumberOfLabelIDs;
+    const int *LabelIDs;
+    const int *LabelIndexTable;
+    unsigned int LabelIndexTableSize;
+    int LabelIndexTableMinimum;
+    double RequiredCount;
+    int VolumeSize;
+    unsigned char *SeedMask;
+    int *NumberOfSeeds;
+    float *MinimumValue;
+    float *MaximumValue;
+    const float *HistogramMinimum;
+    const int *HistogramSize;
+    int **Counts;
+  };
+}
 
-template <class T>
-void vtkImageLogLikelihoodExecute2(vtkImageLogLikelihood *self,
-                                   vtkImageData *in1Data, T *in1Ptr,
-                                   vtkImageData **in2Data,
-                                   vtkImageData *outData, float *outPtr,
-                                   int outExt[6], int numLabels, int lblType, int id)
+//----------------------------------------------------------------------------
+static void vtkImageLogLikelihoodGetRange(int volumeSize, int threadId, int threadCount, int &first, int &last)
 {
-  //get some scalar pointer to appease the compiler
-  void* scalarPtr = 0;
-  for(int i = 0; i < numLabels; i++)
-    if( in2Data[i] ){
-      scalarPtr = in2Data[i]->GetScalarPointer();
-      break;
+  first = (int)(((vtkTypeInt64) volumeSize * threadId) / threadCount);
+  last = (int)(((vtkTypeInt64) volumeSize * (threadId + 1)) / threadCount);
+}
+
+//----------------------------------------------------------------------------
+// Find the index of a label value, or -1 if it is not one of the label IDs.
+static inline int vtkImageLogLikelihoodFindLabel(int value, const vtkImageLogLikelihoodThreadStruct *str)
+{
+  if( str->LabelIndexTable )
+  {
+    unsigned int offset = (unsigned int) value - (unsigned int) str->LabelIndexTableMinimum;
+    return (offset < str->LabelIndexTableSize) ? str->LabelIndexTable[offset] : -1;
+  }
+  for(int k = 0; k < str->NumberOfLabelIDs; k++)
+  {
+    if( str->LabelIDs[k] == value )
+      return k;
+  }
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+// First phase: find which voxels are seeds, i.e. have enough of the label maps
+// agreeing on a label ID, and the range of the image over those seeds. Each
+// label map is read once per chunk of voxels, counting the agreement of all the
+// label IDs together, and the result is recorded in one seed mask per label ID.
+template <class T, class TT>
+VTK_THREAD_RETURN_TYPE vtkImageLogLikelihoodSeedExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkImageLogLikelihoodThreadStruct *str = static_cast<vtkImageLogLikelihoodThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int dimens = str->InData->GetNumberOfScalarComponents();
+  T* inputBuffer = (T*) str->InData->GetScalarPointer();
+  int numIDs = str->NumberOfLabelIDs;
+  int* szSample = str->NumberOfSeeds + numIDs*threadId;
+  std::fill_n(szSample, numIDs, 0);
+  std::vector<int> agree(numIDs*VTK_LOG_LIKELIHOOD_SEED_CHUNK);
+
+  int first, last;
+  vtkImageLogLikelihoodGetRange(str->VolumeSize, threadId, threadCount, first, last);
+  for(int start = first; start < last; start += VTK_LOG_LIKELIHOOD_SEED_CHUNK )
+  {
+    int chunk = std::min(VTK_LOG_LIKELIHOOD_SEED_CHUNK, last - start);
+
+    std::fill(agree.begin(), agree.end(), 0);
+    for(int label = 0; label < str->NumberOfLabelMaps; label++ )
+    {
+      TT* labelBuffer = (TT*)str->LabelBuffers[label] + start;
+      for(int i = 0; i < chunk; i++)
+      {
+        int k = vtkImageLogLikelihoodFindLabel((int) labelBuffer[i], str);
+        if( k >= 0 )
+          agree[k*VTK_LOG_LIKELIHOOD_SEED_CHUNK+i]++;
+      }
     }
 
-    //move down another type
-    switch (lblType)
+    for(int k = 0; k < numIDs; k++)
     {
-      vtkTemplateMacro(
-        vtkImageLogLikelihoodExecute(self,in1Data,
-        (T*) in1Ptr,
-        in2Data,
-        static_cast<VTK_TT *>(scalarPtr),
-        outData,
-        outPtr, outExt,
-        numLabels, id));
-    default:
-      vtkErrorWithObjectMacro(self, << "Execute: Unknown ScalarType");
-      return;
+      const int* agreeK = &(agree[k*VTK_LOG_LIKELIHOOD_SEED_CHUNK]);
+      unsigned char* seedMask = str->SeedMask + (vtkIdType) k*str->VolumeSize + start;
+      float* minVal = str->MinimumValue + 2*(numIDs*threadId+k);
+      float* maxVal = str->MaximumValue + 2*(numIDs*threadId+k);
+      for(int i = 0; i < chunk; i++)
+      {
+        seedMask[i] = ( (double) agreeK[i] >= str->RequiredCount ) ? 1 : 0;
+        if( !seedMask[i] )
+          continue;
+
+        szSample[k]++;
+        int idx = start + i;
+        for(int c = 0; c < dimens; c++)
+        {
+          minVal[c] = (minVal[c] < inputBuffer[dimens*idx+c]) ? minVal[c] : inputBuffer[dimens*idx+c];
+          maxVal[c] = (maxVal[c] > inputBuffer[dimens*idx+c]) ? maxVal[c] : inputBuffer[dimens*idx+c];
+        }
+      }
     }
+  }
 
+  return VTK_THREAD_RETURN_VALUE;
 }
+
 //----------------------------------------------------------------------------
-// This templated function executes the filter for any type of data.
-// Handles the two input operations
-template <class T, class TT>
-void vtkImageLogLikelihoodExecute(vtkImageLogLikelihood *self,
-                                  vtkImageData *in1Data, T *in1Ptr,
-                                  vtkImageData **in2Data, TT *in2Ptr,
-                                  vtkImageData *outData, float *outPtr,
-                                  int outExt[6], int numLabels, int id)
+// Second phase: count the seeds in each bin into a per-thread histogram for
+// every label ID that has seeds.
+template <class T>
+VTK_THREAD_RETURN_TYPE vtkImageLogLikelihoodHistogramExecute( void *arg )
 {
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkImageLogLikelihoodThreadStruct *str = static_cast<vtkImageLogLikelihoodThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int dimens = str->InData->GetNumberOfScalarComponents();
+  T* inputBuffer = (T*) str->InData->GetScalarPointer();
+  float resolution = str->Filter->GetHistogramResolution();
+
+  int first, last;
+  vtkImageLogLikelihoodGetRange(str->VolumeSize, threadId, threadCount, first, last);
+  for(int k = 0; k < str->NumberOfLabelIDs; k++)
+  {
+    int* hist = str->Counts[str->NumberOfLabelIDs*threadId+k];
+    if( !hist )
+      continue;
+    const unsigned char* seedMask = str->SeedMask + (vtkIdType) k*str->VolumeSize;
+    const float* minVal = str->HistogramMinimum + 2*k;
+    int szHist1 = str->HistogramSize[2*k+1];
+    for(int idx = first; idx < last; idx++ )
+    {
+      if( !seedMask[idx] )
+        continue;
+      if(dimens == 1){
+        hist[(int)((inputBuffer[idx]-minVal[0]) / resolution)]++;
+      }else{
+        hist[(int)((inputBuffer[2*idx]-minVal[0]) / resolution)*szHist1 + (int)((inputBuffer[2*idx+1]-minVal[1]) / resolution)]++;
+      }
+    }
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
 
+//----------------------------------------------------------------------------
+// Build the seed histograms with the two threaded phases, reduce the per-thread
+// results, and convert each normalized histogram into a table of costs.
+template <class T, class TT>
+void vtkImageLogLikelihoodBuildHistogram(vtkImageLogLikelihood *self, vtkMultiThreader *threader,
+                                         vtkImageData *in1Data, T *vtkNotUsed(in1Ptr),
+                                         vtkImageData **in2Data, TT *vtkNotUsed(in2Ptr), int numLabels,
+                                         const std::vector<int> &labelIDs,
+                                         std::vector<float*> &costTables, float &outOfRangeCost,
+                                         std::vector<int> &szHist, std::vector<float> &minVal)
+{
+  int numThreads = self->GetNumberOfThreads();
+  int numIDs = (int) labelIDs.size();
   int dimens = in1Data->GetNumberOfScalarComponents();
-  T* inputBuffer = (T*) in1Data->GetScalarPointer();
   int volumeSize = in1Data->GetDimensions()[0]*
     in1Data->GetDimensions()[1]*
     in1Data->GetDimensions()[2];
 
-  float* outBuffer =  (float*)outData->GetScalarPointer();
-
-  //find the actual number of non-null labels
-  int actualNumLabels = 0;
-  for(int label = 0; label < numLabels; label++ )
+  // map label values onto label ID indices
+  int minID = *std::min_element(labelIDs.begin(), labelIDs.end());
+  int maxID = *std::max_element(labelIDs.begin(), labelIDs.end());
+  std::vector<int> indexTable;
+  if( (vtkTypeInt64) maxID - (vtkTypeInt64) minID < VTK_LOG_LIKELIHOOD_MAX_TABLE_SIZE )
   {
-    if( in2Data[label] ) actualNumLabels++;
+    indexTable.assign(maxID - minID + 1, -1);
+    for(int k = 0; k < numIDs; k++)
+      indexTable[labelIDs[k] - minID] = k;
   }
 
-  float minVal[2] = {FLT_MAX, FLT_MAX};
-  float maxVal[2] = {FLT_MIN, FLT_MIN};
-
-  // calculate sample size
-  int szSample = 0;
-  for(int idx = 0; idx < volumeSize; idx++ )
+  vtkImageLogLikelihoodThreadStruct str;
+  str.Filter = self;
+  str.InData = in1Data;
+  str.LabelBuffers = new void*[numLabels];
+  for(int label = 0; label < numLabels; label++ )
+    str.LabelBuffers[label] = in2Data[label]->GetScalarPointer();
+  str.NumberOfLabelMaps = numLabels;
+  str.NumberOfLabelIDs = numIDs;
+  str.LabelIDs = &(labelIDs[0]);
+  str.LabelIndexTable = indexTable.empty() ? 0 : &(indexTable[0]);
+  str.LabelIndexTableSize = (unsigned int) indexTable.size();
+  str.LabelIndexTableMinimum = minID;
+  str.RequiredCount = self->GetRequiredAgreement()*(double)(numLabels);
+  str.VolumeSize = volumeSize;
+  str.SeedMask = new unsigned char[(vtkIdType) numIDs*volumeSize];
+  str.NumberOfSeeds = new int[numIDs*numThreads];
+  std::fill_n(str.NumberOfSeeds, numIDs*numThreads, 0);
+  str.MinimumValue = new float[2*numIDs*numThreads];
+  str.MaximumValue = new float[2*numIDs*numThreads];
+  std::fill_n(str.MinimumValue, 2*numIDs*numThreads, FLT_MAX);
+  std::fill_n(str.MaximumValue, 2*numIDs*numThreads, -FLT_MAX);
+  str.Counts = new int*[numIDs*numThreads];
+  std::fill_n(str.Counts, numIDs*numThreads, (int*) 0);
+
+  // find the seeds and their range
+  threader->SetNumberOfThreads(numThreads);
+  threader->SetSingleMethod(vtkImageLogLikelihoodSeedExecute<T,TT>, &str);
+  threader->SingleMethodExecute();
+
+  costTables.assign(numIDs, (float*) 0);
+  szHist.assign(2*numIDs, 0);
+  minVal.assign(2*numIDs, 0.0f);
+  std::vector<int> szSample(numIDs, 0);
+  bool anySeeds = false;
+  for(int k = 0; k < numIDs; k++)
   {
-    int agree = 0;
-    for(int label = 0; label < numLabels; label++ )
-    {
-      if( in2Data[label] )
-        if( (int) ((TT*)in2Data[label]->GetScalarPointer())[idx] == self->GetLabelID() )
-          agree++;
-    }
-    if( (double) agree >= self->GetRequiredAgreement()*(double)(actualNumLabels) )
+    float maxVal[2] = {-FLT_MAX, -FLT_MAX};
+    minVal[2*k] = minVal[2*k+1] = FLT_MAX;
+    for(int t = 0; t < numThreads; t++)
     {
-      szSample++;
-      if(dimens == 1)
+      szSample[k] += str.NumberOfSeeds[numIDs*t+k];
+      for(int c = 0; c < 2; c++)
       {
-        minVal[0] = (minVal[0] < inputBuffer[idx]) ? minVal[0] : inputBuffer[idx];
-        maxVal[0] = (maxVal[0] > inputBuffer[idx]) ? maxVal[0] : inputBuffer[idx];
-      }
-      else
-      {
-        minVal[0] = (minVal[0] < inputBuffer[2*idx  ]) ? minVal[0] : inputBuffer[2*idx  ];
-        maxVal[0] = (maxVal[0] > inputBuffer[2*idx  ]) ? maxVal[0] : inputBuffer[2*idx  ];
-        minVal[1] = (minVal[1] < inputBuffer[2*idx+1]) ? minVal[1] : inputBuffer[2*idx+1];
-        maxVal[1] = (maxVal[1] > inputBuffer[2*idx+1]) ? maxVal[1] : inputBuffer[2*idx+1];
+        int i = 2*(numIDs*t+k)+c;
+        minVal[2*k+c] = (minVal[2*k+c] < str.MinimumValue[i]) ? minVal[2*k+c] : str.MinimumValue[i];
+        maxVal[c] = (maxVal[c] > str.MaximumValue[i]) ? maxVal[c] : str.MaximumValue[i];
       }
     }
+    if( szSample[k] == 0 )
+      continue;
+
+    // calculate histogram size and allocate per-thread bins
+    float resolution = self->GetHistogramResolution();
+    szHist[2*k] = (int)((maxVal[0]-minVal[2*k])/resolution)+1;
+    szHist[2*k+1] = (dimens == 1) ? 1 : (int)((maxVal[1]-minVal[2*k+1])/resolution)+1;
+    int szHistTot = szHist[2*k]*szHist[2*k+1];
+    for(int t = 0; t < numThreads; t++)
+    {
+      str.Counts[numIDs*t+k] = new int[szHistTot];
+      std::fill_n(str.Counts[numIDs*t+k], szHistTot, 0);
+    }
+    anySeeds = true;
   }
 
-  if(szSample == 0)
+  outOfRangeCost = -log(1.0e-10);
+  if( self->GetNormalizeDataTerm() )
+    outOfRangeCost = outOfRangeCost / -log(1.0e-10);
+  if( anySeeds )
   {
-    std::fill_n( outBuffer, volumeSize, 1.0 );
-    return;
+    // fill per-thread histogram bins
+    str.HistogramMinimum = &(minVal[0]);
+    str.HistogramSize = &(szHist[0]);
+    threader->SetSingleMethod(vtkImageLogLikelihoodHistogramExecute<T>, &str);
+    threader->SingleMethodExecute();
   }
 
-  // calculate histogram and ML data term
-  float resolution = self->GetHistogramResolution();
-  int szHist[2] = {(int)(maxVal[0]-minVal[0]/resolution)+1,
-    (int)(maxVal[1]-minVal[1]/resolution)+1};
-  int szHistTot = szHist[0]*szHist[1];
-  float *hist = new float[szHistTot];
-  std::fill_n(hist, szHistTot, 0.0f);
-
-  // Fill histogram bins
-  for(int idx = 0; idx < volumeSize; idx++ ){
-    int agree = 0;
-    for(int label = 0; label < numLabels; label++ ){
-      if( in2Data[label] )
-        if( (int) ((TT*)in2Data[label]->GetScalarPointer())[idx] == self->GetLabelID() )
-          agree++;
-    }
-    if( (double) agree >= self->GetRequiredAgreement()*(double)(actualNumLabels) ){
-      if(dimens == 1){
-        hist[(int)((inputBuffer[idx]-minVal[0]) / resolution)]++;
-      }else{
-        hist[(int)((inputBuffer[2*idx]-minVal[0]) / resolution)*szHist[1] + (int)((inputBuffer[2*idx+1]-minVal[1]) / resolution)]++;
-      }
+  // reduce, normalize histograms and calculate log likelihood cost of each bin
+  for(int k = 0; k < numIDs; k++)
+  {
+    if( szSample[k] == 0 )
+      continue;
+    int szHistTot = szHist[2*k]*szHist[2*k+1];
+    float* costTable = new float[szHistTot];
+    for(int i = 0; i < szHistTot; i++)
+    {
+      int count = 0;
+      for(int t = 0; t < numThreads; t++)
+        count += str.Counts[numIDs*t+k][i];
+      float hist = (float) count / (float)szSample[k] + 1.0e-10;
+      costTable[i] = -log(hist);
+      if( self->GetNormalizeDataTerm() )
+        costTable[i] = (costTable[i] / -log(1.0e-10) );
     }
+    costTables[k] = costTable;
   }
 
-  // Normalize histogram
-  for (int i = 0; i < szHistTot; i++)
-    hist[i] = hist[i]/ (float)szSample + 1.0e-10;
-
-  // Calculate log likelihood dataterm
-  for (int idx = 0; idx < volumeSize; idx++){
-    if(dimens == 1)
-      outBuffer[idx] =( inputBuffer[idx] < minVal[0] ||  (int)((inputBuffer[idx]-minVal[0]) / resolution) >= szHist[0]) ?
-      -log(1.0e-10) : (-log(hist[ (int)((inputBuffer[idx]-minVal[0]) / resolution) ]));
-    else
-      outBuffer[idx] = ( inputBuffer[2*idx  ] < minVal[0] ||  (int)((inputBuffer[2*idx  ]-minVal[0]) / resolution) >= szHist[0] ) ? -log(1.0e-10) : (
-      ( inputBuffer[2*idx+1] < minVal[1] ||  (int)((inputBuffer[2*idx+1]-minVal[1]) / resolution) >= szHist[1] ) ? -log(1.0e-10) :
-      (-log(hist[ (int)((inputBuffer[2*idx]-minVal[0]) / resolution)*szHist[1] + (int)((inputBuffer[2*idx+1]-minVal[1]) / resolution) ])) );
+  for(int i = 0; i < numIDs*numThreads; i++)
+    delete[] str.Counts[i];
+  delete[] str.LabelBuffers;
+  delete[] str.SeedMask;
+  delete[] str.NumberOfSeeds;
+  delete[] str.MinimumValue;
+  delete[] str.MaximumValue;
+  delete[] str.Counts;
+}
 
+//----------------------------------------------------------------------------
+template <class T>
+void vtkImageLogLikelihoodBuildHistogram2(vtkImageLogLikelihood *self, vtkMultiThreader *threader,
+                                          vtkImageData *in1Data, T *in1Ptr,
+                                          vtkImageData **in2Data, int numLabels,
+                                          const std::vector<int> &labelIDs,
+                                          std::vector<float*> &costTables, float &outOfRangeCost,
+                                          std::vector<int> &szHist, std::vector<float> &minVal)
+{
+  //move down another type
+  switch (in2Data[0]->GetScalarType())
+  {
+    vtkTemplateMacro(
+      vtkImageLogLikelihoodBuildHistogram(self, threader,
+      in1Data, in1Ptr,
+      in2Data, static_cast<VTK_TT *>(0), numLabels,
+      labelIDs, costTables, outOfRangeCost,
+      szHist, minVal));
+  default:
+    vtkErrorWithObjectMacro(self, << "Execute: Unknown ScalarType");
+    return;
   }
+}
 
-  // Normalize costs to [0,1]
-  if( self->GetNormalizeDataTerm() )
-    for (int idx = 0; idx < volumeSize; idx++)
-      outBuffer[idx] = (outBuffer[idx] / -log(1.0e-10) );
-
-  delete[] hist;
+//----------------------------------------------------------------------------
+// This templated function executes the filter for any type of data. It looks
+// up the cost of each voxel of the given extent in the shared cost table.
+template <class T>
+void vtkImageLogLikelihoodExecute(vtkImageLogLikelihood *self,
+                                  vtkImageData *in1Data, T *inPtr,
+                                  vtkImageData *outData, float *outPtr,
+                                  int outExt[6], const float *costTable, float outOfRangeCost,
+                                  const int szHist[2], const float minVal[2])
+{
+  int dimens = in1Data->GetNumberOfScalarComponents();
+  vtkIdType inIncX, inIncY, inIncZ;
+  vtkIdType outIncX, outIncY, outIncZ;
+  in1Data->GetContinuousIncrements(outExt, inIncX, inIncY, inIncZ);
+  outData->GetContinuousIncrements(outExt, outIncX, outIncY, outIncZ);
+  float resolution = self->GetHistogramResolution();
 
-  return;
+  for (int idxZ = outExt[4]; idxZ <= outExt[5]; idxZ++)
+  {
+    for (int idxY = outExt[2]; idxY <= outExt[3]; idxY++)
+    {
+      for (int idxX = outExt[0]; idxX <= outExt[1]; idxX++, inPtr += dimens)
+      {
+        // no seeds were found, so every voxel is equally likely
+        if( !costTable )
+        {
+          *(outPtr++) = 1.0f;
+          continue;
+        }
+
+        int bin0 = (int)((inPtr[0]-minVal[0]) / resolution);
+        if( inPtr[0] < minVal[0] || bin0 >= szHist[0] )
+        {
+          *(outPtr++) = outOfRangeCost;
+          continue;
+        }
+        if( dimens == 1 )
+        {
+          *(outPtr++) = costTable[bin0];
+          continue;
+        }
+
+        int bin1 = (int)((inPtr[1]-minVal[1]) / resolution);
+        *(outPtr++) = ( inPtr[1] < minVal[1] || bin1 >= szHist[1] ) ? outOfRangeCost : costTable[bin0*szHist[1] + bin1];
+      }
+      inPtr += inIncY;
+      outPtr += outIncY;
+    }
+    inPtr += inIncZ;
+    outPtr += outIncZ;
+  }
 }
 
 //----------------------------------------------------------------------------
-// This method is passed an input and output image, and executes the filter
-// algorithm to fill the output from the inputs.
-// It just executes a switch statement to call the correct function for
-// the image data types.
-void vtkImageLogLikelihood::ThreadedRequestData(
-  vtkInformation * vtkNotUsed( request ),
-  vtkInformationVector ** inputVector,
-  vtkInformationVector * outputVector,
-  vtkImageData ***inData,
-  vtkImageData **outData,
-  int outExt[6], int id)
+// Check the inputs and build the seed histogram once, before the superclass
+// splits the output extent among the threads.
+int vtkImageLogLikelihood::RequestData(
+  vtkInformation *request,
+  vtkInformationVector **inputVector,
+  vtkInformationVector *outputVector)
 {
-  void *inPtr1;
-  void *outPtr;
+  this->HistogramReady = false;
 
-  inPtr1 = inData[0][0]->GetScalarPointerForExtent(outExt);
-  outPtr = outData[0]->GetScalarPointerForExtent(outExt);
-  outData[0]->SetScalarType(VTK_FLOAT, outputVector->GetInformationObject(0));
+  if( this->LabelIDs.empty() )
+  {
+    vtkErrorMacro("At least one label ID is required.");
+    return -1;
+  }
 
-  int numLabelMaps = 0;
+  vtkImageData* inData = vtkImageData::SafeDownCast(
+    inputVector[0]->GetInformationObject(0)->Get(vtkDataObject::DATA_OBJECT()));
+  std::vector<vtkImageData*> labelData;
   for(int i = 0; i < inputVector[1]->GetNumberOfInformationObjects(); i++)
   {
-    if( inData[1][i] )
+    vtkImageData* label = vtkImageData::SafeDownCast(
+      inputVector[1]->GetInformationObject(i)->Get(vtkDataObject::DATA_OBJECT()));
+    if( label )
     {
-      numLabelMaps++;
+      labelData.push_back(label);
     }
   }
 
-  if (numLabelMaps == 0) 
+  if (labelData.empty()) 
   {
     vtkErrorMacro("At least one label map is required.");
-    return;
-  }
-
-  // this filter expects the output data-type to be float.
-  if (outData[0]->GetScalarType() != VTK_FLOAT)
-  {
-    vtkErrorMacro("Output data type must be float.");
-    return;
+    return -1;
   }
 
-  // this filter expects the label map to be of type char
-  int LabelType = -1;
-  for(int i = 0; i < inputVector[1]->GetNumberOfInformationObjects(); i++)
+  // this filter expects the label maps to be of the same type
+  int LabelType = labelData[0]->GetScalarType();
+  for(unsigned int i = 0; i < labelData.size(); i++)
   {
-    if( !inData[1][i] )
-      continue;
-    if( LabelType == -1 )
-      LabelType = inData[1][i]->GetScalarType();
-
-    if (inData[1][i]->GetScalarType() != LabelType) 
+    if (labelData[i]->GetScalarType() != LabelType) 
     {
       vtkErrorMacro( "Label maps must be of same type." );
-      return;
+      return -1;
     }
-    if ( inData[1][i]->GetNumberOfScalarComponents() != 1 ) 
+    if ( labelData[i]->GetNumberOfScalarComponents() != 1 ) 
     {
       vtkErrorMacro( "Label map can only have 1 component." );
-      return;
+      return -1;
     }
   }
 
   // this filter expects that inputs that have the same number of components
-  if (inData[0][0]->GetNumberOfScalarComponents() != 1 && inData[0][0]->GetNumberOfScalarComponents() != 2)
+  if (inData->GetNumberOfScalarComponents() != 1 && inData->GetNumberOfScalarComponents() != 2)
   {
     vtkErrorMacro( "Execute: Image can only have one or two components.");
-    return;
+    return -1;
   }
 
-  switch (inData[0][0]->GetScalarType())
+  switch (inData->GetScalarType())
   {
     vtkTemplateMacro(
-      vtkImageLogLikelihoodExecute2(this,inData[0][0],
-      static_cast<VTK_TT *>(inPtr1),
-      inData[1],
-      outData[0],
-      static_cast<float *>(outPtr), outExt,
-      inputVector[1]->GetNumberOfInformationObjects(),
-      LabelType,id));
+      vtkImageLogLikelihoodBuildHistogram2(this, this->Threader,
+      inData, static_cast<VTK_TT *>(0),
+      &(labelData[0]), (int) labelData.size(),
+      this->LabelIDs, this->CostTables, this->OutOfRangeCost,
+      this->HistogramSizes, this->HistogramMinima));
   default:
     vtkErrorMacro( "Execute: Unknown ScalarType");
+    return -1;
+  }
+  this->HistogramReady = true;
+
+  int retVal = this->Superclass::RequestData(request, inputVector, outputVector);
+
+  for(unsigned int k = 0; k < this->CostTables.size(); k++)
+    delete[] this->CostTables[k];
+  this->CostTables.clear();
+  this->HistogramReady = false;
+  return retVal;
+}
+
+//----------------------------------------------------------------------------
+// This method is passed an input and output image, and executes the filter
+// algorithm to fill the output from the inputs.
+// It just executes a switch statement to call the correct function for
+// the image data types.
+void vtkImageLogLikelihood::ThreadedRequestData(
+  vtkInformation * vtkNotUsed( request ),
+  vtkInformationVector ** vtkNotUsed( inputVector ),
+  vtkInformationVector * outputVector,
+  vtkImageData ***inData,
+  vtkImageData **outData,
+  int outExt[6], int vtkNotUsed( id ))
+{
+  // errors have already been reported by RequestData
+  if( !this->HistogramReady )
+  {
     return;
   }
+
+  // each output holds the data term of one label ID
+  int numOutputs = outputVector->GetNumberOfInformationObjects();
+  for(int k = 0; k < numOutputs && k < (int) this->CostTables.size(); k++)
+  {
+    // this filter expects the output data-type to be float.
+    if (outData[k]->GetScalarType() != VTK_FLOAT)
+    {
+      vtkErrorMacro("Output data type must be float.");
+      return;
+    }
+
+    void *inPtr1 = inData[0][0]->GetScalarPointerForExtent(outExt);
+    void *outPtr = outData[k]->GetScalarPointerForExtent(outExt);
+
+    switch (inData[0][0]->GetScalarType())
+    {
+      vtkTemplateMacro(
+        vtkImageLogLikelihoodExecute(this,inData[0][0],
+        static_cast<VTK_TT *>(inPtr1),
+        outData[k],
+        static_cast<float *>(outPtr), outExt,
+        this->CostTables[k], this->OutOfRangeCost,
+        &(this->HistogramSizes[2*k]), &(this->HistogramMinima[2*k])));
+    default:
+      vtkErrorMacro( "Execute: Unknown ScalarType");
+      return;
+    }
+  }
 }
 
 //----------------------------------------------------------------------------
@@ -348,7 +624,62 @@ int vtkImageLogLikelihood::FillInputPortInformation(
 void vtkImageLogLikelihood::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
+  os << indent << "LabelIDs:";
+  for(unsigned int k = 0; k < this->LabelIDs.size(); k++)
+    os << " " << this->LabelIDs[k];
+  os << "\n";
+}
 
+//----------------------------------------------------------------------------
+void vtkImageLogLikelihood::SetLabelID(int labelID)
+{
+  labelID = (labelID < 0) ? 0 : labelID;
+  if( this->LabelIDs.size() == 1 && this->LabelIDs[0] == labelID )
+    return;
+  this->LabelIDs.assign(1, labelID);
+  this->SetNumberOfOutputPorts(1);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageLogLikelihood::GetLabelID()
+{
+  return this->GetLabelID(0);
+}
+
+//----------------------------------------------------------------------------
+void vtkImageLogLikelihood::AddLabelID(int labelID)
+{
+  labelID = (labelID < 0) ? 0 : labelID;
+  if( std::find(this->LabelIDs.begin(), this->LabelIDs.end(), labelID) != this->LabelIDs.end() )
+    return;
+  this->LabelIDs.push_back(labelID);
+  this->SetNumberOfOutputPorts((int) this->LabelIDs.size());
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageLogLikelihood::RemoveAllLabelIDs()
+{
+  if( this->LabelIDs.empty() )
+    return;
+  this->LabelIDs.clear();
+  this->SetNumberOfOutputPorts(1);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageLogLikelihood::GetNumberOfLabelIDs()
+{
+  return (int) this->LabelIDs.size();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageLogLikelihood::GetLabelID(int port)
+{
+  if( port < 0 || port >= (int) this->LabelIDs.size() )
+    return -1;
+  return this->LabelIDs[port];
 }
 
 //----------------------------------------------------------------------------
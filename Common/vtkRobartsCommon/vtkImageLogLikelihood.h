@@ -33,6 +33,7 @@
 
 #include <float.h>
 #include <limits.h>
+#include <vector>
 
 class vtkRobartsCommonExport vtkImageLogLikelihood : public vtkThreadedImageAlgorithm
 {
@@ -58,9 +59,19 @@ public:
   int GetNormalizeDataTerm();
 
   // Description:
-  // Determine which label is being used as the seed.
-  vtkSetClampMacro(LabelID,int, 0, INT_MAX);
-  vtkGetMacro(LabelID,int);
+  // Determine which label is being used as the seed. Setting a single label ID
+  // discards any others that have been added.
+  void SetLabelID(int labelID);
+  int GetLabelID();
+
+  // Description:
+  // Compute the data terms for several labels at once. Each label ID has its
+  // own output port, in the order they were added, and the seeds of all of them
+  // are found in a single pass over the label maps. Duplicate label IDs are ignored.
+  void AddLabelID(int labelID);
+  void RemoveAllLabelIDs();
+  int GetNumberOfLabelIDs();
+  int GetLabelID(int port);
 
   // Description:
   // Determine the resolution of the histogram used for the data term.
@@ -78,16 +89,30 @@ protected:
   vtkImageLogLikelihood();
   ~vtkImageLogLikelihood();
 
-  int LabelID;
+  std::vector<int> LabelIDs;
   int NormalizeDataTerm;
   float HistogramResolution;
   double RequiredAgreement;
   int NumberOfLabelMaps;
 
+  // Description:
+  // Seed histograms shared by all the threads, one per label ID. They are built
+  // once in RequestData and stored as tables of per-bin costs, or as null tables
+  // if no seeds were found. The sizes and minima are stored in pairs.
+  std::vector<float*> CostTables;
+  float OutOfRangeCost;
+  std::vector<int> HistogramSizes;
+  std::vector<float> HistogramMinima;
+  bool HistogramReady;
+
   virtual int RequestInformation (vtkInformation *,
                                   vtkInformationVector **,
                                   vtkInformationVector *);
 
+  virtual int RequestData(vtkInformation *request,
+                          vtkInformationVector **inputVector,
+                          vtkInformationVector *outputVector);
+
   virtual void ThreadedRequestData(vtkInformation *request,
                                    vtkInformationVector **inputVector,
                                    vtkInformationVector *outputVector,
@@ -5,6 +5,7 @@
 #include "vtkPointData.h"
 #include "vtkDataArray.h"
 #include "vtkMath.h"
+#include "vtkMultiThreader.h"
 #include <vtkStreamingDemandDrivenPipeline.h>
 
 //------------------------------------------------------------------------------
@@ -34,6 +35,8 @@ vtkImageMultiStatistics::vtkImageMultiStatistics()
   this->TotalEntropy = 0.0;
   this->Count = 0;
   this->NumberOfBins = 100;
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
 
   //configure the input ports
   this->SetNumberOfInputPorts(1);
@@ -41,6 +44,8 @@ vtkImageMultiStatistics::vtkImageMultiStatistics()
 
 vtkImageMultiStatistics::~vtkImageMultiStatistics()
 {
+  this->Threader->Delete();
+
   if (this->AverageMagnitude) { delete [] this->AverageMagnitude; }
   if (this->MeanSquared) { delete [] this->MeanSquared; }
   if (this->PCAVariance) { delete [] this->PCAVariance; }
@@ -256,329 +261,395 @@ int vtkImageMultiStatistics::GetEntropyResolution()
 }
 
 //----------------------------------------------------------------------------
-#define MAX_COMPONENTS 20
-struct vtkImageMultiStatisticsKDNode
+// Sparse N-dimensional joint histogram stored as an open-addressing hash table
+// (linear probing, load factor <= 1/2). Only occupied bins cost memory, all
+// storage lives in two flat arrays, and neither insertion nor entropy
+// evaluation recurses, so occupancy is bounded only by the number of voxels.
+class vtkImageMultiStatisticsJointHistogram
 {
-
-  int Index[MAX_COMPONENTS];
-  int Partition;
-  int Value;
-  int N;
-
-  vtkImageMultiStatisticsKDNode* Parent;
-  vtkImageMultiStatisticsKDNode* LeftChild;
-  vtkImageMultiStatisticsKDNode* RightChild;
-
-  vtkImageMultiStatisticsKDNode(int N, vtkImageMultiStatisticsKDNode* parent)
+public:
+  vtkImageMultiStatisticsJointHistogram(int N)
   {
     this->N = N;
-    //this->Index = new int[N];
-    this->LeftChild = 0;
-    this->RightChild = 0;
-    this->Parent = parent;
-    this->Partition = parent ? (parent->Partition + 1) % N : 0;
-    this->Value = 0;
+    this->Capacity = 0;
+    this->Occupied = 0;
+    this->Keys = 0;
+    this->Values = 0;
+    this->Allocate(1024);
   }
 
-  ~vtkImageMultiStatisticsKDNode()
+  ~vtkImageMultiStatisticsJointHistogram()
   {
-    //delete [] Index;
-    if (LeftChild) { delete LeftChild; }
-    if (RightChild) { delete RightChild; }
+    delete [] this->Keys;
+    delete [] this->Values;
   }
 
-  long double GetEntropy(int NumPoints)
+  void AddPoint(const int* Index, vtkIdType Count = 1)
   {
-    //get entropy central to this bin
-    long double LocalEntropy = -((long double)this->Value / (long double) NumPoints) *
-                               log((long double)this->Value / (long double) NumPoints) / log(2.0);
-
-    //get entropy from child bins
-    if (this->LeftChild)
-    { LocalEntropy += this->LeftChild->GetEntropy(NumPoints); }
-    if (this->RightChild)
-    { LocalEntropy += this->RightChild->GetEntropy(NumPoints); }
+    if (2 * (this->Occupied + 1) > this->Capacity)
+    { this->Allocate(2 * this->Capacity); }
 
-    //return to parent
-    return LocalEntropy;
+    vtkIdType Slot = this->Find(Index);
+    if (!this->Values[Slot])
+    {
+      int* Key = this->Keys + Slot * this->N;
+      for (int i = 0; i < this->N; i++)
+      { Key[i] = Index[i]; }
+      this->Occupied++;
+    }
+    this->Values[Slot] += Count;
   }
 
-  void AddPoint(int* Index)
+  // Add the contents of another histogram over the same components into this one.
+  void Merge(const vtkImageMultiStatisticsJointHistogram& Other)
   {
+    for (vtkIdType s = 0; s < Other.Capacity; s++)
+      if (Other.Values[s])
+      { this->AddPoint(Other.Keys + s * Other.N, Other.Values[s]); }
+  }
 
-    //see if it belongs to this node
-    bool ThisNode = true;
-    for (int i = 0; i < this->N; i++)
-    {
-      if (this->Index[i] != Index[i])
-      {
-        ThisNode = false;
-        break;
-      }
-    }
-    if (ThisNode)
+  long double GetEntropy(long int NumPoints) const
+  {
+    long double Entropy = 0.0;
+    for (vtkIdType s = 0; s < this->Capacity; s++)
     {
-      this->Value++;
-      return;
+      if (!this->Values[s])
+      { continue; }
+      long double p = (long double) this->Values[s] / (long double) NumPoints;
+      Entropy -= p * log(p) / log(2.0);
     }
-    else if (this->Value == 0)
+    return Entropy;
+  }
+
+private:
+  vtkImageMultiStatisticsJointHistogram(const vtkImageMultiStatisticsJointHistogram&); //not implemented
+  void operator=(const vtkImageMultiStatisticsJointHistogram&); //not implemented
+
+  vtkIdType Find(const int* Index) const
+  {
+    //FNV-1a over the bin indices followed by a final avalanche
+    vtkTypeUInt64 Hash = 14695981039346656037ULL;
+    for (int i = 0; i < this->N; i++)
     {
-      for (int i = 0; i < this->N; i++)
-      { this->Index[i] = Index[i]; }
-      this->Value = 1;
-      return;
+      Hash ^= (vtkTypeUInt32) Index[i];
+      Hash *= 1099511628211ULL;
     }
+    Hash ^= Hash >> 33;
+    Hash *= 0xff51afd7ed558ccdULL;
+    Hash ^= Hash >> 33;
 
-    //see if it belongs to the left child
-    if (Index[this->Partition] < this->Index[this->Partition])
+    vtkIdType Mask = this->Capacity - 1;
+    vtkIdType Slot = (vtkIdType)(Hash & (vtkTypeUInt64) Mask);
+    while (this->Values[Slot])
     {
-      if (this->LeftChild)
-      {
-        this->LeftChild->AddPoint(Index);
-      }
-      else
+      const int* Key = this->Keys + Slot * this->N;
+      bool Match = true;
+      for (int i = 0; i < this->N; i++)
       {
-        this->LeftChild = new vtkImageMultiStatisticsKDNode(this->N, this);
-        for (int i = 0; i < this->N; i++)
-        { this->LeftChild->Index[i] = Index[i]; }
-        this->LeftChild->Value = 1;
+        if (Key[i] != Index[i])
+        {
+          Match = false;
+          break;
+        }
       }
-      return;
+      if (Match)
+      { return Slot; }
+      Slot = (Slot + 1) & Mask;
     }
+    return Slot;
+  }
 
-    //else it belongs to the right child
-    if (this->RightChild)
-    {
-      this->RightChild->AddPoint(Index);
-    }
-    else
+  void Allocate(vtkIdType NewCapacity)
+  {
+    int* OldKeys = this->Keys;
+    vtkIdType* OldValues = this->Values;
+    vtkIdType OldCapacity = this->Capacity;
+
+    this->Capacity = NewCapacity;
+    this->Keys = new int[NewCapacity * this->N];
+    this->Values = new vtkIdType[NewCapacity];
+    memset(this->Values, 0, sizeof(vtkIdType) * NewCapacity);
+
+    //reinsert the occupied bins of the old table
+    for (vtkIdType s = 0; s < OldCapacity; s++)
     {
-      this->RightChild = new vtkImageMultiStatisticsKDNode(this->N, this);
+      if (!OldValues[s])
+      { continue; }
+      vtkIdType Slot = this->Find(OldKeys + s * this->N);
       for (int i = 0; i < this->N; i++)
-      { this->RightChild->Index[i] = Index[i]; }
-      this->RightChild->Value = 1;
+      { this->Keys[Slot * this->N + i] = OldKeys[s * this->N + i]; }
+      this->Values[Slot] = OldValues[s];
     }
 
+    delete [] OldKeys;
+    delete [] OldValues;
   }
 
+  int N;
+  vtkIdType Capacity;
+  vtkIdType Occupied;
+  int* Keys;
+  vtkIdType* Values;
 };
 
-
 //----------------------------------------------------------------------------
-template <class T, class S>
-static void vtkImageMultiStatisticsExecuteWithMask(vtkImageMultiStatistics* self,
-    T* inPtr,
-    vtkImageData* inData,
-    S* maskPtr,
-    vtkImageData* maskData,
-    double* AverageMagnitude,
-    double* MeanSquared,
-    double** Covariance,
-    double** JointEntropy,
-    long int* Count,
-    double* WholeEntropy, int N)
+// Partial statistics gathered by one thread. Moments are kept as running means
+// and co-moments (Welford) rather than raw sums of products, so that partial
+// results can be merged pairwise without catastrophic cancellation.
+class vtkImageMultiStatisticsAccumulator
 {
+public:
+  vtkImageMultiStatisticsAccumulator(int N, int Resolution)
+  {
+    this->N = N;
+    this->Resolution = Resolution;
+    this->Count = 0;
+    this->Minimum = new double[N];
+    this->Maximum = new double[N];
+    this->Mean = new double[N];
+    this->CoMoment = new double[N * N];
+    for (int i = 0; i < N; i++)
+    {
+      this->Minimum[i] = VTK_DOUBLE_MAX;
+      this->Maximum[i] = -VTK_DOUBLE_MAX;
+      this->Mean[i] = 0.0;
+    }
+    memset(this->CoMoment, 0, sizeof(double) * N * N);
 
-  int inIdxX, inIdxY, inIdxZ;
-  vtkIdType inIncX, inIncY, inIncZ;
-  vtkIdType maskIncX, maskIncY, maskIncZ;
-  int inIdxN, inIdxN2;
-  int wholeInExt[6];
-  int wholeMaskExt[6];
-
-  T* curPtr;
-  S* curMaskPtr;
+    this->SingleHistogram = new unsigned int [N * Resolution];
+    memset(this->SingleHistogram, 0, sizeof(unsigned int) * N * Resolution);
+    this->DoubleHistogram = new unsigned int [(N * N - N) * Resolution * Resolution / 2];
+    memset(this->DoubleHistogram, 0, sizeof(unsigned int) * (N * N - N) * Resolution * Resolution / 2);
+    this->JointHistogram = new vtkImageMultiStatisticsJointHistogram(N);
+  }
 
-  vtkImageMultiStatisticsKDNode* MultiHist = new vtkImageMultiStatisticsKDNode(N, 0);
+  ~vtkImageMultiStatisticsAccumulator()
+  {
+    delete [] this->Minimum;
+    delete [] this->Maximum;
+    delete [] this->Mean;
+    delete [] this->CoMoment;
+    delete [] this->SingleHistogram;
+    delete [] this->DoubleHistogram;
+    delete this->JointHistogram;
+  }
 
-  //use the output holders for temporary storage for statistical information
-  double* sum = AverageMagnitude;
-  long double** sum_squared = new long double* [N];
-  for (int i = 0; i < N; i++)
+  // Combine the ranges and moments of another accumulator (Chan et al.)
+  void MergeMoments(const vtkImageMultiStatisticsAccumulator& Other)
   {
-    sum[i] = 0.0;
-    sum_squared[i] = new long double [N];
-    for (int j = 0; j < N; j++)
-    { sum_squared[i][j] = 0.0; }
+    for (int i = 0; i < this->N; i++)
+    {
+      this->Minimum[i] = (Other.Minimum[i] < this->Minimum[i]) ? Other.Minimum[i] : this->Minimum[i];
+      this->Maximum[i] = (Other.Maximum[i] > this->Maximum[i]) ? Other.Maximum[i] : this->Maximum[i];
+    }
+    if (!Other.Count)
+    { return; }
+
+    vtkIdType Total = this->Count + Other.Count;
+    double Weight = (double) Other.Count / (double) Total;
+    double CrossWeight = (double) this->Count * Weight;
+    for (int i = 0; i < this->N; i++)
+    {
+      double Delta_i = Other.Mean[i] - this->Mean[i];
+      for (int j = i; j < this->N; j++)
+      {
+        double Delta_j = Other.Mean[j] - this->Mean[j];
+        this->CoMoment[i * this->N + j] += Other.CoMoment[i * this->N + j] + Delta_i * Delta_j * CrossWeight;
+      }
+    }
+    for (int i = 0; i < this->N; i++)
+    { this->Mean[i] += (Other.Mean[i] - this->Mean[i]) * Weight; }
+    this->Count = Total;
   }
 
-  //Create temporary storage for information theoretic information
-  int* HistIndices = new int[N];
-  int Resolution = self->GetEntropyResolution();
-  double* Maximum = new double[N];
-  double* Minimum = new double[N];
-  for (int i = 0; i < N; i++)
+  void MergeHistograms(const vtkImageMultiStatisticsAccumulator& Other)
   {
-    Minimum[i] = inData->GetPointData()->GetScalars()->GetRange(i)[0];
-    Maximum[i] = inData->GetPointData()->GetScalars()->GetRange(i)[1];
+    vtkIdType NumSingle = this->N * this->Resolution;
+    for (vtkIdType r = 0; r < NumSingle; r++)
+    { this->SingleHistogram[r] += Other.SingleHistogram[r]; }
+    vtkIdType NumDouble = (vtkIdType)(this->N * this->N - this->N) * this->Resolution * this->Resolution / 2;
+    for (vtkIdType r = 0; r < NumDouble; r++)
+    { this->DoubleHistogram[r] += Other.DoubleHistogram[r]; }
+    this->JointHistogram->Merge(*Other.JointHistogram);
   }
-  unsigned int* DoubleHistogram = new unsigned int [(N * N - N) * Resolution * Resolution / 2];
-  memset(DoubleHistogram, 0, sizeof(unsigned int) * (N * N - N) * Resolution * Resolution / 2);
-  unsigned int* SingleHistogram = new unsigned int [N * Resolution];
-  memset(SingleHistogram, 0, sizeof(unsigned int) * N * Resolution);
 
-  // Get increments to march through data
-  inData->GetExtent(wholeInExt);
-  maskData->GetExtent(wholeMaskExt);
-  inData->GetContinuousIncrements(wholeInExt, inIncX, inIncY, inIncZ);
-  maskData->GetContinuousIncrements(wholeMaskExt, maskIncX, maskIncY, maskIncZ);
+  int N;
+  int Resolution;
+  vtkIdType Count;
+  double* Minimum;
+  double* Maximum;
+  double* Mean;
+  double* CoMoment;
+  unsigned int* SingleHistogram;
+  unsigned int* DoubleHistogram;
+  vtkImageMultiStatisticsJointHistogram* JointHistogram;
+
+private:
+  vtkImageMultiStatisticsAccumulator(const vtkImageMultiStatisticsAccumulator&); //not implemented
+  void operator=(const vtkImageMultiStatisticsAccumulator&); //not implemented
+};
 
-  *Count = 0;
+namespace
+{
+  struct vtkImageMultiStatisticsThreadStruct
+  {
+    vtkImageMultiStatistics* Filter;
+    vtkImageData* InData;
+    vtkImageData* MaskData;
+    const double* Minimum;
+    const double* Scale;
+    vtkImageMultiStatisticsAccumulator** Accumulators;
+  };
+}
 
-  // Loop through input dataset once to gather stats
-  curPtr = inPtr;
-  curMaskPtr = maskPtr;
-  for (inIdxZ = wholeInExt[4]; inIdxZ <= wholeInExt[5]; inIdxZ++)
+//----------------------------------------------------------------------------
+static void vtkImageMultiStatisticsGetSlices(const int* Extent, int threadId, int threadCount,
+    int& FirstSlice, int& LastSlice)
+{
+  int numSlices = Extent[5] - Extent[4] + 1;
+  FirstSlice = Extent[4] + (int)(((vtkTypeInt64) numSlices * threadId) / threadCount);
+  LastSlice = Extent[4] + (int)(((vtkTypeInt64) numSlices * (threadId + 1)) / threadCount);
+}
+
+// Description:
+// First pass: the range of every component over the whole volume, used for
+// binning, and the moments over the voxels selected by the mask.
+template <class T, class S>
+VTK_THREAD_RETURN_TYPE vtkImageMultiStatisticsMomentsExecute(void* arg)
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo*>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo*>(arg)->NumberOfThreads;
+  vtkImageMultiStatisticsThreadStruct* str = static_cast<vtkImageMultiStatisticsThreadStruct*>
+      (static_cast<vtkMultiThreader::ThreadInfo*>(arg)->UserData);
+
+  vtkImageMultiStatisticsAccumulator* Acc = str->Accumulators[threadId];
+  int N = Acc->N;
+  int wholeInExt[6];
+  int firstSlice, lastSlice;
+  str->InData->GetExtent(wholeInExt);
+  vtkImageMultiStatisticsGetSlices(wholeInExt, threadId, threadCount, firstSlice, lastSlice);
+
+  double* Delta = new double[N];
+  for (int inIdxZ = firstSlice; inIdxZ < lastSlice; inIdxZ++)
   {
-    for (inIdxY = wholeInExt[2]; !self->AbortExecute && inIdxY <= wholeInExt[3]; inIdxY++)
+    for (int inIdxY = wholeInExt[2]; !str->Filter->AbortExecute && inIdxY <= wholeInExt[3]; inIdxY++)
     {
-      for (inIdxX = wholeInExt[0]; inIdxX <= wholeInExt[1]; inIdxX++)
+      T* curPtr = (T*) str->InData->GetScalarPointer(wholeInExt[0], inIdxY, inIdxZ);
+      S* curMaskPtr = str->MaskData ? (S*) str->MaskData->GetScalarPointer(wholeInExt[0], inIdxY, inIdxZ) : 0;
+      for (int inIdxX = wholeInExt[0]; inIdxX <= wholeInExt[1]; inIdxX++, curPtr += N)
       {
-
-        //only process if we are in the non-zero part of the mask
-        if ((double) *curMaskPtr != 0.0)
+        for (int inIdxN = 0; inIdxN < N; inIdxN++)
         {
-
-          //calculate the histogram indices and add point to histogram
-          for (inIdxN = 0; inIdxN < N; inIdxN++)
-          {
-            int histIdx = (int)((double) Resolution * ((double) curPtr[inIdxN] - Minimum[inIdxN]) / (Maximum[inIdxN] - Minimum[inIdxN]));
-            if (Maximum[inIdxN] <= Minimum[inIdxN]) { histIdx = 0; }
-            if (histIdx >= Resolution)
-            { histIdx = Resolution - 1; }
-            HistIndices[inIdxN] = histIdx;
-          }
-          MultiHist->AddPoint(HistIndices);
-
-          int DimCount = 0;
-          for (inIdxN = 0; inIdxN < N; inIdxN++)
-          {
-
-            //do univariate
-            sum[inIdxN] += curPtr[inIdxN];
-            sum_squared[inIdxN][inIdxN] += curPtr[inIdxN] * curPtr[inIdxN];
-            SingleHistogram[inIdxN * Resolution + HistIndices[inIdxN]]++;
-
-            //do bivariate
-            for (inIdxN2 = inIdxN + 1; inIdxN2 < N; inIdxN2++)
-            {
-              sum_squared[inIdxN][inIdxN2] += curPtr[inIdxN] * curPtr[inIdxN2];
-              sum_squared[inIdxN2][inIdxN]  += curPtr[inIdxN] * curPtr[inIdxN2];
-              DoubleHistogram[DimCount * Resolution * Resolution + HistIndices[inIdxN]*Resolution + HistIndices[inIdxN2]]++;
-              DimCount++;
-            }
-          }
-          (*Count)++;
+          double Value = (double) curPtr[inIdxN];
+          Acc->Minimum[inIdxN] = (Value < Acc->Minimum[inIdxN]) ? Value : Acc->Minimum[inIdxN];
+          Acc->Maximum[inIdxN] = (Value > Acc->Maximum[inIdxN]) ? Value : Acc->Maximum[inIdxN];
         }
 
+        //only accumulate moments if we are in the non-zero part of the mask
+        if (curMaskPtr && (double) * (curMaskPtr++) == 0.0)
+        { continue; }
 
-        curPtr += N;
-        curMaskPtr++;
+        Acc->Count++;
+        double InvCount = 1.0 / (double) Acc->Count;
+        for (int inIdxN = 0; inIdxN < N; inIdxN++)
+        {
+          Delta[inIdxN] = (double) curPtr[inIdxN] - Acc->Mean[inIdxN];
+          Acc->Mean[inIdxN] += Delta[inIdxN] * InvCount;
+        }
+        for (int inIdxN = 0; inIdxN < N; inIdxN++)
+        {
+          double* CoMoment = Acc->CoMoment + inIdxN * N;
+          for (int inIdxN2 = inIdxN; inIdxN2 < N; inIdxN2++)
+          { CoMoment[inIdxN2] += Delta[inIdxN] * ((double) curPtr[inIdxN2] - Acc->Mean[inIdxN2]); }
+        }
       }
-      curPtr += inIncY;
-      curMaskPtr += maskIncY;
     }
-    curPtr += inIncZ;
-    curMaskPtr += maskIncZ;
   }
+  delete [] Delta;
 
-  //compute the means
-  for (int i = 0; i < N; i++)
-  {
-    double SafeSum = sum[i];
-    AverageMagnitude[i] = SafeSum / (double) * Count;
-    MeanSquared[i] = sum_squared[i][i] / (double) * Count;
-  }
+  return VTK_THREAD_RETURN_VALUE;
+}
 
-  //compute the covariances
-  for (int i = 0; i < N; i++)
-  {
-    for (int j = 0; j < N; j++)
-    {
-      Covariance[i][j] = (sum_squared[i][j] / (long double) * Count) - AverageMagnitude[i] * AverageMagnitude[j];
-    }
-  }
+// Description:
+// Second pass: the single, pairwise and joint histograms over the voxels
+// selected by the mask, using the bin scale factors found from the range.
+template <class T, class S>
+VTK_THREAD_RETURN_TYPE vtkImageMultiStatisticsHistogramsExecute(void* arg)
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo*>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo*>(arg)->NumberOfThreads;
+  vtkImageMultiStatisticsThreadStruct* str = static_cast<vtkImageMultiStatisticsThreadStruct*>
+      (static_cast<vtkMultiThreader::ThreadInfo*>(arg)->UserData);
+
+  vtkImageMultiStatisticsAccumulator* Acc = str->Accumulators[threadId];
+  int N = Acc->N;
+  int Resolution = Acc->Resolution;
+  int wholeInExt[6];
+  int firstSlice, lastSlice;
+  str->InData->GetExtent(wholeInExt);
+  vtkImageMultiStatisticsGetSlices(wholeInExt, threadId, threadCount, firstSlice, lastSlice);
 
-  //compute the entropies
-  int DimCount = 0;
-  for (int i = 0; i < N; i++)
+  int* HistIndices = new int[N];
+  for (int inIdxZ = firstSlice; inIdxZ < lastSlice; inIdxZ++)
   {
-
-    //compute single entropy
-    JointEntropy[i][i] = 0.0;
-    for (int r = 0; r < Resolution; r++)
-    {
-      if (SingleHistogram[i * Resolution + r])
-        JointEntropy[i][i] -= ((double) SingleHistogram[i * Resolution + r] / (double) * Count)
-                              * log((double) SingleHistogram[i * Resolution + r] / (double) * Count) / log(2.0);
-    }
-
-    for (int j = i + 1; j < N; j++)
+    for (int inIdxY = wholeInExt[2]; !str->Filter->AbortExecute && inIdxY <= wholeInExt[3]; inIdxY++)
     {
-      int totCount = 0;
-      JointEntropy[i][j] = 0.0;
-      for (int r = 0; r < Resolution * Resolution; r++)
+      T* curPtr = (T*) str->InData->GetScalarPointer(wholeInExt[0], inIdxY, inIdxZ);
+      S* curMaskPtr = str->MaskData ? (S*) str->MaskData->GetScalarPointer(wholeInExt[0], inIdxY, inIdxZ) : 0;
+      for (int inIdxX = wholeInExt[0]; inIdxX <= wholeInExt[1]; inIdxX++, curPtr += N)
       {
-        if (DoubleHistogram[DimCount * Resolution * Resolution + r])
+        if (curMaskPtr && (double) * (curMaskPtr++) == 0.0)
+        { continue; }
+
+        //calculate the histogram indices and add point to histograms
+        for (int inIdxN = 0; inIdxN < N; inIdxN++)
         {
-          JointEntropy[i][j] -= ((double) DoubleHistogram[DimCount * Resolution * Resolution + r] / (double) * Count)
-                                * log((double) DoubleHistogram[DimCount * Resolution * Resolution + r] / (double) * Count) / log(2.0);
-          totCount += DoubleHistogram[DimCount * Resolution * Resolution + r];
+          int histIdx = (int)(((double) curPtr[inIdxN] - str->Minimum[inIdxN]) * str->Scale[inIdxN]);
+          HistIndices[inIdxN] = (histIdx >= Resolution) ? Resolution - 1 : histIdx;
+          Acc->SingleHistogram[inIdxN * Resolution + HistIndices[inIdxN]]++;
         }
+        unsigned int* DoubleHistogram = Acc->DoubleHistogram;
+        for (int inIdxN = 0; inIdxN < N; inIdxN++)
+        {
+          for (int inIdxN2 = inIdxN + 1; inIdxN2 < N; inIdxN2++)
+          {
+            DoubleHistogram[HistIndices[inIdxN] * Resolution + HistIndices[inIdxN2]]++;
+            DoubleHistogram += Resolution * Resolution;
+          }
+        }
+        Acc->JointHistogram->AddPoint(HistIndices);
       }
-      JointEntropy[j][i] = JointEntropy[i][j];
-      DimCount++;
     }
   }
-  *WholeEntropy = MultiHist->GetEntropy(*Count);
-
-  //release storage
-  delete [] Maximum;
-  delete [] Minimum;
-  delete [] SingleHistogram;
-  delete [] DoubleHistogram;
   delete [] HistIndices;
-  for (int i = 0; i < N; i++)
-  { delete [] sum_squared[i]; }
-  delete [] sum_squared;
-
-  //asynchronously delete the huge histogram somehow... //TODO
-  delete MultiHist;
 
+  return VTK_THREAD_RETURN_VALUE;
 }
 
-template <class T>
-static void vtkImageMultiStatisticsExecuteWithMaskStart(vtkImageMultiStatistics* self,
-    T* inPtr,
-    vtkImageData* inData,
-    vtkImageData* maskData,
-    double* AverageMagnitude,
-    double* MeanSquared,
-    double** Covariance,
-    double** JointEntropy,
-    long int* Count,
-    double* WholeEntropy, int N)
+//----------------------------------------------------------------------------
+static double vtkImageMultiStatisticsGetHistogramEntropy(const unsigned int* Histogram, vtkIdType NumBins, long int Count)
 {
-  void* maskPtr = maskData->GetScalarPointerForExtent(maskData->GetExtent());
-
-  switch (maskData->GetScalarType())
+  double Entropy = 0.0;
+  for (vtkIdType r = 0; r < NumBins; r++)
   {
-    vtkTemplateMacro(vtkImageMultiStatisticsExecuteWithMask(
-                       self, inPtr, inData,
-                       (VTK_TT*) maskPtr, maskData,
-                       AverageMagnitude, MeanSquared, Covariance, JointEntropy,
-                       Count, WholeEntropy, N));
-  default:
-    vtkErrorWithObjectMacro(self, << "Update: Unknown ScalarType");
-    return;
+    if (Histogram[r])
+    { Entropy -= ((double) Histogram[r] / (double) Count) * log((double) Histogram[r] / (double) Count) / log(2.0); }
   }
+  return Entropy;
 }
 
-
-template <class T>
-static void vtkImageMultiStatisticsExecuteWithoutMask(vtkImageMultiStatistics* self,
-    T* inPtr,
+// Description:
+// Gather all the statistics with two threaded passes over the input, each
+// thread filling its own accumulator, followed by a pairwise reduction of the
+// accumulators. The pointer arguments only select the scalar types; a null
+// mask selects every voxel.
+template <class T, class S>
+static void vtkImageMultiStatisticsExecute(vtkImageMultiStatistics* self,
+    vtkMultiThreader* threader,
+    T* vtkNotUsed(inPtr),
     vtkImageData* inData,
+    S* vtkNotUsed(maskPtr),
+    vtkImageData* maskData,
     double* AverageMagnitude,
     double* MeanSquared,
     double** Covariance,
@@ -586,150 +657,108 @@ static void vtkImageMultiStatisticsExecuteWithoutMask(vtkImageMultiStatistics* s
     long int* Count,
     double* WholeEntropy, int N)
 {
-  int inIdxX, inIdxY, inIdxZ;
-  vtkIdType inIncX, inIncY, inIncZ;
-  int inIdxN, inIdxN2;
-  int wholeInExt[6];
-  T* curPtr;
-
-  vtkImageMultiStatisticsKDNode* MultiHist = new vtkImageMultiStatisticsKDNode(N, 0);
-
-  //use the output holders for temporary storage for statistical information
-  double* sum = AverageMagnitude;
-  long double** sum_squared = new long double* [N];
-  for (int i = 0; i < N; i++)
-  {
-    sum[i] = 0.0;
-    sum_squared[i] = new long double [N];
-    for (int j = 0; j < N; j++)
-    { sum_squared[i][j] = 0.0; }
-  }
-
-  //Create temporary storage for information theoretic information
-  int* HistIndices = new int[N];
   int Resolution = self->GetEntropyResolution();
-  double* Maximum = new double[N];
-  double* Minimum = new double[N];
+  int numThreads = self->GetNumberOfThreads();
+  vtkImageMultiStatisticsAccumulator** Accumulators = new vtkImageMultiStatisticsAccumulator*[numThreads];
+  for (int t = 0; t < numThreads; t++)
+  { Accumulators[t] = new vtkImageMultiStatisticsAccumulator(N, Resolution); }
+
+  vtkImageMultiStatisticsThreadStruct str;
+  str.Filter = self;
+  str.InData = inData;
+  str.MaskData = maskData;
+  str.Accumulators = Accumulators;
+  threader->SetNumberOfThreads(numThreads);
+
+  //gather the ranges and moments, then reduce them pairwise
+  threader->SetSingleMethod(vtkImageMultiStatisticsMomentsExecute<T, S>, &str);
+  threader->SingleMethodExecute();
+  for (int stride = 1; stride < numThreads; stride *= 2)
+    for (int t = 0; t + stride < numThreads; t += 2 * stride)
+    { Accumulators[t]->MergeMoments(*Accumulators[t + stride]); }
+
+  //precompute the bin scale factors from the range
+  double* Minimum = Accumulators[0]->Minimum;
+  double* Scale = new double[N];
   for (int i = 0; i < N; i++)
   {
-    Minimum[i] = inData->GetPointData()->GetScalars()->GetRange(i)[0];
-    Maximum[i] = inData->GetPointData()->GetScalars()->GetRange(i)[1];
+    double Maximum = Accumulators[0]->Maximum[i];
+    Scale[i] = (Maximum > Minimum[i]) ? (double) Resolution / (Maximum - Minimum[i]) : 0.0;
   }
-  unsigned int* DoubleHistogram = new unsigned int [(N * N - N) * Resolution * Resolution / 2];
-  memset(DoubleHistogram, 0, sizeof(unsigned int) * (N * N - N) * Resolution * Resolution / 2);
-  unsigned int* SingleHistogram = new unsigned int [N * Resolution];
-  memset(SingleHistogram, 0, sizeof(unsigned int) * N * Resolution);
+  self->UpdateProgress(0.5);
 
-  // Get increments to march through data
-  inData->GetExtent(wholeInExt);
-  inData->GetContinuousIncrements(wholeInExt, inIncX, inIncY, inIncZ);
-  *Count = 0;
+  //gather the histograms, then reduce them pairwise
+  str.Minimum = Minimum;
+  str.Scale = Scale;
+  threader->SetSingleMethod(vtkImageMultiStatisticsHistogramsExecute<T, S>, &str);
+  threader->SingleMethodExecute();
+  for (int stride = 1; stride < numThreads; stride *= 2)
+    for (int t = 0; t + stride < numThreads; t += 2 * stride)
+    { Accumulators[t]->MergeHistograms(*Accumulators[t + stride]); }
 
-  // Loop through input dataset once to gather stats
-  curPtr = inPtr;
-  for (inIdxZ = wholeInExt[4]; inIdxZ <= wholeInExt[5]; inIdxZ++)
-  {
-    for (inIdxY = wholeInExt[2]; !self->AbortExecute && inIdxY <= wholeInExt[3]; inIdxY++)
-    {
-      for (inIdxX = wholeInExt[0]; inIdxX <= wholeInExt[1]; inIdxX++)
-      {
-
-        //calculate the histogram indices and add point to histogram
-        for (inIdxN = 0; inIdxN < N; inIdxN++)
-        {
-          int histIdx = (int)((double) Resolution * ((double) curPtr[inIdxN] - Minimum[inIdxN]) / (Maximum[inIdxN] - Minimum[inIdxN]));
-          if (Maximum[inIdxN] == Minimum[inIdxN]) { histIdx = 0; }
-          if (histIdx >= Resolution)
-          { histIdx = Resolution - 1; }
-          HistIndices[inIdxN] = histIdx;
-        }
-        MultiHist->AddPoint(HistIndices);
-
-        int DimCount = 0;
-        for (inIdxN = 0; inIdxN < N; inIdxN++)
-        {
-
-          //do univariate
-          sum[inIdxN] += curPtr[inIdxN];
-          sum_squared[inIdxN][inIdxN] += curPtr[inIdxN] * curPtr[inIdxN];
-          SingleHistogram[inIdxN * Resolution + HistIndices[inIdxN]]++;
+  vtkImageMultiStatisticsAccumulator* Acc = Accumulators[0];
+  *Count = (long int) Acc->Count;
+  double InvCount = Acc->Count ? 1.0 / (double) Acc->Count : 0.0;
 
-          //do bivariate
-          for (inIdxN2 = inIdxN + 1; inIdxN2 < N; inIdxN2++)
-          {
-            sum_squared[inIdxN][inIdxN2] += curPtr[inIdxN] * curPtr[inIdxN2];
-            sum_squared[inIdxN2][inIdxN]  += curPtr[inIdxN] * curPtr[inIdxN2];
-            DoubleHistogram[DimCount * Resolution * Resolution + HistIndices[inIdxN]*Resolution + HistIndices[inIdxN2]]++;
-            DimCount++;
-          }
-        }
-        (*Count)++;
-        curPtr += N;
-      }
-      curPtr += inIncY;
-    }
-    curPtr += inIncZ;
-  }
-
-  //compute the means
+  //compute the means and covariances
   for (int i = 0; i < N; i++)
   {
-    double SafeSum = sum[i];
-    AverageMagnitude[i] = SafeSum / (double) * Count;
-    MeanSquared[i] = sum_squared[i][i] / (double) * Count;
+    AverageMagnitude[i] = Acc->Mean[i];
+    for (int j = i; j < N; j++)
+    {
+      Covariance[i][j] = Acc->CoMoment[i * N + j] * InvCount;
+      Covariance[j][i] = Covariance[i][j];
+    }
+    MeanSquared[i] = Covariance[i][i] + Acc->Mean[i] * Acc->Mean[i];
   }
 
-  //compute the covariances
-  for (int i = 0; i < N; i++)
-    for (int j = 0; j < N; j++)
-    { Covariance[i][j] = (sum_squared[i][j] / (long double) * Count) - AverageMagnitude[i] * AverageMagnitude[j]; }
-
   //compute the entropies
-  int DimCount = 0;
+  const unsigned int* DoubleHistogram = Acc->DoubleHistogram;
   for (int i = 0; i < N; i++)
   {
-
-    //compute single entropy
-    JointEntropy[i][i] = 0.0;
-    for (int r = 0; r < Resolution; r++)
-    {
-      if (SingleHistogram[i * Resolution + r])
-        JointEntropy[i][i] -= ((double) SingleHistogram[i * Resolution + r] / (double) * Count)
-                              * log((double) SingleHistogram[i * Resolution + r] / (double) * Count) / log(2.0);
-    }
-
+    JointEntropy[i][i] = vtkImageMultiStatisticsGetHistogramEntropy(Acc->SingleHistogram + i * Resolution,
+                         Resolution, *Count);
     for (int j = i + 1; j < N; j++)
     {
-      int totCount = 0;
-      JointEntropy[i][j] = 0.0;
-      for (int r = 0; r < Resolution * Resolution; r++)
-      {
-        if (DoubleHistogram[DimCount * Resolution * Resolution + r])
-        {
-          JointEntropy[i][j] -= ((double) DoubleHistogram[DimCount * Resolution * Resolution + r] / (double) * Count)
-                                * log((double) DoubleHistogram[DimCount * Resolution * Resolution + r] / (double) * Count) / log(2.0);
-          totCount += DoubleHistogram[DimCount * Resolution * Resolution + r];
-        }
-      }
+      JointEntropy[i][j] = vtkImageMultiStatisticsGetHistogramEntropy(DoubleHistogram,
+                           (vtkIdType) Resolution * Resolution, *Count);
       JointEntropy[j][i] = JointEntropy[i][j];
-      DimCount++;
+      DoubleHistogram += Resolution * Resolution;
     }
   }
-  *WholeEntropy = MultiHist->GetEntropy(*Count);
+  *WholeEntropy = (double) Acc->JointHistogram->GetEntropy(*Count);
 
   //release storage
-  delete [] Maximum;
-  delete [] Minimum;
-  delete [] SingleHistogram;
-  delete [] DoubleHistogram;
-  delete [] HistIndices;
-  for (int i = 0; i < N; i++)
-  { delete [] sum_squared[i]; }
-  delete [] sum_squared;
-
-  //asynchronously delete the huge histogram somehow... //TODO
-  delete MultiHist;
+  delete [] Scale;
+  for (int t = 0; t < numThreads; t++)
+  { delete Accumulators[t]; }
+  delete [] Accumulators;
+}
 
+template <class T>
+static void vtkImageMultiStatisticsExecuteWithMaskStart(vtkImageMultiStatistics* self,
+    vtkMultiThreader* threader,
+    T* inPtr,
+    vtkImageData* inData,
+    vtkImageData* maskData,
+    double* AverageMagnitude,
+    double* MeanSquared,
+    double** Covariance,
+    double** JointEntropy,
+    long int* Count,
+    double* WholeEntropy, int N)
+{
+  switch (maskData->GetScalarType())
+  {
+    vtkTemplateMacro(vtkImageMultiStatisticsExecute(
+                       self, threader, inPtr, inData,
+                       (VTK_TT*) 0, maskData,
+                       AverageMagnitude, MeanSquared, Covariance, JointEntropy,
+                       Count, WholeEntropy, N));
+  default:
+    vtkErrorWithObjectMacro(self, << "Update: Unknown ScalarType");
+    return;
+  }
 }
 
 // Description:
@@ -748,9 +777,9 @@ void vtkImageMultiStatistics::Update()
     vtkErrorMacro("No input...can't execute!");
     return;
   }
-  this->Update();
+  this->Superclass::Update();
   this->UpdateInformation();
-  this->GetOutputInformation(0)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeInExt);
+  this->GetInputInformation(0, 0)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeInExt);
   inPtr = input->GetScalarPointerForExtent(wholeInExt);
 
   // get the number of input components
@@ -768,7 +797,7 @@ void vtkImageMultiStatistics::Update()
   {
     int MaskExtent[6];
     this->UpdateInformation();
-    this->GetOutputInformation(1)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), MaskExtent);
+    this->GetInputInformation(0, 1)->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), MaskExtent);
 
     if (MaskExtent[0] != wholeInExt[0] || MaskExtent[1] != wholeInExt[1] || MaskExtent[2] != wholeInExt[2] ||
         MaskExtent[3] != wholeInExt[3] || MaskExtent[4] != wholeInExt[4] || MaskExtent[5] != wholeInExt[5])
@@ -855,12 +884,13 @@ void vtkImageMultiStatistics::Update()
     this->AbortExecute = 0;
     this->Progress = 0.0;
 
-    //if there is no mask, run the regular version
+    //if there is no mask, select every voxel
     if (!mask)
       switch (input->GetScalarType())
       {
-        vtkTemplateMacro(vtkImageMultiStatisticsExecuteWithoutMask(
-                           this, (VTK_TT*)(inPtr), input,
+        vtkTemplateMacro(vtkImageMultiStatisticsExecute(
+                           this, this->Threader, (VTK_TT*)(inPtr), input,
+                           (unsigned char*) 0, (vtkImageData*) 0,
                            this->AverageMagnitude, this->MeanSquared,
                            this->Covariance,
                            this->JointEntropy,
@@ -873,7 +903,7 @@ void vtkImageMultiStatistics::Update()
       switch (input->GetScalarType())
       {
         vtkTemplateMacro(vtkImageMultiStatisticsExecuteWithMaskStart(
-                           this, (VTK_TT*)(inPtr), input, mask,
+                           this, this->Threader, (VTK_TT*)(inPtr), input, mask,
                            this->AverageMagnitude,  this->MeanSquared,
                            this->Covariance,
                            this->JointEntropy,
@@ -918,6 +948,7 @@ void vtkImageMultiStatistics::PrintSelf(ostream& os, vtkIndent indent)
   }
 
   os << indent << "Components: " << this->NumberOfComponents << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
   os << indent << "Count: " << this->Count << "\n";
   for (int i = 0; i < this->NumberOfComponents; i++)
   { os << indent << "AverageMagnitude (" << i << "): " << this->AverageMagnitude[i] << "\n"; }
@@ -20,6 +20,8 @@
 #include "vtkImageData.h"
 #include "vtkInformation.h"
 
+class vtkMultiThreader;
+
 class vtkRobartsCommonExport vtkImageMultiStatistics : public vtkAlgorithm
 {
 public:
@@ -73,6 +75,11 @@ public:
   void SetEntropyResolution(int bins);
   int GetEntropyResolution();
 
+  // Description:
+  // Get/Set the number of threads used to gather the statistics
+  vtkSetClampMacro(NumberOfThreads, int, 1, VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads, int);
+
   void Update();
 
   void SetInputData(int port, vtkImageData* input);
@@ -111,6 +118,9 @@ protected:
 
   bool UseMask;
 
+  vtkMultiThreader* Threader;
+  int NumberOfThreads;
+
   vtkTimeStamp ExecuteTime;
 
 private:
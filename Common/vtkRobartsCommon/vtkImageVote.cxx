@@ -32,6 +32,7 @@
 #include "vtkTreeDFSIterator.h"
 #include "vtkTrivialProducer.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <math.h>
 #include <float.h>
@@ -54,10 +55,6 @@ vtkImageVote::vtkImageVote()
   this->FirstUnusedPort = 0;
 
   this->OutputDataType = VTK_SHORT;
-  this->SetNumberOfThreads(1);
-
-  this->Lock = vtkBarrierLock::New();
-  this->Lock->SetRepeatable(true);
 
 }
 
@@ -65,6 +62,7 @@ vtkImageVote::~vtkImageVote()
 {
   this->InputPortMapping.clear();
   this->BackwardsInputPortMapping.clear();
+  this->PortLabelTable.clear();
 }
 
 //------------------------------------------------------------
@@ -151,6 +149,7 @@ int vtkImageVote::CheckInputConsistancy( vtkInformationVector** inputVector, int
   *DataType = -1;
   Extent[0] = -1;
   *NumComponents = -1;
+  *NumLabels = (int) this->InputPortMapping.size();
 
   //make sure that every image is the correct size and same datatype
   for(unsigned int inputPortNumber = 0; inputPortNumber < this->InputPortMapping.size(); inputPortNumber++)
@@ -227,6 +226,11 @@ int vtkImageVote::RequestInformation(
     return -1;
   }
 
+  //the output is a single label map the size of the inputs
+  vtkInformation *outputInfo = outputVector->GetInformationObject(0);
+  outputInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),Extent,6);
+  vtkDataObject::SetPointDataActiveScalarInfo(outputInfo, this->OutputDataType, 1);
+
   return 1;
 }
 
@@ -246,64 +250,145 @@ int vtkImageVote::RequestUpdateExtent(
     return -1;
   }
 
-  //set up the extents
+  //each input only needs to cover the requested part of the output
+  int updateExtent[6];
   vtkInformation *outputInfo = outputVector->GetInformationObject(0);
-  vtkImageData *outputBuffer = vtkImageData::SafeDownCast(outputInfo->Get(vtkDataObject::DATA_OBJECT()));
-  outputInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(),Extent,6);
-  outputInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),Extent,6);
+  outputInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),updateExtent);
+  for(int inputPortNumber = 0; inputPortNumber < NumLabels; inputPortNumber++)
+  {
+    vtkInformation *inputInfo = inputVector[0]->GetInformationObject(inputPortNumber);
+    inputInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),updateExtent,6);
+  }
 
   return 1;
 }
 
-
-template<class T>
-void vtkImageVoteExecute(vtkImageVote *self,
-                         vtkImageData **inData,
-                         vtkImageData *outData,
-                         int* outExt, T* unUsed, int threadId )
+int vtkImageVote::RequestData(
+  vtkInformation* request,
+  vtkInformationVector** inputVector,
+  vtkInformationVector* outputVector)
 {
-
-  T** inPtr = new T* [self->GetNumberOfInputConnections(0)];
-  for(int i = 0; i < self->GetNumberOfInputConnections(0); i++ )
+  //check input for consistency
+  int Extent[6];
+  int NumLabels;
+  int DataType;
+  int NumComponents;
+  int result = CheckInputConsistancy( inputVector, Extent, &NumLabels, &DataType, &NumComponents );
+  if( result || NumLabels == 0 )
   {
-    inPtr[i] = (T*) inData[i]->GetScalarPointer();
+    return -1;
+  }
+  if( NumComponents != 1 )
+  {
+    vtkErrorMacro("Inputs can only have one component.");
+    return -1;
   }
 
-  void* outPtr = outData->GetScalarPointer();
-
-  switch (outData->GetScalarType())
+  //gather the label of each port before the threads need it
+  this->PortLabelTable.assign(NumLabels, 0);
+  for(int inputPortNumber = 0; inputPortNumber < NumLabels; inputPortNumber++)
   {
-    vtkTemplateMacro(vtkImageVoteExecute(self, inData, inPtr, outData, static_cast<VTK_TT *>(outPtr), outExt, threadId ));
-  default:
-    vtkGenericWarningMacro("Execute: Unknown output ScalarType");
-    return;
+    this->PortLabelTable[inputPortNumber] = this->GetMappedTerm<vtkIdType>(inputPortNumber);
   }
 
-  delete[] inPtr;
+  //the superclass allocates the output and splits it among the threads
+  return this->Superclass::RequestData(request, inputVector, outputVector);
 }
 
+//----------------------------------------------------------------------------
+// Find the label of the largest input for each voxel of the extent. Each row is
+// processed one input at a time, keeping a running maximum and its port in row
+// buffers. The port is selected with a mask rather than a branch so that the
+// compiler can turn the row into vector compares and selects. Ties go to the
+// input on the lowest port.
 template <class IT, class OT>
 void vtkImageVoteExecute(vtkImageVote *self,
-                         vtkImageData **inData, IT **inPtr,
+                         vtkImageData **inData, IT **inPtr, int numInputs,
                          vtkImageData *outData, OT *outPtr,
-                         int* outExt, int threadId )
+                         int* outExt, const vtkIdType *portLabels )
 {
+  int rowLength = outExt[1] - outExt[0] + 1;
+  vtkIdType incX, incY, incZ;
 
-  int NumThreads = self->GetNumberOfThreads();
-  int VolumeSize = (outExt[1]-outExt[0]+1)*(outExt[3]-outExt[2]+1)*(outExt[5]-outExt[4]+1);
-  for(int idx = threadId*VolumeSize/NumThreads; idx < (threadId+1)*VolumeSize/NumThreads; idx++)
+  std::vector<vtkIdType> inIncY(numInputs), inIncZ(numInputs);
+  for(int iv = 0; iv < numInputs; iv++ )
   {
-    OT maxIdentifier = -1;
-    IT maxValue = 0;
-    for( int iv = 0; iv < self->GetNumberOfInputConnections(0); iv++ )
-      if( inPtr[iv] && (maxIdentifier == -1 || inPtr[iv][idx] > maxValue ) )
+    inData[iv]->GetContinuousIncrements(outExt, incX, incY, incZ);
+    inIncY[iv] = incY;
+    inIncZ[iv] = incZ;
+  }
+  vtkIdType outIncY, outIncZ;
+  outData->GetContinuousIncrements(outExt, incX, outIncY, outIncZ);
+
+  //labels in the output type
+  std::vector<OT> labels(numInputs);
+  for(int iv = 0; iv < numInputs; iv++ )
+  {
+    labels[iv] = (OT) portLabels[iv];
+  }
+
+  std::vector<IT> maxValue(rowLength);
+  std::vector<int> maxPort(rowLength);
+  IT* maxValueRow = &(maxValue[0]);
+  int* maxPortRow = &(maxPort[0]);
+
+  for (int idxZ = outExt[4]; idxZ <= outExt[5]; idxZ++)
+  {
+    for (int idxY = outExt[2]; idxY <= outExt[3]; idxY++)
+    {
+      std::copy(inPtr[0], inPtr[0] + rowLength, maxValueRow);
+      std::fill(maxPortRow, maxPortRow + rowLength, 0);
+      inPtr[0] += rowLength + inIncY[0];
+
+      for( int iv = 1; iv < numInputs; iv++ )
+      {
+        const IT* inRow = inPtr[iv];
+        for(int idxX = 0; idxX < rowLength; idxX++)
+        {
+          IT value = inRow[idxX];
+          IT currentMax = maxValueRow[idxX];
+          int larger = -(int)(value > currentMax);
+          maxPortRow[idxX] = (iv & larger) | (maxPortRow[idxX] & ~larger);
+          maxValueRow[idxX] = (value > currentMax) ? value : currentMax;
+        }
+        inPtr[iv] += rowLength + inIncY[iv];
+      }
+
+      for(int idxX = 0; idxX < rowLength; idxX++)
       {
-        maxIdentifier = self->GetMappedTerm<OT>(iv);
-        maxValue = inPtr[iv][idx];
+        outPtr[idxX] = labels[maxPortRow[idxX]];
       }
-    outPtr[idx] = (maxIdentifier == -1) ? (OT) 0: maxIdentifier;
+      outPtr += rowLength + outIncY;
+    }
+    for( int iv = 0; iv < numInputs; iv++ )
+    {
+      inPtr[iv] += inIncZ[iv];
+    }
+    outPtr += outIncZ;
   }
+}
 
+template<class T>
+void vtkImageVoteExecute(vtkImageVote *self,
+                         vtkImageData **inData, int numInputs,
+                         vtkImageData *outData,
+                         int* outExt, T* unUsed, const vtkIdType *portLabels )
+{
+  std::vector<T*> inPtr(numInputs);
+  for(int i = 0; i < numInputs; i++ )
+  {
+    inPtr[i] = (T*) inData[i]->GetScalarPointerForExtent(outExt);
+  }
+
+  void* outPtr = outData->GetScalarPointerForExtent(outExt);
+
+  switch (outData->GetScalarType())
+  {
+    vtkTemplateMacro(vtkImageVoteExecute(self, inData, &(inPtr[0]), numInputs, outData, static_cast<VTK_TT *>(outPtr), outExt, portLabels ));
+  default:
+    vtkGenericWarningMacro("Execute: Unknown output ScalarType");
+    return;
+  }
 }
 
 void vtkImageVote::ThreadedRequestData(vtkInformation *request,
@@ -313,34 +398,19 @@ void vtkImageVote::ThreadedRequestData(vtkInformation *request,
                                        vtkImageData **outData,
                                        int extent[6], int threadId)
 {
-
-  //check input for consistency
-  int Extent[6];
-  int NumLabels;
-  int DataType;
-  int NumComponents;
-  int result = CheckInputConsistancy( inputVector, Extent, &NumLabels, &DataType, &NumComponents );
-  if( result || NumLabels == 0 )
+  //inputs have been checked for consistency in RequestData
+  int numInputs = (int) this->PortLabelTable.size();
+  if( numInputs == 0 )
   {
     return;
   }
 
-  //allocate output image (using short)
-  if( threadId == 0 )
-  {
-    (*outData)->SetExtent(Extent);
-    (*outData)->AllocateScalars(this->OutputDataType, NumComponents);
-  }
-
-  this->Lock->Initialize(this->GetNumberOfThreads());
-  this->Lock->Enter();
-
   //call typed method
-  switch (DataType)
+  switch (inData[0][0]->GetScalarType())
   {
-    vtkTemplateMacro(vtkImageVoteExecute(this, *inData, *outData, Extent, static_cast<VTK_TT *>(0), threadId ));
+    vtkTemplateMacro(vtkImageVoteExecute(this, inData[0], numInputs, outData[0], extent, static_cast<VTK_TT *>(0), &(this->PortLabelTable[0]) ));
   default:
     vtkGenericWarningMacro("Execute: Unknown output ScalarType");
     return;
   }
-}
\ No newline at end of file
+}
@@ -35,7 +35,7 @@
 #include "vtkInformationVector.h"
 #include "vtkSetGet.h"
 #include <map>
-#include "vtkBarrierLock.h"
+#include <vector>
 
 #include <limits.h>
 
@@ -73,6 +73,9 @@ public:
   virtual int RequestUpdateExtent( vtkInformation* request,
                                    vtkInformationVector** inputVector,
                                    vtkInformationVector* outputVector);
+  virtual int RequestData( vtkInformation* request,
+                           vtkInformationVector** inputVector,
+                           vtkInformationVector* outputVector);
   virtual int FillInputPortInformation(int i, vtkInformation* info);
 
   template<class T>
@@ -93,7 +96,10 @@ protected:
 
   int OutputDataType;
 
-  vtkBarrierLock* Lock;
+  // Description:
+  // The label given by each input port, gathered once in RequestData so that
+  // the threads do not need to search the mapping.
+  std::vector<vtkIdType> PortLabelTable;
 
 private:
   vtkImageVote operator=(const vtkImageVote&);
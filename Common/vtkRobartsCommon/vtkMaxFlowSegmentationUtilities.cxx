@@ -1,5 +1,7 @@
 #include "vtkMaxFlowSegmentationUtilities.h"
+#include "vtkMultiThreader.h"
 #include <math.h>
+#include <string.h>
 
 //----------------------------------------------------------------------------
 // CPU VERSION OF THE ALGORITHM
@@ -74,6 +76,16 @@ void updateLabel(float* sink, float* inc, float* div, float* label, float CC, in
   //  label[x] = (label[x] < 0.0f) ? 0.0f : label[x];
 }
 
+double updateLabelAndSumChange(float* sink, float* inc, float* div, float* label, float CC, int size){
+  double sum = 0.0;
+  for(int x = 0; x < size; x++){
+    float change = CC*(inc[x] - div[x] - sink[x]);
+    label[x] += change;
+    sum += fabs(change);
+  }
+  return sum;
+}
+
 void dagmf_storeSourceFlowInBuffer(float* working, float* sink, float* div, float* label, float* source, float* exclude, float CC, float multiplicity, int size){
   for(int x = 0; x < size; x++)
     //working[x] += (sink[x] + div[x] -source[x] + multiplicity*exclude[x] - label[x] / CC) * multiplicity;
@@ -210,4 +222,1101 @@ void ghmf_projectOntoSet(float* div, float* flowX, float* flowY, float* flowZ, i
     div[x] -= (x/VX % VY) ? flowY[x-VX] : 0.0f;
   for(int x = 0; x < size; x++)
     div[x] -= (x >= VX*VY) ? flowZ[x-VX*VZ] : 0.0f;
-}
\ No newline at end of file
+}
+
+//----------------------------------------------------------------------------
+// WORKING BUFFER ARENA
+//----------------------------------------------------------------------------
+
+static const vtkTypeInt64 mfArenaAlignment = 64;
+
+vtkTypeInt64 arenaBufferStride(int size){
+  const vtkTypeInt64 floatsPerLine = mfArenaAlignment / (vtkTypeInt64) sizeof(float);
+  return (((vtkTypeInt64) size + floatsPerLine - 1) / floatsPerLine) * floatsPerLine;
+}
+
+float* acquireArena(char** allocation, vtkTypeInt64* capacity, vtkTypeInt64 bytes){
+  if( *allocation == 0 || *capacity < bytes ){
+    releaseArena(allocation, capacity);
+    if( bytes < 0 || (vtkTypeUInt64) bytes > (vtkTypeUInt64) ((size_t) -1) - mfArenaAlignment )
+      return 0;
+    try{
+      *allocation = new char[(size_t) (bytes + mfArenaAlignment)];
+    }catch( ... ){
+      *allocation = 0;
+    }
+    if( *allocation == 0 )
+      return 0;
+    *capacity = bytes;
+  }
+
+  //round up to the next cache line boundary
+  size_t offset = (size_t) (mfArenaAlignment - ((size_t) *allocation) % mfArenaAlignment) % mfArenaAlignment;
+  return (float*) (*allocation + offset);
+}
+
+void releaseArena(char** allocation, vtkTypeInt64* capacity){
+  delete[] *allocation;
+  *allocation = 0;
+  *capacity = 0;
+}
+
+//----------------------------------------------------------------------------
+// MULTITHREADED VERSION OF THE ALGORITHM
+//----------------------------------------------------------------------------
+
+namespace
+{
+
+// Elementwise kernels are split on cache line (16 float) boundaries so that
+// neighbouring threads never write to the same line.
+const int mfElementGranularity = 16;
+
+// Conversions between single precision and the two 16-bit storage formats, rounding
+// to nearest even. Half precision has the wider mantissa, bfloat16 the wider range.
+inline vtkTypeUInt16 floatToHalf(float f){
+  vtkTypeUInt32 x;
+  memcpy(&x, &f, sizeof(x));
+  vtkTypeUInt32 sign = (x >> 16) & 0x8000;
+  vtkTypeUInt32 mant = x & 0x7fffff;
+  int exp = (int) ((x >> 23) & 0xff);
+  if( exp == 0xff )
+    return (vtkTypeUInt16) (sign | 0x7c00 | (mant ? 0x200 : 0));
+  exp += 15 - 127;
+  if( exp >= 31 )
+    return (vtkTypeUInt16) (sign | 0x7c00);
+  if( exp <= 0 ){
+    if( exp < -10 )
+      return (vtkTypeUInt16) sign;
+    mant |= 0x800000;
+    int shift = 14 - exp;
+    vtkTypeUInt32 h = mant >> shift;
+    vtkTypeUInt32 rem = mant & ((1u << shift) - 1);
+    vtkTypeUInt32 halfway = 1u << (shift - 1);
+    if( rem > halfway || (rem == halfway && (h & 1)) )
+      h++;
+    return (vtkTypeUInt16) (sign | h);
+  }
+  vtkTypeUInt32 h = ((vtkTypeUInt32) exp << 10) | (mant >> 13);
+  vtkTypeUInt32 rem = mant & 0x1fff;
+  if( rem > 0x1000 || (rem == 0x1000 && (h & 1)) )
+    h++; //a carry into the exponent rounds up to the next binade or infinity
+  return (vtkTypeUInt16) (sign | h);
+}
+
+inline float halfToFloat(vtkTypeUInt16 h){
+  vtkTypeUInt32 sign = ((vtkTypeUInt32) h & 0x8000) << 16;
+  vtkTypeUInt32 exp = (h >> 10) & 0x1f;
+  vtkTypeUInt32 mant = h & 0x3ff;
+  vtkTypeUInt32 x;
+  if( exp == 0 ){
+    if( mant == 0 )
+      x = sign;
+    else{
+      exp = 127 - 15 + 1;
+      while( !(mant & 0x400) ){
+        mant <<= 1;
+        exp--;
+      }
+      x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  }
+  else if( exp == 31 )
+    x = sign | 0x7f800000 | (mant << 13);
+  else
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+inline vtkTypeUInt16 floatToBFloat16(float f){
+  vtkTypeUInt32 x;
+  memcpy(&x, &f, sizeof(x));
+  if( (x & 0x7fffffff) > 0x7f800000 )
+    return (vtkTypeUInt16) ((x >> 16) | 0x40);
+  x += 0x7fff + ((x >> 16) & 1);
+  return (vtkTypeUInt16) (x >> 16);
+}
+
+inline float bfloat16ToFloat(vtkTypeUInt16 h){
+  vtkTypeUInt32 x = (vtkTypeUInt32) h << 16;
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+struct mfKernelArgs;
+typedef void (*mfRangeKernel)(const mfKernelArgs* args, int begin, int end);
+typedef double (*mfReduceKernel)(const mfKernelArgs* args, int begin, int end);
+
+// Arguments for a single kernel invocation, shared by all the threads. The
+// buffers and scalars are positional and interpreted by each range kernel.
+struct mfKernelArgs
+{
+  mfRangeKernel Kernel;
+  mfReduceKernel ReduceKernel;
+  double* Sums; //one per thread, for reduction kernels
+  float* B[6];
+  vtkTypeUInt16* P[3]; //16-bit spatial flows, for the packed storage policies
+  float  S[2];
+  int    VX, VY, VZ;
+  int    Size;
+  int    Granularity;
+};
+
+VTK_THREAD_RETURN_TYPE mfThreadedExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  const mfKernelArgs* args = static_cast<const mfKernelArgs *>
+                             (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  //find the contiguous slab of chunks this thread is responsible for
+  long long numChunks = (args->Size + args->Granularity - 1) / args->Granularity;
+  long long begin = (numChunks * threadId / threadCount) * args->Granularity;
+  long long end = (numChunks * (threadId+1) / threadCount) * args->Granularity;
+  if( end > args->Size )
+  {
+    end = args->Size;
+  }
+  if( args->ReduceKernel )
+  {
+    args->Sums[threadId] = (begin < end) ? args->ReduceKernel(args, (int) begin, (int) end) : 0.0;
+  }
+  else if( begin < end )
+  {
+    args->Kernel(args, (int) begin, (int) end);
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+bool mfUseSerial( vtkMultiThreader* threader )
+{
+  return !threader || threader->GetNumberOfThreads() < 2;
+}
+
+void mfInitArgs( mfKernelArgs& args, mfRangeKernel kernel, int size, int VX = 0, int VY = 0, int VZ = 0 )
+{
+  args.Kernel = kernel;
+  args.ReduceKernel = 0;
+  args.Sums = 0;
+  for( int i = 0; i < 6; i++ )
+  {
+    args.B[i] = 0;
+  }
+  for( int i = 0; i < 3; i++ )
+  {
+    args.P[i] = 0;
+  }
+  args.S[0] = args.S[1] = 0.0f;
+  args.VX = VX;
+  args.VY = VY;
+  args.VZ = VZ;
+  args.Size = size;
+
+  //stencil kernels are split on row boundaries so each row can be processed branch-free
+  args.Granularity = VX ? VX : mfElementGranularity;
+}
+
+void mfRunKernel( vtkMultiThreader* threader, mfKernelArgs& args )
+{
+  threader->SetSingleMethod(mfThreadedExecute, &args);
+  threader->SingleMethodExecute();
+}
+
+// Runs a reduction kernel and adds up the per-thread results in thread order.
+double mfRunReduceKernel( vtkMultiThreader* threader, mfKernelArgs& args, mfReduceKernel kernel )
+{
+  double sums[VTK_MAX_THREADS];
+  args.ReduceKernel = kernel;
+  args.Sums = sums;
+  mfRunKernel(threader, args);
+  double sum = 0.0;
+  for( int i = 0; i < threader->GetNumberOfThreads(); i++ )
+  {
+    sum += sums[i];
+  }
+  return sum;
+}
+
+//----------------------------------------------------------------------------
+// Elementwise range kernels
+
+void mfZeroOutBuffer(const mfKernelArgs* a, int begin, int end){
+  float* buffer = a->B[0];
+  for(int x = begin; x < end; x++)
+    buffer[x] = 0.0f;
+}
+
+void mfSetBufferToValue(const mfKernelArgs* a, int begin, int end){
+  float* buffer = a->B[0];
+  const float value = a->S[0];
+  for(int x = begin; x < end; x++)
+    buffer[x] = value;
+}
+
+void mfTranslateBuffer(const mfKernelArgs* a, int begin, int end){
+  float* bufferOut = a->B[0];
+  const float* bufferIn = a->B[1];
+  const float shift = a->S[0];
+  const float scale = a->S[1];
+  for(int x = begin; x < end; x++)
+    bufferOut[x] = shift+scale*bufferIn[x];
+}
+
+void mfSumBuffer(const mfKernelArgs* a, int begin, int end){
+  float* bufferOut = a->B[0];
+  const float* bufferIn = a->B[1];
+  for(int x = begin; x < end; x++)
+    bufferOut[x] += bufferIn[x];
+}
+
+void mfSumScaledBuffer(const mfKernelArgs* a, int begin, int end){
+  float* bufferOut = a->B[0];
+  const float* bufferIn = a->B[1];
+  const float scale = a->S[0];
+  for(int x = begin; x < end; x++)
+    bufferOut[x] += scale*bufferIn[x];
+}
+
+void mfCopyBuffer(const mfKernelArgs* a, int begin, int end){
+  float* bufferOut = a->B[0];
+  const float* bufferIn = a->B[1];
+  for(int x = begin; x < end; x++)
+    bufferOut[x] = bufferIn[x];
+}
+
+void mfMinBuffer(const mfKernelArgs* a, int begin, int end){
+  float* bufferOut = a->B[0];
+  const float* bufferIn = a->B[1];
+  for(int x = begin; x < end; x++)
+    bufferOut[x] = (bufferOut[x] > bufferIn[x]) ? bufferIn[x] : bufferOut[x];
+}
+
+void mfDivBuffer(const mfKernelArgs* a, int begin, int end){
+  float* bufferOut = a->B[0];
+  const float* bufferIn = a->B[1];
+  for(int x = begin; x < end; x++)
+    bufferOut[x] /= bufferIn[x];
+}
+
+void mfDivAndStoreBuffer(const mfKernelArgs* a, int begin, int end){
+  float* bufferOut = a->B[0];
+  const float* bufferIn = a->B[1];
+  const float value = a->S[0];
+  for(int x = begin; x < end; x++)
+    bufferOut[x] = bufferIn[x] / value;
+}
+
+void mfLblBuffer(const mfKernelArgs* a, int begin, int end){
+  float* label = a->B[0];
+  const float* sink = a->B[1];
+  const float* cap = a->B[2];
+  for(int x = begin; x < end; x++)
+    label[x] = (sink[x] == cap[x]) ? 1.0f : 0.0f;
+}
+
+void mfConstrainBuffer(const mfKernelArgs* a, int begin, int end){
+  float* sink = a->B[0];
+  const float* cap = a->B[1];
+  for(int x = begin; x < end; x++)
+    sink[x] = (sink[x] > cap[x]) ? cap[x] : sink[x];
+}
+
+void mfUpdateLeafSinkFlow(const mfKernelArgs* a, int begin, int end){
+  float* sink = a->B[0];
+  const float* inc = a->B[1];
+  const float* div = a->B[2];
+  const float* label = a->B[3];
+  const float CC = a->S[0];
+  for(int x = begin; x < end; x++)
+    sink[x] = inc[x] - div[x] + label[x] / CC;
+}
+
+void mfUpdateLabel(const mfKernelArgs* a, int begin, int end){
+  const float* sink = a->B[0];
+  const float* inc = a->B[1];
+  const float* div = a->B[2];
+  float* label = a->B[3];
+  const float CC = a->S[0];
+  for(int x = begin; x < end; x++)
+    label[x] += CC*(inc[x] - div[x] - sink[x]);
+}
+
+double mfUpdateLabelAndSumChange(const mfKernelArgs* a, int begin, int end){
+  const float* sink = a->B[0];
+  const float* inc = a->B[1];
+  const float* div = a->B[2];
+  float* label = a->B[3];
+  const float CC = a->S[0];
+  double sum = 0.0;
+  for(int x = begin; x < end; x++){
+    float change = CC*(inc[x] - div[x] - sink[x]);
+    label[x] += change;
+    sum += fabs(change);
+  }
+  return sum;
+}
+
+void mfStoreSourceFlowInBuffer(const mfKernelArgs* a, int begin, int end){
+  float* working = a->B[0];
+  const float* sink = a->B[1];
+  const float* div = a->B[2];
+  const float* label = a->B[3];
+  const float CC = a->S[0];
+  for(int x = begin; x < end; x++)
+    working[x] += sink[x] + div[x] - label[x] / CC;
+}
+
+void mfStoreSinkFlowInBuffer(const mfKernelArgs* a, int begin, int end){
+  float* working = a->B[0];
+  const float* inc = a->B[1];
+  const float* div = a->B[2];
+  const float* label = a->B[3];
+  const float CC = a->S[0];
+  for(int x = begin; x < end; x++)
+    working[x] = inc[x] - div[x] + label[x] / CC;
+}
+
+void mfDagmfStoreSourceFlowInBuffer(const mfKernelArgs* a, int begin, int end){
+  float* working = a->B[0];
+  const float* sink = a->B[1];
+  const float* div = a->B[2];
+  const float* label = a->B[3];
+  const float* source = a->B[4];
+  const float CC = a->S[0];
+  const float multiplicity = a->S[1];
+  for(int x = begin; x < end; x++)
+    working[x] += (sink[x] + div[x] - source[x] - label[x] / CC) * multiplicity;
+}
+
+void mfDagmfStoreSinkFlowInBuffer(const mfKernelArgs* a, int begin, int end){
+  float* working = a->B[0];
+  const float* inc = a->B[1];
+  const float* div = a->B[2];
+  const float* label = a->B[3];
+  const float* sink = a->B[4];
+  const float CC = a->S[0];
+  const float multiplicity = a->S[1];
+  for(int x = begin; x < end; x++)
+    working[x] = inc[x] - div[x] + label[x] / CC + multiplicity*sink[x];
+}
+
+void mfFlowGradientStep(const mfKernelArgs* a, int begin, int end){
+  const float* sink = a->B[0];
+  const float* inc = a->B[1];
+  float* div = a->B[2];
+  const float* label = a->B[3];
+  const float StepSize = a->S[0];
+  const float CC = a->S[1];
+  for(int x = begin; x < end; x++)
+    div[x] = StepSize*(sink[x] + div[x] - inc[x] - label[x] / CC);
+}
+
+//----------------------------------------------------------------------------
+// Storage policies for the spatial flows read and written by the stencil kernels.
+// Arithmetic is always carried out in single precision; the packed policies round
+// to nearest even whenever a flow is stored. The single precision policy compiles
+// down to the original kernels.
+
+struct mfFloat32Storage
+{
+  typedef float Type;
+  static float* Flow(const mfKernelArgs* a, int i){ return a->B[1+i]; }
+  static float Load(float v){ return v; }
+  static float Store(float v){ return v; }
+};
+
+struct mfFloat16Storage
+{
+  typedef vtkTypeUInt16 Type;
+  static Type* Flow(const mfKernelArgs* a, int i){ return a->P[i]; }
+  static float Load(Type h){ return halfToFloat(h); }
+  static Type Store(float v){ return floatToHalf(v); }
+};
+
+struct mfBFloat16Storage
+{
+  typedef vtkTypeUInt16 Type;
+  static Type* Flow(const mfKernelArgs* a, int i){ return a->P[i]; }
+  static float Load(Type h){ return bfloat16ToFloat(h); }
+  static Type Store(float v){ return floatToBFloat16(v); }
+};
+
+//----------------------------------------------------------------------------
+// Stencil range kernels, processed one row at a time so that the boundary
+// conditions of the serial kernels are resolved outside of the inner loops
+
+template< class S >
+void mfGhmfApplyStep(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int slice = VX*VY;
+  for(int row = begin; row < end; row += VX){
+    const float* d = a->B[0] + row;
+    typename S::Type* fx = S::Flow(a,0) + row;
+    typename S::Type* fy = S::Flow(a,1) + row;
+    typename S::Type* fz = S::Flow(a,2) + row;
+
+    fx[0] = S::Store(S::Load(fx[0]) * (0.5f * (d[0] - 0.0f)));
+    for(int i = 1; i < VX; i++)
+      fx[i] = S::Store(S::Load(fx[i]) * (0.5f * (d[i] - d[i-1])));
+
+    if( (row/VX) % VY )
+      for(int i = 0; i < VX; i++)
+        fy[i] = S::Store(S::Load(fy[i]) * (0.5f * (d[i] - d[i-VX])));
+    else
+      for(int i = 0; i < VX; i++)
+        fy[i] = S::Store(S::Load(fy[i]) * (0.5f * (d[i] - 0.0f)));
+
+    if( row >= slice )
+      for(int i = 0; i < VX; i++)
+        fz[i] = S::Store(S::Load(fz[i]) * (0.5f * (d[i] - d[i-slice])));
+    else
+      for(int i = 0; i < VX; i++)
+        fz[i] = S::Store(S::Load(fz[i]) * (0.5f * (d[i] - 0.0f)));
+  }
+}
+
+template< class S >
+void mfDagmfApplyStep(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int slice = VX*VY;
+  for(int row = begin; row < end; row += VX){
+    const float* d = a->B[0] + row;
+    typename S::Type* fx = S::Flow(a,0) + row;
+    typename S::Type* fy = S::Flow(a,1) + row;
+    typename S::Type* fz = S::Flow(a,2) + row;
+
+    fx[0] = S::Store(S::Load(fx[0]) - (d[0] - d[0]));
+    for(int i = 1; i < VX; i++)
+      fx[i] = S::Store(S::Load(fx[i]) - (d[i] - d[i-1]));
+
+    if( (row/VX) % VY )
+      for(int i = 0; i < VX; i++)
+        fy[i] = S::Store(S::Load(fy[i]) - (d[i] - d[i-VX]));
+    else
+      for(int i = 0; i < VX; i++)
+        fy[i] = S::Store(S::Load(fy[i]) - (d[i] - d[i]));
+
+    if( row >= slice )
+      for(int i = 0; i < VX; i++)
+        fz[i] = S::Store(S::Load(fz[i]) - (d[i] - d[i-slice]));
+    else
+      for(int i = 0; i < VX; i++)
+        fz[i] = S::Store(S::Load(fz[i]) - (d[i] - d[i]));
+  }
+}
+
+// Shared by both solvers. Matches the serial kernel term for term, except that the
+// neighbours past the end of the buffer (which the serial kernel reads for the last
+// row of the volume) are treated as zero.
+template< class S >
+void mfComputeFlowMag(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int size = a->Size;
+  const int slice = VX*VY;
+  const float* smooth = a->B[4];
+  const float alpha = a->S[0];
+  for(int row = begin; row < end; row += VX){
+    float* d = a->B[0] + row;
+    const typename S::Type* fx = S::Flow(a,0) + row;
+    const typename S::Type* fy = S::Flow(a,1) + row;
+    const typename S::Type* fz = S::Flow(a,2) + row;
+
+    for(int i = 0; i < VX; i++)
+      d[i] = S::Load(fx[i])*S::Load(fx[i]) + S::Load(fy[i])*S::Load(fy[i]) + S::Load(fz[i])*S::Load(fz[i]);
+    if( row + VX < size )
+      d[VX-1] += S::Load(fx[VX])*S::Load(fx[VX]);
+    if( ((row/VX + 1) % VY) == 0 && row + VX < size )
+      for(int i = 0; i < VX; i++)
+        d[i] += S::Load(fx[i+VX])*S::Load(fx[i+VX]);
+    if( row < size - slice )
+      for(int i = 0; i < VX; i++)
+        d[i] += S::Load(fx[i+slice])*S::Load(fx[i+slice]);
+    for(int i = 0; i < VX; i++)
+      d[i] = sqrt(d[i]);
+
+    if( smooth )
+    {
+      const float* s = smooth + row;
+      for(int i = 0; i < VX; i++)
+        d[i] = (d[i] > alpha * s[i]) ? alpha * s[i] / d[i] : 1.0f;
+    }
+    else
+      for(int i = 0; i < VX; i++)
+        d[i] = (d[i] > alpha) ? alpha / d[i] : 1.0f;
+  }
+}
+
+// First half of the projection, shared by both solvers. Only reads the multiplier
+// in the div buffer, so must complete on all threads before the divergence is found.
+template< class S >
+void mfProjectFlows(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int slice = VX*VY;
+  for(int row = begin; row < end; row += VX){
+    const float* d = a->B[0] + row;
+    typename S::Type* fx = S::Flow(a,0) + row;
+    typename S::Type* fy = S::Flow(a,1) + row;
+    typename S::Type* fz = S::Flow(a,2) + row;
+
+    fx[0] = S::Store(S::Load(fx[0]) * (0.5f * (d[0] + -d[0])));
+    for(int i = 1; i < VX; i++)
+      fx[i] = S::Store(S::Load(fx[i]) * (0.5f * (d[i] + d[i-1])));
+
+    if( (row/VX) % VY )
+      for(int i = 0; i < VX; i++)
+        fy[i] = S::Store(S::Load(fy[i]) * (0.5f * (d[i] + d[i-VX])));
+    else
+      for(int i = 0; i < VX; i++)
+        fy[i] = S::Store(S::Load(fy[i]) * (0.5f * (d[i] + -d[i])));
+
+    if( row >= slice )
+      for(int i = 0; i < VX; i++)
+        fz[i] = S::Store(S::Load(fz[i]) * (0.5f * (d[i] + d[i-slice])));
+    else
+      for(int i = 0; i < VX; i++)
+        fz[i] = S::Store(S::Load(fz[i]) * (0.5f * (d[i] + -d[i])));
+  }
+}
+
+template< class S >
+void mfGhmfComputeDivergence(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int slice = VX*VY;
+  const int zOffset = VX*a->VZ; //as in the serial kernel
+  for(int row = begin; row < end; row += VX){
+    float* d = a->B[0] + row;
+    const typename S::Type* fx = S::Flow(a,0) + row;
+    const typename S::Type* fy = S::Flow(a,1) + row;
+    const typename S::Type* fz = S::Flow(a,2) + row;
+
+    for(int i = 0; i < VX; i++)
+      d[i] = S::Load(fx[i]) + S::Load(fy[i]) + S::Load(fz[i]);
+    for(int i = 1; i < VX; i++)
+      d[i] -= S::Load(fx[i-1]);
+    if( (row/VX) % VY )
+      for(int i = 0; i < VX; i++)
+        d[i] -= S::Load(fy[i-VX]);
+    if( row >= slice )
+      for(int i = 0; i < VX; i++)
+        d[i] -= S::Load(fz[i-zOffset]);
+  }
+}
+
+template< class S >
+void mfDagmfComputeDivergence(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int size = a->Size;
+  const int slice = VX*VY;
+  const int zOffset = VX*a->VZ; //as in the serial kernel
+  for(int row = begin; row < end; row += VX){
+    float* d = a->B[0] + row;
+    const typename S::Type* fx = S::Flow(a,0) + row;
+    const typename S::Type* fy = S::Flow(a,1) + row;
+    const typename S::Type* fz = S::Flow(a,2) + row;
+
+    for(int i = 0; i < VX; i++)
+      d[i] = S::Load(fx[i]) + S::Load(fy[i]) + S::Load(fz[i]);
+    for(int i = 0; i < VX-1; i++)
+      d[i] -= S::Load(fx[i+1]);
+    if( (row/VX + 1) % VY )
+      for(int i = 0; i < VX; i++)
+        d[i] -= S::Load(fy[i+VX]);
+    if( row < size - slice )
+      for(int i = 0; i < VX; i++)
+        d[i] -= S::Load(fz[i+zOffset]);
+  }
+}
+
+//----------------------------------------------------------------------------
+// Pyramid range kernels, split over the z-slices of the volume being written. The
+// fine dimensions are given, the coarse ones being half of each, rounded up.
+
+void mfDownsampleBuffer(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int VZ = a->VZ;
+  const int CX = (VX + 1) / 2;
+  const int CY = (VY + 1) / 2;
+  float* coarse = a->B[0];
+  const float* fine = a->B[1];
+  for(int z = begin; z < end; z++)
+    for(int y = 0; y < CY; y++)
+      for(int x = 0; x < CX; x++){
+        float sum = 0.0f;
+        int count = 0;
+        for(int k = 2*z; k < 2*z+2 && k < VZ; k++)
+          for(int j = 2*y; j < 2*y+2 && j < VY; j++)
+            for(int i = 2*x; i < 2*x+2 && i < VX; i++){
+              sum += fine[(k*VY + j)*VX + i];
+              count++;
+            }
+        coarse[(z*CY + y)*CX + x] = sum / (float) count;
+      }
+}
+
+template< class S >
+void mfProlongBuffer(const mfKernelArgs* a, int begin, int end){
+  const int VX = a->VX;
+  const int VY = a->VY;
+  const int CX = (VX + 1) / 2;
+  const int CY = (VY + 1) / 2;
+  const float* coarse = a->B[0];
+  typename S::Type* fine = S::Flow(a,0);
+  const float scale = a->S[0];
+  for(int z = begin; z < end; z++)
+    for(int y = 0; y < VY; y++){
+      const float* c = coarse + ((z/2)*CY + y/2)*CX;
+      typename S::Type* f = fine + (z*VY + y)*VX;
+      for(int x = 0; x < VX; x++)
+        f[x] = S::Store(scale * c[x/2]);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Fused spatial flow update for a single node. The volume is walked one z-slice
+// at a time with each stage lagging behind the one before it, so that every
+// stage finds its neighbours in the state the unfused kernels would leave them
+// in, while the handful of slices in flight stay resident in cache:
+//   slice z     : gradient step, then apply step (needs slice z-1 of the step)
+//   slice z-1   : flow magnitude (needs slice z of the applied flows), then
+//                 projection (needs slice z-2 of the multiplier)
+//   slice z-1-L : divergence (needs projected flows up to L slices ahead)
+
+template< class S >
+void mfFusedSpatialFlowUpdate(const mfKernelArgs* grad, const mfKernelArgs* flow,
+                              mfRangeKernel applyStep, mfRangeKernel divergence, int divergenceLag){
+  const int slice = flow->VX*flow->VY;
+  const int VZ = flow->VZ;
+  for(int z = 0; z < VZ + divergenceLag + 1; z++){
+    if( z < VZ ){
+      mfFlowGradientStep(grad, z*slice, (z+1)*slice);
+      applyStep(flow, z*slice, (z+1)*slice);
+    }
+    int p = z - 1;
+    if( p >= 0 && p < VZ ){
+      mfComputeFlowMag<S>(flow, p*slice, (p+1)*slice);
+      mfProjectFlows<S>(flow, p*slice, (p+1)*slice);
+    }
+    int d = z - 1 - divergenceLag;
+    if( d >= 0 && d < VZ )
+      divergence(flow, d*slice, (d+1)*slice);
+  }
+}
+
+// The divergence of the GHMF solver only looks backwards, so it can run one slice behind
+// the projection. That of the DAGMF solver looks VX*VZ voxels ahead in the z flow, so it
+// has to wait until the projection has passed however many slices that spans.
+template< class S >
+void mfGhmfFusedSpatialFlowUpdate(const mfKernelArgs* grad, const mfKernelArgs* flow){
+  mfFusedSpatialFlowUpdate<S>(grad, flow, mfGhmfApplyStep<S>, mfGhmfComputeDivergence<S>, 1);
+}
+
+template< class S >
+void mfDagmfFusedSpatialFlowUpdate(const mfKernelArgs* grad, const mfKernelArgs* flow){
+  int lag = (flow->VZ + flow->VY - 1) / flow->VY;
+  mfFusedSpatialFlowUpdate<S>(grad, flow, mfDagmfApplyStep<S>, mfDagmfComputeDivergence<S>, lag > 1 ? lag : 1);
+}
+
+void mfInitFusedArgs(mfKernelArgs& grad, mfKernelArgs& flow, float* sink, float* inc, float* div, float* label,
+                     float* flowX, float* flowY, float* flowZ, float* smooth, float alpha,
+                     float StepSize, float CC, int VX, int VY, int VZ, int size){
+  mfInitArgs(grad, mfFlowGradientStep, size);
+  grad.B[0] = sink;
+  grad.B[1] = inc;
+  grad.B[2] = div;
+  grad.B[3] = label;
+  grad.S[0] = StepSize;
+  grad.S[1] = CC;
+
+  mfInitArgs(flow, 0, size, VX, VY, VZ);
+  flow.B[0] = div;
+  flow.B[1] = flowX;
+  flow.B[2] = flowY;
+  flow.B[3] = flowZ;
+  flow.B[4] = smooth;
+  flow.S[0] = alpha;
+}
+
+}
+
+//----------------------------------------------------------------------------
+
+void zeroOutBuffer(vtkMultiThreader* threader, float* buffer, int size){
+  if( mfUseSerial(threader) ){ zeroOutBuffer(buffer, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfZeroOutBuffer, size);
+  args.B[0] = buffer;
+  mfRunKernel(threader, args);
+}
+
+void setBufferToValue(vtkMultiThreader* threader, float* buffer, float value, int size){
+  if( mfUseSerial(threader) ){ setBufferToValue(buffer, value, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfSetBufferToValue, size);
+  args.B[0] = buffer;
+  args.S[0] = value;
+  mfRunKernel(threader, args);
+}
+
+void translateBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, float shift, float scale, int size){
+  if( mfUseSerial(threader) ){ translateBuffer(bufferOut, bufferIn, shift, scale, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfTranslateBuffer, size);
+  args.B[0] = bufferOut;
+  args.B[1] = bufferIn;
+  args.S[0] = shift;
+  args.S[1] = scale;
+  mfRunKernel(threader, args);
+}
+
+void sumBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size){
+  if( mfUseSerial(threader) ){ sumBuffer(bufferOut, bufferIn, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfSumBuffer, size);
+  args.B[0] = bufferOut;
+  args.B[1] = bufferIn;
+  mfRunKernel(threader, args);
+}
+
+void sumScaledBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, float scale, int size){
+  if( mfUseSerial(threader) ){ sumScaledBuffer(bufferOut, bufferIn, scale, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfSumScaledBuffer, size);
+  args.B[0] = bufferOut;
+  args.B[1] = bufferIn;
+  args.S[0] = scale;
+  mfRunKernel(threader, args);
+}
+
+void copyBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size){
+  if( mfUseSerial(threader) ){ copyBuffer(bufferOut, bufferIn, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfCopyBuffer, size);
+  args.B[0] = bufferOut;
+  args.B[1] = bufferIn;
+  mfRunKernel(threader, args);
+}
+
+void minBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size){
+  if( mfUseSerial(threader) ){ minBuffer(bufferOut, bufferIn, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfMinBuffer, size);
+  args.B[0] = bufferOut;
+  args.B[1] = bufferIn;
+  mfRunKernel(threader, args);
+}
+
+void divBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size){
+  if( mfUseSerial(threader) ){ divBuffer(bufferOut, bufferIn, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfDivBuffer, size);
+  args.B[0] = bufferOut;
+  args.B[1] = bufferIn;
+  mfRunKernel(threader, args);
+}
+
+void divAndStoreBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, float value, int size){
+  if( mfUseSerial(threader) ){ divAndStoreBuffer(bufferOut, bufferIn, value, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfDivAndStoreBuffer, size);
+  args.B[0] = bufferOut;
+  args.B[1] = bufferIn;
+  args.S[0] = value;
+  mfRunKernel(threader, args);
+}
+
+void lblBuffer(vtkMultiThreader* threader, float* label, float* sink, float* cap, int size ){
+  if( mfUseSerial(threader) ){ lblBuffer(label, sink, cap, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfLblBuffer, size);
+  args.B[0] = label;
+  args.B[1] = sink;
+  args.B[2] = cap;
+  mfRunKernel(threader, args);
+}
+
+void constrainBuffer(vtkMultiThreader* threader, float* sink, float* cap, int size ){
+  if( mfUseSerial(threader) ){ constrainBuffer(sink, cap, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfConstrainBuffer, size);
+  args.B[0] = sink;
+  args.B[1] = cap;
+  mfRunKernel(threader, args);
+}
+
+void updateLeafSinkFlow(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float CC, int size){
+  if( mfUseSerial(threader) ){ updateLeafSinkFlow(sink, inc, div, label, CC, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfUpdateLeafSinkFlow, size);
+  args.B[0] = sink;
+  args.B[1] = inc;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.S[0] = CC;
+  mfRunKernel(threader, args);
+}
+
+void updateLabel(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float CC, int size){
+  if( mfUseSerial(threader) ){ updateLabel(sink, inc, div, label, CC, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfUpdateLabel, size);
+  args.B[0] = sink;
+  args.B[1] = inc;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.S[0] = CC;
+  mfRunKernel(threader, args);
+}
+
+double updateLabelAndSumChange(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float CC, int size){
+  if( mfUseSerial(threader) ){ return updateLabelAndSumChange(sink, inc, div, label, CC, size); }
+  mfKernelArgs args;
+  mfInitArgs(args, 0, size);
+  args.B[0] = sink;
+  args.B[1] = inc;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.S[0] = CC;
+  return mfRunReduceKernel(threader, args, mfUpdateLabelAndSumChange);
+}
+
+void storeSourceFlowInBuffer(vtkMultiThreader* threader, float* working, float* sink, float* div, float* label, float CC, int size){
+  if( mfUseSerial(threader) ){ storeSourceFlowInBuffer(working, sink, div, label, CC, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfStoreSourceFlowInBuffer, size);
+  args.B[0] = working;
+  args.B[1] = sink;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.S[0] = CC;
+  mfRunKernel(threader, args);
+}
+
+void storeSinkFlowInBuffer(vtkMultiThreader* threader, float* working, float* inc, float* div, float* label, float CC, int size){
+  if( mfUseSerial(threader) ){ storeSinkFlowInBuffer(working, inc, div, label, CC, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfStoreSinkFlowInBuffer, size);
+  args.B[0] = working;
+  args.B[1] = inc;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.S[0] = CC;
+  mfRunKernel(threader, args);
+}
+
+void dagmf_storeSourceFlowInBuffer(vtkMultiThreader* threader, float* working, float* sink, float* div, float* label, float* source, float* exclude, float CC, float multiplicity, int size){
+  if( mfUseSerial(threader) ){ dagmf_storeSourceFlowInBuffer(working, sink, div, label, source, exclude, CC, multiplicity, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfDagmfStoreSourceFlowInBuffer, size);
+  args.B[0] = working;
+  args.B[1] = sink;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.B[4] = source;
+  args.S[0] = CC;
+  args.S[1] = multiplicity;
+  mfRunKernel(threader, args);
+}
+
+void dagmf_storeSinkFlowInBuffer(vtkMultiThreader* threader, float* working, float* inc, float* div, float* label, float* sink, float multiplicity, float CC, int size){
+  if( mfUseSerial(threader) ){ dagmf_storeSinkFlowInBuffer(working, inc, div, label, sink, multiplicity, CC, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfDagmfStoreSinkFlowInBuffer, size);
+  args.B[0] = working;
+  args.B[1] = inc;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.B[4] = sink;
+  args.S[0] = CC;
+  args.S[1] = multiplicity;
+  mfRunKernel(threader, args);
+}
+
+void dagmf_flowGradientStep(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float StepSize, float CC, int size){
+  if( mfUseSerial(threader) ){ dagmf_flowGradientStep(sink, inc, div, label, StepSize, CC, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfFlowGradientStep, size);
+  args.B[0] = sink;
+  args.B[1] = inc;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.S[0] = StepSize;
+  args.S[1] = CC;
+  mfRunKernel(threader, args);
+}
+
+void dagmf_applyStep(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size){
+  if( mfUseSerial(threader) ){ dagmf_applyStep(div, flowX, flowY, flowZ, VX, VY, VZ, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfDagmfApplyStep<mfFloat32Storage>, size, VX, VY, VZ);
+  args.B[0] = div;
+  args.B[1] = flowX;
+  args.B[2] = flowY;
+  args.B[3] = flowZ;
+  mfRunKernel(threader, args);
+}
+
+void dagmf_computeFlowMag(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, float* smooth, float alpha, int VX, int VY, int VZ, int size ){
+  if( mfUseSerial(threader) ){ dagmf_computeFlowMag(div, flowX, flowY, flowZ, smooth, alpha, VX, VY, VZ, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfComputeFlowMag<mfFloat32Storage>, size, VX, VY, VZ);
+  args.B[0] = div;
+  args.B[1] = flowX;
+  args.B[2] = flowY;
+  args.B[3] = flowZ;
+  args.B[4] = smooth;
+  args.S[0] = alpha;
+  mfRunKernel(threader, args);
+}
+
+void dagmf_projectOntoSet(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size){
+  if( mfUseSerial(threader) ){ dagmf_projectOntoSet(div, flowX, flowY, flowZ, VX, VY, VZ, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfProjectFlows<mfFloat32Storage>, size, VX, VY, VZ);
+  args.B[0] = div;
+  args.B[1] = flowX;
+  args.B[2] = flowY;
+  args.B[3] = flowZ;
+  mfRunKernel(threader, args);
+  args.Kernel = mfDagmfComputeDivergence<mfFloat32Storage>;
+  mfRunKernel(threader, args);
+}
+
+void ghmf_flowGradientStep(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float StepSize, float CC, int size){
+  if( mfUseSerial(threader) ){ ghmf_flowGradientStep(sink, inc, div, label, StepSize, CC, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfFlowGradientStep, size);
+  args.B[0] = sink;
+  args.B[1] = inc;
+  args.B[2] = div;
+  args.B[3] = label;
+  args.S[0] = StepSize;
+  args.S[1] = CC;
+  mfRunKernel(threader, args);
+}
+
+void ghmf_applyStep(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size){
+  if( mfUseSerial(threader) ){ ghmf_applyStep(div, flowX, flowY, flowZ, VX, VY, VZ, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfGhmfApplyStep<mfFloat32Storage>, size, VX, VY, VZ);
+  args.B[0] = div;
+  args.B[1] = flowX;
+  args.B[2] = flowY;
+  args.B[3] = flowZ;
+  mfRunKernel(threader, args);
+}
+
+void ghmf_computeFlowMag(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, float* smooth, float alpha, int VX, int VY, int VZ, int size ){
+  if( mfUseSerial(threader) ){ ghmf_computeFlowMag(div, flowX, flowY, flowZ, smooth, alpha, VX, VY, VZ, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfComputeFlowMag<mfFloat32Storage>, size, VX, VY, VZ);
+  args.B[0] = div;
+  args.B[1] = flowX;
+  args.B[2] = flowY;
+  args.B[3] = flowZ;
+  args.B[4] = smooth;
+  args.S[0] = alpha;
+  mfRunKernel(threader, args);
+}
+
+void ghmf_projectOntoSet(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size){
+  if( mfUseSerial(threader) ){ ghmf_projectOntoSet(div, flowX, flowY, flowZ, VX, VY, VZ, size); return; }
+  mfKernelArgs args;
+  mfInitArgs(args, mfProjectFlows<mfFloat32Storage>, size, VX, VY, VZ);
+  args.B[0] = div;
+  args.B[1] = flowX;
+  args.B[2] = flowY;
+  args.B[3] = flowZ;
+  mfRunKernel(threader, args);
+  args.Kernel = mfGhmfComputeDivergence<mfFloat32Storage>;
+  mfRunKernel(threader, args);
+}
+
+//----------------------------------------------------------------------------
+
+void ghmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label, float* flowX, float* flowY, float* flowZ,
+                             float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size){
+  mfKernelArgs grad, flow;
+  mfInitFusedArgs(grad, flow, sink, inc, div, label, flowX, flowY, flowZ, smooth, alpha, StepSize, CC, VX, VY, VZ, size);
+  mfGhmfFusedSpatialFlowUpdate<mfFloat32Storage>(&grad, &flow);
+}
+
+void dagmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label, float* flowX, float* flowY, float* flowZ,
+                              float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size){
+  mfKernelArgs grad, flow;
+  mfInitFusedArgs(grad, flow, sink, inc, div, label, flowX, flowY, flowZ, smooth, alpha, StepSize, CC, VX, VY, VZ, size);
+  mfDagmfFusedSpatialFlowUpdate<mfFloat32Storage>(&grad, &flow);
+}
+
+void ghmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label,
+                             vtkTypeUInt16* flowX, vtkTypeUInt16* flowY, vtkTypeUInt16* flowZ, bool bfloat16,
+                             float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size){
+  mfKernelArgs grad, flow;
+  mfInitFusedArgs(grad, flow, sink, inc, div, label, 0, 0, 0, smooth, alpha, StepSize, CC, VX, VY, VZ, size);
+  flow.P[0] = flowX;
+  flow.P[1] = flowY;
+  flow.P[2] = flowZ;
+  if( bfloat16 )
+    mfGhmfFusedSpatialFlowUpdate<mfBFloat16Storage>(&grad, &flow);
+  else
+    mfGhmfFusedSpatialFlowUpdate<mfFloat16Storage>(&grad, &flow);
+}
+
+void dagmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label,
+                              vtkTypeUInt16* flowX, vtkTypeUInt16* flowY, vtkTypeUInt16* flowZ, bool bfloat16,
+                              float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size){
+  mfKernelArgs grad, flow;
+  mfInitFusedArgs(grad, flow, sink, inc, div, label, 0, 0, 0, smooth, alpha, StepSize, CC, VX, VY, VZ, size);
+  flow.P[0] = flowX;
+  flow.P[1] = flowY;
+  flow.P[2] = flowZ;
+  if( bfloat16 )
+    mfDagmfFusedSpatialFlowUpdate<mfBFloat16Storage>(&grad, &flow);
+  else
+    mfDagmfFusedSpatialFlowUpdate<mfFloat16Storage>(&grad, &flow);
+}
+
+//----------------------------------------------------------------------------
+
+void downsampleBuffer(vtkMultiThreader* threader, float* coarse, float* fine, int VX, int VY, int VZ){
+  mfKernelArgs args;
+  mfInitArgs(args, mfDownsampleBuffer, (VZ + 1) / 2, VX, VY, VZ);
+  args.Granularity = 1;
+  args.B[0] = coarse;
+  args.B[1] = fine;
+  if( mfUseSerial(threader) ){ mfDownsampleBuffer(&args, 0, args.Size); return; }
+  mfRunKernel(threader, args);
+}
+
+void prolongBuffer(vtkMultiThreader* threader, float* fine, float* coarse, float scale, int VX, int VY, int VZ){
+  mfKernelArgs args;
+  mfInitArgs(args, mfProlongBuffer<mfFloat32Storage>, VZ, VX, VY, VZ);
+  args.Granularity = 1;
+  args.B[0] = coarse;
+  args.B[1] = fine;
+  args.S[0] = scale;
+  if( mfUseSerial(threader) ){ args.Kernel(&args, 0, args.Size); return; }
+  mfRunKernel(threader, args);
+}
+
+void prolongBuffer(vtkMultiThreader* threader, vtkTypeUInt16* fine, float* coarse, float scale, bool bfloat16,
+                   int VX, int VY, int VZ){
+  mfKernelArgs args;
+  mfInitArgs(args, bfloat16 ? mfProlongBuffer<mfBFloat16Storage> : mfProlongBuffer<mfFloat16Storage>, VZ, VX, VY, VZ);
+  args.Granularity = 1;
+  args.B[0] = coarse;
+  args.P[0] = fine;
+  args.S[0] = scale;
+  if( mfUseSerial(threader) ){ args.Kernel(&args, 0, args.Size); return; }
+  mfRunKernel(threader, args);
+}
@@ -7,6 +7,9 @@
 #define VTKMAXFLOWSEGMENTATIONUTILITIES_H
 
 #include "vtkRobartsCommonExport.h"
+#include "vtkType.h"
+
+class vtkMultiThreader;
 
 void zeroOutBuffer(float* buffer, int size);
 void setBufferToValue(float* buffer, float value, int size);
@@ -21,6 +24,8 @@ void lblBuffer( float* label, float* sink, float* cap, int size );
 void constrainBuffer( float* sink, float* cap, int size );
 void updateLeafSinkFlow(float* sink, float* inc, float* div, float* label, float CC, int size);
 void updateLabel(float* sink, float* inc, float* div, float* label, float CC, int size);
+// As updateLabel, but also returns the sum of the absolute changes made to the label
+double updateLabelAndSumChange(float* sink, float* inc, float* div, float* label, float CC, int size);
 void storeSourceFlowInBuffer(float* working, float* sink, float* div, float* label, float CC, int size);
 void storeSinkFlowInBuffer(float* working, float* inc, float* div, float* label, float CC, int size);
 
@@ -37,6 +42,77 @@ void ghmf_applyStep(float* div, float* flowX, float* flowY, float* flowZ, int VX
 void ghmf_computeFlowMag(float* div, float* flowX, float* flowY, float* flowZ, float* smooth, float alpha, int VX, int VY, int VZ, int size );
 void ghmf_projectOntoSet(float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size);
 
+// Multithreaded versions of the above. The buffers are split into contiguous, row-aligned
+// slabs which are handed to the threads of the given threader, and the inner loops are
+// written branch-free per row so the compiler can vectorize them. Each voxel is computed
+// with the same sequence of operations as the serial version. If the threader is null or
+// has only a single thread, the serial version is called instead.
+void zeroOutBuffer(vtkMultiThreader* threader, float* buffer, int size);
+void setBufferToValue(vtkMultiThreader* threader, float* buffer, float value, int size);
+void translateBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, float shift, float scale, int size);
+void sumBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size);
+void sumScaledBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, float scale, int size);
+void copyBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size);
+void minBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size);
+void divBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, int size);
+void divAndStoreBuffer(vtkMultiThreader* threader, float* bufferOut, float* bufferIn, float value, int size);
+void lblBuffer(vtkMultiThreader* threader, float* label, float* sink, float* cap, int size );
+void constrainBuffer(vtkMultiThreader* threader, float* sink, float* cap, int size );
+void updateLeafSinkFlow(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float CC, int size);
+void updateLabel(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float CC, int size);
+double updateLabelAndSumChange(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float CC, int size);
+void storeSourceFlowInBuffer(vtkMultiThreader* threader, float* working, float* sink, float* div, float* label, float CC, int size);
+void storeSinkFlowInBuffer(vtkMultiThreader* threader, float* working, float* inc, float* div, float* label, float CC, int size);
+
+void dagmf_storeSourceFlowInBuffer(vtkMultiThreader* threader, float* working, float* sink, float* div, float* label, float* source, float* exclude, float CC, float multiplicity, int size);
+void dagmf_storeSinkFlowInBuffer(vtkMultiThreader* threader, float* working, float* inc, float* div, float* label, float* sink, float multiplicity, float CC, int size);
+void dagmf_flowGradientStep(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float StepSize, float CC, int size);
+void dagmf_applyStep(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size);
+void dagmf_computeFlowMag(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, float* smooth, float alpha, int VX, int VY, int VZ, int size );
+void dagmf_projectOntoSet(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size);
+
+void ghmf_flowGradientStep(vtkMultiThreader* threader, float* sink, float* inc, float* div, float* label, float StepSize, float CC, int size);
+void ghmf_applyStep(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size);
+void ghmf_computeFlowMag(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, float* smooth, float alpha, int VX, int VY, int VZ, int size );
+void ghmf_projectOntoSet(vtkMultiThreader* threader, float* div, float* flowX, float* flowY, float* flowZ, int VX, int VY, int VZ, int size);
+
+// Fused spatial flow update for a single node, equivalent to calling flowGradientStep, applyStep,
+// computeFlowMag and projectOntoSet in turn, but done in a single pass over the volume one z-slice
+// at a time. This touches each of the node's buffers once per iteration rather than once per kernel.
+// The results are identical to the multithreaded versions above. Runs in the calling thread, so
+// independent nodes can be updated concurrently.
+void ghmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label, float* flowX, float* flowY, float* flowZ,
+                             float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size);
+void dagmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label, float* flowX, float* flowY, float* flowZ,
+                              float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size);
+
+// As above, but with the spatial flows stored as 16-bit half precision or, if bfloat16 is set, bfloat16
+// values. All arithmetic is in single precision and the flows are rounded to nearest even when stored.
+// The div buffer holds intermediate results and remains single precision.
+void ghmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label,
+                             vtkTypeUInt16* flowX, vtkTypeUInt16* flowY, vtkTypeUInt16* flowZ, bool bfloat16,
+                             float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size);
+void dagmf_updateSpatialFlows(float* sink, float* inc, float* div, float* label,
+                              vtkTypeUInt16* flowX, vtkTypeUInt16* flowY, vtkTypeUInt16* flowZ, bool bfloat16,
+                              float* smooth, float alpha, float StepSize, float CC, int VX, int VY, int VZ, int size);
+
+// Resampling between the levels of the multi-resolution solve. Each coarse volume is half the size of
+// the fine one in each direction, rounded up, and the fine dimensions are given. downsampleBuffer
+// averages each 2x2x2 block of fine voxels (clipped at the far edges) into a coarse voxel. prolongBuffer
+// copies each coarse voxel, times the scale, into the fine voxels it covers, and can store the result in
+// either of the 16-bit formats used for the spatial flows.
+void downsampleBuffer(vtkMultiThreader* threader, float* coarse, float* fine, int VX, int VY, int VZ);
+void prolongBuffer(vtkMultiThreader* threader, float* fine, float* coarse, float scale, int VX, int VY, int VZ);
+void prolongBuffer(vtkMultiThreader* threader, vtkTypeUInt16* fine, float* coarse, float scale, bool bfloat16,
+                   int VX, int VY, int VZ);
 
+// Single allocation arena for the working buffers of the CPU solvers. Each buffer is padded to a
+// whole number of 64-byte cache lines, so every buffer in the arena starts on a cache line boundary.
+// acquireArena returns an aligned pointer to at least the requested number of bytes, reusing the
+// existing allocation if it is large enough, or null (with the arena released) if it cannot be
+// allocated. All sizes are in 64-bit arithmetic.
+vtkTypeInt64 arenaBufferStride(int size);
+float* acquireArena(char** allocation, vtkTypeInt64* capacity, vtkTypeInt64 bytes);
+void releaseArena(char** allocation, vtkTypeInt64* capacity);
 
 #endif
\ No newline at end of file
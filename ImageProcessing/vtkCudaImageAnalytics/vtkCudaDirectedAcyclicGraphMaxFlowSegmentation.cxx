@@ -158,12 +158,6 @@ int vtkCudaDirectedAcyclicGraphMaxFlowSegmentation::InitializeAlgorithm()
     {
       vtkErrorMacro("Could not allocate sufficient GPU buffers.");
       Scheduler->Clear();
-      while( CPUBuffersAcquired.size() > 0 )
-      {
-        float* tempBuffer = CPUBuffersAcquired.front();
-        delete[] tempBuffer;
-        CPUBuffersAcquired.pop_front();
-      }
     }
   }
 
@@ -48,6 +48,8 @@ protected:
 
   virtual int InitializeAlgorithm();
   virtual int RunAlgorithm();
+  virtual int SupportsPackedFlowStorage() { return 0; } //the GPU keeps its own single precision copies
+  virtual int SupportsMultiResolution() { return 0; }
 
   double  MaxGPUUsage;
   void PropogateLabels(vtkIdType currNode);
@@ -148,12 +148,6 @@ int vtkCudaHierarchicalMaxFlowSegmentation2::InitializeAlgorithm()
     {
       vtkErrorMacro("Could not allocate sufficient GPU buffers.");
       Scheduler->Clear();
-      while( CPUBuffersAcquired.size() > 0 )
-      {
-        float* tempBuffer = CPUBuffersAcquired.front();
-        delete[] tempBuffer;
-        CPUBuffersAcquired.pop_front();
-      }
     }
 
   }
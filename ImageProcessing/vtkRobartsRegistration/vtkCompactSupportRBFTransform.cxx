@@ -18,11 +18,19 @@
 #include "vtkCompactSupportRBFTransform.h"
 
 #include "vtkMath.h"
+#include "vtkMultiThreader.h"
 #include "vtkObjectFactory.h"
 #include "vtkPoints.h"
 
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
 vtkStandardNewMacro(vtkCompactSupportRBFTransform);
 
+// the largest displacement field that will be built, in nodes
+#define VTK_RBF_MAX_FIELD_NODES 67108864.0
+
 //------------------------------------------------------------------------
 // some dull matrix things
 
@@ -94,6 +102,358 @@ inline void vtkMatrixTranspose(double **a, double **b, int rows, int cols)
     }
 }
 
+//------------------------------------------------------------------------
+// The source landmarks sorted into a uniform grid of cells, along with
+// their weights, so that every cell is a contiguous run of landmarks.
+class vtkCompactSupportRBFLandmarkGrid
+{
+public:
+  std::vector<double> Landmarks; // 3 per landmark, in cell order
+  std::vector<double> Weights;   // 3 per landmark, in cell order
+  std::vector<int> PointIds;     // original index of each landmark
+  std::vector<int> CellStart;    // first landmark of each cell
+  int Dimensions[3];
+  double Origin[3];
+  double InverseSpacing;         // zero if the support is unbounded
+
+  // Bucket the points into cells at least as large as the support. If the
+  // support is not positive, all the points go in a single cell.
+  void Build(vtkPoints *points, double support)
+  {
+    int n = points->GetNumberOfPoints();
+    double bounds[6];
+    points->GetBounds(bounds);
+
+    this->InverseSpacing = 0.0;
+    for (int a = 0; a < 3; a++)
+      {
+      this->Origin[a] = bounds[2*a];
+      this->Dimensions[a] = 1;
+      }
+    if (support > 0.0 && n > 0)
+      {
+      // keep the number of cells in proportion to the number of points
+      double spacing = support*(1.0 + 1.0e-9);
+      double maxCells = 8.0*n + 4096.0;
+      for (;;)
+        {
+        double numCells = 1.0;
+        for (int a = 0; a < 3; a++)
+          {
+          numCells *= floor((bounds[2*a+1] - bounds[2*a])/spacing) + 1.0;
+          }
+        if (numCells <= maxCells)
+          {
+          break;
+          }
+        spacing *= pow(numCells/maxCells, 1.0/3.0) * (1.0 + 1.0e-9);
+        }
+      this->InverseSpacing = 1.0/spacing;
+      for (int a = 0; a < 3; a++)
+        {
+        this->Dimensions[a] = (int)((bounds[2*a+1] - bounds[2*a])*this->InverseSpacing) + 1;
+        }
+      }
+
+    // counting sort of the points into their cells
+    int numCells = this->Dimensions[0]*this->Dimensions[1]*this->Dimensions[2];
+    std::vector<int> pointCells(n);
+    this->CellStart.assign(numCells+1, 0);
+    for (int i = 0; i < n; i++)
+      {
+      double p[3];
+      int cell[3];
+      points->GetPoint(i, p);
+      for (int a = 0; a < 3; a++)
+        {
+        cell[a] = (int)((p[a] - this->Origin[a])*this->InverseSpacing);
+        cell[a] = (cell[a] < this->Dimensions[a]) ? cell[a] : this->Dimensions[a]-1;
+        }
+      pointCells[i] = cell[0] + this->Dimensions[0]*(cell[1] + this->Dimensions[1]*cell[2]);
+      this->CellStart[pointCells[i]+1]++;
+      }
+    for (int c = 0; c < numCells; c++)
+      {
+      this->CellStart[c+1] += this->CellStart[c];
+      }
+    std::vector<int> next(this->CellStart.begin(), this->CellStart.end()-1);
+    this->Landmarks.resize(3*n);
+    this->Weights.assign(3*n, 0.0);
+    this->PointIds.resize(n);
+    for (int i = 0; i < n; i++)
+      {
+      int j = next[pointCells[i]]++;
+      points->GetPoint(i, &this->Landmarks[3*j]);
+      this->PointIds[j] = i;
+      }
+  }
+
+  // Copy the weights, given in the original order of the landmarks.
+  void SetWeights(double **W)
+  {
+    for (size_t j = 0; j < this->PointIds.size(); j++)
+      {
+      for (int d = 0; d < 3; d++)
+        {
+        this->Weights[3*j+d] = W[this->PointIds[j]][d];
+        }
+      }
+  }
+
+  // Find the runs of landmarks in the cells neighbouring a point, which
+  // hold every landmark within the support of the point. The range of
+  // cells searched is returned so that it can be reused.
+  int FindRuns(const double p[3], int runs[18], int range[6]) const
+  {
+    if (this->InverseSpacing == 0.0)
+      {
+      range[0] = range[1] = range[2] = range[3] = range[4] = range[5] = 0;
+      runs[0] = 0;
+      runs[1] = this->CellStart[1];
+      return 1;
+      }
+
+    for (int a = 0; a < 3; a++)
+      {
+      double c = floor((p[a] - this->Origin[a])*this->InverseSpacing);
+      range[2*a] = (c - 1.0 > 0.0) ? (int)(c - 1.0) : 0;
+      range[2*a+1] = (c + 1.0 < this->Dimensions[a] - 1) ? (int)(c + 1.0) : this->Dimensions[a] - 1;
+      if (range[2*a] > range[2*a+1])
+        {
+        // the empty range, the same for every point outside the grid
+        range[0] = range[2] = range[4] = 1;
+        range[1] = range[3] = range[5] = 0;
+        return 0;
+        }
+      }
+
+    int numRuns = 0;
+    for (int k = range[4]; k <= range[5]; k++)
+      {
+      for (int j = range[2]; j <= range[3]; j++)
+        {
+        int row = this->Dimensions[0]*(j + this->Dimensions[1]*k);
+        int first = this->CellStart[row + range[0]];
+        int last = this->CellStart[row + range[1] + 1];
+        if (first < last)
+          {
+          runs[2*numRuns] = first;
+          runs[2*numRuns+1] = last;
+          numRuns++;
+          }
+        }
+      }
+    return numRuns;
+  }
+};
+
+//------------------------------------------------------------------------
+// The displacements of the transform sampled on a regular grid of nodes,
+// stored as single precision with x varying fastest.
+class vtkCompactSupportRBFDisplacementField
+{
+public:
+  std::vector<float> Displacements; // 3 per node
+  int Dimensions[3];
+  double Origin[3];
+  double Spacing;
+  double InverseSpacing;            // zero if there is no field
+
+  vtkCompactSupportRBFDisplacementField()
+  {
+    this->Clear();
+  }
+
+  void Clear()
+  {
+    std::vector<float>().swap(this->Displacements);
+    for (int a = 0; a < 3; a++)
+      {
+      this->Dimensions[a] = 0;
+      this->Origin[a] = 0.0;
+      }
+    this->Spacing = 0.0;
+    this->InverseSpacing = 0.0;
+  }
+
+  // Lay out nodes at the given spacing that cover the bounds. Returns false,
+  // leaving the field empty, if the spacing would need too many nodes.
+  bool Allocate(const double bounds[6], double spacing)
+  {
+    this->Clear();
+    if (!(spacing > 0.0))
+      {
+      return false;
+      }
+
+    int dims[3];
+    double numNodes = 1.0;
+    for (int a = 0; a < 3; a++)
+      {
+      double n = ceil((bounds[2*a+1] - bounds[2*a])/spacing) + 1.0;
+      n = (n > 2.0) ? n : 2.0;
+      numNodes *= n;
+      if (numNodes > VTK_RBF_MAX_FIELD_NODES)
+        {
+        return false;
+        }
+      dims[a] = (int) n;
+      }
+
+    for (int a = 0; a < 3; a++)
+      {
+      this->Dimensions[a] = dims[a];
+      this->Origin[a] = bounds[2*a];
+      }
+    this->Spacing = spacing;
+    this->InverseSpacing = 1.0/spacing;
+    this->Displacements.resize(3*(size_t) numNodes);
+    return true;
+  }
+
+  // Interpolate the displacement at a point trilinearly. Returns false if
+  // there is no field or the point is outside of it.
+  template<class T>
+  bool Interpolate(const T point[3], double displacement[3]) const
+  {
+    if (this->InverseSpacing == 0.0)
+      {
+      return false;
+      }
+
+    int idx[3];
+    double f[3];
+    for (int a = 0; a < 3; a++)
+      {
+      double x = (point[a] - this->Origin[a])*this->InverseSpacing;
+      if (!(x >= 0.0 && x <= this->Dimensions[a] - 1))
+        {
+        return false;
+        }
+      int i = (int) x;
+      i = (i < this->Dimensions[a] - 2) ? i : this->Dimensions[a] - 2;
+      idx[a] = i;
+      f[a] = x - i;
+      }
+
+    size_t sx = 3;
+    size_t sy = sx*this->Dimensions[0];
+    size_t sz = sy*this->Dimensions[1];
+    const float *v = &this->Displacements[sx*idx[0] + sy*idx[1] + sz*idx[2]];
+    for (int d = 0; d < 3; d++)
+      {
+      double c00 = v[d] + f[0]*(v[sx+d] - v[d]);
+      double c10 = v[sy+d] + f[0]*(v[sy+sx+d] - v[sy+d]);
+      double c01 = v[sz+d] + f[0]*(v[sz+sx+d] - v[sz+d]);
+      double c11 = v[sz+sy+d] + f[0]*(v[sz+sy+sx+d] - v[sz+sy+d]);
+      double c0 = c00 + f[1]*(c10 - c00);
+      double c1 = c01 + f[1]*(c11 - c01);
+      displacement[d] = c0 + f[2]*(c1 - c0);
+      }
+    return true;
+  }
+};
+
+//------------------------------------------------------------------------
+// Solve L*W = X for the weights with the conjugate gradient method, where
+// L is the sparse matrix of the basis evaluated between landmarks within
+// the support of each other. Everything is in the cell order of the grid.
+// Returns false if the iteration fails to converge, e.g. if L is singular.
+static bool vtkCompactSupportRBFSolveSparse(vtkCompactSupportRBFLandmarkGrid *grid,
+                                            double (*phi)(double), double sigma,
+                                            double **X, double **W)
+{
+  int N = (int) grid->PointIds.size();
+  double invSigma = 1.0/sigma;
+
+  // gather the non-zero entries of L by rows
+  std::vector<int> rowStart(1, 0);
+  std::vector<int> columns;
+  std::vector<double> values;
+  for (int q = 0; q < N; q++)
+    {
+    const double *p = &grid->Landmarks[3*q];
+    int runs[18], range[6];
+    int numRuns = grid->FindRuns(p, runs, range);
+    for (int run = 0; run < numRuns; run++)
+      {
+      for (int c = runs[2*run]; c < runs[2*run+1]; c++)
+        {
+        const double *p2 = &grid->Landmarks[3*c];
+        double dx = p[0]-p2[0], dy = p[1]-p2[1], dz = p[2]-p2[2];
+        double U = phi(sqrt(dx*dx + dy*dy + dz*dz)*invSigma);
+        if (U != 0.0)
+          {
+          columns.push_back(c);
+          values.push_back(U);
+          }
+        }
+      }
+    rowStart.push_back((int) columns.size());
+    }
+
+  std::vector<double> x(N), r(N), p(N), Ap(N);
+  int maxIterations = 10*N + 100;
+  for (int d = 0; d < 3; d++)
+    {
+    double bb = 0.0;
+    for (int q = 0; q < N; q++)
+      {
+      x[q] = 0.0;
+      r[q] = p[q] = X[grid->PointIds[q]][d];
+      bb += r[q]*r[q];
+      }
+    double rr = bb;
+    double tolerance = 1.0e-20*bb;
+
+    int iteration = 0;
+    for (; iteration < maxIterations && rr > tolerance; iteration++)
+      {
+      double pAp = 0.0;
+      for (int q = 0; q < N; q++)
+        {
+        double sum = 0.0;
+        for (int e = rowStart[q]; e < rowStart[q+1]; e++)
+          {
+          sum += values[e]*p[columns[e]];
+          }
+        Ap[q] = sum;
+        pAp += p[q]*sum;
+        }
+      if (!(pAp > 0.0))
+        {
+        return false;
+        }
+
+      double alpha = rr/pAp;
+      double rrNew = 0.0;
+      for (int q = 0; q < N; q++)
+        {
+        x[q] += alpha*p[q];
+        r[q] -= alpha*Ap[q];
+        rrNew += r[q]*r[q];
+        }
+      double beta = rrNew/rr;
+      rr = rrNew;
+      for (int q = 0; q < N; q++)
+        {
+        p[q] = r[q] + beta*p[q];
+        }
+      }
+    if (rr > tolerance)
+      {
+      return false;
+      }
+
+    for (int q = 0; q < N; q++)
+      {
+      W[grid->PointIds[q]][d] = x[q];
+      }
+    }
+
+  return true;
+}
+
 //------------------------------------------------------------------------
 vtkCompactSupportRBFTransform::vtkCompactSupportRBFTransform()
 {
@@ -113,6 +473,19 @@ vtkCompactSupportRBFTransform::vtkCompactSupportRBFTransform()
 
   this->NumberOfPoints = 0;
   this->MatrixW = NULL;
+  this->LandmarkGrid = new vtkCompactSupportRBFLandmarkGrid;
+
+  this->UseDisplacementField = 0;
+  this->DisplacementFieldSpacing = 1.0;
+  this->DisplacementFieldDimensions[0] = 0;
+  this->DisplacementFieldDimensions[1] = 0;
+  this->DisplacementFieldDimensions[2] = 0;
+  this->DisplacementFieldMaximumError = 0.0;
+  this->DisplacementFieldRMSError = 0.0;
+  this->DisplacementField = new vtkCompactSupportRBFDisplacementField;
+
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
 }
 
 //------------------------------------------------------------------------
@@ -131,6 +504,9 @@ vtkCompactSupportRBFTransform::~vtkCompactSupportRBFTransform()
     vtkDeleteMatrix(this->MatrixW);
     this->MatrixW = NULL;
     }
+  delete this->LandmarkGrid;
+  delete this->DisplacementField;
+  this->Threader->Delete();
 }
 
 //------------------------------------------------------------------------
@@ -196,71 +572,35 @@ vtkMTimeType vtkCompactSupportRBFTransform::GetMTime()
 }
 
 //------------------------------------------------------------------------
-void vtkCompactSupportRBFTransform::InternalUpdate()
+// Solve L*W = X for the weights, where L is the dense matrix of the basis
+// evaluated between every pair of landmarks.
+static void vtkCompactSupportRBFSolveDense(vtkPoints *source, double (*phi)(double),
+                                           double sigma, double **X, double **W, int N)
 {
-  if (this->SourceLandmarks == NULL || this->TargetLandmarks == NULL)
-    {
-    if (this->MatrixW)
-      {
-      vtkDeleteMatrix(this->MatrixW);
-      }
-    this->MatrixW = NULL;
-    this->NumberOfPoints = 0;
-    return;
-    }
-
-  if (this->SourceLandmarks->GetNumberOfPoints() !=
-      this->TargetLandmarks->GetNumberOfPoints())
-    {
-    vtkErrorMacro("Update: Source and Target Landmarks contain a different number of points");
-    return;
-    }
-
-  const vtkIdType N = this->SourceLandmarks->GetNumberOfPoints();
   const int D = 3; // dimensions
 
-  // Notation and inspiration from:
-  // Fred L. Bookstein (1997) "Shape and the Information in Medical Images:
-  // A Decade of the Morphometric Synthesis" Computer Vision and Image
-  // Understanding 66(2):97-118
-  // and online work published by Tim Cootes (http://www.wiau.man.ac.uk/~bim)
-
-  // the output weights and input matrices
-  double **W = vtkNewMatrix(N,D);
   double **L = vtkNewMatrix(N,N);
-  double **X = vtkNewMatrix(N,D);
 
   int q,c;
   double p[3],p2[3];
   double dx,dy,dz;
   double r;
-  double (*phi)(double) = this->BasisFunction;
 
   for(q = 0; q < N; q++)
     {
-      this->SourceLandmarks->GetPoint(q,p);
+      source->GetPoint(q,p);
       // fill in the diagonal of L
       L[q][q] = phi(0.0);
       // fill the rest of L using symmetry
       for(c = 0; c < q; c++)
         {
-        this->SourceLandmarks->GetPoint(c,p2);
+        source->GetPoint(c,p2);
         dx = p[0]-p2[0]; dy = p[1]-p2[1]; dz = p[2]-p2[2];
         r = sqrt(dx*dx + dy*dy + dz*dz);
-        L[q][c] = L[c][q] = phi(r/this->Sigma);
+        L[q][c] = L[c][q] = phi(r/sigma);
         }
       }
 
-  // build X - matrix of DISPLACEMENTS
-  for (q = 0; q < N; q++)
-    {
-      this->SourceLandmarks->GetPoint(q,p);
-      this->TargetLandmarks->GetPoint(q,p2);
-      X[q][0] = p2[0] - p[0];
-      X[q][1] = p2[1] - p[1];
-      X[q][2] = p2[2] - p[2];
-    }
-
   // solve for W, where W = Inverse(L)*X;
   // this is done via eigenvector decomposition so
   // that we can avoid singular values
@@ -268,6 +608,7 @@ void vtkCompactSupportRBFTransform::InternalUpdate()
   double **w = vtkNewMatrix(N,N);
   double **V = vtkNewMatrix(N,N);
   double **U = L;  // reuse the space
+  double **T = vtkNewMatrix(N,D);
   double *values = new double[N];
   vtkMath::JacobiN(L,N,values,V);
   vtkMatrixTranspose(V,U,N,N);
@@ -299,12 +640,83 @@ void vtkCompactSupportRBFTransform::InternalUpdate()
 
 
   vtkMatrixMultiply(U,X,W,N,N,N,D);
-  vtkMatrixMultiply(w,W,X,N,N,N,D);
-  vtkMatrixMultiply(V,X,W,N,N,N,D);
+  vtkMatrixMultiply(w,W,T,N,N,N,D);
+  vtkMatrixMultiply(V,T,W,N,N,N,D);
 
   vtkDeleteMatrix(V);
   vtkDeleteMatrix(w);
   vtkDeleteMatrix(U);
+  vtkDeleteMatrix(T);
+}
+
+//------------------------------------------------------------------------
+void vtkCompactSupportRBFTransform::InternalUpdate()
+{
+  this->DisplacementField->Clear();
+  this->DisplacementFieldDimensions[0] = 0;
+  this->DisplacementFieldDimensions[1] = 0;
+  this->DisplacementFieldDimensions[2] = 0;
+  this->DisplacementFieldMaximumError = 0.0;
+  this->DisplacementFieldRMSError = 0.0;
+
+  if (this->SourceLandmarks == NULL || this->TargetLandmarks == NULL)
+    {
+    if (this->MatrixW)
+      {
+      vtkDeleteMatrix(this->MatrixW);
+      }
+    this->MatrixW = NULL;
+    this->NumberOfPoints = 0;
+    return;
+    }
+
+  if (this->SourceLandmarks->GetNumberOfPoints() !=
+      this->TargetLandmarks->GetNumberOfPoints())
+    {
+    vtkErrorMacro("Update: Source and Target Landmarks contain a different number of points");
+    return;
+    }
+
+  const vtkIdType N = this->SourceLandmarks->GetNumberOfPoints();
+  const int D = 3; // dimensions
+
+  // Notation and inspiration from:
+  // Fred L. Bookstein (1997) "Shape and the Information in Medical Images:
+  // A Decade of the Morphometric Synthesis" Computer Vision and Image
+  // Understanding 66(2):97-118
+  // and online work published by Tim Cootes (http://www.wiau.man.ac.uk/~bim)
+
+  // the output weights and input matrices
+  double **W = vtkNewMatrix(N,D);
+  double **X = vtkNewMatrix(N,D);
+
+  int q;
+  double p[3],p2[3];
+
+  // build X - matrix of DISPLACEMENTS
+  for (q = 0; q < N; q++)
+    {
+      this->SourceLandmarks->GetPoint(q,p);
+      this->TargetLandmarks->GetPoint(q,p2);
+      X[q][0] = p2[0] - p[0];
+      X[q][1] = p2[1] - p[1];
+      X[q][2] = p2[2] - p[2];
+    }
+
+  // the built-in bases vanish beyond Sigma, so only nearby landmarks
+  // interact and L is sparse; a custom basis may have any support
+  double support = (this->Basis == VTK_RBF_CUSTOM) ? 0.0 : this->Sigma;
+  this->LandmarkGrid->Build(this->SourceLandmarks, support);
+
+  if (support <= 0.0 ||
+      !vtkCompactSupportRBFSolveSparse(this->LandmarkGrid, this->BasisFunction,
+                                       this->Sigma, X, W))
+    {
+    vtkCompactSupportRBFSolveDense(this->SourceLandmarks, this->BasisFunction,
+                                   this->Sigma, X, W, N);
+    }
+  this->LandmarkGrid->SetWeights(W);
+
   vtkDeleteMatrix(X);
 
   if (this->MatrixW)
@@ -313,15 +725,62 @@ void vtkCompactSupportRBFTransform::InternalUpdate()
     }
   this->MatrixW = W;
   this->NumberOfPoints = N;
+
+  // bake the displacements now that the weights are known
+  if (this->UseDisplacementField && N > 0)
+    {
+    if (this->BuildDisplacementField(this->DisplacementField,
+                                     this->DisplacementFieldSpacing,
+                                     this->DisplacementFieldMaximumError,
+                                     this->DisplacementFieldRMSError))
+      {
+      for (int a = 0; a < 3; a++)
+        {
+        this->DisplacementFieldDimensions[a] = this->DisplacementField->Dimensions[a];
+        }
+      }
+    else
+      {
+      vtkErrorMacro("Update: DisplacementFieldSpacing " << this->DisplacementFieldSpacing
+                    << " is too small for the extent of the landmarks, no displacement field is used");
+      }
+    }
+}
+
+//------------------------------------------------------------------------
+// Add the perturbations from a run of landmarks, stored as in the grid.
+template<class T>
+inline void vtkCompactSupportRBFAccumulate(const double *landmarks,
+                                           const double *weights,
+                                           int first, int last,
+                                           double (*phi)(double), double invSigma,
+                                           const T point[3], double sum[3])
+{
+  double x = sum[0], y = sum[1], z = sum[2];
+  for(int i = first; i < last; i++)
+    {
+      const double *p = landmarks + 3*i;
+      const double *w = weights + 3*i;
+      double dx = point[0]-p[0], dy = point[1]-p[1], dz = point[2]-p[2];
+      double r = sqrt(dx*dx + dy*dy + dz*dz);
+      double U = phi(r*invSigma);
+      x += U*w[0];
+      y += U*w[1];
+      z += U*w[2];
+    }
+  sum[0] = x;
+  sum[1] = y;
+  sum[2] = z;
 }
 
 //------------------------------------------------------------------------
 // The matrix W was created by Update.  Not much has to be done to
 // apply the transform:  do an affine transformation, then do
-// perturbations based on the landmarks.
+// perturbations based on the landmarks within the support of the point.
 template<class T>
 inline void vtkCompactSupportRBFForwardTransformPoint(vtkCompactSupportRBFTransform *self,
-                                                    double **W, int N,
+                                                    vtkCompactSupportRBFLandmarkGrid *grid,
+                                                    int N,
                                                     double (*phi)(double),
                                                     const T point[3], T output[3])
 {
@@ -333,42 +792,40 @@ inline void vtkCompactSupportRBFForwardTransformPoint(vtkCompactSupportRBFTransf
       return;
     }
 
-  double dx,dy,dz;
-  double p[3];
-  double U,r;
   double invSigma = 1.0/self->GetSigma();
-  double sigma = self->GetSigma();
-  double x = 0, y = 0, z = 0;
-
-  vtkPoints *sourceLandmarks = self->GetSourceLandmarks();
+  double sum[3] = {0, 0, 0};
+  double p[3] = {point[0], point[1], point[2]};
 
   // Do the nonlinear stuff
-  for(vtkIdType i = 0; i < N; i++)
+  int runs[18], range[6];
+  int numRuns = grid->FindRuns(p, runs, range);
+  for(int run = 0; run < numRuns; run++)
     {
-      sourceLandmarks->GetPoint(i,p);
-      dx = point[0]-p[0]; dy = point[1]-p[1]; dz = point[2]-p[2];
-      r = sqrt(dx*dx + dy*dy + dz*dz);
-      U = phi(r*invSigma);
-      x += U*W[i][0];
-      y += U*W[i][1];
-      z += U*W[i][2];
+      vtkCompactSupportRBFAccumulate(&grid->Landmarks[0], &grid->Weights[0],
+                                     runs[2*run], runs[2*run+1],
+                                     phi, invSigma, point, sum);
     }
 
   // finish off with adding the displacement to the starting location
-  x += point[0];
-  y += point[1];
-  z += point[2];
-
-  output[0] = x;
-  output[1] = y;
-  output[2] = z;
+  output[0] = sum[0] + point[0];
+  output[1] = sum[1] + point[1];
+  output[2] = sum[2] + point[2];
 
 }
 
 void vtkCompactSupportRBFTransform::ForwardTransformPoint(const double point[3],
                 double output[3])
 {
-  vtkCompactSupportRBFForwardTransformPoint(this, this->MatrixW,
+  double displacement[3];
+  if (this->DisplacementField->Interpolate(point, displacement))
+    {
+    output[0] = point[0] + displacement[0];
+    output[1] = point[1] + displacement[1];
+    output[2] = point[2] + displacement[2];
+    return;
+    }
+
+  vtkCompactSupportRBFForwardTransformPoint(this, this->LandmarkGrid,
               this->NumberOfPoints,
               this->BasisFunction,
               point, output);
@@ -377,18 +834,283 @@ void vtkCompactSupportRBFTransform::ForwardTransformPoint(const double point[3],
 void vtkCompactSupportRBFTransform::ForwardTransformPoint(const float point[3],
                 float output[3])
 {
-  vtkCompactSupportRBFForwardTransformPoint(this, this->MatrixW,
+  double displacement[3];
+  if (this->DisplacementField->Interpolate(point, displacement))
+    {
+    output[0] = point[0] + displacement[0];
+    output[1] = point[1] + displacement[1];
+    output[2] = point[2] + displacement[2];
+    return;
+    }
+
+  vtkCompactSupportRBFForwardTransformPoint(this, this->LandmarkGrid,
               this->NumberOfPoints,
               this->BasisFunction,
               point, output);
 }
 
+//----------------------------------------------------------------------------
+// Transform a series of points, gathering the landmarks near each point into
+// a contiguous buffer that is kept for as long as the following points need
+// the same cells.
+void vtkCompactSupportRBFTransform::TransformPoints(vtkPoints *inPts,
+                                                    vtkPoints *outPts)
+{
+  this->Update();
+  if (this->InverseFlag || this->NumberOfPoints == 0)
+    {
+    this->Superclass::TransformPoints(inPts, outPts);
+    return;
+    }
+
+  vtkCompactSupportRBFLandmarkGrid *grid = this->LandmarkGrid;
+  double invSigma = 1.0/this->Sigma;
+  std::vector<double> landmarks, weights;
+  int cachedRange[6] = {1, 0, 1, 0, 1, 0};
+  int n = inPts->GetNumberOfPoints();
+
+  for (int i = 0; i < n; i++)
+    {
+    double point[3], displacement[3];
+    inPts->GetPoint(i, point);
+
+    if (this->DisplacementField->Interpolate(point, displacement))
+      {
+      outPts->InsertNextPoint(point[0] + displacement[0], point[1] + displacement[1],
+                              point[2] + displacement[2]);
+      continue;
+      }
+
+    int runs[18], range[6];
+    int numRuns = grid->FindRuns(point, runs, range);
+    if (!std::equal(range, range+6, cachedRange))
+      {
+      landmarks.clear();
+      weights.clear();
+      for (int run = 0; run < numRuns; run++)
+        {
+        landmarks.insert(landmarks.end(), grid->Landmarks.begin() + 3*runs[2*run],
+                         grid->Landmarks.begin() + 3*runs[2*run+1]);
+        weights.insert(weights.end(), grid->Weights.begin() + 3*runs[2*run],
+                       grid->Weights.begin() + 3*runs[2*run+1]);
+        }
+      std::copy(range, range+6, cachedRange);
+      }
+
+    double sum[3] = {0, 0, 0};
+    if (!landmarks.empty())
+      {
+      vtkCompactSupportRBFAccumulate(&landmarks[0], &weights[0],
+                                     0, (int) landmarks.size()/3,
+                                     this->BasisFunction, invSigma, point, sum);
+      }
+    outPts->InsertNextPoint(sum[0] + point[0], sum[1] + point[1], sum[2] + point[2]);
+    }
+}
+
+//----------------------------------------------------------------------------
+namespace
+{
+  struct vtkCompactSupportRBFFieldThreadStruct
+  {
+    vtkCompactSupportRBFTransform *Transform;
+    vtkCompactSupportRBFLandmarkGrid *Grid;
+    vtkCompactSupportRBFDisplacementField *Field;
+    int NumberOfPoints;
+    double (*BasisFunction)(double);
+    std::vector<double> MaximumError;     // one per thread
+    std::vector<double> SumSquaredError;  // one per thread
+  };
+}
+
+//----------------------------------------------------------------------------
+static void vtkCompactSupportRBFGetRange(int n, int threadId, int threadCount, int &first, int &last)
+{
+  first = (int)(((vtkTypeInt64) n * threadId) / threadCount);
+  last = (int)(((vtkTypeInt64) n * (threadId + 1)) / threadCount);
+}
+
+//----------------------------------------------------------------------------
+// Evaluate the transform exactly at the nodes of a slab of the field.
+static VTK_THREAD_RETURN_TYPE vtkCompactSupportRBFFillFieldExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkCompactSupportRBFFieldThreadStruct *str = static_cast<vtkCompactSupportRBFFieldThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  vtkCompactSupportRBFDisplacementField *field = str->Field;
+  const int *dims = field->Dimensions;
+  int first, last;
+  vtkCompactSupportRBFGetRange(dims[2], threadId, threadCount, first, last);
+
+  float *v = &field->Displacements[3*(size_t)dims[0]*dims[1]*first];
+  for (int k = first; k < last; k++)
+    {
+    for (int j = 0; j < dims[1]; j++)
+      {
+      for (int i = 0; i < dims[0]; i++)
+        {
+        double point[3], output[3];
+        point[0] = field->Origin[0] + i*field->Spacing;
+        point[1] = field->Origin[1] + j*field->Spacing;
+        point[2] = field->Origin[2] + k*field->Spacing;
+        vtkCompactSupportRBFForwardTransformPoint(str->Transform, str->Grid,
+                                                  str->NumberOfPoints, str->BasisFunction,
+                                                  point, output);
+        v[0] = (float)(output[0] - point[0]);
+        v[1] = (float)(output[1] - point[1]);
+        v[2] = (float)(output[2] - point[2]);
+        v += 3;
+        }
+      }
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Compare the interpolated and the exact transform at the centres of the
+// cells of a slab of the field, where interpolation is least accurate.
+static VTK_THREAD_RETURN_TYPE vtkCompactSupportRBFFieldErrorExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkCompactSupportRBFFieldThreadStruct *str = static_cast<vtkCompactSupportRBFFieldThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  const vtkCompactSupportRBFDisplacementField *field = str->Field;
+  const int *dims = field->Dimensions;
+  int first, last;
+  vtkCompactSupportRBFGetRange(dims[2] - 1, threadId, threadCount, first, last);
+
+  double maximumError = 0.0;
+  double sumSquaredError = 0.0;
+  for (int k = first; k < last; k++)
+    {
+    for (int j = 0; j < dims[1] - 1; j++)
+      {
+      for (int i = 0; i < dims[0] - 1; i++)
+        {
+        double point[3], output[3], displacement[3];
+        point[0] = field->Origin[0] + (i + 0.5)*field->Spacing;
+        point[1] = field->Origin[1] + (j + 0.5)*field->Spacing;
+        point[2] = field->Origin[2] + (k + 0.5)*field->Spacing;
+        vtkCompactSupportRBFForwardTransformPoint(str->Transform, str->Grid,
+                                                  str->NumberOfPoints, str->BasisFunction,
+                                                  point, output);
+        field->Interpolate(point, displacement);
+        double dx = point[0] + displacement[0] - output[0];
+        double dy = point[1] + displacement[1] - output[1];
+        double dz = point[2] + displacement[2] - output[2];
+        double e2 = dx*dx + dy*dy + dz*dz;
+        sumSquaredError += e2;
+        maximumError = (e2 > maximumError) ? e2 : maximumError;
+        }
+      }
+    }
+  str->MaximumError[threadId] = sqrt(maximumError);
+  str->SumSquaredError[threadId] = sumSquaredError;
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+int vtkCompactSupportRBFTransform::BuildDisplacementField(
+  vtkCompactSupportRBFDisplacementField *field, double spacing,
+  double &maximumError, double &rmsError)
+{
+  maximumError = 0.0;
+  rmsError = 0.0;
+
+  // the displacement vanishes further than Sigma from the landmarks
+  double bounds[6];
+  this->SourceLandmarks->GetBounds(bounds);
+  for (int a = 0; a < 3; a++)
+    {
+    bounds[2*a] -= this->Sigma;
+    bounds[2*a+1] += this->Sigma;
+    }
+  if (!field->Allocate(bounds, spacing))
+    {
+    return 0;
+    }
+
+  vtkCompactSupportRBFFieldThreadStruct str;
+  str.Transform = this;
+  str.Grid = this->LandmarkGrid;
+  str.Field = field;
+  str.NumberOfPoints = this->NumberOfPoints;
+  str.BasisFunction = this->BasisFunction;
+  str.MaximumError.assign(this->NumberOfThreads, 0.0);
+  str.SumSquaredError.assign(this->NumberOfThreads, 0.0);
+
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+  this->Threader->SetSingleMethod(vtkCompactSupportRBFFillFieldExecute, &str);
+  this->Threader->SingleMethodExecute();
+  this->Threader->SetSingleMethod(vtkCompactSupportRBFFieldErrorExecute, &str);
+  this->Threader->SingleMethodExecute();
+
+  double sumSquaredError = 0.0;
+  for (int t = 0; t < this->NumberOfThreads; t++)
+    {
+    maximumError = (str.MaximumError[t] > maximumError) ? str.MaximumError[t] : maximumError;
+    sumSquaredError += str.SumSquaredError[t];
+    }
+  double numCells = (double)(field->Dimensions[0] - 1) *
+    (field->Dimensions[1] - 1) * (field->Dimensions[2] - 1);
+  rmsError = sqrt(sumSquaredError/numCells);
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkCompactSupportRBFTransform::ComputeDisplacementFieldError(
+  double spacing, double &maximumError, double &rmsError)
+{
+  maximumError = 0.0;
+  rmsError = 0.0;
+  this->Update();
+  if (this->NumberOfPoints == 0)
+    {
+    return 0;
+    }
+
+  vtkCompactSupportRBFDisplacementField field;
+  return this->BuildDisplacementField(&field, spacing, maximumError, rmsError);
+}
+
+//----------------------------------------------------------------------------
+void vtkCompactSupportRBFTransform::PrintDisplacementFieldAccuracy(
+  ostream& os, int numberOfSpacings, const double *spacings)
+{
+  this->Update();
+
+  os << "Spacing\tDimensions\tMemory (MB)\tMaximum Error\tRMS Error\n";
+  for (int s = 0; s < numberOfSpacings; s++)
+    {
+    os << spacings[s] << "\t";
+    vtkCompactSupportRBFDisplacementField field;
+    double maximumError, rmsError;
+    if (this->NumberOfPoints == 0 ||
+        !this->BuildDisplacementField(&field, spacings[s], maximumError, rmsError))
+      {
+      os << "(not built)\n";
+      continue;
+      }
+    os << field.Dimensions[0] << "x" << field.Dimensions[1] << "x"
+       << field.Dimensions[2] << "\t"
+       << field.Displacements.size()*sizeof(float)/1048576.0 << "\t"
+       << maximumError << "\t" << rmsError << "\n";
+    }
+}
+
 //----------------------------------------------------------------------------
 // calculate the thin plate spline as well as the jacobian
 template<class T>
 inline void vtkCompactSupportRBFForwardTransformDerivative(
   vtkCompactSupportRBFTransform *self,
-  double **W, int N,
+  vtkCompactSupportRBFLandmarkGrid *grid, int N,
   double (*phi)(double, double&),
   const T point[3], T output[3],
   T derivative[3][3])
@@ -405,22 +1127,21 @@ inline void vtkCompactSupportRBFForwardTransformDerivative(
     }
 
   double dx,dy,dz;
-  double p[3];
   double r, U, f, Ux, Uy, Uz;
   double x = 0, y = 0, z = 0;
   double invSigma = 1.0/self->GetSigma();
-  double sigma = self->GetSigma();
-
-  derivative[0][0] = derivative[0][1] = derivative[0][2] = 0;
-  derivative[1][0] = derivative[1][1] = derivative[1][2] = 0;
-  derivative[2][0] = derivative[2][1] = derivative[2][2] = 0;
-
-  vtkPoints *sourceLandmarks = self->GetSourceLandmarks();
+  double d[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  double q[3] = {point[0], point[1], point[2]};
 
-  // do the nonlinear stuff
-  for(vtkIdType i = 0; i < N; i++)
+  // do the nonlinear stuff, only near the point
+  int runs[18], range[6];
+  int numRuns = grid->FindRuns(q, runs, range);
+  for(int run = 0; run < numRuns; run++)
     {
-      sourceLandmarks->GetPoint(i,p);
+    for(int i = runs[2*run]; i < runs[2*run+1]; i++)
+      {
+      const double *p = &grid->Landmarks[3*i];
+      const double *w = &grid->Weights[3*i];
       dx = point[0]-p[0]; dy = point[1]-p[1]; dz = point[2]-p[2];
       r = sqrt(dx*dx + dy*dy + dz*dz);
 
@@ -432,19 +1153,20 @@ inline void vtkCompactSupportRBFForwardTransformDerivative(
       Uy = f*dy;
       Uz = f*dz;
 
-      x += U*W[i][0];
-      y += U*W[i][1];
-      z += U*W[i][2];
-
-      derivative[0][0] += Ux*W[i][0];
-      derivative[0][1] += Uy*W[i][0];
-      derivative[0][2] += Uz*W[i][0];
-      derivative[1][0] += Ux*W[i][1];
-      derivative[1][1] += Uy*W[i][1];
-      derivative[1][2] += Uz*W[i][1];
-      derivative[2][0] += Ux*W[i][2];
-      derivative[2][1] += Uy*W[i][2];
-      derivative[2][2] += Uz*W[i][2];
+      x += U*w[0];
+      y += U*w[1];
+      z += U*w[2];
+
+      d[0][0] += Ux*w[0];
+      d[0][1] += Uy*w[0];
+      d[0][2] += Uz*w[0];
+      d[1][0] += Ux*w[1];
+      d[1][1] += Uy*w[1];
+      d[1][2] += Uz*w[1];
+      d[2][0] += Ux*w[2];
+      d[2][1] += Uy*w[2];
+      d[2][2] += Uz*w[2];
+      }
     }
 
   // finish off with adding the displacement to the starting location
@@ -456,9 +1178,13 @@ inline void vtkCompactSupportRBFForwardTransformDerivative(
   output[1] = y;
   output[2] = z;
 
-  derivative[0][0] += 1;
-  derivative[1][1] += 1;
-  derivative[2][2] += 1;
+  for (int i = 0; i < 3; i++)
+    {
+    derivative[i][0] = d[i][0];
+    derivative[i][1] = d[i][1];
+    derivative[i][2] = d[i][2];
+    derivative[i][i] += 1;
+    }
 
 }
 
@@ -467,7 +1193,7 @@ void vtkCompactSupportRBFTransform::ForwardTransformDerivative(
                                                   double output[3],
                                                   double derivative[3][3])
 {
-  vtkCompactSupportRBFForwardTransformDerivative(this, this->MatrixW,
+  vtkCompactSupportRBFForwardTransformDerivative(this, this->LandmarkGrid,
              this->NumberOfPoints,
              this->BasisDerivative,
              point, output, derivative);
@@ -478,7 +1204,7 @@ void vtkCompactSupportRBFTransform::ForwardTransformDerivative(
                      float output[3],
                      float derivative[3][3])
 {
-  vtkCompactSupportRBFForwardTransformDerivative(this, this->MatrixW,
+  vtkCompactSupportRBFForwardTransformDerivative(this, this->LandmarkGrid,
              this->NumberOfPoints,
              this->BasisDerivative,
              point, output, derivative);
@@ -501,6 +1227,13 @@ void vtkCompactSupportRBFTransform::PrintSelf(ostream& os, vtkIndent indent)
     {
     this->TargetLandmarks->PrintSelf(os,indent.GetNextIndent());
     }
+  os << indent << "UseDisplacementField: " << (this->UseDisplacementField ? "On\n" : "Off\n");
+  os << indent << "DisplacementFieldSpacing: " << this->DisplacementFieldSpacing << "\n";
+  os << indent << "DisplacementFieldDimensions: " << this->DisplacementFieldDimensions[0] << " "
+     << this->DisplacementFieldDimensions[1] << " " << this->DisplacementFieldDimensions[2] << "\n";
+  os << indent << "DisplacementFieldMaximumError: " << this->DisplacementFieldMaximumError << "\n";
+  os << indent << "DisplacementFieldRMSError: " << this->DisplacementFieldRMSError << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
 }
 
 //----------------------------------------------------------------------------
@@ -521,6 +1254,9 @@ void vtkCompactSupportRBFTransform::InternalDeepCopy(
   this->SetBasis(t->GetBasis());
   this->SetSourceLandmarks(t->SourceLandmarks);
   this->SetTargetLandmarks(t->TargetLandmarks);
+  this->SetUseDisplacementField(t->UseDisplacementField);
+  this->SetDisplacementFieldSpacing(t->DisplacementFieldSpacing);
+  this->SetNumberOfThreads(t->NumberOfThreads);
 
   if (this->InverseFlag != t->InverseFlag)
     {
@@ -38,6 +38,7 @@
 
 #include "vtkRobartsRegistrationExport.h"
 
+#include "vtkMultiThreader.h"
 #include "vtkWarpTransform.h"
 
 #define VTK_RBF_CUSTOM 0
@@ -45,6 +46,9 @@
 #define VTK_RBF_CS3D2C 2
 #define VTK_RBF_CS3D4C 3
 
+class vtkCompactSupportRBFLandmarkGrid;
+class vtkCompactSupportRBFDisplacementField;
+
 class vtkRobartsRegistrationExport vtkCompactSupportRBFTransform : public vtkWarpTransform
 {
 public:
@@ -53,7 +57,9 @@ public:
   static vtkCompactSupportRBFTransform *New();
 
   // Description:
-  // Specify the 'stiffness' of the spline. The default is 1.0.
+  // Specify the 'stiffness' of the spline. The default is 1.0. This is
+  // the radius of support of the basis, so landmarks further than Sigma
+  // from a point do not move it.
   vtkGetMacro(Sigma,double);
   vtkSetMacro(Sigma,double);
 
@@ -103,6 +109,59 @@ public:
   // Make another transform of the same type.
   vtkAbstractTransform *MakeTransform();
 
+  // Description:
+  // Apply the transformation to a series of points, and append the results
+  // to outPts. Consecutive points that share a neighbourhood of landmarks,
+  // such as the points along a scanline, reuse the same gathered landmarks.
+  void TransformPoints(vtkPoints *inPts, vtkPoints *outPts);
+
+  // Description:
+  // Bake the displacements into a regular grid when the transform is
+  // updated, and interpolate them trilinearly instead of summing the basis
+  // for every point. This pays off when the same transform is applied to
+  // many points, e.g. when reslicing several volumes. The field covers the
+  // source landmarks plus Sigma on every side; points outside it are
+  // transformed exactly. The field is rebuilt whenever the landmarks, the
+  // basis or Sigma change. The derivative is always computed exactly.
+  // The default is Off.
+  vtkSetMacro(UseDisplacementField,int);
+  vtkGetMacro(UseDisplacementField,int);
+  vtkBooleanMacro(UseDisplacementField,int);
+
+  // Description:
+  // The spacing of the displacement field. The default is 1.0.
+  vtkSetMacro(DisplacementFieldSpacing,double);
+  vtkGetMacro(DisplacementFieldSpacing,double);
+
+  // Description:
+  // Get the number of nodes of the displacement field along each axis,
+  // which is zero if there is no field. Valid after Update().
+  vtkGetVector3Macro(DisplacementFieldDimensions,int);
+
+  // Description:
+  // Get the largest and the root-mean-square distance between the
+  // interpolated and the exact transform, measured at the centre of every
+  // cell of the displacement field when it was built. Valid after Update().
+  vtkGetMacro(DisplacementFieldMaximumError,double);
+  vtkGetMacro(DisplacementFieldRMSError,double);
+
+  // Description:
+  // Build a displacement field at the given spacing without keeping it, and
+  // measure its error as above. Returns 0 if the field could not be built.
+  int ComputeDisplacementFieldError(double spacing, double &maximumError,
+                                    double &rmsError);
+
+  // Description:
+  // Print a table of the size and error of the displacement field for each
+  // of the given spacings, to help choose DisplacementFieldSpacing.
+  void PrintDisplacementFieldAccuracy(ostream& os, int numberOfSpacings,
+                                      const double *spacings);
+
+  // Description:
+  // Set the number of threads used to build the displacement field.
+  vtkSetClampMacro(NumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads,int);
+
 protected:
   vtkCompactSupportRBFTransform();
   ~vtkCompactSupportRBFTransform();
@@ -136,6 +195,29 @@ protected:
 
   int NumberOfPoints;
   double **MatrixW;
+
+  // Description:
+  // The source landmarks and their weights, bucketed into cells at least as
+  // large as the support of the basis so that a point only visits the landmarks
+  // in its own and the neighbouring cells. Built by InternalUpdate.
+  vtkCompactSupportRBFLandmarkGrid *LandmarkGrid;
+
+  // Description:
+  // Fill a displacement field at the given spacing from the landmark grid,
+  // and measure its error. Returns 0 if the field would be too large.
+  int BuildDisplacementField(vtkCompactSupportRBFDisplacementField *field,
+                             double spacing, double &maximumError,
+                             double &rmsError);
+
+  int UseDisplacementField;
+  double DisplacementFieldSpacing;
+  int DisplacementFieldDimensions[3];
+  double DisplacementFieldMaximumError;
+  double DisplacementFieldRMSError;
+  vtkCompactSupportRBFDisplacementField *DisplacementField;
+
+  vtkMultiThreader *Threader;
+  int NumberOfThreads;
 private:
   vtkCompactSupportRBFTransform(const vtkCompactSupportRBFTransform&);  // Not implemented.
   void operator=(const vtkCompactSupportRBFTransform&);  // Not implemented.
@@ -1,6 +1,8 @@
 #include "vtkFunctionMinimizer.h"
 #include "vtkObjectFactory.h"
 
+#include <string.h>
+
 static double amotry(double **p, double *y, double *ptry, double *psum,
                      int ndim, void (*funk)(void *data), void *data,
                      double *result, int ihi, double fac)
@@ -28,13 +30,18 @@ static double amotry(double **p, double *y, double *ptry, double *psum,
   return ytry;
 }
 
+// The vertices that are shrunk towards the lowest one are independent,
+// and are evaluated together by *batch.
 static int amoeba(double **p, double *y, double *ptry, int ndim, double ftol,
-                  void (*funk)(void *data), void *data, double *result,
-                  int *nfunk, int maxnfunk)
+                  void (*funk)(void *data),
+                  void (*batch)(void *data, int k, const double *points, double *results),
+                  void *data, double *result, int *nfunk, int maxnfunk)
 {
-  int i,ihi,ilo,inhi,j,mpts;
+  int i,ihi,ilo,inhi,j,k,mpts;
   double rtol,sum,swap,ysave,ytry;
   double *psum = new double[ndim];
+  double *pshrink = new double[ndim*ndim];
+  double *yshrink = new double[ndim];
 
   mpts = ndim+1;
   *nfunk = 0;
@@ -88,7 +95,7 @@ static int amoeba(double **p, double *y, double *ptry, int ndim, double ftol,
       rtol = double(2.0*fabs(y[ihi]-y[ilo])/(fabs(y[ihi])+fabs(y[ilo])));
     }
 
-    if (rtol < ftol)
+    if (rtol < ftol || *nfunk >= maxnfunk)
     {
       swap = y[1];
       y[1] = y[ilo];
@@ -101,11 +108,6 @@ static int amoeba(double **p, double *y, double *ptry, int ndim, double ftol,
       }
       break;
     }
-    if (*nfunk >= maxnfunk)
-    {
-      delete [] psum;
-      return -1;      /* break if greater than max number of func evals */
-    }
 
     *nfunk += 2;
     ytry = amotry(p,y,ptry,psum,ndim,funk,data,result,ihi,double(-1.0));
@@ -119,16 +121,23 @@ static int amoeba(double **p, double *y, double *ptry, int ndim, double ftol,
       ytry = amotry(p,y,ptry,psum,ndim,funk,data,result,ihi,double(0.5));
       if (ytry >= ysave)
       {
-        for (i = 0; i < mpts; i++)
+        for (i = 0, k = 0; i < mpts; i++)
         {
           if (i != ilo)
           {
             for (j = 0; j < ndim; j++)
             {
-              p[i][j] = ptry[j] = psum[j] = (p[i][j] + p[ilo][j])/double(2.0);
+              p[i][j] = pshrink[k*ndim + j] = (p[i][j] + p[ilo][j])/double(2.0);
             }
-            (*funk)(data);
-            y[i] = *result;
+            k++;
+          }
+        }
+        (*batch)(data, ndim, pshrink, yshrink);
+        for (i = 0, k = 0; i < mpts; i++)
+        {
+          if (i != ilo)
+          {
+            y[i] = yshrink[k++];
           }
         }
         *nfunk += ndim;
@@ -151,28 +160,26 @@ static int amoeba(double **p, double *y, double *ptry, int ndim, double ftol,
   }
 
   delete [] psum;
+  delete [] pshrink;
+  delete [] yshrink;
 
-  return 0;
+  /* -1 if stopped at the max number of func evals */
+  return ((*nfunk >= maxnfunk && rtol >= ftol) ? -1 : 0);
 }
 
+// The vertices must be stored one after the other, so that they can be
+// evaluated together by *batch.
 static double minimize(double *parameters, double **vertices, int ndim,
-                       void (*funk)(void *data), void *data, double *result,
+                       void (*funk)(void *data),
+                       void (*batch)(void *data, int k, const double *points, double *results),
+                       void *data, double *result,
                        double tolerance, int maxiterations, int *iterations)
 {
   double *y = new double[ndim+1];
 
-  for (int k = 0; k < ndim+1; k++)
-  {
-    for (int l = 0; l < ndim; l++)
-    {
-      parameters[l] = vertices[k][l];
-    }
-
-    (*funk)(data);
-    y[k] = *result;
-  }
+  (*batch)(data, ndim+1, vertices[0], y);
 
-  amoeba(vertices,y,parameters,ndim,tolerance,funk,data,result,
+  amoeba(vertices,y,parameters,ndim,tolerance,funk,batch,data,result,
          iterations,maxiterations);
   *result = y[1]; // copy the lowest result in the *result
   delete [] y;
@@ -186,20 +193,101 @@ static double minimize(double *parameters, double **vertices, int ndim,
   return *result;
 }
 
+//----------------------------------------------------------------------------
+namespace
+{
+  // One minimization run, which is passed to the numerical recipes
+  // routines in place of the minimizer. They write the point to evaluate
+  // into Parameters and read the value from Result.
+  struct vtkFunctionMinimizerRun
+  {
+    vtkFunctionMinimizer *Self;
+    double *Parameters;
+    double Result;
+    int Serial;
+    int ThreadId;
+  };
+
+  struct vtkFunctionMinimizerPointsStruct
+  {
+    vtkFunctionMinimizer *Self;
+    int NumberOfPoints;
+    const double *Points;
+    double *Results;
+  };
+
+  struct vtkFunctionMinimizerStartsStruct
+  {
+    vtkFunctionMinimizer *Self;
+    int NumberOfStarts;
+    double *Simplices;
+    double *Results;
+    int *Iterations;
+  };
+}
+
+//----------------------------------------------------------------------------
+static void vtkFunctionMinimizerGetRange(int n, int threadId, int threadCount,
+                                         int &first, int &last)
+{
+  first = (int)(((vtkTypeInt64) n * threadId) / threadCount);
+  last = (int)(((vtkTypeInt64) n * (threadId + 1)) / threadCount);
+}
+
+//----------------------------------------------------------------------------
 void vtkFunctionMinimizerFunction(void *data)
 {
-  vtkFunctionMinimizer *self = (vtkFunctionMinimizer *)data;
-  /* old code for when a vtkFunctionParser was used
-  for (int i = 0; i < self->NumberOfParameters; i++)
-    {
-    self->Function->SetScalarVariableValue(self->ParameterIndices[i],
-    }
-  self->ScalarResult = self->Function->GetScalarResult();
-  */
-  if (self->Function)
+  vtkFunctionMinimizerRun *run = (vtkFunctionMinimizerRun *)data;
+  run->Result = run->Self->EvaluatePoint(run->ThreadId, run->Parameters);
+}
+
+//----------------------------------------------------------------------------
+void vtkFunctionMinimizerBatch(void *data, int numberOfPoints, const double *points,
+                               double *results)
+{
+  vtkFunctionMinimizerRun *run = (vtkFunctionMinimizerRun *)data;
+  run->Self->EvaluatePoints(numberOfPoints, points, results, run->Serial, run->ThreadId);
+}
+
+//----------------------------------------------------------------------------
+// Evaluate a range of the points on each thread.
+VTK_THREAD_RETURN_TYPE vtkFunctionMinimizerPointsExecute(void *arg)
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkFunctionMinimizerPointsStruct *str = static_cast<vtkFunctionMinimizerPointsStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int first, last;
+  vtkFunctionMinimizerGetRange(str->NumberOfPoints, threadId, threadCount, first, last);
+  int n = str->Self->NumberOfParameters;
+  for (int i = first; i < last; i++)
   {
-    self->Function(self->FunctionArg);
+    str->Results[i] = str->Self->EvaluatePoint(threadId, &str->Points[i*n]);
   }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Minimize from a range of the starting simplices on each thread.
+VTK_THREAD_RETURN_TYPE vtkFunctionMinimizerStartsExecute(void *arg)
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkFunctionMinimizerStartsStruct *str = static_cast<vtkFunctionMinimizerStartsStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int first, last;
+  vtkFunctionMinimizerGetRange(str->NumberOfStarts, threadId, threadCount, first, last);
+  int n = str->Self->NumberOfParameters;
+  for (int i = first; i < last; i++)
+  {
+    str->Results[i] = str->Self->MinimizeFromSimplex(&str->Simplices[i*n*(n+1)], 1,
+                                                     threadId, &str->Iterations[i]);
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
 }
 
 vtkStandardNewMacro(vtkFunctionMinimizer);
@@ -211,14 +299,23 @@ vtkFunctionMinimizer::vtkFunctionMinimizer()
   , FunctionArgDelete(NULL)
   , NumberOfParameters(0)
   , ParameterNames(NULL)
+  , ParameterIndices(NULL)
   , Parameters(NULL)
   , ParameterBrackets(NULL)
+  , Vertices(NULL)
   , ScalarResult(0.0)
   , Tolerance(0.005)
   , MaxIterations(1000)
   , Iterations(0)
+  , ThreadedFunction(NULL)
+  , ThreadedFunctionArg(NULL)
+  , BatchFunction(NULL)
+  , BatchFunctionArg(NULL)
+  , NumberOfStartingPoints(0)
+  , StartingPoints(NULL)
 {
-
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
 }
 
 //----------------------------------------------------------------------------
@@ -265,8 +362,16 @@ vtkFunctionMinimizer::~vtkFunctionMinimizer()
     delete [] this->Vertices;
     this->Vertices = NULL;
   }
+  if (this->StartingPoints)
+  {
+    delete [] this->StartingPoints;
+    this->StartingPoints = NULL;
+  }
 
   this->NumberOfParameters = 0;
+  this->NumberOfStartingPoints = 0;
+
+  this->Threader->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -277,6 +382,8 @@ void vtkFunctionMinimizer::PrintSelf(ostream& os, vtkIndent indent)
   os << indent << "MaxIterations: " << this->MaxIterations << "\n";
   os << indent << "Iterations: " << this->Iterations << "\n";
   os << indent << "Tolerance: " << this->Tolerance << "\n";
+  os << indent << "NumberOfStartingPoints: " << this->NumberOfStartingPoints << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
 }
 
 //----------------------------------------------------------------------------
@@ -305,6 +412,65 @@ void vtkFunctionMinimizer::SetFunctionArgDelete(void (*f)(void *))
   }
 }
 
+//----------------------------------------------------------------------------
+void vtkFunctionMinimizer::SetThreadedFunction(double (*f)(void *, int, const double *),
+                                               void *arg)
+{
+  if ( f != this->ThreadedFunction || arg != this->ThreadedFunctionArg )
+  {
+    this->ThreadedFunction = f;
+    this->ThreadedFunctionArg = arg;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkFunctionMinimizer::SetBatchFunction(void (*f)(void *, int, const double *, double *),
+                                            void *arg)
+{
+  if ( f != this->BatchFunction || arg != this->BatchFunctionArg )
+  {
+    this->BatchFunction = f;
+    this->BatchFunctionArg = arg;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkFunctionMinimizer::AddStartingPoint(const double *parameters)
+{
+  int n = this->NumberOfParameters;
+  double *newStartingPoints = new double[(this->NumberOfStartingPoints + 1)*n];
+  if (this->StartingPoints)
+  {
+    memcpy(newStartingPoints, this->StartingPoints,
+           this->NumberOfStartingPoints*n*sizeof(double));
+    delete [] this->StartingPoints;
+  }
+  memcpy(&newStartingPoints[this->NumberOfStartingPoints*n], parameters, n*sizeof(double));
+  this->StartingPoints = newStartingPoints;
+  this->NumberOfStartingPoints++;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkFunctionMinimizer::RemoveAllStartingPoints()
+{
+  if (this->StartingPoints)
+  {
+    delete [] this->StartingPoints;
+    this->StartingPoints = NULL;
+    this->NumberOfStartingPoints = 0;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+int vtkFunctionMinimizer::GetNumberOfStartingPoints()
+{
+  return this->NumberOfStartingPoints;
+}
+
 //----------------------------------------------------------------------------
 double *vtkFunctionMinimizer::GetScalarVariableBracket(const char *name)
 {
@@ -346,7 +512,7 @@ double vtkFunctionMinimizer::GetScalarVariableValue(const char *name)
 // initialize the simplex, also find the indices of the variables
 int vtkFunctionMinimizer::Initialize()
 {
-  if (!this->Function)
+  if (!this->Function && !this->ThreadedFunction && !this->BatchFunction)
   {
     vtkErrorMacro("Initialize: Funtion is NULL");
     return 0;
@@ -449,9 +615,100 @@ void vtkFunctionMinimizer::SetScalarVariableBracket(const char *name,
   this->ParameterBrackets = newParameterBrackets;
   this->Vertices = newVertices;
 
+  // the starting points do not have the new variable
+  this->RemoveAllStartingPoints();
+
   this->Modified();
 }
 
+//----------------------------------------------------------------------------
+double vtkFunctionMinimizer::EvaluatePoint(int threadId, const double *parameters)
+{
+  if (this->ThreadedFunction)
+  {
+    return this->ThreadedFunction(this->ThreadedFunctionArg, threadId, parameters);
+  }
+  if (this->Function)
+  {
+    // the function reads the parameters and sets the result
+    if (parameters != this->Parameters)
+    {
+      memcpy(this->Parameters, parameters, this->NumberOfParameters*sizeof(double));
+    }
+    this->Function(this->FunctionArg);
+    return this->ScalarResult;
+  }
+  double result = 0.0;
+  this->BatchFunction(this->BatchFunctionArg, 1, parameters, &result);
+  return result;
+}
+
+//----------------------------------------------------------------------------
+void vtkFunctionMinimizer::EvaluatePoints(int numberOfPoints, const double *points,
+                                          double *results, int serial, int threadId)
+{
+  int n = this->NumberOfParameters;
+  if (!serial && numberOfPoints > 1)
+  {
+    if (this->BatchFunction)
+    {
+      this->BatchFunction(this->BatchFunctionArg, numberOfPoints, points, results);
+      return;
+    }
+    if (this->ThreadedFunction && this->NumberOfThreads > 1)
+    {
+      vtkFunctionMinimizerPointsStruct str;
+      str.Self = this;
+      str.NumberOfPoints = numberOfPoints;
+      str.Points = points;
+      str.Results = results;
+
+      int numThreads = this->NumberOfThreads;
+      numThreads = (numThreads < numberOfPoints) ? numThreads : numberOfPoints;
+      this->Threader->SetNumberOfThreads(numThreads);
+      this->Threader->SetSingleMethod(vtkFunctionMinimizerPointsExecute, &str);
+      this->Threader->SingleMethodExecute();
+      return;
+    }
+  }
+
+  for (int i = 0; i < numberOfPoints; i++)
+  {
+    results[i] = this->EvaluatePoint(threadId, &points[i*n]);
+  }
+}
+
+//----------------------------------------------------------------------------
+double vtkFunctionMinimizer::MinimizeFromSimplex(double *simplex, int serial, int threadId,
+                                                 int *iterations)
+{
+  int n = this->NumberOfParameters;
+  double **vertices = new double *[n+1];
+  for (int k = 0; k <= n; k++)
+  {
+    vertices[k] = &simplex[k*n];
+  }
+
+  // the point that is being evaluated
+  double *parms = new double[n];
+
+  vtkFunctionMinimizerRun run;
+  run.Self = this;
+  run.Parameters = parms;
+  run.Result = 0.0;
+  run.Serial = serial;
+  run.ThreadId = threadId;
+
+  double result = minimize(parms, vertices, n, &vtkFunctionMinimizerFunction,
+                           &vtkFunctionMinimizerBatch, &run, &run.Result,
+                           this->Tolerance, this->MaxIterations, iterations);
+
+  delete [] parms;
+  delete [] vertices;
+
+  return result;
+}
+
 //----------------------------------------------------------------------------
 void vtkFunctionMinimizer::Minimize()
 {
@@ -459,8 +716,77 @@ void vtkFunctionMinimizer::Minimize()
   {
     return;
   }
-  minimize(this->Parameters, this->Vertices, this->NumberOfParameters,
-           &vtkFunctionMinimizerFunction, this, &this->ScalarResult,
-           this->Tolerance, this->MaxIterations, &this->Iterations);
-}
 
+  // the simplex set up by Initialize starts at the middle of the brackets,
+  // the simplices for the starting points are moved to start there instead
+  int n = this->NumberOfParameters;
+  int size = n*(n+1);
+  int numStarts = this->NumberOfStartingPoints;
+  double *simplices;
+  if (numStarts > 0)
+  {
+    simplices = new double[numStarts*size];
+    for (int i = 0; i < numStarts; i++)
+    {
+      const double *start = &this->StartingPoints[i*n];
+      for (int k = 0; k <= n; k++)
+      {
+        for (int l = 0; l < n; l++)
+        {
+          simplices[i*size + k*n + l] = start[l] +
+            (this->Vertices[k][l] - this->Vertices[0][l]);
+        }
+      }
+    }
+  }
+  else
+  {
+    numStarts = 1;
+    simplices = new double[size];
+    memcpy(simplices, this->Vertices[0], size*sizeof(double));
+  }
+  double *results = new double[numStarts];
+  int *iterations = new int[numStarts];
+
+  // the starting points are minimized on separate threads if the function
+  // can be called from several threads, or one after the other
+  if (numStarts > 1 && this->ThreadedFunction && this->NumberOfThreads > 1)
+  {
+    vtkFunctionMinimizerStartsStruct str;
+    str.Self = this;
+    str.NumberOfStarts = numStarts;
+    str.Simplices = simplices;
+    str.Results = results;
+    str.Iterations = iterations;
+
+    int numThreads = this->NumberOfThreads;
+    numThreads = (numThreads < numStarts) ? numThreads : numStarts;
+    this->Threader->SetNumberOfThreads(numThreads);
+    this->Threader->SetSingleMethod(vtkFunctionMinimizerStartsExecute, &str);
+    this->Threader->SingleMethodExecute();
+  }
+  else
+  {
+    for (int i = 0; i < numStarts; i++)
+    {
+      results[i] = this->MinimizeFromSimplex(&simplices[i*size], 0, 0, &iterations[i]);
+    }
+  }
+
+  // keep the lowest minimum, the first one if several are equal
+  int best = 0;
+  for (int i = 1; i < numStarts; i++)
+  {
+    if (results[i] < results[best])
+    {
+      best = i;
+    }
+  }
+  memcpy(this->Parameters, &simplices[best*size], n*sizeof(double));
+  this->ScalarResult = results[best];
+  this->Iterations = iterations[best];
+
+  delete [] simplices;
+  delete [] results;
+  delete [] iterations;
+}
@@ -76,6 +76,12 @@ vtkImageADManipulator::vtkImageADManipulator()
   }
 }
 
+//----------------------------------------------------------------------------
+vtkImageADManipulator::~vtkImageADManipulator()
+{
+  this->SetSampler(NULL);
+}
+
 //----------------------------------------------------------------------------
 void vtkImageADManipulator::SetInput1(vtkImageData *input)
 {
@@ -103,6 +109,15 @@ vtkImageData *vtkImageADManipulator::GetInput2()
   return this->inData[1];
 }
 
+//----------------------------------------------------------------------------
+void vtkImageADManipulator::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  if (this->Samples.SetSampler(sampler, this))
+  {
+    this->Modified();
+  }
+}
+
 //----------------------------------------------------------------------------
 void vtkImageADManipulator::SetExtent(int ext[6])
 {
@@ -113,6 +128,9 @@ void vtkImageADManipulator::SetExtent(int ext[6])
   this->inPtr[1] = this->inData[1]->GetScalarPointerForExtent(ext);
 
   memcpy(this->Extent, ext, sizeof(int)*6);
+
+  // Draw the samples from image 2, and keep them with its values
+  this->Samples.Update(this->inData[1], this->Extent);
 }
 
 //----------------------------------------------------------------------------
@@ -256,6 +274,47 @@ void vtkImageADManipulatorExecute(vtkImageADManipulator *self,
 
 }
 
+//----------------------------------------------------------------------------
+// Sum the absolute differences at the samples
+struct vtkImageADManipulatorSampleOp
+{
+  double Sum;
+
+  inline void operator()(double s, double t)
+  {
+    this->Sum += fabs(s - t);
+  }
+};
+
+//----------------------------------------------------------------------------
+// Evaluate over the samples only, interpolating image 1 at each of them.
+template <class T>
+void vtkImageADManipulatorSampleExecute(vtkImageADManipulator *self,
+                                        T *in1Ptr, vtkIdType inc[3], int inExt[6],
+                                        int loc000[3], int loc111[3],
+                                        vtkImageMetricSamples *samples)
+{
+  // Check if translation takes us out of the input image, in which case
+  // set the result to indicate complete dissimilarity and stop.
+  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
+       (self->Extent[2] + loc000[1] < inExt[2]) ||
+       (self->Extent[4] + loc000[2] < inExt[4]) ||
+       (self->Extent[1] + loc111[0] > inExt[1]) ||
+       (self->Extent[3] + loc111[1] > inExt[3]) ||
+       (self->Extent[5] + loc111[2] > inExt[5]) )
+  {
+    self->Result = 1E300;
+    return;
+  }
+
+  double F[8] = { self->F000, self->F100, self->F010, self->F110,
+                  self->F001, self->F101, self->F011, self->F111 };
+  vtkImageADManipulatorSampleOp op = { 0.0 };
+  vtkImageMetricSamplesExecute(in1Ptr, inc, loc000, loc111, F, samples, op);
+
+  self->Result = op.Sum * samples->GetScale();
+}
+
 //----------------------------------------------------------------------------
 double vtkImageADManipulator::GetResult()
 {
@@ -280,6 +339,19 @@ double vtkImageADManipulator::GetResult()
 
   this->Result = 0.0;
 
+  if (this->Samples.GetSampler())
+  {
+    switch (this->inData[0]->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImageADManipulatorSampleExecute(this,
+                       (VTK_TT *)(this->inPtr[0]), this->inc, this->inExt,
+                       this->loc000, this->loc111, &this->Samples));
+    default:
+      vtkErrorMacro( "Execute: Unknown ScalarType");
+    }
+    return this->Result;
+  }
+
   switch (this->inData[0]->GetScalarType())
   {
     vtkTemplateMacro(vtkImageADManipulatorExecute(this,
@@ -31,6 +31,9 @@
 #include "vtkObject.h"
 #include "vtkObjectFactory.h"
 #include "vtkImageData.h"
+#include "vtkImageMetricSamples.h"
+
+class vtkImageVoxelSampler;
 
 class vtkRobartsRegistrationExport vtkImageADManipulator : public vtkObject
 {
@@ -55,6 +58,14 @@ public:
   // Set the translation of input 1 in 3D (mm)
   virtual void SetTranslation(double Translation[3]);
 
+  // Description:
+  // Set/get a sampler to only evaluate the metric over a subset of the
+  // voxels of the extent. The samples are drawn from image 2 by
+  // SetExtent, and are kept until it is called again. The sum over the
+  // samples is scaled to estimate the sum over all of the voxels.
+  virtual void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkImageVoxelSampler *GetSampler() { return this->Samples.GetSampler(); };
+
   // Description:
   // Get the absolute difference
   double GetResult();
@@ -75,7 +86,7 @@ public:
 
 protected:
   vtkImageADManipulator();
-  ~vtkImageADManipulator() {};
+  ~vtkImageADManipulator();
 
   // Globals used to speed up repeated execution:
 
@@ -95,6 +106,10 @@ protected:
   vtkImageData *inData[2];
   void *inPtr[2];
 
+  // The sampler, and the samples that it draws from image 2 (calculate
+  // on SetExtent)
+  vtkImageMetricSamples Samples;
+
 };
 
 #endif
\ No newline at end of file
@@ -16,16 +16,27 @@
 
 =========================================================================*/
 #include "vtkImageAbsoluteDifference.h"
+#include "vtkImageVoxelSampler.h"
 
 #include <vtkExecutive.h>
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
 
 vtkStandardNewMacro(vtkImageAbsoluteDifference);
+vtkCxxSetObjectMacro(vtkImageAbsoluteDifference, Sampler, vtkImageVoxelSampler);
 
 //----------------------------------------------------------------------------
 vtkImageAbsoluteDifference::vtkImageAbsoluteDifference()
 {
   this->ReverseStencil = 0;
-  SetNumberOfThreads(THREAD_NUM);
+  this->Sampler = NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkImageAbsoluteDifference::~vtkImageAbsoluteDifference()
+{
+  this->SetSampler(NULL);
 }
 
 //----------------------------------------------------------------------------
@@ -86,30 +97,28 @@ template <class T>
 void vtkImageAbsoluteDifferenceExecute(vtkImageAbsoluteDifference *self,
                                        vtkImageData *in1Data, T *in1Ptr,
                                        vtkImageData *in2Data, T *in2Ptr,
-                                       int outExt[6], int id)
+                                       int outExt[6], double *sum)
 {
   int idX, idY, idZ;
-  vtkIdType incX, incY, incZ;
-  int maxX, maxY, maxZ;
+  vtkIdType inc1X, inc1Y, inc1Z;
+  vtkIdType inc2X, inc2Y, inc2Z;
   int pminX, pmaxX, iter;
   T *temp1Ptr, *temp2Ptr;
   vtkImageStencilData *stencil = self->GetStencil();
-
-  self->ThreadAbsoluteDifference[id] = 0;
-
-  // Find the region to loop over
-  maxX = (outExt[1] - outExt[0])*in1Data->GetNumberOfScalarComponents();
-  maxY = outExt[3] - outExt[2];
-  maxZ = outExt[5] - outExt[4];
+  double error = 0.0;
 
   // Get increments to march through data
-  in1Data->GetIncrements(incX, incY, incZ);
+  in1Data->GetIncrements(inc1X, inc1Y, inc1Z);
+  in2Data->GetIncrements(inc2X, inc2Y, inc2Z);
 
   // Loop over data within stencil sub-extents
-  for (idZ = 0; idZ <= maxZ; idZ++)
+  for (idZ = outExt[4]; idZ <= outExt[5]; idZ++)
   {
-    for (idY = 0; idY <= maxY; idY++)
+    for (idY = outExt[2]; idY <= outExt[3]; idY++)
     {
+      // Sum each row on its own, then add the rows with compensation
+      double rowSum = 0.0;
+
       // Flag that we want the complementary extents
       iter = 0;
       if (self->GetReverseStencil())
@@ -117,27 +126,100 @@ void vtkImageAbsoluteDifferenceExecute(vtkImageAbsoluteDifference *self,
         iter = -1;
       }
 
-      pminX = 0;
-      pmaxX = maxX;
+      pminX = outExt[0];
+      pmaxX = outExt[1];
       while ((stencil !=0 &&
-              stencil->GetNextExtent(pminX, pmaxX, 0, maxX, idY, idZ+outExt[4], iter)) ||
+              stencil->GetNextExtent(pminX, pmaxX, outExt[0], outExt[1], idY, idZ, iter)) ||
              (stencil == 0 && iter++ == 0))
       {
         // Set up pointers to the sub-extents
-        temp1Ptr = in1Ptr + (incZ * idZ + incY * idY + pminX);
-        temp2Ptr = in2Ptr + (incZ * idZ + incY * idY + pminX);
-        // Compute over the sub-extent
-        for (idX = pminX; idX <= pmaxX; idX++)
+        temp1Ptr = in1Ptr + (inc1Z * (idZ - outExt[4]) + inc1Y * (idY - outExt[2]) +
+                             inc1X * (pminX - outExt[0]));
+        temp2Ptr = in2Ptr + (inc2Z * (idZ - outExt[4]) + inc2Y * (idY - outExt[2]) +
+                             inc2X * (pminX - outExt[0]));
+        // Compute over the sub-extent, and all of the components
+        for (idX = (pmaxX - pminX + 1)*inc1X; idX > 0; idX--)
         {
-          self->ThreadAbsoluteDifference[id] += fabs((double)*temp1Ptr - (double)*temp2Ptr);
+          rowSum += fabs((double)*temp1Ptr - (double)*temp2Ptr);
           temp1Ptr++;
           temp2Ptr++;
         }
       }
+
+      vtkImageMetricAdd(*sum, error, rowSum);
     }
   }
 }
 
+//----------------------------------------------------------------------------
+// Accumulate over the samples of input 1 that lie within outExt, which have
+// already been restricted to the stencil by the sampler.
+template <class T>
+void vtkImageAbsoluteDifferenceSampleExecute(vtkImageData *in2Data, T *in2Ptr,
+    const int *points, const double *values,
+    vtkIdType first, vtkIdType last,
+    int outExt[6], double *sum)
+{
+  vtkIdType incX, incY, incZ;
+  double error = 0.0;
+
+  in2Data->GetIncrements(incX, incY, incZ);
+
+  for (vtkIdType i = first; i < last; i++)
+  {
+    const int *point = points + 3*i;
+    if (point[0] >= outExt[0] && point[0] <= outExt[1] &&
+        point[1] >= outExt[2] && point[1] <= outExt[3])
+    {
+      T *tempPtr = in2Ptr + ((point[0] - outExt[0])*incX +
+                             (point[1] - outExt[2])*incY +
+                             (point[2] - outExt[4])*incZ);
+      vtkImageMetricAdd(*sum, error, fabs(values[i] - (double)*tempPtr));
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// Draw the samples for the update extent, and prepare the threads.
+int vtkImageAbsoluteDifference::RequestData(vtkInformation *request,
+    vtkInformationVector **inputVector,
+    vtkInformationVector *outputVector)
+{
+  int extent[6];
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+  outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(), extent);
+
+  if (this->Sampler)
+  {
+    if (!this->Sampler->Update(this->GetInput1(), extent, this->GetStencil(),
+                               this->ReverseStencil))
+    {
+      vtkErrorMacro( "RequestData: Unable to sample input 1");
+      return 0;
+    }
+  }
+
+  this->ThreadSums.assign(
+    VTK_METRIC_THREAD_STRIDE*this->GetNumberOfThreads(), 0.0);
+  this->Splitter.ComputeSplitSlices(extent, this->GetNumberOfThreads(),
+    this->Sampler, this->GetStencil(), this->ReverseStencil);
+
+  return this->Superclass::RequestData(request, inputVector, outputVector);
+}
+
+//----------------------------------------------------------------------------
+// Split the extent at the slices chosen by the splitter.
+int vtkImageAbsoluteDifference::SplitExtent(int splitExt[6],
+    int startExt[6], int num, int total)
+{
+  int numPieces = this->Splitter.SplitExtent(splitExt, startExt, num, total);
+  if (numPieces == 0)
+  {
+    return this->Superclass::SplitExtent(splitExt, startExt, num, total);
+  }
+  return numPieces;
+}
+
 //----------------------------------------------------------------------------
 // This method is passed a input and output datas, and executes the filter
 // algorithm to fill the output from the inputs.
@@ -152,6 +234,13 @@ void vtkImageAbsoluteDifference::ThreadedExecute(vtkImageData **inData,
 
   vtkDebugMacro( "Execute: inData = " << inData);
 
+  if (VTK_METRIC_THREAD_STRIDE*(id + 1) > (int)this->ThreadSums.size())
+  {
+    vtkErrorMacro( "Execute: No partial sums for thread " << id);
+    return;
+  }
+  double *sum = &this->ThreadSums[VTK_METRIC_THREAD_STRIDE*id];
+
   if (inData[0] == NULL)
   {
     vtkErrorMacro( "Input " << 0 << " must be specified.");
@@ -183,12 +272,28 @@ void vtkImageAbsoluteDifference::ThreadedExecute(vtkImageData **inData,
     return;
   }
 
+  if (this->Sampler)
+  {
+    vtkIdType range[2];
+    this->Sampler->GetSliceRange(outExt[4], outExt[5], range);
+    switch (inData[1]->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImageAbsoluteDifferenceSampleExecute(
+                       inData[1], (VTK_TT *)(inPtr2),
+                       this->Sampler->GetPoints(), this->Sampler->GetValues(),
+                       range[0], range[1], outExt, sum));
+    default:
+      vtkErrorMacro( "Execute: Unknown ScalarType");
+    }
+    return;
+  }
+
   switch (inData[0]->GetScalarType())
   {
     vtkTemplateMacro(vtkImageAbsoluteDifferenceExecute(this,
                      inData[0], (VTK_TT *)(inPtr1),
                      inData[1], (VTK_TT *)(inPtr2),
-                     outExt, id));
+                     outExt, sum));
   default:
     vtkErrorMacro( "Execute: Unknown ScalarType");
     return;
@@ -198,12 +303,20 @@ void vtkImageAbsoluteDifference::ThreadedExecute(vtkImageData **inData,
 //----------------------------------------------------------------------------
 double vtkImageAbsoluteDifference::GetResult()
 {
-  int n = GetNumberOfThreads();
+  int n = (int)(this->ThreadSums.size()/VTK_METRIC_THREAD_STRIDE);
   double result = 0.0;
+  double error = 0.0;
 
   for (int id = 0; id < n; id++)
   {
-    result += this->ThreadAbsoluteDifference[id];
+    vtkImageMetricAdd(result, error,
+                      this->ThreadSums[VTK_METRIC_THREAD_STRIDE*id]);
+  }
+
+  if (this->Sampler && this->Sampler->GetNumberOfSamples() > 0)
+  {
+    result *= ((double)this->Sampler->GetNumberOfCandidates() /
+               (double)this->Sampler->GetNumberOfSamples());
   }
 
   if (result < 0)
@@ -214,6 +327,17 @@ double vtkImageAbsoluteDifference::GetResult()
   return result;
 }
 
+//----------------------------------------------------------------------------
+vtkMTimeType vtkImageAbsoluteDifference::GetMTime()
+{
+  vtkMTimeType mTime = this->Superclass::GetMTime();
+  if (this->Sampler && this->Sampler->GetMTime() > mTime)
+  {
+    mTime = this->Sampler->GetMTime();
+  }
+  return mTime;
+}
+
 //----------------------------------------------------------------------------
 void vtkImageAbsoluteDifference::PrintSelf(ostream& os, vtkIndent indent)
 {
@@ -223,4 +347,5 @@ void vtkImageAbsoluteDifference::PrintSelf(ostream& os, vtkIndent indent)
   os << indent << "Input 2: "<< this->GetInput2() << "\n";
   os << indent << "Stencil: " << this->GetStencil() << "\n";
   os << indent << "ReverseStencil: " << (this->ReverseStencil ? "On\n" : "Off\n");
+  os << indent << "Sampler: " << this->Sampler << "\n";
 }
@@ -18,6 +18,9 @@
 // .NAME vtkImageAbsoluteDifference - Returns the absolute difference of 2 images
 // .SECTION Description
 // vtkImageAbsoluteDifference calculates the absolute difference of 2 images
+// The work is split by slices over as many threads as SetNumberOfThreads
+// asks for, by default the number of processors, so that every thread
+// gets about the same number of voxels of the stencil.
 
 #ifndef __vtkImageAbsoluteDifference_h
 #define __vtkImageAbsoluteDifference_h
@@ -28,9 +31,11 @@
 #include "vtkObjectFactory.h"
 #include "vtkImageStencilData.h"
 #include "vtkImageData.h"
+#include "vtkImageMetricSplitter.h"
 
-// This number must be greater than the number of CPU's
-#define THREAD_NUM 2
+#include <vector>
+
+class vtkImageVoxelSampler;
 
 class vtkRobartsRegistrationExport vtkImageAbsoluteDifference : public vtkThreadedImageAlgorithm
 {
@@ -56,22 +61,40 @@ public:
   vtkBooleanMacro(ReverseStencil, int);
   vtkGetMacro(ReverseStencil, int);
 
+  // Description:
+  // Only accumulate over the voxels that the sampler chooses from input 1,
+  // within the stencil. The samples are drawn on every update, and the
+  // result is scaled to estimate the sum over all of the voxels.
+  virtual void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkGetObjectMacro(Sampler, vtkImageVoxelSampler);
+
   // Description:
   // Get the absolute difference
   double GetResult();
 
   // Description:
-  // These allow averaging after threads are finished.
-  double ThreadAbsoluteDifference[THREAD_NUM];
+  // The modified time, including that of the sampler.
+  vtkMTimeType GetMTime();
 
 protected:
   vtkImageAbsoluteDifference();
-  ~vtkImageAbsoluteDifference() {};
+  ~vtkImageAbsoluteDifference();
 
   int ReverseStencil;
+  vtkImageVoxelSampler *Sampler;
 
+  int RequestData(vtkInformation *request, vtkInformationVector **inputVector,
+                  vtkInformationVector *outputVector);
+  int SplitExtent(int splitExt[6], int startExt[6], int num, int total);
   void ThreadedExecute(vtkImageData **inDatas, vtkImageData *outData, int extent[6], int id);
 
+  // The sum of each thread, kept a cache line apart.
+  std::vector<double> ThreadSums;
+
+  // Splits the extent so that the threads get the same number of samples
+  // or voxels of the stencil.
+  vtkImageMetricSplitter Splitter;
+
 private:
   vtkImageAbsoluteDifference(const vtkImageAbsoluteDifference&);  // Not implemented.
   void operator=(const vtkImageAbsoluteDifference&);  // Not implemented.
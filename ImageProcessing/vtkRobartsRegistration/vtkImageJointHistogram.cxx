@@ -0,0 +1,1144 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageJointHistogram.cxx,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+#include "vtkImageJointHistogram.h"
+
+#include "vtkImageData.h"
+#include "vtkImageVoxelSampler.h"
+#include "vtkObjectFactory.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+vtkStandardNewMacro(vtkImageJointHistogram);
+
+//----------------------------------------------------------------------------
+namespace
+{
+  // Maps a value to its bin with a multiplication rather than a division,
+  // correcting the truncated quotient by at most one bin so that the result
+  // is floor((v + Offset)/Width).
+  struct vtkImageJointHistogramBinner
+  {
+    double Width;
+    double InverseWidth;
+    double Offset;
+    double Limit;
+    int Number;
+    int Clamp;
+
+    void Initialize(int number, double width, double origin, int binning, int clamp)
+    {
+      this->Number = number;
+      this->Width = width;
+      this->InverseWidth = 1.0/width;
+      this->Offset = (binning == VTK_JOINT_HISTOGRAM_ROUND) ? 0.5*width : 0.0;
+      this->Offset -= origin;
+      this->Limit = number*width;
+      this->Clamp = clamp;
+    }
+
+    // Returns the bin, or -1 if the value is outside of the bins and
+    // clamping is off.
+    inline int operator()(double v) const
+    {
+      double x = v + this->Offset;
+      if (!(x >= 0.0))
+      {
+        return this->Clamp ? 0 : -1;
+      }
+      if (x >= this->Limit)
+      {
+        return this->Clamp ? this->Number - 1 : -1;
+      }
+      int a = (int)(x*this->InverseWidth);
+      a += ((a + 1)*this->Width <= x);
+      a -= (a*this->Width > x);
+      return a;
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  template<class H>
+  struct vtkImageJointHistogramThreadStruct
+  {
+    const unsigned char *FixedBins8;    // one of these is NULL
+    const unsigned short *FixedBins16;
+    int RowSize;                        // of the joint histogram
+    int RowLength;
+    int NumberOfRows;
+    int RowsPerSlice;
+    const int *Points;                  // the samples, or NULL
+    vtkIdType NumberOfPoints;
+    void *MovingPointer;
+    int ScalarType;
+    vtkIdType Increments[3];
+    vtkIdType Offsets[8];     // of the 8 neighbours, from the first
+    const double *Weights;
+    int Interpolate;
+    int PartialVolume;
+    vtkImageJointHistogramBinner Binner;
+    vtkIdType HistogramSize;
+    std::vector<H*> Histograms;  // one per thread
+    std::vector<int> Errors;     // one per thread
+  };
+}
+
+//----------------------------------------------------------------------------
+namespace
+{
+  struct vtkImageJointHistogramParzenStruct
+  {
+    const unsigned char *FixedBins8;    // one of these is NULL
+    const unsigned short *FixedBins16;
+    int RowSize;                        // of the Parzen histogram
+    int RowLength;
+    int NumberOfRows;
+    int RowsPerSlice;
+    const int *Points;                  // the samples, or NULL
+    vtkIdType NumberOfPoints;
+    void *MovingPointer;
+    int ScalarType;
+    vtkIdType Increments[3];
+    double Fraction[3];
+    double Scale;                       // maps a value to a bin coordinate
+    double Shift;
+    int NumberOfBins;
+    vtkIdType HistogramSize;
+    const double *LogRatio;             // NULL in the first pass
+    std::vector<double*> Histograms;    // one per thread
+    std::vector<double> Gradients;      // three per thread
+  };
+}
+
+//----------------------------------------------------------------------------
+// The multi-threader runs no more than the global maximum number of
+// threads, and the histograms of any threads above it would never be
+// cleared, so they are not made.
+static int vtkImageJointHistogramClampThreads(int numThreads)
+{
+  int maxThreads = vtkMultiThreader::GetGlobalMaximumNumberOfThreads();
+  return (maxThreads > 0 && numThreads > maxThreads) ? maxThreads : numThreads;
+}
+
+//----------------------------------------------------------------------------
+static void vtkImageJointHistogramGetRange(vtkIdType n, int threadId, int threadCount,
+                                           vtkIdType &first, vtkIdType &last)
+{
+  first = (vtkIdType)(((vtkTypeInt64) n * threadId) / threadCount);
+  last = (vtkIdType)(((vtkTypeInt64) n * (threadId + 1)) / threadCount);
+}
+
+//----------------------------------------------------------------------------
+// Call op(b, p) for every voxel of a run of rows of the extent, or of a
+// range of the samples, that is not masked, with the bin b of the fixed
+// image and a pointer p to the moving image at that voxel.
+template<class T, class B, class Op>
+void vtkImageJointHistogramVisit(const int *points, int rowLength, int rowsPerSlice,
+                                 const vtkIdType inc[3], const T *movingPtr,
+                                 const B *fixedBins, vtkIdType first, vtkIdType last,
+                                 Op &op)
+{
+  const B masked = static_cast<B>(~0);
+
+  if (points)
+  {
+    for (vtkIdType s = first; s < last; s++)
+    {
+      B b = fixedBins[s];
+      if (b != masked)
+      {
+        const int *xyz = points + 3*s;
+        op(b, movingPtr + xyz[0]*inc[0] + xyz[1]*inc[1] + xyz[2]*inc[2]);
+      }
+    }
+    return;
+  }
+
+  for (vtkIdType row = first; row < last; row++)
+  {
+    const B *fixedRow = fixedBins + row*rowLength;
+    const T *p = movingPtr + (row % rowsPerSlice)*inc[1] + (row / rowsPerSlice)*inc[2];
+    for (int idX = 0; idX < rowLength; idX++, p += inc[0])
+    {
+      B b = fixedRow[idX];
+      if (b != masked)
+      {
+        op(b, p);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// No translation, bin the voxels of the moving image directly
+template<class T, class H>
+struct vtkImageJointHistogramBinOp
+{
+  const vtkImageJointHistogramBinner *Binner;
+  int RowSize;
+  H *Histogram;
+  int Errors;
+
+  inline void operator()(int b, const T *p)
+  {
+    int a = (*this->Binner)((double)*p);
+    if (a < 0)
+    {
+      this->Errors++;
+      return;
+    }
+    this->Histogram[b*this->RowSize + a]++;
+  }
+};
+
+// Partial volume interpolation: each neighbour adds its weight
+template<class T, class H>
+struct vtkImageJointHistogramPartialVolumeOp
+{
+  const vtkImageJointHistogramBinner *Binner;
+  int RowSize;
+  H *Histogram;
+  int Errors;
+  const vtkIdType *Offsets;
+  const double *Weights;
+
+  inline void operator()(int b, const T *p)
+  {
+    const vtkIdType *o = this->Offsets;
+    int a[8];
+    int bad = 0;
+    for (int n = 0; n < 8; n++)
+    {
+      a[n] = (*this->Binner)((double)p[o[n]]);
+      bad |= a[n];
+    }
+    if (bad < 0)
+    {
+      this->Errors++;
+      return;
+    }
+    H *h = this->Histogram + b*this->RowSize;
+    for (int n = 0; n < 8; n++)
+    {
+      h[a[n]] += (H)this->Weights[n];
+    }
+  }
+};
+
+// Bin the trilinearly interpolated value
+template<class T, class H>
+struct vtkImageJointHistogramTrilinearOp
+{
+  const vtkImageJointHistogramBinner *Binner;
+  int RowSize;
+  H *Histogram;
+  int Errors;
+  const vtkIdType *Offsets;
+  const double *Weights;
+
+  inline void operator()(int b, const T *p)
+  {
+    const vtkIdType *o = this->Offsets;
+    const double *F = this->Weights;
+    double Vxyz = (p[o[0]] * F[0] + p[o[1]] * F[1] +
+                   p[o[2]] * F[2] + p[o[3]] * F[3] +
+                   p[o[4]] * F[4] + p[o[5]] * F[5] +
+                   p[o[6]] * F[6] + p[o[7]] * F[7]);
+    int a = (*this->Binner)(Vxyz);
+    if (a < 0)
+    {
+      this->Errors++;
+      return;
+    }
+    this->Histogram[b*this->RowSize + a]++;
+  }
+};
+
+//----------------------------------------------------------------------------
+// Accumulate a run of rows of the extent, or a range of the samples, into
+// a histogram.
+template<class T, class B, class H>
+void vtkImageJointHistogramRange(const vtkImageJointHistogramThreadStruct<H> *str,
+                                 const T *movingPtr, const B *fixedBins,
+                                 vtkIdType first, vtkIdType last,
+                                 H *hist, int &errors)
+{
+  if (!str->Interpolate)
+  {
+    vtkImageJointHistogramBinOp<T,H> op = { &str->Binner, str->RowSize, hist, 0 };
+    vtkImageJointHistogramVisit(str->Points, str->RowLength, str->RowsPerSlice,
+                                str->Increments, movingPtr, fixedBins, first, last, op);
+    errors = op.Errors;
+  }
+  else if (str->PartialVolume)
+  {
+    vtkImageJointHistogramPartialVolumeOp<T,H> op = { &str->Binner, str->RowSize, hist, 0,
+                                                      str->Offsets, str->Weights };
+    vtkImageJointHistogramVisit(str->Points, str->RowLength, str->RowsPerSlice,
+                                str->Increments, movingPtr, fixedBins, first, last, op);
+    errors = op.Errors;
+  }
+  else
+  {
+    vtkImageJointHistogramTrilinearOp<T,H> op = { &str->Binner, str->RowSize, hist, 0,
+                                                  str->Offsets, str->Weights };
+    vtkImageJointHistogramVisit(str->Points, str->RowLength, str->RowsPerSlice,
+                                str->Increments, movingPtr, fixedBins, first, last, op);
+    errors = op.Errors;
+  }
+}
+
+//----------------------------------------------------------------------------
+// The Parzen window estimate of the mutual information is done in two
+// passes over the voxels. The first adds the cubic B-spline window of
+// each interpolated value to the joint histogram. The second adds the
+// derivative of the window, weighted by the log ratio of the joint
+// histogram to the histogram of the moving image, to the gradient.
+template<class T>
+struct vtkImageJointHistogramParzenOp
+{
+  vtkIdType Increments[3];
+  double Fraction[3];
+  double Scale;
+  double Shift;
+  double MaxBin;
+  int RowSize;
+  const double *LogRatio;
+  double *Histogram;
+  double Gradient[3];
+
+  inline void operator()(int b, const T *p)
+  {
+    vtkIdType dx = this->Increments[0];
+    vtkIdType dy = this->Increments[1];
+    vtkIdType dz = this->Increments[2];
+    double fx = this->Fraction[0];
+    double fy = this->Fraction[1];
+    double fz = this->Fraction[2];
+
+    // interpolate along x, then y, then z, keeping the derivatives
+    double v000 = p[0], v100 = p[dx], v010 = p[dy], v110 = p[dx+dy];
+    double v001 = p[dz], v101 = p[dx+dz], v011 = p[dy+dz], v111 = p[dx+dy+dz];
+    double d00 = v100 - v000, d10 = v110 - v010, d01 = v101 - v001, d11 = v111 - v011;
+    double v00 = v000 + fx*d00, v10 = v010 + fx*d10;
+    double v01 = v001 + fx*d01, v11 = v011 + fx*d11;
+    double d0 = d00 + fy*(d10 - d00), d1 = d01 + fy*(d11 - d01);
+    double v0 = v00 + fy*(v10 - v00), v1 = v01 + fy*(v11 - v01);
+    double v = v0 + fz*(v1 - v0);
+
+    // the bin coordinate, which is clamped to the bins
+    double xi = v*this->Scale + this->Shift;
+    double dxi = this->Scale;
+    if (xi < 0.0)
+    {
+      xi = 0.0;
+      dxi = 0.0;
+    }
+    else if (xi > this->MaxBin)
+    {
+      xi = this->MaxBin;
+      dxi = 0.0;
+    }
+    int a = (int)xi;
+    double t = xi - a;
+    double u = 1.0 - t;
+    double t2 = t*t;
+
+    // the window covers bins a-1 to a+2, which start at column a
+    vtkIdType idx = (vtkIdType)b*this->RowSize + a;
+    if (this->LogRatio == NULL)
+    {
+      double *h = this->Histogram + idx;
+      h[0] += u*u*u/6.0;
+      h[1] += (3.0*t2*t - 6.0*t2 + 4.0)/6.0;
+      h[2] += (-3.0*t2*t + 3.0*t2 + 3.0*t + 1.0)/6.0;
+      h[3] += t2*t/6.0;
+    }
+    else if (dxi != 0.0)
+    {
+      const double *l = this->LogRatio + idx;
+      double dm = (-0.5*u*u*l[0] + (1.5*t2 - 2.0*t)*l[1] +
+                   (-1.5*t2 + t + 0.5)*l[2] + 0.5*t2*l[3])*dxi;
+      this->Gradient[0] += dm*(d0 + fz*(d1 - d0));
+      this->Gradient[1] += dm*((v10 - v00) + fz*((v11 - v01) - (v10 - v00)));
+      this->Gradient[2] += dm*(v1 - v0);
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+template<class T, class B>
+void vtkImageJointHistogramParzenRange(const vtkImageJointHistogramParzenStruct *str,
+                                       const T *movingPtr, const B *fixedBins,
+                                       vtkIdType first, vtkIdType last,
+                                       double *hist, double *gradient)
+{
+  vtkImageJointHistogramParzenOp<T> op;
+  for (int i = 0; i < 3; i++)
+  {
+    op.Increments[i] = str->Increments[i];
+    op.Fraction[i] = str->Fraction[i];
+    op.Gradient[i] = 0.0;
+  }
+  op.Scale = str->Scale;
+  op.Shift = str->Shift;
+  op.MaxBin = str->NumberOfBins - 1;
+  op.RowSize = str->RowSize;
+  op.LogRatio = str->LogRatio;
+  op.Histogram = hist;
+
+  vtkImageJointHistogramVisit(str->Points, str->RowLength, str->RowsPerSlice,
+                              str->Increments, movingPtr, fixedBins, first, last, op);
+
+  gradient[0] = op.Gradient[0];
+  gradient[1] = op.Gradient[1];
+  gradient[2] = op.Gradient[2];
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkImageJointHistogramParzenExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkImageJointHistogramParzenStruct *str = static_cast<vtkImageJointHistogramParzenStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  vtkIdType first, last;
+  vtkIdType n = (str->Points ? str->NumberOfPoints : str->NumberOfRows);
+  vtkImageJointHistogramGetRange(n, threadId, threadCount, first, last);
+
+  double *hist = str->Histograms[threadId];
+  if (str->LogRatio == NULL)
+  {
+    std::fill(hist, hist + str->HistogramSize, 0.0);
+  }
+
+  double *gradient = &str->Gradients[3*threadId];
+  if (str->FixedBins8)
+  {
+    switch (str->ScalarType)
+    {
+      vtkTemplateMacro(vtkImageJointHistogramParzenRange(str,
+                       static_cast<VTK_TT *>(str->MovingPointer), str->FixedBins8,
+                       first, last, hist, gradient));
+    }
+  }
+  else
+  {
+    switch (str->ScalarType)
+    {
+      vtkTemplateMacro(vtkImageJointHistogramParzenRange(str,
+                       static_cast<VTK_TT *>(str->MovingPointer), str->FixedBins16,
+                       first, last, hist, gradient));
+    }
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+template<class H>
+VTK_THREAD_RETURN_TYPE vtkImageJointHistogramExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkImageJointHistogramThreadStruct<H> *str = static_cast<vtkImageJointHistogramThreadStruct<H> *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  vtkIdType first, last;
+  vtkIdType n = (str->Points ? str->NumberOfPoints : str->NumberOfRows);
+  vtkImageJointHistogramGetRange(n, threadId, threadCount, first, last);
+
+  H *hist = str->Histograms[threadId];
+  if (threadId > 0)
+  {
+    std::fill(hist, hist + str->HistogramSize, (H)0);
+  }
+
+  int errors = 0;
+  if (str->FixedBins8)
+  {
+    switch (str->ScalarType)
+    {
+      vtkTemplateMacro(vtkImageJointHistogramRange(str, static_cast<VTK_TT *>(str->MovingPointer),
+                       str->FixedBins8, first, last, hist, errors));
+    }
+  }
+  else
+  {
+    switch (str->ScalarType)
+    {
+      vtkTemplateMacro(vtkImageJointHistogramRange(str, static_cast<VTK_TT *>(str->MovingPointer),
+                       str->FixedBins16, first, last, hist, errors));
+    }
+  }
+  str->Errors[threadId] = errors;
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Sum the histograms of the threads into that of the first thread, with
+// each thread summing a range of bins.
+template<class H>
+VTK_THREAD_RETURN_TYPE vtkImageJointHistogramReduceExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkImageJointHistogramThreadStruct<H> *str = static_cast<vtkImageJointHistogramThreadStruct<H> *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  vtkIdType first, last;
+  vtkImageJointHistogramGetRange(str->HistogramSize, threadId, threadCount, first, last);
+
+  H *hist = str->Histograms[0];
+  for (size_t t = 1; t < str->Histograms.size(); t++)
+  {
+    const H *other = str->Histograms[t];
+    for (vtkIdType i = first; i < last; i++)
+    {
+      hist[i] += other[i];
+    }
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+vtkImageJointHistogram::vtkImageJointHistogram()
+{
+  this->BinNumber[0] = 256;
+  this->BinNumber[1] = 256;
+  this->BinWidth[0] = 1.0;
+  this->BinWidth[1] = 1.0;
+  this->BinOrigin[0] = 0.0;
+  this->BinOrigin[1] = 0.0;
+  this->Binning = VTK_JOINT_HISTOGRAM_FLOOR;
+  this->Clamp = 0;
+  this->PartialVolume = 0;
+  this->FixedImage = NULL;
+  this->FixedMask = NULL;
+  for (int i = 0; i < 6; i++)
+  {
+    this->Extent[i] = 0;
+  }
+  this->NumberOfSamples = 0;
+  this->FixedStatus = 0;
+  this->Sampler = NULL;
+  this->SamplerTime = 0;
+
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
+}
+
+//----------------------------------------------------------------------------
+vtkImageJointHistogram::~vtkImageJointHistogram()
+{
+  this->SetSampler(NULL);
+  this->Threader->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageJointHistogram::SetBinNumber(int numS, int numT)
+{
+  if (this->BinNumber[0] == numS && this->BinNumber[1] == numT)
+  {
+    return;
+  }
+  this->BinNumber[0] = numS;
+  this->BinNumber[1] = numT;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageJointHistogram::SetBinWidth(double widthS, double widthT)
+{
+  if (this->BinWidth[0] == widthS && this->BinWidth[1] == widthT)
+  {
+    return;
+  }
+  this->BinWidth[0] = widthS;
+  this->BinWidth[1] = widthT;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageJointHistogram::SetBinOrigin(double originS, double originT)
+{
+  if (this->BinOrigin[0] == originS && this->BinOrigin[1] == originT)
+  {
+    return;
+  }
+  this->BinOrigin[0] = originS;
+  this->BinOrigin[1] = originT;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+template <class T, class B>
+void vtkImageJointHistogramMaskExecute(T *maskPtr, int extent[6], vtkIdType inc[3],
+                                       const int *points, std::vector<B> &bins)
+{
+  const B masked = static_cast<B>(~0);
+  B *binPtr = &bins[0];
+  if (points)
+  {
+    for (size_t s = 0; s < bins.size(); s++, points += 3)
+    {
+      T m = maskPtr[points[0]*inc[0] + points[1]*inc[1] + points[2]*inc[2]];
+      binPtr[s] = m ? 0 : masked;
+    }
+    return;
+  }
+  for (int idZ = extent[4]; idZ <= extent[5]; idZ++)
+  {
+    const T *rowPtr = maskPtr;
+    for (int idY = extent[2]; idY <= extent[3]; idY++)
+    {
+      const T *p = rowPtr;
+      for (int idX = extent[0]; idX <= extent[1]; idX++)
+      {
+        *binPtr++ = (*p) ? 0 : masked;
+        p += inc[0];
+      }
+      rowPtr += inc[1];
+    }
+    maskPtr += inc[2];
+  }
+}
+
+//----------------------------------------------------------------------------
+template <class B>
+inline void vtkImageJointHistogramBinFixedValue(double v, const vtkImageJointHistogramBinner &bin,
+                                                B *binPtr, long *hist, vtkIdType &count,
+                                                int &errors)
+{
+  const B masked = static_cast<B>(~0);
+  if (*binPtr != masked)
+  {
+    int b = bin(v);
+    if (b < 0)
+    {
+      errors++;
+      *binPtr = masked;
+    }
+    else
+    {
+      hist[b]++;
+      count++;
+      *binPtr = static_cast<B>(b);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+template <class T, class B>
+int vtkImageJointHistogramFixedExecute(T *inPtr, int extent[6], vtkIdType inc[3],
+                                       const int *points,
+                                       const vtkImageJointHistogramBinner &bin,
+                                       std::vector<B> &bins, long *hist, vtkIdType &count)
+{
+  B *binPtr = &bins[0];
+  int errors = 0;
+  count = 0;
+  if (points)
+  {
+    for (size_t s = 0; s < bins.size(); s++, points += 3)
+    {
+      T v = inPtr[points[0]*inc[0] + points[1]*inc[1] + points[2]*inc[2]];
+      vtkImageJointHistogramBinFixedValue((double)v, bin, binPtr + s, hist, count, errors);
+    }
+    return (errors == 0);
+  }
+  for (int idZ = extent[4]; idZ <= extent[5]; idZ++)
+  {
+    const T *rowPtr = inPtr;
+    for (int idY = extent[2]; idY <= extent[3]; idY++)
+    {
+      const T *p = rowPtr;
+      for (int idX = extent[0]; idX <= extent[1]; idX++, binPtr++)
+      {
+        vtkImageJointHistogramBinFixedValue((double)*p, bin, binPtr, hist, count, errors);
+        p += inc[0];
+      }
+      rowPtr += inc[1];
+    }
+    inPtr += inc[2];
+  }
+  return (errors == 0);
+}
+
+//----------------------------------------------------------------------------
+// Bin the fixed image over the extent, or at the points (relative to the
+// extent) if given, with one bin per point.
+template <class B>
+int vtkImageJointHistogramBinFixedImage(vtkImageJointHistogram *self, vtkImageData *image,
+                                        vtkImageData *mask, int extent[6],
+                                        const int *points,
+                                        const vtkImageJointHistogramBinner &bin,
+                                        std::vector<B> &bins, long *hist, vtkIdType &count)
+{
+  vtkIdType inc[3];
+  if (mask)
+  {
+    mask->GetIncrements(inc);
+    void *maskPtr = mask->GetScalarPointerForExtent(extent);
+    switch (mask->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImageJointHistogramMaskExecute(static_cast<VTK_TT *>(maskPtr),
+                       extent, inc, points, bins));
+    default:
+      vtkErrorWithObjectMacro(self, "SetFixedImage: Unknown ScalarType");
+      return 0;
+    }
+  }
+
+  image->GetIncrements(inc);
+  void *inPtr = image->GetScalarPointerForExtent(extent);
+  switch (image->GetScalarType())
+  {
+    vtkTemplateMacro(return vtkImageJointHistogramFixedExecute(static_cast<VTK_TT *>(inPtr),
+                            extent, inc, points, bin, bins, hist, count));
+  default:
+    vtkErrorWithObjectMacro(self, "SetFixedImage: Unknown ScalarType");
+    return 0;
+  }
+}
+
+//----------------------------------------------------------------------------
+int vtkImageJointHistogram::SetFixedImage(vtkImageData *image, vtkImageData *mask,
+                                          int extent[6])
+{
+  if (image != this->FixedImage || mask != this->FixedMask ||
+      memcmp(extent, this->Extent, sizeof(int)*6) != 0)
+  {
+    this->FixedImage = image;
+    this->FixedMask = mask;
+    memcpy(this->Extent, extent, sizeof(int)*6);
+    this->Modified();
+  }
+
+  // copy the samples, relative to the extent, so that they stay the same
+  // until the fixed image is set again
+  if (this->Sampler)
+  {
+    if (!this->Sampler->Update(image, extent))
+    {
+      this->FixedStatus = 0;
+      return 0;
+    }
+    if (this->Sampler->GetSamplesTime() != this->SamplerTime)
+    {
+      vtkIdType n = this->Sampler->GetNumberOfSamples();
+      const int *points = this->Sampler->GetPoints();
+      this->SamplePoints.resize(3*n);
+      for (vtkIdType i = 0; i < 3*n; i += 3)
+      {
+        this->SamplePoints[i] = points[i] - extent[0];
+        this->SamplePoints[i+1] = points[i+1] - extent[2];
+        this->SamplePoints[i+2] = points[i+2] - extent[4];
+      }
+      this->SamplerTime = this->Sampler->GetSamplesTime();
+      this->Modified();
+    }
+  }
+
+  return this->UpdateFixedBins();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageJointHistogram::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  if (sampler == this->Sampler)
+  {
+    return;
+  }
+  if (this->Sampler)
+  {
+    this->Sampler->UnRegister(this);
+  }
+  this->Sampler = sampler;
+  if (this->Sampler)
+  {
+    this->Sampler->Register(this);
+  }
+  std::vector<int>().swap(this->SamplePoints);
+  this->SamplerTime = 0;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageJointHistogram::UpdateFixedBins()
+{
+  if (this->FixedImage == NULL)
+  {
+    return 0;
+  }
+  if (this->FixedBinsTime > this->GetMTime() &&
+      this->FixedBinsTime > this->FixedImage->GetMTime() &&
+      (this->FixedMask == NULL || this->FixedBinsTime > this->FixedMask->GetMTime()))
+  {
+    return this->FixedStatus;
+  }
+
+  int *extent = this->Extent;
+  vtkIdType numVoxels = (vtkIdType)(extent[1] - extent[0] + 1) *
+    (extent[3] - extent[2] + 1) * (extent[5] - extent[4] + 1);
+  numVoxels = (numVoxels > 0) ? numVoxels : 0;
+  const int *points = NULL;
+  if (this->Sampler)
+  {
+    numVoxels = (vtkIdType)(this->SamplePoints.size()/3);
+    points = (numVoxels > 0 ? &this->SamplePoints[0] : NULL);
+  }
+  this->FixedHistogram.assign(this->BinNumber[1], 0);
+  this->NumberOfSamples = 0;
+  this->FixedStatus = 1;
+
+  vtkImageJointHistogramBinner bin;
+  bin.Initialize(this->BinNumber[1], this->BinWidth[1], this->BinOrigin[1],
+                 this->Binning, this->Clamp);
+
+  // the largest index of each type marks the voxels that are not binned,
+  // and with a sampler there is one bin per sample rather than per voxel
+  std::vector<unsigned char>().swap(this->FixedBins8);
+  std::vector<unsigned short>().swap(this->FixedBins16);
+  if (this->BinNumber[1] <= VTK_UNSIGNED_CHAR_MAX)
+  {
+    this->FixedBins8.assign(numVoxels, 0);
+    if (numVoxels > 0)
+    {
+      this->FixedStatus = vtkImageJointHistogramBinFixedImage(this, this->FixedImage,
+        this->FixedMask, extent, points, bin, this->FixedBins8, &this->FixedHistogram[0],
+        this->NumberOfSamples);
+    }
+  }
+  else if (this->BinNumber[1] <= VTK_UNSIGNED_SHORT_MAX)
+  {
+    this->FixedBins16.assign(numVoxels, 0);
+    if (numVoxels > 0)
+    {
+      this->FixedStatus = vtkImageJointHistogramBinFixedImage(this, this->FixedImage,
+        this->FixedMask, extent, points, bin, this->FixedBins16, &this->FixedHistogram[0],
+        this->NumberOfSamples);
+    }
+  }
+  else
+  {
+    vtkErrorMacro("SetFixedImage: Too many bins for the fixed image");
+    this->FixedStatus = 0;
+  }
+
+  this->FixedBinsTime.Modified();
+  return this->FixedStatus;
+}
+
+//----------------------------------------------------------------------------
+template<class H>
+int vtkImageJointHistogram::Accumulate(vtkImageData *image, int loc000[3], int loc111[3],
+                                       const double weights[8], H *histS, H *histST,
+                                       std::vector< std::vector<H> > &threadHistograms)
+{
+  vtkIdType histogramSize = (vtkIdType)this->BinNumber[0]*this->BinNumber[1];
+  memset(histS, 0, this->BinNumber[0]*sizeof(H));
+  memset(histST, 0, histogramSize*sizeof(H));
+  if (!this->UpdateFixedBins())
+  {
+    return 0;
+  }
+  if (this->FixedBins8.empty() && this->FixedBins16.empty())
+  {
+    return 1;
+  }
+
+  vtkImageJointHistogramThreadStruct<H> str;
+  str.FixedBins8 = (this->FixedBins8.empty() ? NULL : &this->FixedBins8[0]);
+  str.FixedBins16 = (this->FixedBins16.empty() ? NULL : &this->FixedBins16[0]);
+  str.RowSize = this->BinNumber[0];
+  str.RowLength = this->Extent[1] - this->Extent[0] + 1;
+  str.RowsPerSlice = this->Extent[3] - this->Extent[2] + 1;
+  str.NumberOfRows = str.RowsPerSlice * (this->Extent[5] - this->Extent[4] + 1);
+  str.Points = (this->Sampler ? &this->SamplePoints[0] : NULL);
+  str.NumberOfPoints = (vtkIdType)(this->SamplePoints.size()/3);
+  str.ScalarType = image->GetScalarType();
+  image->GetIncrements(str.Increments);
+  int ext[6];
+  for (int i = 0; i < 3; i++)
+  {
+    ext[2*i] = this->Extent[2*i] + loc000[i];
+    ext[2*i+1] = this->Extent[2*i+1] + loc000[i];
+  }
+  str.MovingPointer = image->GetScalarPointerForExtent(ext);
+
+  // offsets of the neighbours in the order of the weights
+  vtkIdType dx = (loc111[0] - loc000[0])*str.Increments[0];
+  vtkIdType dy = (loc111[1] - loc000[1])*str.Increments[1];
+  vtkIdType dz = (loc111[2] - loc000[2])*str.Increments[2];
+  str.Offsets[0] = 0;
+  str.Offsets[1] = dx;
+  str.Offsets[2] = dy;
+  str.Offsets[3] = dx + dy;
+  str.Offsets[4] = dz;
+  str.Offsets[5] = dx + dz;
+  str.Offsets[6] = dy + dz;
+  str.Offsets[7] = dx + dy + dz;
+  str.Weights = weights;
+  str.Interpolate = (loc000[0] != 0 || loc111[0] != 0 ||
+                     loc000[1] != 0 || loc111[1] != 0 ||
+                     loc000[2] != 0 || loc111[2] != 0);
+  str.PartialVolume = this->PartialVolume;
+  str.Binner.Initialize(this->BinNumber[0], this->BinWidth[0], this->BinOrigin[0],
+                        this->Binning, this->Clamp);
+  str.HistogramSize = histogramSize;
+
+  // A thread only gets its own histogram if it has at least as many voxels
+  // as there are bins, otherwise clearing and summing the histograms would
+  // cost more than the threads save.
+  vtkIdType numVoxels = (str.Points ? str.NumberOfPoints :
+                         (vtkIdType)str.NumberOfRows*str.RowLength);
+  vtkIdType numUnits = (str.Points ? str.NumberOfPoints : str.NumberOfRows);
+  vtkIdType maxThreads = numVoxels/histogramSize;
+  int numThreads = this->NumberOfThreads;
+  numThreads = (numThreads < maxThreads) ? numThreads : (int)maxThreads;
+  numThreads = (numThreads < numUnits) ? numThreads : (int)numUnits;
+  numThreads = (numThreads > 1) ? numThreads : 1;
+  numThreads = vtkImageJointHistogramClampThreads(numThreads);
+
+  if ((int)threadHistograms.size() < numThreads - 1)
+  {
+    threadHistograms.resize(numThreads - 1);
+  }
+  str.Histograms.push_back(histST);
+  for (int t = 1; t < numThreads; t++)
+  {
+    threadHistograms[t-1].resize(histogramSize);
+    str.Histograms.push_back(&threadHistograms[t-1][0]);
+  }
+  str.Errors.assign(numThreads, 0);
+
+  this->Threader->SetNumberOfThreads(numThreads);
+  this->Threader->SetSingleMethod(vtkImageJointHistogramExecute<H>, &str);
+  this->Threader->SingleMethodExecute();
+  if (numThreads > 1)
+  {
+    this->Threader->SetSingleMethod(vtkImageJointHistogramReduceExecute<H>, &str);
+    this->Threader->SingleMethodExecute();
+  }
+
+  // the histogram of the moving image is the marginal of the joint histogram
+  for (int b = 0; b < this->BinNumber[1]; b++)
+  {
+    const H *row = histST + (vtkIdType)b*this->BinNumber[0];
+    for (int a = 0; a < this->BinNumber[0]; a++)
+    {
+      histS[a] += row[a];
+    }
+  }
+
+  int errors = 0;
+  for (int t = 0; t < numThreads; t++)
+  {
+    errors += str.Errors[t];
+  }
+  return (errors == 0);
+}
+
+//----------------------------------------------------------------------------
+int vtkImageJointHistogram::ComputeJointHistogram(vtkImageData *image, int loc000[3],
+                                                  int loc111[3], const double weights[8],
+                                                  long *histS, long *histST)
+{
+  if (this->PartialVolume)
+  {
+    vtkErrorMacro("ComputeJointHistogram: PartialVolume needs double histograms");
+    return 0;
+  }
+  return this->Accumulate(image, loc000, loc111, weights, histS, histST,
+                          this->ThreadHistograms);
+}
+
+//----------------------------------------------------------------------------
+int vtkImageJointHistogram::ComputeJointHistogram(vtkImageData *image, int loc000[3],
+                                                  int loc111[3], const double weights[8],
+                                                  double *histS, double *histST)
+{
+  return this->Accumulate(image, loc000, loc111, weights, histS, histST,
+                          this->ThreadWeightedHistograms);
+}
+
+//----------------------------------------------------------------------------
+int vtkImageJointHistogram::ComputeParzenMutualInformation(vtkImageData *image,
+                                                           int loc000[3],
+                                                           const double fraction[3],
+                                                           double &value,
+                                                           double gradient[3])
+{
+  value = 0.0;
+  gradient[0] = gradient[1] = gradient[2] = 0.0;
+  if (!this->UpdateFixedBins())
+  {
+    return 0;
+  }
+  if (this->FixedBins8.empty() && this->FixedBins16.empty())
+  {
+    return 0;
+  }
+
+  int numS = this->BinNumber[0];
+  int numT = this->BinNumber[1];
+
+  vtkImageJointHistogramParzenStruct str;
+  str.FixedBins8 = (this->FixedBins8.empty() ? NULL : &this->FixedBins8[0]);
+  str.FixedBins16 = (this->FixedBins16.empty() ? NULL : &this->FixedBins16[0]);
+  str.RowSize = numS + 3;
+  str.RowLength = this->Extent[1] - this->Extent[0] + 1;
+  str.RowsPerSlice = this->Extent[3] - this->Extent[2] + 1;
+  str.NumberOfRows = str.RowsPerSlice * (this->Extent[5] - this->Extent[4] + 1);
+  str.Points = (this->Sampler ? &this->SamplePoints[0] : NULL);
+  str.NumberOfPoints = (vtkIdType)(this->SamplePoints.size()/3);
+  str.ScalarType = image->GetScalarType();
+  image->GetIncrements(str.Increments);
+  int ext[6];
+  for (int i = 0; i < 3; i++)
+  {
+    ext[2*i] = this->Extent[2*i] + loc000[i];
+    ext[2*i+1] = this->Extent[2*i+1] + loc000[i];
+    str.Fraction[i] = fraction[i];
+  }
+  str.MovingPointer = image->GetScalarPointerForExtent(ext);
+
+  // the bin centres are at integer bin coordinates
+  double offset = (this->Binning == VTK_JOINT_HISTOGRAM_ROUND) ? 0.5 : 0.0;
+  str.Scale = 1.0/this->BinWidth[0];
+  str.Shift = offset - 0.5 - this->BinOrigin[0]*str.Scale;
+  str.NumberOfBins = numS;
+  str.HistogramSize = (vtkIdType)str.RowSize*numT;
+  str.LogRatio = NULL;
+
+  // as for ComputeJointHistogram, a thread needs as many voxels as bins
+  vtkIdType numVoxels = (str.Points ? str.NumberOfPoints :
+                         (vtkIdType)str.NumberOfRows*str.RowLength);
+  vtkIdType numUnits = (str.Points ? str.NumberOfPoints : str.NumberOfRows);
+  vtkIdType maxThreads = numVoxels/str.HistogramSize;
+  int numThreads = this->NumberOfThreads;
+  numThreads = (numThreads < maxThreads) ? numThreads : (int)maxThreads;
+  numThreads = (numThreads < numUnits) ? numThreads : (int)numUnits;
+  numThreads = (numThreads > 1) ? numThreads : 1;
+  numThreads = vtkImageJointHistogramClampThreads(numThreads);
+
+  if ((int)this->ThreadWeightedHistograms.size() < numThreads - 1)
+  {
+    this->ThreadWeightedHistograms.resize(numThreads - 1);
+  }
+  this->ParzenHistogram.resize(str.HistogramSize);
+  str.Histograms.push_back(&this->ParzenHistogram[0]);
+  for (int t = 1; t < numThreads; t++)
+  {
+    this->ThreadWeightedHistograms[t-1].resize(str.HistogramSize);
+    str.Histograms.push_back(&this->ThreadWeightedHistograms[t-1][0]);
+  }
+  str.Gradients.assign(3*numThreads, 0.0);
+
+  this->Threader->SetNumberOfThreads(numThreads);
+  this->Threader->SetSingleMethod(vtkImageJointHistogramParzenExecute, &str);
+  this->Threader->SingleMethodExecute();
+
+  double *hist = &this->ParzenHistogram[0];
+  for (int t = 1; t < numThreads; t++)
+  {
+    const double *other = str.Histograms[t];
+    for (vtkIdType i = 0; i < str.HistogramSize; i++)
+    {
+      hist[i] += other[i];
+    }
+  }
+
+  // the marginal histograms, and the log ratio of the joint histogram to
+  // that of the moving image
+  std::vector<double> histS(str.RowSize, 0.0);
+  std::vector<double> histT(numT, 0.0);
+  double count = 0.0;
+  for (int b = 0; b < numT; b++)
+  {
+    const double *row = hist + (vtkIdType)b*str.RowSize;
+    for (int a = 0; a < str.RowSize; a++)
+    {
+      histS[a] += row[a];
+      histT[b] += row[a];
+    }
+    count += histT[b];
+  }
+  if (count <= 0.0)
+  {
+    return 0;
+  }
+
+  this->ParzenLogRatio.resize(str.HistogramSize);
+  double *logRatio = &this->ParzenLogRatio[0];
+  double mi = 0.0;
+  for (int b = 0; b < numT; b++)
+  {
+    const double *row = hist + (vtkIdType)b*str.RowSize;
+    double *lrow = logRatio + (vtkIdType)b*str.RowSize;
+    for (int a = 0; a < str.RowSize; a++)
+    {
+      lrow[a] = 0.0;
+      if (row[a] > 0.0)
+      {
+        lrow[a] = log(row[a]/histS[a]);
+        mi += row[a]*(lrow[a] - log(histT[b]/count));
+      }
+    }
+  }
+  value = mi/count;
+
+  // the second pass, for the gradient
+  str.LogRatio = logRatio;
+  this->Threader->SetSingleMethod(vtkImageJointHistogramParzenExecute, &str);
+  this->Threader->SingleMethodExecute();
+  for (int t = 0; t < numThreads; t++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      gradient[i] += str.Gradients[3*t + i];
+    }
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    gradient[i] /= count;
+  }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkImageJointHistogram::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "BinNumber: ( " << this->BinNumber[0] << ", " << this->BinNumber[1] << " )\n";
+  os << indent << "BinWidth: ( " << this->BinWidth[0] << ", " << this->BinWidth[1] << " )\n";
+  os << indent << "BinOrigin: ( " << this->BinOrigin[0] << ", " << this->BinOrigin[1] << " )\n";
+  os << indent << "Binning: " << (this->Binning == VTK_JOINT_HISTOGRAM_ROUND ? "Round\n" : "Floor\n");
+  os << indent << "Clamp: " << (this->Clamp ? "On\n" : "Off\n");
+  os << indent << "PartialVolume: " << (this->PartialVolume ? "On\n" : "Off\n");
+  os << indent << "FixedImage: " << this->FixedImage << "\n";
+  os << indent << "FixedMask: " << this->FixedMask << "\n";
+  os << indent << "Sampler: " << this->Sampler << "\n";
+  os << indent << "NumberOfSamples: " << this->NumberOfSamples << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+}
@@ -0,0 +1,220 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageJointHistogram.h,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkImageJointHistogram - joint histogram engine for the
+// vtkImage*Manipulator metrics.
+// .SECTION Description
+// vtkImageJointHistogram accumulates the joint histogram of a fixed image
+// and a moving image that is translated by a fraction of a voxel, which is
+// the inner loop of the histogram based vtkImage*Manipulator metrics.
+// The fixed image is binned once into a compact volume of 8 or 16 bit bin
+// indices, which is only rebuilt when the fixed image, the mask, the
+// extent or the bins change, so that every evaluation only reads the
+// moving image and one or two bytes per voxel of the fixed image.
+// The extent is split into runs of rows that are accumulated by separate
+// threads into their own histograms, which are then summed. The histogram
+// of the moving image is the marginal of the joint histogram.
+//
+// The moving image is either interpolated trilinearly and the result is
+// binned, or, with PartialVolume on, each of the 8 neighbouring voxels is
+// binned and contributes its trilinear weight (partial volume
+// interpolation). A voxel value v falls in bin
+// floor((v - BinOrigin)/BinWidth), or floor((v - BinOrigin)/BinWidth + 0.5)
+// with BinningToRound. Values outside of the bins
+// are either clamped to the first or last bin, or reported as an error.
+//
+// With a vtkImageVoxelSampler, only the samples that it draws from the
+// fixed image are binned and visited, in a compact list with one bin per
+// sample, so that every evaluation only reads a fraction of the images.
+//
+// For gradient based optimization, the mutual information can also be
+// estimated with a cubic B-spline Parzen window over the bins of the
+// moving image, which makes it differentiable with respect to the
+// translation (Mattes et al., IEEE TMI 22(1), 2003).
+// .SECTION see also
+// vtkImageMIManipulator vtkImageSMIManipulator2 vtkImageSMIPVIManipulator
+// vtkImageVoxelSampler
+
+#ifndef __vtkImageJointHistogram_h
+#define __vtkImageJointHistogram_h
+
+#include "vtkRobartsRegistrationExport.h"
+
+#include "vtkMultiThreader.h"
+#include "vtkObject.h"
+#include "vtkTimeStamp.h"
+
+#include <vector>
+
+class vtkImageData;
+class vtkImageVoxelSampler;
+
+#define VTK_JOINT_HISTOGRAM_FLOOR 0
+#define VTK_JOINT_HISTOGRAM_ROUND 1
+
+class vtkRobartsRegistrationExport vtkImageJointHistogram : public vtkObject
+{
+public:
+  static vtkImageJointHistogram *New();
+  vtkTypeMacro(vtkImageJointHistogram,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Set the number of bins and the bin width for the moving (S) and the
+  // fixed (T) image. Set these before the fixed image.
+  void SetBinNumber(int numS, int numT);
+  vtkGetVector2Macro(BinNumber,int);
+  void SetBinWidth(double widthS, double widthT);
+  vtkGetVector2Macro(BinWidth,double);
+
+  // Description:
+  // The value at the start of the first bin, for the moving (S) and the
+  // fixed (T) image. The default is zero.
+  void SetBinOrigin(double originS, double originT);
+  vtkGetVector2Macro(BinOrigin,double);
+
+  // Description:
+  // Whether a value is binned by truncating or by rounding v/BinWidth.
+  // The default is Floor.
+  vtkSetClampMacro(Binning,int,VTK_JOINT_HISTOGRAM_FLOOR,VTK_JOINT_HISTOGRAM_ROUND);
+  vtkGetMacro(Binning,int);
+  void SetBinningToFloor() { this->SetBinning(VTK_JOINT_HISTOGRAM_FLOOR); };
+  void SetBinningToRound() { this->SetBinning(VTK_JOINT_HISTOGRAM_ROUND); };
+
+  // Description:
+  // Clamp values outside of the bins to the first or last bin. If off,
+  // such values make SetFixedImage and ComputeJointHistogram fail.
+  // The default is Off.
+  vtkSetMacro(Clamp,int);
+  vtkGetMacro(Clamp,int);
+  vtkBooleanMacro(Clamp,int);
+
+  // Description:
+  // Use partial volume interpolation rather than binning the trilinearly
+  // interpolated value. The default is Off.
+  vtkSetMacro(PartialVolume,int);
+  vtkGetMacro(PartialVolume,int);
+  vtkBooleanMacro(PartialVolume,int);
+
+  // Description:
+  // Set the number of threads used to accumulate the joint histogram.
+  vtkSetClampMacro(NumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads,int);
+
+  // Description:
+  // Only bin and visit the samples drawn by this sampler from the fixed
+  // image. The samples are drawn by SetFixedImage, and are kept until it
+  // is called again. Set this before the fixed image.
+  void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkImageVoxelSampler *GetSampler() { return this->Sampler; };
+
+  // Description:
+  // Bin the fixed image over the extent, skipping the voxels where the
+  // mask, if given, is zero. The histogram of the fixed image is then
+  // available from GetFixedHistogram. Nothing is done if the images, the
+  // extent and the bins are unchanged since the last call. Returns 0 if
+  // a value is outside of the bins and Clamp is off.
+  int SetFixedImage(vtkImageData *image, vtkImageData *mask, int extent[6]);
+  const long *GetFixedHistogram() { return &this->FixedHistogram[0]; };
+
+  // Description:
+  // The number of voxels (or samples) of the fixed image that were binned.
+  vtkGetMacro(NumberOfSamples,vtkIdType);
+
+  // Description:
+  // Accumulate the histogram of the moving image and the joint histogram,
+  // indexed by T*BinNumber[0] + S, over the extent of the fixed image.
+  // The moving image is translated by whole voxels to loc000, and
+  // interpolated towards loc111 with the weights F000, F100, F010, F110,
+  // F001, F101, F011, F111. The translated extent must lie within the
+  // moving image. The histograms are overwritten. Returns 0 if a value
+  // is outside of the bins and Clamp is off. The fixed image is binned
+  // again first if the bins have changed since SetFixedImage.
+  int ComputeJointHistogram(vtkImageData *image, int loc000[3], int loc111[3],
+                            const double weights[8], long *histS, long *histST);
+  int ComputeJointHistogram(vtkImageData *image, int loc000[3], int loc111[3],
+                            const double weights[8], double *histS, double *histST);
+
+  // Description:
+  // Compute the mutual information of the fixed image and the moving
+  // image translated by loc000 + fraction voxels, with a cubic B-spline
+  // Parzen window over the bins of the moving image, and its gradient
+  // with respect to the translation in voxels. Unlike
+  // ComputeJointHistogram, the moving image is always read at loc000 + 1
+  // along every axis, which must lie within it. Moving values outside of
+  // the bins are clamped, and do not contribute to the gradient.
+  // Returns 0 if there are no samples.
+  int ComputeParzenMutualInformation(vtkImageData *image, int loc000[3],
+                                     const double fraction[3], double &value,
+                                     double gradient[3]);
+
+protected:
+  vtkImageJointHistogram();
+  ~vtkImageJointHistogram();
+
+  // Bin the fixed image if it, or the bins, changed since it was binned.
+  int UpdateFixedBins();
+
+  template<class H>
+  int Accumulate(vtkImageData *image, int loc000[3], int loc111[3],
+                 const double weights[8], H *histS, H *histST,
+                 std::vector< std::vector<H> > &threadHistograms);
+
+  int BinNumber[2];
+  double BinWidth[2];
+  double BinOrigin[2];
+  int Binning;
+  int Clamp;
+  int PartialVolume;
+
+  // The fixed image and the extent, and the bin of each of its voxels, or
+  // the largest value of the type where the mask is zero. Only one of the
+  // bin volumes is used, depending on the number of bins.
+  vtkImageData *FixedImage;
+  vtkImageData *FixedMask;
+  int Extent[6];
+  std::vector<unsigned char> FixedBins8;
+  std::vector<unsigned short> FixedBins16;
+  std::vector<long> FixedHistogram;
+  vtkIdType NumberOfSamples;
+  int FixedStatus;
+  vtkTimeStamp FixedBinsTime;
+
+  // The samples relative to the extent, as copied from the sampler at the
+  // given time, in which case the bin volumes hold one bin per sample.
+  vtkImageVoxelSampler *Sampler;
+  std::vector<int> SamplePoints;
+  vtkMTimeType SamplerTime;
+
+  // Histograms for all but the first thread, which uses the output.
+  std::vector< std::vector<long> > ThreadHistograms;
+  std::vector< std::vector<double> > ThreadWeightedHistograms;
+
+  // The Parzen window joint histogram, which has 3 more columns than
+  // there are bins for the moving image because the window reaches past
+  // the first and the last bin, and the log of its ratio to the histogram
+  // of the moving image.
+  std::vector<double> ParzenHistogram;
+  std::vector<double> ParzenLogRatio;
+
+  vtkMultiThreader *Threader;
+  int NumberOfThreads;
+
+private:
+  vtkImageJointHistogram(const vtkImageJointHistogram&);  // Not implemented.
+  void operator=(const vtkImageJointHistogram&);  // Not implemented.
+};
+
+#endif
@@ -17,6 +17,9 @@
 =========================================================================*/
 #include "vtkImageMIManipulator.h"
 
+#include "vtkImageJointHistogram.h"
+#include "vtkImageVoxelSampler.h"
+
 //--------------------------------------------------------------------------
 // The 'floor' function on x86 and mips is many times slower than these
 // and is used a lot in this code, optimize for different CPU architectures
@@ -84,18 +87,26 @@ vtkImageMIManipulator::vtkImageMIManipulator()
   {
     this->Extent[i] = 0;
   }
-  this->BinWidth[0] = 1;
-  this->BinWidth[1] = 1;
+  this->BinWidth[0] = 1.0;
+  this->BinWidth[1] = 1.0;
+  this->BinOrigin[0] = 0.0;
+  this->BinOrigin[1] = 0.0;
   this->BinNumber[0] = 4096;
   this->BinNumber[1] = 4096;
+  this->HistS = NULL;
+  this->HistT = NULL;
+  this->HistST = NULL;
+  this->Histogram = vtkImageJointHistogram::New();
+  this->Histogram->SetBinNumber(this->BinNumber[0], this->BinNumber[1]);
 }
 
 //----------------------------------------------------------------------------
 vtkImageMIManipulator::~vtkImageMIManipulator()
 {
-  delete this->HistS;
-  delete this->HistT;
-  delete this->HistST;
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
+  this->Histogram->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -103,7 +114,6 @@ void vtkImageMIManipulator::SetInput1(vtkImageData *input)
 {
   input->GetSpacing(this->inSpa);
   input->GetExtent(this->inExt);
-  input->GetIncrements(this->inc[0], this->inc[1], this->inc[2]);
   this->inData[0] = input;
 }
 
@@ -130,82 +140,71 @@ void vtkImageMIManipulator::SetBinNumber(int numS, int numT)
 {
   this->BinNumber[0] = numS;
   this->BinNumber[1] = numT;
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
   this->HistS = new long[numS];
   this->HistT = new long[numT];
   this->HistST = new long[numS*numT];
+  this->Histogram->SetBinNumber(numS, numT);
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageMIManipulatorEntropyT(vtkImageMIManipulator *self,
-                                   T  *inPtr, int inc2[2], double count)
+void vtkImageMIManipulator::SetNumberOfThreads(int numThreads)
 {
-  short b;
-  double temp, entropyT = 0;
-
-  // Loop over data
-  for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-  {
-    for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-    {
-      for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-      {
-        b = vtkResliceFloor(*inPtr/double(self->BinWidth[1]));
-        if (b < 0.0)
-        {
-          cout << "ERROR: Images have values < 0.0\n";
-          exit(0);
-        }
-        self->HistT[b]++;
-        inPtr++;
-      }
-      inPtr += inc2[0];
-    }
-    inPtr += inc2[1];
-  }
+  this->Histogram->SetNumberOfThreads(numThreads);
+}
 
-  for (int i = 0; i < self->BinNumber[1]; i++)
-  {
-    temp = (double)self->HistT[i];
-    if (temp > 0.0)
-    {
-      entropyT += temp * log(temp);
-    }
-  }
+//----------------------------------------------------------------------------
+int vtkImageMIManipulator::GetNumberOfThreads()
+{
+  return this->Histogram->GetNumberOfThreads();
+}
 
-  self->entropyT = -entropyT / count + log(count);
+//----------------------------------------------------------------------------
+void vtkImageMIManipulator::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  this->Histogram->SetSampler(sampler);
+}
 
+//----------------------------------------------------------------------------
+vtkImageVoxelSampler *vtkImageMIManipulator::GetSampler()
+{
+  return this->Histogram->GetSampler();
 }
 
 //----------------------------------------------------------------------------
 void vtkImageMIManipulator::SetExtent(int ext[6])
 {
-  void *inPtr;
-
-  this->inc2[0] = this->inc[1] - this->inc[0] * (ext[1] - ext[0] + 1);
-  this->inc2[1] = this->inc[2] - this->inc[1] * (ext[3] - ext[2] + 1);
-
-  this->inPtr[0] = this->inData[0]->GetScalarPointerForExtent(ext);
-  this->inPtr[1] = this->inData[1]->GetScalarPointerForExtent(ext);
-  inPtr = this->inData[1]->GetScalarPointerForExtent(ext);
+  memcpy(this->Extent, ext, sizeof(int)*6);
 
-  this->count = (ext[1]-ext[0]+1) * (ext[3]-ext[2]+1) * (ext[5]-ext[4]+1);
+  // Bin image 2 once for all translations, and calculate its entropy
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  this->Histogram->SetBinOrigin(this->BinOrigin[0], this->BinOrigin[1]);
+  if (!this->Histogram->SetFixedImage(this->inData[1], NULL, this->Extent))
+  {
+    vtkErrorMacro( "SetExtent: Images have values outside of the bins.");
+    return;
+  }
+  this->count = this->Histogram->GetNumberOfSamples();
   if (this->count == 0)
   {
     vtkErrorMacro( "GetResult: No data to work with.");
   }
+  memcpy(this->HistT, this->Histogram->GetFixedHistogram(), this->BinNumber[1]*sizeof(long));
 
-  memcpy(this->Extent, ext, sizeof(int)*6);
-
-  memset((void *)this->HistT, 0, this->BinNumber[1]*sizeof(long));
-  // Calculate the entropy of image 2
-  switch (this->inData[1]->GetScalarType())
+  double temp, entropyT = 0, count = this->count;
+  for (int i = 0; i < this->BinNumber[1]; i++)
   {
-    vtkTemplateMacro(vtkImageMIManipulatorEntropyT(this,
-                     (VTK_TT *)(inPtr), this->inc2, this->count));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
+    temp = (double)this->HistT[i];
+    if (temp > 0.0)
+    {
+      entropyT += temp * log(temp);
+    }
   }
+
+  this->entropyT = -entropyT / count + log(count);
+
 }
 
 //----------------------------------------------------------------------------
@@ -238,6 +237,8 @@ void vtkImageMIManipulator::SetTranslation(double tran[3])
     }
   }
 
+  memcpy(this->Fraction, f, sizeof(double)*3);
+
   this->F000 = (1.0 - f[0]) * (1.0 - f[1]) * (1.0 - f[2]);
   this->F100 =        f[0]  * (1.0 - f[1]) * (1.0 - f[2]);
   this->F010 = (1.0 - f[0]) *        f[1]  * (1.0 - f[2]);
@@ -249,138 +250,67 @@ void vtkImageMIManipulator::SetTranslation(double tran[3])
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageMIManipulatorExecute(vtkImageMIManipulator *self,
-                                  T  *in1Ptr, T *in2Ptr,
-                                  vtkIdType inc[3], int inc2[2], int inExt[6],
-                                  int loc000[3], int loc111[3], double count)
+double vtkImageMIManipulator::GetResult()
 {
-  double V000, V100, V010, V110, V001, V101, V011, V111, Vxyz;
-  double temp, entropyS = 0, entropyST = 0;
-  short a, b;
+  double temp, entropyS = 0, entropyST = 0, count = this->count;
   int i, j;
 
-  // CASE 1: Check if translation takes us out of the input image, in
-  // which case set the result to indicate complete dissimilarity and stop.
-  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
-       (self->Extent[2] + loc000[1] < inExt[2]) ||
-       (self->Extent[4] + loc000[2] < inExt[4]) ||
-       (self->Extent[1] + loc111[0] > inExt[1]) ||
-       (self->Extent[3] + loc111[1] > inExt[3]) ||
-       (self->Extent[5] + loc111[2] > inExt[5]) )
+  // Check inputs.
+  if (this->inData[0] == NULL)
   {
-    self->Result = 0.0;
-    return;
+    vtkErrorMacro( "Input " << 0 << " must be specified.");
+    return 0;
   }
-
-  // CASE 2: Check if no interpolation is necessary.
-  if ( (loc000[0] == 0) && (loc111[0] == 0) &&
-       (loc000[1] == 0) && (loc111[1] == 0) &&
-       (loc000[2] == 0) && (loc111[2] == 0) )
+  if (this->inData[1] == NULL)
   {
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          a = vtkResliceFloor(*in1Ptr/double(self->BinWidth[0]));
-          b = vtkResliceFloor(*in2Ptr/double(self->BinWidth[1]));
-
-          if ((a < 0.0) || (b < 0.0))
-          {
-            cout << "ERROR: Images have values < 0.0\n";
-            exit(0);
-          }
-
-          self->HistS[a]++;
-          self->HistST[b * self->BinNumber[0] + a]++;
-
-          in1Ptr++;
-          in2Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-    }
+    vtkErrorMacro( "Input " << 1 << " must be specified.");
+    return 0;
+  }
+  if ((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType()))
+  {
+    vtkErrorMacro( "Execute: Inputs must be of the same ScalarType");
+    return 0;
   }
 
-  // CASE 3: If the above two cases don't apply, do the full calculation.
-  else
+  this->Result = 0;
+
+  // Check if translation takes us out of the input image, in
+  // which case set the result to indicate complete dissimilarity and stop.
+  if ( (this->Extent[0] + this->loc000[0] < this->inExt[0]) ||
+       (this->Extent[2] + this->loc000[1] < this->inExt[2]) ||
+       (this->Extent[4] + this->loc000[2] < this->inExt[4]) ||
+       (this->Extent[1] + this->loc111[0] > this->inExt[1]) ||
+       (this->Extent[3] + this->loc111[1] > this->inExt[3]) ||
+       (this->Extent[5] + this->loc111[2] > this->inExt[5]) )
   {
-    in1Ptr += inc[2] * loc000[2] + inc[1] * loc000[1] + inc[0] * loc000[0];
+    this->Result = 0.0;
+    return this->Result;
+  }
 
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        // Initiate previous data
-        V000 = *in1Ptr;
-        in1Ptr += inc[1];
-        V010 = *in1Ptr;
-        in1Ptr += inc[2];
-        V011 = *in1Ptr;
-        in1Ptr -= inc[1];
-        V001 = *in1Ptr;
-        in1Ptr -= inc[2];
-
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          in1Ptr++;
-          V100 = *in1Ptr;
-          in1Ptr += inc[1];
-          V110 = *in1Ptr;
-          in1Ptr += inc[2];
-          V111 = *in1Ptr;
-          in1Ptr -= inc[1];
-          V101 = *in1Ptr;
-          in1Ptr -= inc[2];
-
-          Vxyz = (V000 * self->F000 + V100 * self->F100 +
-                  V010 * self->F010 + V110 * self->F110 +
-                  V001 * self->F001 + V101 * self->F101 +
-                  V011 * self->F011 + V111 * self->F111);
-
-          V000 = V100;
-          V010 = V110;
-          V001 = V101;
-          V011 = V111;
-
-          a = vtkResliceFloor(Vxyz/double(self->BinWidth[0]));
-          b = vtkResliceFloor(*in2Ptr/double(self->BinWidth[1]));
-
-          if ((a < 0.0) || (b < 0.0))
-          {
-            cout << "ERROR: Images have values < 0.0\n";
-            exit(0);
-          }
-
-          self->HistS[a]++;
-          self->HistST[b * self->BinNumber[0] + a]++;
-
-          in2Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-    }
+  // Accumulate the histograms, interpolating image 1
+  double F[8] = { this->F000, this->F100, this->F010, this->F110,
+                  this->F001, this->F101, this->F011, this->F111 };
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  this->Histogram->SetBinOrigin(this->BinOrigin[0], this->BinOrigin[1]);
+  if (!this->Histogram->ComputeJointHistogram(this->inData[0], this->loc000, this->loc111,
+                                              F, this->HistS, this->HistST))
+  {
+    vtkErrorMacro( "GetResult: Images have values outside of the bins.");
+    this->Result = 0.0;
+    return this->Result;
   }
 
   // Loop over S and ST histograms.
-  for (i = 0; i < self->BinNumber[0]; i++)
+  for (i = 0; i < this->BinNumber[0]; i++)
   {
-    temp = (double)self->HistS[i];
+    temp = (double)this->HistS[i];
     if (temp > 0.0)
     {
       entropyS += temp * log(temp);
     }
-    for (j = 0; j < self->BinNumber[1]; j++)
+    for (j = 0; j < this->BinNumber[1]; j++)
     {
-      temp = (double)self->HistST[j * self->BinNumber[0] + i];
+      temp = (double)this->HistST[j * this->BinNumber[0] + i];
       if (temp > 0.0)
       {
         entropyST += temp * log(temp);
@@ -392,13 +322,16 @@ void vtkImageMIManipulatorExecute(vtkImageMIManipulator *self,
   entropyS  = -entropyS /count + log(count);
   entropyST = -entropyST/count + log(count);
 
-  self->Result = entropyS + self->entropyT - entropyST;
+  this->Result = entropyS + this->entropyT - entropyST;
 
+  return this->Result;
 }
 
 //----------------------------------------------------------------------------
-double vtkImageMIManipulator::GetResult()
+double vtkImageMIManipulator::GetResultAndGradient(double gradient[3])
 {
+  gradient[0] = gradient[1] = gradient[2] = 0.0;
+
   // Check inputs.
   if (this->inData[0] == NULL)
   {
@@ -416,24 +349,36 @@ double vtkImageMIManipulator::GetResult()
     return 0;
   }
 
-  // Zero the histograms and result.
-  memset((void *)this->HistS, 0, this->BinNumber[0]*sizeof(long));
-  memset((void *)this->HistST, 0, this->BinNumber[0]*this->BinNumber[1]*sizeof(long));
   this->Result = 0;
 
-  // Calculate and return MI result.
-  switch (this->inData[0]->GetScalarType())
+  // The derivative needs the next voxel along every axis, even if the
+  // translation along it is zero.
+  if ( (this->Extent[0] + this->loc000[0] < this->inExt[0]) ||
+       (this->Extent[2] + this->loc000[1] < this->inExt[2]) ||
+       (this->Extent[4] + this->loc000[2] < this->inExt[4]) ||
+       (this->Extent[1] + this->loc000[0] + 1 > this->inExt[1]) ||
+       (this->Extent[3] + this->loc000[1] + 1 > this->inExt[3]) ||
+       (this->Extent[5] + this->loc000[2] + 1 > this->inExt[5]) )
   {
-    vtkTemplateMacro(vtkImageMIManipulatorExecute(this,
-                     (VTK_TT *)(this->inPtr[0]), (VTK_TT *)(this->inPtr[1]),
-                     this->inc, this->inc2, this->inExt,
-                     this->loc000, this->loc111, this->count));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
+    return this->Result;
   }
 
-  return this->Result;
+  double voxelGradient[3];
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  this->Histogram->SetBinOrigin(this->BinOrigin[0], this->BinOrigin[1]);
+  if (!this->Histogram->ComputeParzenMutualInformation(this->inData[0], this->loc000,
+                                                       this->Fraction, this->Result,
+                                                       voxelGradient))
+  {
+    vtkErrorMacro( "GetResultAndGradient: No data to work with.");
+    return this->Result;
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    gradient[i] = voxelGradient[i]/this->inSpa[i];
+  }
 
+  return this->Result;
 }
 
 //----------------------------------------------------------------------------
@@ -444,6 +389,7 @@ void vtkImageMIManipulator::PrintSelf(ostream& os, vtkIndent indent)
   os << indent << "Input 1: "    << this->inData[0]   << "\n";
   os << indent << "Input 2: "    << this->inData[1]   << "\n";
   os << indent << "BinWidth: ( " << this->BinWidth[0] << ", " << this->BinWidth[1]  << " )\n";
+  os << indent << "BinOrigin: ( " << this->BinOrigin[0] << ", " << this->BinOrigin[1]  << " )\n";
   os << indent << "BinNumber: ( "<< this->BinNumber[0]<< ", " << this->BinNumber[1] << " )\n";
   os << indent << "Extent: "     << this->Extent      << "\n";
   os << indent << "Result: "     << this->Result      << "\n";
@@ -33,6 +33,9 @@
 #include "vtkObjectFactory.h"
 #include "vtkImageData.h"
 
+class vtkImageJointHistogram;
+class vtkImageVoxelSampler;
+
 class vtkRobartsRegistrationExport vtkImageMIManipulator : public vtkObject
 {
 public:
@@ -53,8 +56,14 @@ public:
   // BinNumber = 256, BinWidth = 16 are OK.
   virtual void SetBinNumber(int numS, int numT);
   int BinNumber[2];
-  vtkSetVector2Macro(BinWidth,int);
-  int BinWidth[2];
+  vtkSetVector2Macro(BinWidth,double);
+  double BinWidth[2];
+
+  // Description:
+  // The intensity at the start of the first bin, for images with values
+  // below zero. The default is zero.
+  vtkSetVector2Macro(BinOrigin,double);
+  double BinOrigin[2];
 
   // Description:
   // Set/get the extent to calculate the MI over.
@@ -65,11 +74,30 @@ public:
   // Set the translation of input 1 in 3D (mm)
   virtual void SetTranslation(double Translation[3]);
 
+  // Description:
+  // Set/get the number of threads used to accumulate the histograms.
+  virtual void SetNumberOfThreads(int numThreads);
+  int GetNumberOfThreads();
+
+  // Description:
+  // Set/get a sampler to only evaluate the metric over a subset of the
+  // voxels of the extent. The samples are drawn from image 2 by
+  // SetExtent, and are kept until it is called again.
+  virtual void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkImageVoxelSampler *GetSampler();
+
   // Description:
   // Get the absolute difference
   double GetResult();
   double Result;
 
+  // Description:
+  // Get the MI estimated with a cubic B-spline Parzen window, which is
+  // smooth but slightly different from GetResult, and its gradient with
+  // respect to the translation (per mm), for gradient based optimizers.
+  // Image 1 must extend one voxel past the translated extent.
+  double GetResultAndGradient(double gradient[3]);
+
   // Source, target, and join histograms
   long *HistS;
   long *HistT;
@@ -97,10 +125,6 @@ protected:
 
   // Globals used to speed up repeated execution:
 
-  // Increments to go through the data (calculate on SetExtent)
-  vtkIdType inc[3];
-  int inc2[2];
-
   // Information about inputs (calculate on SetInput1)
   int inExt[6];
   double inSpa[3];
@@ -108,13 +132,16 @@ protected:
   // Information on translation of image 1 (calculate on SetTranslation)
   int loc000[3];
   int loc111[3];
+  double Fraction[3];
 
-  // Number of voxels in Extent
+  // Number of voxels (or samples) in Extent that were binned
   double count;
 
   // Input data
   vtkImageData *inData[2];
-  void *inPtr[2];
+
+  // Bins image 2 and accumulates the histograms
+  vtkImageJointHistogram *Histogram;
 
 };
 
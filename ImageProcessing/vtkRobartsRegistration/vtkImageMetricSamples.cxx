@@ -0,0 +1,70 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageMetricSamples.cxx,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+#include "vtkImageMetricSamples.h"
+
+#include "vtkImageVoxelSampler.h"
+
+//----------------------------------------------------------------------------
+vtkImageMetricSamples::vtkImageMetricSamples()
+{
+  this->Sampler = NULL;
+  this->Scale = 1.0;
+}
+
+//----------------------------------------------------------------------------
+int vtkImageMetricSamples::SetSampler(vtkImageVoxelSampler *sampler,
+                                      vtkObjectBase *owner)
+{
+  if (sampler == this->Sampler)
+  {
+    return 0;
+  }
+  if (this->Sampler)
+  {
+    this->Sampler->UnRegister(owner);
+  }
+  this->Sampler = sampler;
+  if (this->Sampler)
+  {
+    this->Sampler->Register(owner);
+  }
+  this->Points.clear();
+  this->Values.clear();
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkImageMetricSamples::Update(vtkImageData *image, int extent[6])
+{
+  if (this->Sampler == NULL)
+  {
+    return;
+  }
+
+  this->Sampler->Update(image, extent);
+  vtkIdType n = this->Sampler->GetNumberOfSamples();
+  const int *points = this->Sampler->GetPoints();
+  const double *values = this->Sampler->GetValues();
+  this->Points.resize(3*n);
+  this->Values.assign(values, values + n);
+  for (vtkIdType i = 0; i < 3*n; i += 3)
+  {
+    this->Points[i] = points[i] - extent[0];
+    this->Points[i+1] = points[i+1] - extent[2];
+    this->Points[i+2] = points[i+2] - extent[4];
+  }
+  this->Scale = (n > 0 ? (double)this->Sampler->GetNumberOfCandidates()/n : 0.0);
+}
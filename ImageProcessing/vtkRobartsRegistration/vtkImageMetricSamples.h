@@ -0,0 +1,117 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageMetricSamples.h,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkImageMetricSamples - the samples over which the manipulators
+// evaluate their metric.
+// .SECTION Description
+// vtkImageMetricSamples is used by vtkImageNCCManipulator,
+// vtkImageADManipulator and vtkImageSDManipulator to keep their
+// vtkImageVoxelSampler, and the samples that it draws from image 2 on
+// SetExtent: their points relative to the extent, and the values of image
+// 2 at them. vtkImageMetricSamplesExecute visits the samples with image 1
+// interpolated at each of them. It is not a vtkObject, and is kept by the
+// manipulators as a member.
+// .SECTION see also
+// vtkImageVoxelSampler vtkImageMetricSplitter
+
+#ifndef __vtkImageMetricSamples_h
+#define __vtkImageMetricSamples_h
+
+#include "vtkRobartsRegistrationExport.h"
+
+#include "vtkType.h"
+
+#include <vector>
+
+class vtkImageData;
+class vtkImageVoxelSampler;
+class vtkObjectBase;
+
+class vtkRobartsRegistrationExport vtkImageMetricSamples
+{
+public:
+  vtkImageMetricSamples();
+
+  // Description:
+  // Set the sampler, which is registered by owner, and discard the
+  // samples. Returns 0 if the sampler is unchanged. The owner must set
+  // it to NULL before it is destroyed.
+  int SetSampler(vtkImageVoxelSampler *sampler, vtkObjectBase *owner);
+  vtkImageVoxelSampler *GetSampler() { return this->Sampler; };
+
+  // Description:
+  // Draw the samples from the image over the extent, and keep them with
+  // the values of the image. Nothing is done without a sampler.
+  void Update(vtkImageData *image, int extent[6]);
+
+  // Description:
+  // The samples, as x, y, z relative to the extent, the values of the
+  // image at them, and their number. The points and values are NULL if
+  // there are no samples.
+  const int *GetPoints() {
+    return (this->Points.empty() ? NULL : &this->Points[0]); };
+  const double *GetValues() {
+    return (this->Values.empty() ? NULL : &this->Values[0]); };
+  vtkIdType GetNumberOfSamples() { return (vtkIdType)this->Values.size(); };
+
+  // Description:
+  // The ratio of the number of voxels that the samples were drawn from to
+  // the number of samples, which scales a sum over the samples to
+  // estimate the sum over the voxels.
+  double GetScale() { return this->Scale; };
+
+protected:
+  vtkImageVoxelSampler *Sampler;
+  std::vector<int> Points;
+  std::vector<double> Values;
+  double Scale;
+};
+
+//BTX
+// Call op(v, t) for every sample, with v the value of image 1 translated
+// by loc000 and interpolated towards loc111 with the trilinear weights
+// F000, F100, F010, F110, F001, F101, F011, F111, and t the value of image
+// 2. in1Ptr points to image 1 at the first voxel of the extent, and the
+// translated samples must lie within image 1.
+template <class T, class Op>
+void vtkImageMetricSamplesExecute(const T *in1Ptr, const vtkIdType inc[3],
+                                  const int loc000[3], const int loc111[3],
+                                  const double F[8], vtkImageMetricSamples *samples,
+                                  Op &op)
+{
+  const int *points = samples->GetPoints();
+  const double *values = samples->GetValues();
+  vtkIdType n = samples->GetNumberOfSamples();
+
+  // Offsets of the neighbours, which are zero along the axes that need
+  // no interpolation
+  in1Ptr += inc[2] * loc000[2] + inc[1] * loc000[1] + inc[0] * loc000[0];
+  vtkIdType dx = (loc111[0] - loc000[0]) * inc[0];
+  vtkIdType dy = (loc111[1] - loc000[1]) * inc[1];
+  vtkIdType dz = (loc111[2] - loc000[2]) * inc[2];
+
+  for (vtkIdType i = 0; i < n; i++, points += 3)
+  {
+    const T *p = in1Ptr + points[0] * inc[0] + points[1] * inc[1] + points[2] * inc[2];
+    double Vxyz = (p[0] * F[0] + p[dx] * F[1] +
+                   p[dy] * F[2] + p[dx+dy] * F[3] +
+                   p[dz] * F[4] + p[dx+dz] * F[5] +
+                   p[dy+dz] * F[6] + p[dx+dy+dz] * F[7]);
+    op(Vxyz, values[i]);
+  }
+}
+//ETX
+
+#endif
@@ -0,0 +1,121 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageMetricSplitter.cxx,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+#include "vtkImageMetricSplitter.h"
+
+#include "vtkImageStencilData.h"
+#include "vtkImageVoxelSampler.h"
+
+#include <string.h>
+
+//----------------------------------------------------------------------------
+vtkImageMetricSplitter::vtkImageMetricSplitter()
+{
+  for (int i = 0; i < 6; i++)
+  {
+    this->SplitUpdateExtent[i] = 0;
+  }
+  this->NumberOfPieces = 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkImageMetricSplitter::ComputeSplitSlices(int extent[6], int numPieces,
+  vtkImageVoxelSampler *sampler, vtkImageStencilData *stencil,
+  int reverseStencil)
+{
+  this->SplitSlices.clear();
+  memcpy(this->SplitUpdateExtent, extent, sizeof(int)*6);
+  this->NumberOfPieces = numPieces;
+
+  int numSlices = extent[5] - extent[4] + 1;
+  numPieces = (numPieces < numSlices ? numPieces : numSlices);
+  if ((sampler == NULL && stencil == NULL) || numPieces < 2 ||
+      extent[0] > extent[1] || extent[2] > extent[3])
+  {
+    return;
+  }
+
+  // the work in each slice
+  std::vector<double> work(numSlices + 1, 0.0);
+  for (int idZ = extent[4]; idZ <= extent[5]; idZ++)
+  {
+    double count = 0.0;
+    if (sampler)
+    {
+      vtkIdType range[2];
+      sampler->GetSliceRange(idZ, idZ, range);
+      count = (double)(range[1] - range[0]);
+    }
+    else
+    {
+      for (int idY = extent[2]; idY <= extent[3]; idY++)
+      {
+        int iter = (reverseStencil ? -1 : 0);
+        int r1 = extent[0];
+        int r2 = extent[1];
+        while (stencil->GetNextExtent(r1, r2, extent[0], extent[1], idY, idZ, iter))
+        {
+          count += r2 - r1 + 1;
+        }
+      }
+    }
+    work[idZ - extent[4] + 1] = work[idZ - extent[4]] + count;
+  }
+  double total = work[numSlices];
+  if (total <= 0)
+  {
+    return;
+  }
+
+  // split where the cumulative work passes each multiple of total/numPieces,
+  // but give every piece at least one slice
+  this->SplitSlices.resize(numPieces + 1);
+  this->SplitSlices[0] = extent[4];
+  this->SplitSlices[numPieces] = extent[5] + 1;
+  int slice = 0;
+  for (int piece = 1; piece < numPieces; piece++)
+  {
+    double goal = total*piece/numPieces;
+    while (slice < numSlices && work[slice] < goal)
+    {
+      slice++;
+    }
+    int first = this->SplitSlices[piece-1] - extent[4] + 1;
+    int last = numSlices - (numPieces - piece);
+    slice = (slice > first ? slice : first);
+    slice = (slice < last ? slice : last);
+    this->SplitSlices[piece] = extent[4] + slice;
+  }
+}
+
+//----------------------------------------------------------------------------
+int vtkImageMetricSplitter::SplitExtent(int splitExt[6], int startExt[6],
+                                        int num, int total)
+{
+  int numPieces = (int)this->SplitSlices.size() - 1;
+  if (numPieces < 1 || total != this->NumberOfPieces ||
+      memcmp(startExt, this->SplitUpdateExtent, sizeof(int)*6) != 0)
+  {
+    return 0;
+  }
+
+  memcpy(splitExt, startExt, sizeof(int)*6);
+  if (num < numPieces)
+  {
+    splitExt[4] = this->SplitSlices[num];
+    splitExt[5] = this->SplitSlices[num+1] - 1;
+  }
+  return numPieces;
+}
@@ -0,0 +1,82 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageMetricSplitter.h,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkImageMetricSplitter - split the work of the metric filters
+// over threads.
+// .SECTION Description
+// vtkImageMetricSplitter is used by vtkImageNormalizedCrossCorrelation,
+// vtkImageAbsoluteDifference and vtkImagePatternIntensity to split their
+// update extent into slabs of slices that hold the same number of samples
+// of their sampler, or of voxels of their stencil, rather than the same
+// number of slices. It is not a vtkObject, and is kept by the filters as
+// a member.
+// .SECTION see also
+// vtkImageVoxelSampler vtkThreadedImageAlgorithm
+
+#ifndef __vtkImageMetricSplitter_h
+#define __vtkImageMetricSplitter_h
+
+#include "vtkRobartsRegistrationExport.h"
+
+#include <vector>
+
+class vtkImageStencilData;
+class vtkImageVoxelSampler;
+
+// The partial sums of each thread are this many doubles apart, so that no
+// two threads write to the same cache line.
+#define VTK_METRIC_THREAD_STRIDE 16
+
+//BTX
+// Add a value to a sum with Kahan's compensated summation, so that the
+// rounding error does not grow with the number of terms.
+inline void vtkImageMetricAdd(double &sum, double &error, double value)
+{
+  double y = value - error;
+  double t = sum + y;
+  error = (t - sum) - y;
+  sum = t;
+}
+//ETX
+
+class vtkRobartsRegistrationExport vtkImageMetricSplitter
+{
+public:
+  vtkImageMetricSplitter();
+
+  // Description:
+  // Choose the slices at which to split the extent into numPieces pieces,
+  // weighting each slice by its samples, or else by its voxels within the
+  // stencil. Without a sampler or a stencil, the extent is not split.
+  void ComputeSplitSlices(int extent[6], int numPieces,
+                          vtkImageVoxelSampler *sampler,
+                          vtkImageStencilData *stencil, int reverseStencil);
+
+  // Description:
+  // Split startExt at the chosen slices, as for SplitExtent of
+  // vtkThreadedImageAlgorithm, and return the number of pieces. Returns
+  // 0 if ComputeSplitSlices did not split startExt into total pieces, in
+  // which case the filter should split it as usual.
+  int SplitExtent(int splitExt[6], int startExt[6], int num, int total);
+
+protected:
+  // The first slice of each piece, the extent split, and the number of
+  // pieces that were asked for.
+  std::vector<int> SplitSlices;
+  int SplitUpdateExtent[6];
+  int NumberOfPieces;
+};
+
+#endif
@@ -76,6 +76,12 @@ vtkImageNCCManipulator::vtkImageNCCManipulator()
   }
 }
 
+//----------------------------------------------------------------------------
+vtkImageNCCManipulator::~vtkImageNCCManipulator()
+{
+  this->SetSampler(NULL);
+}
+
 //----------------------------------------------------------------------------
 void vtkImageNCCManipulator::SetInput1(vtkImageData *input)
 {
@@ -103,6 +109,15 @@ vtkImageData *vtkImageNCCManipulator::GetInput2()
   return this->inData[1];
 }
 
+//----------------------------------------------------------------------------
+void vtkImageNCCManipulator::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  if (this->Samples.SetSampler(sampler, this))
+  {
+    this->Modified();
+  }
+}
+
 //----------------------------------------------------------------------------
 void vtkImageNCCManipulator::SetExtent(int ext[6])
 {
@@ -113,6 +128,9 @@ void vtkImageNCCManipulator::SetExtent(int ext[6])
   this->inPtr[1] = this->inData[1]->GetScalarPointerForExtent(ext);
 
   memcpy(this->Extent, ext, sizeof(int)*6);
+
+  // Draw the samples from image 2, and keep them with its values
+  this->Samples.Update(this->inData[1], this->Extent);
 }
 
 //----------------------------------------------------------------------------
@@ -145,6 +163,8 @@ void vtkImageNCCManipulator::SetTranslation(double tran[3])
     }
   }
 
+  memcpy(this->Fraction, f, sizeof(double)*3);
+
   this->F000 = (1.0 - f[0]) * (1.0 - f[1]) * (1.0 - f[2]);
   this->F100 =        f[0]  * (1.0 - f[1]) * (1.0 - f[2]);
   this->F010 = (1.0 - f[0]) *        f[1]  * (1.0 - f[2]);
@@ -265,6 +285,58 @@ void vtkImageNCCManipulatorExecute(vtkImageNCCManipulator *self,
 
 }
 
+//----------------------------------------------------------------------------
+// Sum the products and squares of the interpolated values of image 1 and
+// the values of image 2 at the samples
+struct vtkImageNCCManipulatorSampleOp
+{
+  double SumST;
+  double SumS;
+  double SumT;
+
+  inline void operator()(double s, double t)
+  {
+    this->SumST += s * t;
+    this->SumS += s * s;
+    this->SumT += t * t;
+  }
+};
+
+//----------------------------------------------------------------------------
+// Evaluate over the samples only, interpolating image 1 at each of them.
+template <class T>
+void vtkImageNCCManipulatorSampleExecute(vtkImageNCCManipulator *self,
+                                         T *in1Ptr, vtkIdType inc[3], int inExt[6],
+                                         int loc000[3], int loc111[3],
+                                         vtkImageMetricSamples *samples)
+{
+  // Check if translation takes us out of the input image, in which case
+  // set the result to indicate complete dissimilarity and stop.
+  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
+       (self->Extent[2] + loc000[1] < inExt[2]) ||
+       (self->Extent[4] + loc000[2] < inExt[4]) ||
+       (self->Extent[1] + loc111[0] > inExt[1]) ||
+       (self->Extent[3] + loc111[1] > inExt[3]) ||
+       (self->Extent[5] + loc111[2] > inExt[5]) )
+  {
+    self->Result = 0.0;
+    return;
+  }
+
+  double F[8] = { self->F000, self->F100, self->F010, self->F110,
+                  self->F001, self->F101, self->F011, self->F111 };
+  vtkImageNCCManipulatorSampleOp op = { 0.0, 0.0, 0.0 };
+  vtkImageMetricSamplesExecute(in1Ptr, inc, loc000, loc111, F, samples, op);
+
+  if (op.SumS <= 0.0 || op.SumT <= 0.0)
+  {
+    self->Result = 0.0;
+    return;
+  }
+
+  self->Result = op.SumST / (sqrt(op.SumS) * sqrt(op.SumT));
+}
+
 //----------------------------------------------------------------------------
 double vtkImageNCCManipulator::GetResult()
 {
@@ -288,6 +360,19 @@ double vtkImageNCCManipulator::GetResult()
 
   this->Result = 0;
 
+  if (this->Samples.GetSampler())
+  {
+    switch (this->inData[0]->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImageNCCManipulatorSampleExecute(this,
+                       (VTK_TT *)(this->inPtr[0]), this->inc, this->inExt,
+                       this->loc000, this->loc111, &this->Samples));
+    default:
+      vtkErrorMacro( "Execute: Unknown ScalarType");
+    }
+    return this->Result;
+  }
+
   switch (this->inData[0]->GetScalarType())
   {
     vtkTemplateMacro(vtkImageNCCManipulatorExecute(this,
@@ -301,6 +386,167 @@ double vtkImageNCCManipulator::GetResult()
   return this->Result;
 }
 
+//----------------------------------------------------------------------------
+// Interpolate image 1 at p with its derivatives with respect to the
+// translation, always reading the next voxel along every axis, and add
+// the terms of a voxel of image 2 with value t to the sums.
+template <class T>
+inline void vtkImageNCCManipulatorAddGradientTerms(const T *in1Ptr,
+                                                   vtkIdType dx, vtkIdType dy,
+                                                   vtkIdType dz, const double f[3],
+                                                   double t, double sums[3],
+                                                   double dST[3], double dSS[3])
+{
+  double d00 = (double)in1Ptr[dx] - (double)in1Ptr[0];
+  double d10 = (double)in1Ptr[dx+dy] - (double)in1Ptr[dy];
+  double d01 = (double)in1Ptr[dx+dz] - (double)in1Ptr[dz];
+  double d11 = (double)in1Ptr[dx+dy+dz] - (double)in1Ptr[dy+dz];
+  double V00 = in1Ptr[0] + f[0]*d00;
+  double V10 = in1Ptr[dy] + f[0]*d10;
+  double V01 = in1Ptr[dz] + f[0]*d01;
+  double V11 = in1Ptr[dy+dz] + f[0]*d11;
+  double d0 = d00 + f[1]*(d10 - d00);
+  double d1 = d01 + f[1]*(d11 - d01);
+  double V0 = V00 + f[1]*(V10 - V00);
+  double V1 = V01 + f[1]*(V11 - V01);
+  double Vxyz = V0 + f[2]*(V1 - V0);
+  double dV[3];
+  dV[0] = d0 + f[2]*(d1 - d0);
+  dV[1] = (V10 - V00) + f[2]*((V11 - V01) - (V10 - V00));
+  dV[2] = V1 - V0;
+
+  sums[0] += Vxyz * t;
+  sums[1] += Vxyz * Vxyz;
+  sums[2] += t * t;
+  for (int i = 0; i < 3; i++)
+  {
+    dST[i] += dV[i] * t;
+    dSS[i] += dV[i] * Vxyz;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Sum over the extent, or over the samples if given.
+template <class T>
+void vtkImageNCCManipulatorGradientExecute(vtkImageNCCManipulator *self,
+                                           T  *in1Ptr, T *in2Ptr,
+                                           vtkIdType inc[3], int inc2[2],
+                                           int loc000[3], double f[3],
+                                           const int *points, const double *values,
+                                           vtkIdType n, double gradient[3])
+{
+  double sums[3] = { 0.0, 0.0, 0.0 };
+  double dST[3] = { 0.0, 0.0, 0.0 };
+  double dSS[3] = { 0.0, 0.0, 0.0 };
+  vtkIdType dx = inc[0], dy = inc[1], dz = inc[2];
+
+  in1Ptr += inc[2] * loc000[2] + inc[1] * loc000[1] + inc[0] * loc000[0];
+
+  if (points)
+  {
+    for (vtkIdType i = 0; i < n; i++, points += 3)
+    {
+      vtkImageNCCManipulatorAddGradientTerms(
+        in1Ptr + points[0] * inc[0] + points[1] * inc[1] + points[2] * inc[2],
+        dx, dy, dz, f, values[i], sums, dST, dSS);
+    }
+  }
+  else
+  {
+    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
+    {
+      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
+      {
+        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
+        {
+          vtkImageNCCManipulatorAddGradientTerms(in1Ptr, dx, dy, dz, f,
+                                                 (double)*in2Ptr, sums, dST, dSS);
+          in1Ptr++;
+          in2Ptr++;
+        }
+        in1Ptr += inc2[0];
+        in2Ptr += inc2[0];
+      }
+      in1Ptr += inc2[1];
+      in2Ptr += inc2[1];
+    }
+  }
+
+  double sumST = sums[0], sumS = sums[1], sumT = sums[2];
+  if (sumS <= 0.0 || sumT <= 0.0)
+  {
+    self->Result = 0.0;
+    return;
+  }
+
+  double norm = sqrt(sumS) * sqrt(sumT);
+  self->Result = sumST / norm;
+  for (int i = 0; i < 3; i++)
+  {
+    gradient[i] = (dST[i] - sumST / sumS * dSS[i]) / norm;
+  }
+}
+
+//----------------------------------------------------------------------------
+double vtkImageNCCManipulator::GetResultAndGradient(double gradient[3])
+{
+  gradient[0] = gradient[1] = gradient[2] = 0.0;
+
+  if (this->inData[0] == NULL)
+  {
+    vtkErrorMacro( "Input " << 0 << " must be specified.");
+    return 0;
+  }
+
+  if (this->inData[1] == NULL)
+  {
+    vtkErrorMacro( "Input " << 1 << " must be specified.");
+    return 0;
+  }
+
+  if ((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType()))
+  {
+    vtkErrorMacro( "Execute: Inputs must be of the same ScalarType");
+    return 0;
+  }
+
+  this->Result = 0;
+
+  // The derivative needs the next voxel along every axis, even if the
+  // translation along it is zero.
+  if ( (this->Extent[0] + this->loc000[0] < this->inExt[0]) ||
+       (this->Extent[2] + this->loc000[1] < this->inExt[2]) ||
+       (this->Extent[4] + this->loc000[2] < this->inExt[4]) ||
+       (this->Extent[1] + this->loc000[0] + 1 > this->inExt[1]) ||
+       (this->Extent[3] + this->loc000[1] + 1 > this->inExt[3]) ||
+       (this->Extent[5] + this->loc000[2] + 1 > this->inExt[5]) )
+  {
+    return this->Result;
+  }
+  if (this->Samples.GetSampler() && this->Samples.GetNumberOfSamples() == 0)
+  {
+    return this->Result;
+  }
+
+  switch (this->inData[0]->GetScalarType())
+  {
+    vtkTemplateMacro(vtkImageNCCManipulatorGradientExecute(this,
+                     (VTK_TT *)(this->inPtr[0]), (VTK_TT *)(this->inPtr[1]),
+                     this->inc, this->inc2, this->loc000, this->Fraction,
+                     this->Samples.GetPoints(), this->Samples.GetValues(),
+                     this->Samples.GetNumberOfSamples(), gradient));
+  default:
+    vtkErrorMacro( "Execute: Unknown ScalarType");
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    gradient[i] /= this->inSpa[i];
+  }
+
+  return this->Result;
+}
+
 //----------------------------------------------------------------------------
 void vtkImageNCCManipulator::PrintSelf(ostream& os, vtkIndent indent)
 {
@@ -31,6 +31,9 @@
 #include "vtkObject.h"
 #include "vtkObjectFactory.h"
 #include "vtkImageData.h"
+#include "vtkImageMetricSamples.h"
+
+class vtkImageVoxelSampler;
 
 class vtkRobartsRegistrationExport vtkImageNCCManipulator : public vtkObject
 {
@@ -55,11 +58,24 @@ public:
   // Set the translation of input 1 in 3D (mm)
   virtual void SetTranslation(double Translation[3]);
 
+  // Description:
+  // Set/get a sampler to only evaluate the metric over a subset of the
+  // voxels of the extent. The samples are drawn from image 2 by
+  // SetExtent, and are kept until it is called again.
+  virtual void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkImageVoxelSampler *GetSampler() { return this->Samples.GetSampler(); };
+
   // Description:
   // Get the absolute difference
   double GetResult();
   double Result;
 
+  // Description:
+  // Get the NCC and its gradient with respect to the translation (per
+  // mm), for gradient based optimizers. Image 1 must extend one voxel
+  // past the translated extent.
+  double GetResultAndGradient(double gradient[3]);
+
   // Trilinear coefficients updated on SetTranslation.  Keep these
   // global and public to speed up execution (If they were in
   // protected would have to pass them using TemplateMacroXX where
@@ -75,7 +91,7 @@ public:
 
 protected:
   vtkImageNCCManipulator();
-  ~vtkImageNCCManipulator() {};
+  ~vtkImageNCCManipulator();
 
   // Globals used to speed up repeated execution:
 
@@ -90,11 +106,16 @@ protected:
   // Information on translation of image 1 (calculate on SetTranslation)
   int loc000[3];
   int loc111[3];
+  double Fraction[3];
 
   // Input data
   vtkImageData *inData[2];
   void *inPtr[2];
 
+  // The sampler, and the samples that it draws from image 2 (calculate
+  // on SetExtent)
+  vtkImageMetricSamples Samples;
+
 };
 
 #endif
@@ -16,16 +16,27 @@
 
 =========================================================================*/
 #include "vtkImageNormalizedCrossCorrelation.h"
+#include "vtkImageVoxelSampler.h"
 
 #include <vtkExecutive.h>
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
 
 vtkStandardNewMacro(vtkImageNormalizedCrossCorrelation);
+vtkCxxSetObjectMacro(vtkImageNormalizedCrossCorrelation, Sampler, vtkImageVoxelSampler);
 
 //----------------------------------------------------------------------------
 vtkImageNormalizedCrossCorrelation::vtkImageNormalizedCrossCorrelation()
 {
   this->ReverseStencil = 0;
-  SetNumberOfThreads(THREAD_NUM);
+  this->Sampler = NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkImageNormalizedCrossCorrelation::~vtkImageNormalizedCrossCorrelation()
+{
+  this->SetSampler(NULL);
 }
 
 //----------------------------------------------------------------------------
@@ -86,32 +97,30 @@ template <class T>
 void vtkImageNormalizedCrossCorrelationExecute(vtkImageNormalizedCrossCorrelation *self,
     vtkImageData *in1Data, T *in1Ptr,
     vtkImageData *in2Data, T *in2Ptr,
-    int outExt[6], int id)
+    int outExt[6], double sums[3])
 {
   int idX, idY, idZ;
-  vtkIdType incX, incY, incZ;
-  int maxX, maxY, maxZ;
+  vtkIdType inc1X, inc1Y, inc1Z;
+  vtkIdType inc2X, inc2Y, inc2Z;
   int pminX, pmaxX, iter;
   T *temp1Ptr, *temp2Ptr;
   vtkImageStencilData *stencil = self->GetStencil();
-
-  self->ThreadSumST[id] = 0.0;
-  self->ThreadSumS[id] = 0.0;
-  self->ThreadSumT[id] = 0.0;
-
-  // Find the region to loop over
-  maxX = (outExt[1] - outExt[0])*in1Data->GetNumberOfScalarComponents();
-  maxY = outExt[3] - outExt[2];
-  maxZ = outExt[5] - outExt[4];
+  double error[3] = { 0.0, 0.0, 0.0 };
 
   // Get increments to march through data
-  in1Data->GetIncrements(incX, incY, incZ);
+  in1Data->GetIncrements(inc1X, inc1Y, inc1Z);
+  in2Data->GetIncrements(inc2X, inc2Y, inc2Z);
 
   // Loop over data within stencil sub-extents
-  for (idZ = 0; idZ <= maxZ; idZ++)
+  for (idZ = outExt[4]; idZ <= outExt[5]; idZ++)
   {
-    for (idY = 0; idY <= maxY; idY++)
+    for (idY = outExt[2]; idY <= outExt[3]; idY++)
     {
+      // Sum each row on its own, then add the rows with compensation
+      double rowST = 0.0;
+      double rowS = 0.0;
+      double rowT = 0.0;
+
       // Flag that we want the complementary extents
       iter = 0;
       if (self->GetReverseStencil())
@@ -119,27 +128,107 @@ void vtkImageNormalizedCrossCorrelationExecute(vtkImageNormalizedCrossCorrelatio
         iter = -1;
       }
 
-      pminX = 0;
-      pmaxX = maxX;
+      pminX = outExt[0];
+      pmaxX = outExt[1];
       while ((stencil !=0 &&
-              stencil->GetNextExtent(pminX, pmaxX, 0, maxX, idY, idZ+outExt[4], iter)) ||
+              stencil->GetNextExtent(pminX, pmaxX, outExt[0], outExt[1], idY, idZ, iter)) ||
              (stencil == 0 && iter++ == 0))
       {
         // Set up pointers to the sub-extents
-        temp1Ptr = in1Ptr + (incZ * idZ + incY * idY + pminX);
-        temp2Ptr = in2Ptr + (incZ * idZ + incY * idY + pminX);
-        // Compute over the sub-extent
-        for (idX = pminX; idX <= pmaxX; idX++)
+        temp1Ptr = in1Ptr + (inc1Z * (idZ - outExt[4]) + inc1Y * (idY - outExt[2]) +
+                             inc1X * (pminX - outExt[0]));
+        temp2Ptr = in2Ptr + (inc2Z * (idZ - outExt[4]) + inc2Y * (idY - outExt[2]) +
+                             inc2X * (pminX - outExt[0]));
+        // Compute over the sub-extent, and all of the components
+        for (idX = (pmaxX - pminX + 1)*inc1X; idX > 0; idX--)
         {
-          self->ThreadSumST[id] += (double)*temp1Ptr * (double)*temp2Ptr;
-          self->ThreadSumS[id] += (double)*temp1Ptr * (double)*temp1Ptr;
-          self->ThreadSumT[id] += (double)*temp2Ptr * (double)*temp2Ptr;
-          temp1Ptr++;
-          temp2Ptr++;
+          double s = (double)*temp1Ptr++;
+          double t = (double)*temp2Ptr++;
+          rowST += s * t;
+          rowS += s * s;
+          rowT += t * t;
         }
       }
+
+      vtkImageMetricAdd(sums[0], error[0], rowST);
+      vtkImageMetricAdd(sums[1], error[1], rowS);
+      vtkImageMetricAdd(sums[2], error[2], rowT);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// Accumulate over the samples of input 1 that lie within outExt, which have
+// already been restricted to the stencil by the sampler.
+template <class T>
+void vtkImageNormalizedCrossCorrelationSampleExecute(
+    vtkImageData *in2Data, T *in2Ptr,
+    const int *points, const double *values,
+    vtkIdType first, vtkIdType last,
+    int outExt[6], double sums[3])
+{
+  vtkIdType incX, incY, incZ;
+  double error[3] = { 0.0, 0.0, 0.0 };
+
+  in2Data->GetIncrements(incX, incY, incZ);
+
+  for (vtkIdType i = first; i < last; i++)
+  {
+    const int *point = points + 3*i;
+    if (point[0] >= outExt[0] && point[0] <= outExt[1] &&
+        point[1] >= outExt[2] && point[1] <= outExt[3])
+    {
+      T *tempPtr = in2Ptr + ((point[0] - outExt[0])*incX +
+                             (point[1] - outExt[2])*incY +
+                             (point[2] - outExt[4])*incZ);
+      double s = values[i];
+      double t = (double)*tempPtr;
+      vtkImageMetricAdd(sums[0], error[0], s * t);
+      vtkImageMetricAdd(sums[1], error[1], s * s);
+      vtkImageMetricAdd(sums[2], error[2], t * t);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// Draw the samples for the update extent, and prepare the threads.
+int vtkImageNormalizedCrossCorrelation::RequestData(vtkInformation *request,
+    vtkInformationVector **inputVector,
+    vtkInformationVector *outputVector)
+{
+  int extent[6];
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+  outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(), extent);
+
+  if (this->Sampler)
+  {
+    if (!this->Sampler->Update(this->GetInput1(), extent, this->GetStencil(),
+                               this->ReverseStencil))
+    {
+      vtkErrorMacro( "RequestData: Unable to sample input 1");
+      return 0;
     }
   }
+
+  this->ThreadSums.assign(
+    VTK_METRIC_THREAD_STRIDE*this->GetNumberOfThreads(), 0.0);
+  this->Splitter.ComputeSplitSlices(extent, this->GetNumberOfThreads(),
+    this->Sampler, this->GetStencil(), this->ReverseStencil);
+
+  return this->Superclass::RequestData(request, inputVector, outputVector);
+}
+
+//----------------------------------------------------------------------------
+// Split the extent at the slices chosen by the splitter.
+int vtkImageNormalizedCrossCorrelation::SplitExtent(int splitExt[6],
+    int startExt[6], int num, int total)
+{
+  int numPieces = this->Splitter.SplitExtent(splitExt, startExt, num, total);
+  if (numPieces == 0)
+  {
+    return this->Superclass::SplitExtent(splitExt, startExt, num, total);
+  }
+  return numPieces;
 }
 
 //----------------------------------------------------------------------------
@@ -156,6 +245,13 @@ void vtkImageNormalizedCrossCorrelation::ThreadedExecute(vtkImageData **inData,
 
   vtkDebugMacro( "Execute: inData = " << inData);
 
+  if (VTK_METRIC_THREAD_STRIDE*(id + 1) > (int)this->ThreadSums.size())
+  {
+    vtkErrorMacro( "Execute: No partial sums for thread " << id);
+    return;
+  }
+  double *sums = &this->ThreadSums[VTK_METRIC_THREAD_STRIDE*id];
+
   if (inData[0] == NULL)
   {
     vtkErrorMacro( "Input " << 0 << " must be specified.");
@@ -187,12 +283,28 @@ void vtkImageNormalizedCrossCorrelation::ThreadedExecute(vtkImageData **inData,
     return;
   }
 
+  if (this->Sampler)
+  {
+    vtkIdType range[2];
+    this->Sampler->GetSliceRange(outExt[4], outExt[5], range);
+    switch (inData[1]->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImageNormalizedCrossCorrelationSampleExecute(
+                       inData[1], (VTK_TT *)(inPtr2),
+                       this->Sampler->GetPoints(), this->Sampler->GetValues(),
+                       range[0], range[1], outExt, sums));
+    default:
+      vtkErrorMacro( "Execute: Unknown ScalarType");
+    }
+    return;
+  }
+
   switch (inData[0]->GetScalarType())
   {
     vtkTemplateMacro(vtkImageNormalizedCrossCorrelationExecute(this,
                      inData[0], (VTK_TT *)(inPtr1),
                      inData[1], (VTK_TT *)(inPtr2),
-                     outExt, id));
+                     outExt, sums));
   default:
     vtkErrorMacro( "Execute: Unknown ScalarType");
     return;
@@ -202,17 +314,19 @@ void vtkImageNormalizedCrossCorrelation::ThreadedExecute(vtkImageData **inData,
 //----------------------------------------------------------------------------
 double vtkImageNormalizedCrossCorrelation::GetResult()
 {
-  int n = GetNumberOfThreads();
+  int n = (int)(this->ThreadSums.size()/VTK_METRIC_THREAD_STRIDE);
   double sumST = 0.0;
   double sumS = 0.0;
   double sumT = 0.0;
+  double error[3] = { 0.0, 0.0, 0.0 };
   double result;
 
   for (int id = 0; id < n; id++)
   {
-    sumST += this->ThreadSumST[id];
-    sumS += this->ThreadSumS[id];
-    sumT += this->ThreadSumT[id];
+    const double *sums = &this->ThreadSums[VTK_METRIC_THREAD_STRIDE*id];
+    vtkImageMetricAdd(sumST, error[0], sums[0]);
+    vtkImageMetricAdd(sumS, error[1], sums[1]);
+    vtkImageMetricAdd(sumT, error[2], sums[2]);
   }
 
   result = sumST / (sqrt(sumS) * sqrt(sumT));
@@ -225,6 +339,17 @@ double vtkImageNormalizedCrossCorrelation::GetResult()
   return result;
 }
 
+//----------------------------------------------------------------------------
+vtkMTimeType vtkImageNormalizedCrossCorrelation::GetMTime()
+{
+  vtkMTimeType mTime = this->Superclass::GetMTime();
+  if (this->Sampler && this->Sampler->GetMTime() > mTime)
+  {
+    mTime = this->Sampler->GetMTime();
+  }
+  return mTime;
+}
+
 //----------------------------------------------------------------------------
 void vtkImageNormalizedCrossCorrelation::PrintSelf(ostream& os, vtkIndent indent)
 {
@@ -234,4 +359,5 @@ void vtkImageNormalizedCrossCorrelation::PrintSelf(ostream& os, vtkIndent indent
   os << indent << "Input 2: "<< this->GetInput2() << "\n";
   os << indent << "Stencil: " << this->GetStencil() << "\n";
   os << indent << "ReverseStencil: " << (this->ReverseStencil ? "On\n" : "Off\n");
+  os << indent << "Sampler: " << this->Sampler << "\n";
 }
@@ -18,6 +18,9 @@
 // .NAME vtkImageNormalizedCrossCorrelation - Returns the absolute difference of 2 images
 // .SECTION Description
 // vtkImageNormalizedCrossCorrelation calculates the absolute difference of 2 images
+// The work is split by slices over as many threads as SetNumberOfThreads
+// asks for, by default the number of processors, so that every thread
+// gets about the same number of voxels of the stencil.
 
 #ifndef __vtkImageNormalizedCrossCorrelation_h
 #define __vtkImageNormalizedCrossCorrelation_h
@@ -28,9 +31,11 @@
 #include "vtkObjectFactory.h"
 #include "vtkImageStencilData.h"
 #include "vtkImageData.h"
+#include "vtkImageMetricSplitter.h"
 
-// Constants used for array declaration.
-#define THREAD_NUM 2
+#include <vector>
+
+class vtkImageVoxelSampler;
 
 class vtkRobartsRegistrationExport vtkImageNormalizedCrossCorrelation : public vtkThreadedImageAlgorithm
 {
@@ -55,24 +60,39 @@ public:
   vtkBooleanMacro(ReverseStencil, int);
   vtkGetMacro(ReverseStencil, int);
 
+  // Description:
+  // Only accumulate over the voxels that the sampler chooses from input 1,
+  // within the stencil. The samples are drawn on every update.
+  virtual void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkGetObjectMacro(Sampler, vtkImageVoxelSampler);
+
   // Description:
   // Get the absolute difference
   double GetResult();
 
   // Description:
-  // These allow averaging after threads are finished.
-  double ThreadSumST[THREAD_NUM];
-  double ThreadSumS[THREAD_NUM];
-  double ThreadSumT[THREAD_NUM];
+  // The modified time, including that of the sampler.
+  vtkMTimeType GetMTime();
 
 protected:
   vtkImageNormalizedCrossCorrelation();
-  ~vtkImageNormalizedCrossCorrelation() {};
+  ~vtkImageNormalizedCrossCorrelation();
 
   int ReverseStencil;
+  vtkImageVoxelSampler *Sampler;
 
+  int RequestData(vtkInformation *request, vtkInformationVector **inputVector,
+                  vtkInformationVector *outputVector);
+  int SplitExtent(int splitExt[6], int startExt[6], int num, int total);
   void ThreadedExecute(vtkImageData **inDatas, vtkImageData *outData, int extent[6], int id);
 
+  // The sums ST, SS and TT of each thread, kept a cache line apart.
+  std::vector<double> ThreadSums;
+
+  // Splits the extent so that the threads get the same number of samples
+  // or voxels of the stencil.
+  vtkImageMetricSplitter Splitter;
+
 private:
   vtkImageNormalizedCrossCorrelation(const vtkImageNormalizedCrossCorrelation&);  // Not implemented.
   void operator=(const vtkImageNormalizedCrossCorrelation&);  // Not implemented.
@@ -16,15 +16,30 @@
 
 =========================================================================*/
 #include "vtkImagePatternIntensity.h"
+#include "vtkImageVoxelSampler.h"
 
 #include <vtkExecutive.h>
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
+
+#include <vector>
 
 vtkStandardNewMacro(vtkImagePatternIntensity);
+vtkCxxSetObjectMacro(vtkImagePatternIntensity, Sampler, vtkImageVoxelSampler);
 
 //----------------------------------------------------------------------------
 vtkImagePatternIntensity::vtkImagePatternIntensity()
 {
   this->ReverseStencil = 0;
+  this->Sampler = NULL;
+  this->Difference = NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkImagePatternIntensity::~vtkImagePatternIntensity()
+{
+  this->SetSampler(NULL);
 }
 
 //----------------------------------------------------------------------------
@@ -84,35 +99,31 @@ vtkImageStencilData *vtkImagePatternIntensity::GetStencil()
 template <class T>
 void vtkImagePatternIntensityExecute(vtkImagePatternIntensity *self,
                                      vtkImageData *diffData, T *diffPtr,
-                                     int outExt[6], int id)
+                                     int outExt[6], double *sum)
 {
   int totExt[6];
   int idX, idY, idZ;
   int id2X, id2Y, id2Z;
   vtkIdType incX, incY, incZ;
-  int maxX, maxY, maxZ;
   int pminX, pmaxX, iter;
   int rX, rY, rZ;
   T *temp1Ptr, *temp2Ptr;
   vtkImageStencilData *stencil = self->GetStencil();
-
-  self->ThreadPatternIntensity[id] = 0;
+  double error = 0.0;
 
   diffData->GetExtent(totExt);
 
-  // Find the region to loop over
-  maxX = outExt[1] - outExt[0];
-  maxY = outExt[3] - outExt[2];
-  maxZ = outExt[5] - outExt[4];
-
   // Get increments to march through data
   diffData->GetIncrements(incX, incY, incZ);
 
   // Loop over data within stencil sub-extents
-  for (idZ = 0; idZ <= maxZ; idZ++)
+  for (idZ = outExt[4]; idZ <= outExt[5]; idZ++)
   {
-    for (idY = 0; idY <= maxY; idY++)
+    for (idY = outExt[2]; idY <= outExt[3]; idY++)
     {
+      // Sum each row on its own, then add the rows with compensation
+      double rowSum = 0.0;
+
       // Flag that we want the complementary extents
       iter = 0;
       if (self->GetReverseStencil())
@@ -120,14 +131,15 @@ void vtkImagePatternIntensityExecute(vtkImagePatternIntensity *self,
         iter = -1;
       }
 
-      pminX = 0;
-      pmaxX = maxX;
+      pminX = outExt[0];
+      pmaxX = outExt[1];
       while ((stencil !=0 &&
-              stencil->GetNextExtent(pminX, pmaxX, 0, maxX, idY, idZ+outExt[4], iter)) ||
+              stencil->GetNextExtent(pminX, pmaxX, outExt[0], outExt[1], idY, idZ, iter)) ||
              (stencil == 0 && iter++ == 0))
       {
         // Set up pointers to the sub-extents
-        temp1Ptr = diffPtr + (incZ * idZ + incY * idY + pminX);
+        temp1Ptr = diffPtr + (incZ * (idZ - outExt[4]) + incY * (idY - outExt[2]) +
+                              incX * (pminX - outExt[0]));
         // Compute over the sub-extent
         for (idX = pminX; idX <= pmaxX; idX++)
         {
@@ -138,7 +150,7 @@ void vtkImagePatternIntensityExecute(vtkImagePatternIntensity *self,
             {
               for (id2X = -3; id2X <= 3; id2X++)
               {
-                if (sqrt((double)(id2X*id2X) + (double)(id2Y*id2Y) + (double)(id2Z*id2Z)) <= 3.0)
+                if (id2X*id2X + id2Y*id2Y + id2Z*id2Z <= 9)
                 {
                   rX = idX+id2X;
                   rY = idY+id2Y;
@@ -147,22 +159,161 @@ void vtkImagePatternIntensityExecute(vtkImagePatternIntensity *self,
                        (rY >= totExt[2]) && (rY <= totExt[3]) &&
                        (rZ >= totExt[4]) && (rZ <= totExt[5]) )
                   {
-                    temp2Ptr = diffPtr + (incZ * rZ + incY * rY + rX);
-                    self->ThreadPatternIntensity[id] += 100.0 / (100 + (*temp1Ptr - *temp2Ptr) * (*temp1Ptr - *temp2Ptr));
+                    temp2Ptr = temp1Ptr + (incZ * id2Z + incY * id2Y + incX * id2X);
+                    rowSum += 100.0 / (100 + (*temp1Ptr - *temp2Ptr) * (*temp1Ptr - *temp2Ptr));
                   }
                   else
                   {
-                    self->ThreadPatternIntensity[id] += 100.0 / (100 + (*temp1Ptr * *temp1Ptr));
+                    rowSum += 100.0 / (100 + (*temp1Ptr * *temp1Ptr));
                   }
                 }
               }
             }
           }
-          temp1Ptr++;
+          temp1Ptr += incX;
+        }
+      }
+
+      vtkImageMetricAdd(*sum, error, rowSum);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// Accumulate over the samples of input 1 that lie within outExt, with the
+// differences of the two images computed at each sample and at the voxels
+// within a radius of 3 around it.
+template <class T>
+void vtkImagePatternIntensitySampleExecute(vtkImageData *in1Data, T *in1Ptr,
+    vtkImageData *in2Data, T *in2Ptr,
+    const int *points, const double *values,
+    vtkIdType first, vtkIdType last,
+    int outExt[6], double *sum)
+{
+  int totExt[6];
+  vtkIdType inc1[3], inc2[3];
+  double error = 0.0;
+
+  in1Data->GetExtent(totExt);
+  in1Data->GetIncrements(inc1);
+  in2Data->GetIncrements(inc2);
+
+  // the offsets of the neighbourhood
+  std::vector<int> offsets;
+  for (int id2Z = -3; id2Z <= 3; id2Z++)
+  {
+    for (int id2Y = -3; id2Y <= 3; id2Y++)
+    {
+      for (int id2X = -3; id2X <= 3; id2X++)
+      {
+        if (id2X*id2X + id2Y*id2Y + id2Z*id2Z <= 9)
+        {
+          offsets.push_back(id2X);
+          offsets.push_back(id2Y);
+          offsets.push_back(id2Z);
         }
       }
     }
   }
+  int numOffsets = (int)(offsets.size()/3);
+
+  for (vtkIdType i = first; i < last; i++)
+  {
+    const int *point = points + 3*i;
+    if (point[0] < outExt[0] || point[0] > outExt[1] ||
+        point[1] < outExt[2] || point[1] > outExt[3])
+    {
+      continue;
+    }
+
+    T *temp2Ptr = in2Ptr + ((point[0] - outExt[0])*inc2[0] +
+                            (point[1] - outExt[2])*inc2[1] +
+                            (point[2] - outExt[4])*inc2[2]);
+    double diff = values[i] - (double)*temp2Ptr;
+    double pointSum = 0.0;
+
+    for (int j = 0; j < numOffsets; j++)
+    {
+      int rX = point[0] + offsets[3*j];
+      int rY = point[1] + offsets[3*j+1];
+      int rZ = point[2] + offsets[3*j+2];
+      double d = diff;
+      if ( (rX >= totExt[0]) && (rX <= totExt[1]) &&
+           (rY >= totExt[2]) && (rY <= totExt[3]) &&
+           (rZ >= totExt[4]) && (rZ <= totExt[5]) )
+      {
+        vtkIdType o1 = ((rX - outExt[0])*inc1[0] + (rY - outExt[2])*inc1[1] +
+                        (rZ - outExt[4])*inc1[2]);
+        vtkIdType o2 = ((rX - outExt[0])*inc2[0] + (rY - outExt[2])*inc2[1] +
+                        (rZ - outExt[4])*inc2[2]);
+        d -= (double)in1Ptr[o1] - (double)in2Ptr[o2];
+      }
+      pointSum += 100.0 / (100 + d*d);
+    }
+
+    vtkImageMetricAdd(*sum, error, pointSum);
+  }
+}
+
+//----------------------------------------------------------------------------
+// Draw the samples for the update extent, or compute the difference of the
+// images for all of the threads, and prepare the threads.
+int vtkImagePatternIntensity::RequestData(vtkInformation *request,
+    vtkInformationVector **inputVector,
+    vtkInformationVector *outputVector)
+{
+  int extent[6];
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+  outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(), extent);
+
+  if (this->Sampler)
+  {
+    if (!this->Sampler->Update(this->GetInput1(), extent, this->GetStencil(),
+                               this->ReverseStencil))
+    {
+      vtkErrorMacro( "RequestData: Unable to sample input 1");
+      return 0;
+    }
+  }
+  else
+  {
+    vtkImageMathematics *diffMath = vtkImageMathematics::New();
+    diffMath->SetInput1Data(this->GetInput1());
+    diffMath->SetInput2Data(this->GetInput2());
+    diffMath->SetOperationToSubtract();
+    diffMath->Update();
+    this->Difference = diffMath->GetOutput();
+    this->Difference->Register(this);
+    diffMath->Delete();
+  }
+
+  this->ThreadSums.assign(
+    VTK_METRIC_THREAD_STRIDE*this->GetNumberOfThreads(), 0.0);
+  this->Splitter.ComputeSplitSlices(extent, this->GetNumberOfThreads(),
+    this->Sampler, this->GetStencil(), this->ReverseStencil);
+
+  int result = this->Superclass::RequestData(request, inputVector, outputVector);
+
+  if (this->Difference)
+  {
+    this->Difference->UnRegister(this);
+    this->Difference = NULL;
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------
+// Split the extent at the slices chosen by the splitter.
+int vtkImagePatternIntensity::SplitExtent(int splitExt[6],
+    int startExt[6], int num, int total)
+{
+  int numPieces = this->Splitter.SplitExtent(splitExt, startExt, num, total);
+  if (numPieces == 0)
+  {
+    return this->Superclass::SplitExtent(splitExt, startExt, num, total);
+  }
+  return numPieces;
 }
 
 //----------------------------------------------------------------------------
@@ -178,6 +329,13 @@ void vtkImagePatternIntensity::ThreadedExecute(vtkImageData **inData,
 
   vtkDebugMacro( "Execute: inData = " << inData);
 
+  if (VTK_METRIC_THREAD_STRIDE*(id + 1) > (int)this->ThreadSums.size())
+  {
+    vtkErrorMacro( "Execute: No partial sums for thread " << id);
+    return;
+  }
+  double *sum = &this->ThreadSums[VTK_METRIC_THREAD_STRIDE*id];
+
   if (inData[0] == NULL)
   {
     vtkErrorMacro( "Input " << 0 << " must be specified.");
@@ -206,19 +364,38 @@ void vtkImagePatternIntensity::ThreadedExecute(vtkImageData **inData,
     return;
   }
 
-  vtkImageMathematics *diffMath = vtkImageMathematics::New();
-  diffMath->SetInput1Data(inData[0]);
-  diffMath->SetInput2Data(inData[1]);
-  diffMath->SetOperationToSubtract();
-  diffMath->Update();
+  if (this->Sampler)
+  {
+    vtkIdType range[2];
+    this->Sampler->GetSliceRange(outExt[4], outExt[5], range);
+    void *inPtr1 = inData[0]->GetScalarPointerForExtent(outExt);
+    void *inPtr2 = inData[1]->GetScalarPointerForExtent(outExt);
+    switch (inData[0]->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImagePatternIntensitySampleExecute(
+                       inData[0], (VTK_TT *)(inPtr1),
+                       inData[1], (VTK_TT *)(inPtr2),
+                       this->Sampler->GetPoints(), this->Sampler->GetValues(),
+                       range[0], range[1], outExt, sum));
+    default:
+      vtkErrorMacro( "Execute: Unknown ScalarType");
+    }
+    return;
+  }
+
+  if (this->Difference == NULL)
+  {
+    vtkErrorMacro( "Execute: The difference of the images was not computed");
+    return;
+  }
 
-  diffPtr = diffMath->GetOutput()->GetScalarPointer();
+  diffPtr = this->Difference->GetScalarPointerForExtent(outExt);
 
-  switch (diffMath->GetOutput()->GetScalarType())
+  switch (this->Difference->GetScalarType())
   {
     vtkTemplateMacro(vtkImagePatternIntensityExecute(this,
-                     diffMath->GetOutput(), (VTK_TT *)(diffPtr),
-                     outExt, id));
+                     this->Difference, (VTK_TT *)(diffPtr),
+                     outExt, sum));
   default:
     vtkErrorMacro( "Execute: Unknown ScalarType");
     return;
@@ -228,12 +405,20 @@ void vtkImagePatternIntensity::ThreadedExecute(vtkImageData **inData,
 //----------------------------------------------------------------------------
 double vtkImagePatternIntensity::GetResult()
 {
-  int n = GetNumberOfThreads();
+  int n = (int)(this->ThreadSums.size()/VTK_METRIC_THREAD_STRIDE);
   double result = 0.0;
+  double error = 0.0;
 
   for (int id = 0; id < n; id++)
   {
-    result += this->ThreadPatternIntensity[id];
+    vtkImageMetricAdd(result, error,
+                      this->ThreadSums[VTK_METRIC_THREAD_STRIDE*id]);
+  }
+
+  if (this->Sampler && this->Sampler->GetNumberOfSamples() > 0)
+  {
+    result *= ((double)this->Sampler->GetNumberOfCandidates() /
+               (double)this->Sampler->GetNumberOfSamples());
   }
 
   if (result < 0)
@@ -244,6 +429,17 @@ double vtkImagePatternIntensity::GetResult()
   return result;
 }
 
+//----------------------------------------------------------------------------
+vtkMTimeType vtkImagePatternIntensity::GetMTime()
+{
+  vtkMTimeType mTime = this->Superclass::GetMTime();
+  if (this->Sampler && this->Sampler->GetMTime() > mTime)
+  {
+    mTime = this->Sampler->GetMTime();
+  }
+  return mTime;
+}
+
 //----------------------------------------------------------------------------
 void vtkImagePatternIntensity::PrintSelf(ostream& os, vtkIndent indent)
 {
@@ -253,4 +449,5 @@ void vtkImagePatternIntensity::PrintSelf(ostream& os, vtkIndent indent)
   os << indent << "Input 2: "<< this->GetInput2() << "\n";
   os << indent << "Stencil: " << this->GetStencil() << "\n";
   os << indent << "ReverseStencil: " << (this->ReverseStencil ? "On\n" : "Off\n");
+  os << indent << "Sampler: " << this->Sampler << "\n";
 }
@@ -18,6 +18,9 @@
 // .NAME vtkImagePatternIntensity - Returns the absolute difference of 2 images
 // .SECTION Description
 // vtkImagePatternIntensity calculates the absolute difference of 2 images
+// The work is split by slices over as many threads as SetNumberOfThreads
+// asks for, by default the number of processors, so that every thread
+// gets about the same number of voxels of the stencil.
 
 #ifndef __vtkImagePatternIntensity_h
 #define __vtkImagePatternIntensity_h
@@ -28,8 +31,13 @@
 #include "vtkObjectFactory.h"
 #include "vtkImageStencilData.h"
 #include "vtkImageData.h"
+#include "vtkImageMetricSplitter.h"
 #include "vtkImageMathematics.h"
 
+#include <vector>
+
+class vtkImageVoxelSampler;
+
 class vtkRobartsRegistrationExport vtkImagePatternIntensity : public vtkThreadedImageAlgorithm
 {
 public:
@@ -53,23 +61,45 @@ public:
   vtkBooleanMacro(ReverseStencil, int);
   vtkGetMacro(ReverseStencil, int);
 
+  // Description:
+  // Only accumulate over the voxels that the sampler chooses from input 1,
+  // within the stencil. The samples are drawn on every update, and the
+  // result is scaled to estimate the sum over all of the voxels. The
+  // differences are computed at the samples and their neighbours only,
+  // instead of over the whole images.
+  virtual void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkGetObjectMacro(Sampler, vtkImageVoxelSampler);
+
   // Description:
   // Get the absolute difference
   double GetResult();
 
   // Description:
-  // These allow averaging after threads are finished.
-  // Maximum of 4 processors can be handled.
-  double ThreadPatternIntensity[4];
+  // The modified time, including that of the sampler.
+  vtkMTimeType GetMTime();
 
 protected:
   vtkImagePatternIntensity();
-  ~vtkImagePatternIntensity() {};
+  ~vtkImagePatternIntensity();
 
   int ReverseStencil;
+  vtkImageVoxelSampler *Sampler;
 
+  int RequestData(vtkInformation *request, vtkInformationVector **inputVector,
+                  vtkInformationVector *outputVector);
+  int SplitExtent(int splitExt[6], int startExt[6], int num, int total);
   void ThreadedExecute(vtkImageData **inDatas, vtkImageData *outData, int extent[6], int id);
 
+  // The difference of the inputs, computed once for all of the threads.
+  vtkImageData *Difference;
+
+  // The sum of each thread, kept a cache line apart.
+  std::vector<double> ThreadSums;
+
+  // Splits the extent so that the threads get the same number of samples
+  // or voxels of the stencil.
+  vtkImageMetricSplitter Splitter;
+
 private:
   vtkImagePatternIntensity(const vtkImagePatternIntensity&);  // Not implemented.
   void operator=(const vtkImagePatternIntensity&);  // Not implemented.
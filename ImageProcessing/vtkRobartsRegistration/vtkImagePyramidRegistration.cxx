@@ -0,0 +1,910 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImagePyramidRegistration.cxx,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+#include "vtkImagePyramidRegistration.h"
+
+#include "vtkFunctionMinimizer.h"
+#include "vtkImageADManipulator.h"
+#include "vtkImageData.h"
+#include "vtkImageMIManipulator.h"
+#include "vtkImageNCCManipulator.h"
+#include "vtkImageNMIManipulator.h"
+#include "vtkImageSDManipulator.h"
+#include "vtkImageVoxelSampler.h"
+#include "vtkLBFGSMinimizer.h"
+#include "vtkObjectFactory.h"
+#include "vtkPowellMinimizer.h"
+#include "vtkTimerLog.h"
+
+#include <math.h>
+
+vtkStandardNewMacro(vtkImagePyramidRegistration);
+
+// The fewest voxels that an axis is shrunk to
+#define VTK_PYRAMID_MIN_VOXELS 8
+
+static const char *vtkImagePyramidRegistrationNames[3] = { "tx", "ty", "tz" };
+
+//----------------------------------------------------------------------------
+vtkImagePyramidRegistration::vtkImagePyramidRegistration()
+{
+  this->FixedImage = NULL;
+  this->MovingImage = NULL;
+  this->Sampler = NULL;
+  this->NumberOfLevels = 3;
+  this->Metric = VTK_PYRAMID_METRIC_NCC;
+  this->Optimizer = VTK_PYRAMID_OPTIMIZER_POWELL;
+  this->BinNumber[0] = this->BinNumber[1] = 64;
+  this->SearchRange = 20.0;
+  this->Tolerance = 1e-5;
+  this->MaxIterations = 1000;
+  for (int i = 0; i < 3; i++)
+  {
+    this->InitialTranslation[i] = 0.0;
+    this->Translation[i] = 0.0;
+    this->Axes[i] = i;
+  }
+  this->MetricValue = 0.0;
+  this->PyramidTime = 0.0;
+  this->Manipulator = NULL;
+  this->NumberOfAxes = 0;
+  this->NumberOfEvaluations = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkImagePyramidRegistration::~vtkImagePyramidRegistration()
+{
+  this->ReleasePyramid();
+  this->SetFixedImage(NULL);
+  this->SetMovingImage(NULL);
+  this->SetSampler(NULL);
+}
+
+//----------------------------------------------------------------------------
+void vtkImagePyramidRegistration::SetFixedImage(vtkImageData *image)
+{
+  if (image == this->FixedImage)
+  {
+    return;
+  }
+  this->ReleasePyramid();
+  if (this->FixedImage)
+  {
+    this->FixedImage->UnRegister(this);
+  }
+  this->FixedImage = image;
+  if (this->FixedImage)
+  {
+    this->FixedImage->Register(this);
+  }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkImagePyramidRegistration::SetMovingImage(vtkImageData *image)
+{
+  if (image == this->MovingImage)
+  {
+    return;
+  }
+  this->ReleasePyramid();
+  if (this->MovingImage)
+  {
+    this->MovingImage->UnRegister(this);
+  }
+  this->MovingImage = image;
+  if (this->MovingImage)
+  {
+    this->MovingImage->Register(this);
+  }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkImagePyramidRegistration::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  if (sampler == this->Sampler)
+  {
+    return;
+  }
+  if (this->Sampler)
+  {
+    this->Sampler->UnRegister(this);
+  }
+  this->Sampler = sampler;
+  if (this->Sampler)
+  {
+    this->Sampler->Register(this);
+  }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+const char *vtkImagePyramidRegistration::GetMetricAsString()
+{
+  switch (this->Metric)
+  {
+  case VTK_PYRAMID_METRIC_NCC:
+    return "NCC";
+  case VTK_PYRAMID_METRIC_AD:
+    return "AD";
+  case VTK_PYRAMID_METRIC_SD:
+    return "SD";
+  case VTK_PYRAMID_METRIC_MI:
+    return "MI";
+  case VTK_PYRAMID_METRIC_NMI:
+    return "NMI";
+  }
+  return "Unknown";
+}
+
+//----------------------------------------------------------------------------
+const char *vtkImagePyramidRegistration::GetOptimizerAsString()
+{
+  switch (this->Optimizer)
+  {
+  case VTK_PYRAMID_OPTIMIZER_SIMPLEX:
+    return "Simplex";
+  case VTK_PYRAMID_OPTIMIZER_POWELL:
+    return "Powell";
+  case VTK_PYRAMID_OPTIMIZER_LBFGS:
+    return "LBFGS";
+  }
+  return "Unknown";
+}
+
+//----------------------------------------------------------------------------
+vtkImageData *vtkImagePyramidRegistration::GetFixedLevel(int level)
+{
+  if (level < 0 || level >= static_cast<int>(this->FixedLevels.size()))
+  {
+    return NULL;
+  }
+  return this->FixedLevels[level];
+}
+
+//----------------------------------------------------------------------------
+vtkImageData *vtkImagePyramidRegistration::GetMovingLevel(int level)
+{
+  if (level < 0 || level >= static_cast<int>(this->MovingLevels.size()))
+  {
+    return NULL;
+  }
+  return this->MovingLevels[level];
+}
+
+//----------------------------------------------------------------------------
+double vtkImagePyramidRegistration::GetLevelTime(int level)
+{
+  if (level < 0 || level >= static_cast<int>(this->LevelTimes.size()))
+  {
+    return 0.0;
+  }
+  return this->LevelTimes[level];
+}
+
+//----------------------------------------------------------------------------
+double vtkImagePyramidRegistration::GetLevelMetricValue(int level)
+{
+  if (level < 0 || level >= static_cast<int>(this->LevelMetricValues.size()))
+  {
+    return 0.0;
+  }
+  return this->LevelMetricValues[level];
+}
+
+//----------------------------------------------------------------------------
+int vtkImagePyramidRegistration::GetLevelNumberOfEvaluations(int level)
+{
+  if (level < 0 || level >= static_cast<int>(this->LevelEvaluations.size()))
+  {
+    return 0;
+  }
+  return this->LevelEvaluations[level];
+}
+
+//----------------------------------------------------------------------------
+void vtkImagePyramidRegistration::GetLevelTranslation(int level, double translation[3])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    translation[i] = 0.0;
+    if (level >= 0 && 3*level + i < static_cast<int>(this->LevelTranslations.size()))
+    {
+      translation[i] = this->LevelTranslations[3*level + i];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkImagePyramidRegistration::ReleasePyramid()
+{
+  for (size_t i = 0; i < this->FixedLevels.size(); i++)
+  {
+    this->FixedLevels[i]->UnRegister(this);
+  }
+  for (size_t i = 0; i < this->MovingLevels.size(); i++)
+  {
+    this->MovingLevels[i]->UnRegister(this);
+  }
+  this->FixedLevels.clear();
+  this->MovingLevels.clear();
+}
+
+//----------------------------------------------------------------------------
+// Store an average in the scalar type, rounded for the integer types.
+template <class T>
+inline void vtkImagePyramidRegistrationConvert(double value, T &result)
+{
+  result = static_cast<T>(floor(value + 0.5));
+}
+
+inline void vtkImagePyramidRegistrationConvert(double value, float &result)
+{
+  result = static_cast<float>(value);
+}
+
+inline void vtkImagePyramidRegistrationConvert(double value, double &result)
+{
+  result = value;
+}
+
+//----------------------------------------------------------------------------
+// Average the blocks of factor[0] x factor[1] x factor[2] voxels of
+// inData that start at the voxels of outData, with factor[i] times the
+// index of each voxel of outData.
+template <class T>
+void vtkImagePyramidRegistrationShrink(vtkImageData *inData, vtkImageData *outData,
+                                       const int factor[3], T *)
+{
+  int inExt[6], outExt[6];
+  inData->GetExtent(inExt);
+  outData->GetExtent(outExt);
+  int numComponents = inData->GetNumberOfScalarComponents();
+
+  vtkIdType inc[3];
+  inc[0] = numComponents;
+  inc[1] = inc[0]*(inExt[1] - inExt[0] + 1);
+  inc[2] = inc[1]*(inExt[3] - inExt[2] + 1);
+
+  T *inPtr = static_cast<T *>(inData->GetScalarPointer());
+  T *outPtr = static_cast<T *>(outData->GetScalarPointer());
+  double scale = 1.0/(factor[0]*factor[1]*factor[2]);
+
+  for (int idZ = outExt[4]; idZ <= outExt[5]; idZ++)
+  {
+    for (int idY = outExt[2]; idY <= outExt[3]; idY++)
+    {
+      for (int idX = outExt[0]; idX <= outExt[1]; idX++)
+      {
+        T *blockPtr = inPtr + (factor[2]*idZ - inExt[4])*inc[2] +
+                              (factor[1]*idY - inExt[2])*inc[1] +
+                              (factor[0]*idX - inExt[0])*inc[0];
+        for (int c = 0; c < numComponents; c++)
+        {
+          double sum = 0.0;
+          for (int k = 0; k < factor[2]; k++)
+          {
+            for (int j = 0; j < factor[1]; j++)
+            {
+              T *ptr = blockPtr + k*inc[2] + j*inc[1] + c;
+              for (int i = 0; i < factor[0]; i++)
+              {
+                sum += *ptr;
+                ptr += inc[0];
+              }
+            }
+          }
+          vtkImagePyramidRegistrationConvert(sum*scale, *outPtr++);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// Build the next level of one image.
+static vtkImageData *vtkImagePyramidRegistrationShrinkImage(vtkImageData *inData,
+  const int outExt[6], const int factor[3], vtkObject *self)
+{
+  double spacing[3], origin[3];
+  inData->GetSpacing(spacing);
+  inData->GetOrigin(origin);
+  for (int i = 0; i < 3; i++)
+  {
+    // voxel j of the output is at the middle of voxels 2j and 2j+1
+    if (factor[i] == 2)
+    {
+      origin[i] += 0.5*spacing[i];
+      spacing[i] *= 2.0;
+    }
+  }
+
+  vtkImageData *outData = vtkImageData::New();
+  outData->SetExtent(const_cast<int *>(outExt));
+  outData->SetSpacing(spacing);
+  outData->SetOrigin(origin);
+  outData->AllocateScalars(inData->GetScalarType(),
+                           inData->GetNumberOfScalarComponents());
+
+  switch (inData->GetScalarType())
+  {
+    vtkTemplateMacro(vtkImagePyramidRegistrationShrink(inData, outData, factor,
+                     static_cast<VTK_TT *>(NULL)));
+  default:
+    vtkErrorWithObjectMacro(self, "BuildPyramid: Unknown ScalarType");
+  }
+
+  return outData;
+}
+
+//----------------------------------------------------------------------------
+int vtkImagePyramidRegistration::BuildPyramid()
+{
+  this->ReleasePyramid();
+
+  double startTime = vtkTimerLog::GetUniversalTime();
+
+  this->FixedImage->Register(this);
+  this->FixedLevels.push_back(this->FixedImage);
+  this->MovingImage->Register(this);
+  this->MovingLevels.push_back(this->MovingImage);
+
+  for (int level = 1; level < this->NumberOfLevels; level++)
+  {
+    vtkImageData *fixed = this->FixedLevels[level-1];
+    vtkImageData *moving = this->MovingLevels[level-1];
+    int fixedExt[6], movingExt[6], factor[3];
+    fixed->GetExtent(fixedExt);
+    moving->GetExtent(movingExt);
+
+    // Voxels 2j and 2j+1 of both images become voxel j, which keeps the
+    // images in the same index space. Axes that would be left with fewer
+    // than VTK_PYRAMID_MIN_VOXELS voxels in either image are kept as
+    // they are.
+    int fixedOut[6], movingOut[6];
+    for (int i = 0; i < 3; i++)
+    {
+      fixedOut[2*i] = static_cast<int>(ceil(0.5*fixedExt[2*i]));
+      fixedOut[2*i+1] = static_cast<int>(floor(0.5*(fixedExt[2*i+1] - 1)));
+      movingOut[2*i] = static_cast<int>(ceil(0.5*movingExt[2*i]));
+      movingOut[2*i+1] = static_cast<int>(floor(0.5*(movingExt[2*i+1] - 1)));
+      factor[i] = 2;
+      if (fixedOut[2*i+1] - fixedOut[2*i] + 1 < VTK_PYRAMID_MIN_VOXELS ||
+          movingOut[2*i+1] - movingOut[2*i] + 1 < VTK_PYRAMID_MIN_VOXELS)
+      {
+        fixedOut[2*i] = fixedExt[2*i];
+        fixedOut[2*i+1] = fixedExt[2*i+1];
+        movingOut[2*i] = movingExt[2*i];
+        movingOut[2*i+1] = movingExt[2*i+1];
+        factor[i] = 1;
+      }
+    }
+
+    this->FixedLevels.push_back(
+      vtkImagePyramidRegistrationShrinkImage(fixed, fixedOut, factor, this));
+    this->MovingLevels.push_back(
+      vtkImagePyramidRegistrationShrinkImage(moving, movingOut, factor, this));
+  }
+
+  this->PyramidUpdateTime.Modified();
+  this->PyramidTime = vtkTimerLog::GetUniversalTime() - startTime;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Give a manipulator the images and the extent of a level.
+template <class T>
+void vtkImagePyramidRegistrationSetUp(T *manipulator, vtkImageData *fixed,
+                                      vtkImageData *moving, int extent[6],
+                                      vtkImageVoxelSampler *sampler)
+{
+  manipulator->SetInput1(moving);
+  manipulator->SetInput2(fixed);
+  if (sampler)
+  {
+    manipulator->SetSampler(sampler);
+  }
+  manipulator->SetExtent(extent);
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+double vtkImagePyramidRegistrationGetResult(T *manipulator, const double translation[3])
+{
+  double t[3];
+  t[0] = translation[0];
+  t[1] = translation[1];
+  t[2] = translation[2];
+  manipulator->SetTranslation(t);
+  return manipulator->GetResult();
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+double vtkImagePyramidRegistrationGetResultAndGradient(T *manipulator,
+  const double translation[3], double gradient[3])
+{
+  double t[3];
+  t[0] = translation[0];
+  t[1] = translation[1];
+  t[2] = translation[2];
+  manipulator->SetTranslation(t);
+  return manipulator->GetResultAndGradient(gradient);
+}
+
+//----------------------------------------------------------------------------
+// Spread the bins of MI and NMI over the range of the values of an image,
+// with the smallest and largest values at the centres of the first and
+// last bins, so that the values interpolated within the image never fall
+// outside of the bins. Returns 0 if the range is not finite.
+static int vtkImagePyramidRegistrationBins(vtkImageData *image, int number,
+                                           double &width, double &origin)
+{
+  double range[2];
+  image->GetScalarRange(range);
+  if (!(range[0] >= -VTK_DOUBLE_MAX && range[1] <= VTK_DOUBLE_MAX))
+  {
+    return 0;
+  }
+  width = 1.0;
+  if (range[1] > range[0])
+  {
+    width = (range[1] - range[0])/(number - 1);
+  }
+  origin = range[0] - 0.5*width;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+double vtkImagePyramidRegistration::EvaluateCost(const double translation[3],
+                                                 double *gradient)
+{
+  this->NumberOfEvaluations++;
+
+  // NCC, MI and NMI are larger for better matches, AD and SD smaller.
+  // 1 - NCC is used rather than -NCC, since the tolerance of the simplex
+  // is relative to the value.
+  switch (this->Metric)
+  {
+  case VTK_PYRAMID_METRIC_NCC:
+    if (gradient)
+    {
+      double value = vtkImagePyramidRegistrationGetResultAndGradient(
+        static_cast<vtkImageNCCManipulator *>(this->Manipulator), translation, gradient);
+      gradient[0] = -gradient[0];
+      gradient[1] = -gradient[1];
+      gradient[2] = -gradient[2];
+      return 1.0 - value;
+    }
+    return 1.0 - vtkImagePyramidRegistrationGetResult(
+      static_cast<vtkImageNCCManipulator *>(this->Manipulator), translation);
+  case VTK_PYRAMID_METRIC_AD:
+    return vtkImagePyramidRegistrationGetResult(
+      static_cast<vtkImageADManipulator *>(this->Manipulator), translation);
+  case VTK_PYRAMID_METRIC_SD:
+    return vtkImagePyramidRegistrationGetResult(
+      static_cast<vtkImageSDManipulator *>(this->Manipulator), translation);
+  case VTK_PYRAMID_METRIC_MI:
+    if (gradient)
+    {
+      double value = vtkImagePyramidRegistrationGetResultAndGradient(
+        static_cast<vtkImageMIManipulator *>(this->Manipulator), translation, gradient);
+      gradient[0] = -gradient[0];
+      gradient[1] = -gradient[1];
+      gradient[2] = -gradient[2];
+      return -value;
+    }
+    return -vtkImagePyramidRegistrationGetResult(
+      static_cast<vtkImageMIManipulator *>(this->Manipulator), translation);
+  case VTK_PYRAMID_METRIC_NMI:
+    return -vtkImagePyramidRegistrationGetResult(
+      static_cast<vtkImageNMIManipulator *>(this->Manipulator), translation);
+  }
+  return 0.0;
+}
+
+//----------------------------------------------------------------------------
+// The function given to the simplex and Powell minimizers, which are
+// kept to one thread since the manipulator is shared.
+double vtkImagePyramidRegistrationFunction(void *arg, int vtkNotUsed(threadId),
+                                           const double *parameters)
+{
+  vtkImagePyramidRegistration *self =
+    static_cast<vtkImagePyramidRegistration *>(arg);
+
+  double translation[3];
+  translation[0] = self->Translation[0];
+  translation[1] = self->Translation[1];
+  translation[2] = self->Translation[2];
+  for (int i = 0; i < self->NumberOfAxes; i++)
+  {
+    translation[self->Axes[i]] = parameters[i];
+  }
+
+  return self->EvaluateCost(translation, NULL);
+}
+
+//----------------------------------------------------------------------------
+double vtkImagePyramidRegistrationGradientFunction(void *arg,
+  const double *parameters, double *gradient)
+{
+  vtkImagePyramidRegistration *self =
+    static_cast<vtkImagePyramidRegistration *>(arg);
+
+  double translation[3], translationGradient[3];
+  translation[0] = self->Translation[0];
+  translation[1] = self->Translation[1];
+  translation[2] = self->Translation[2];
+  for (int i = 0; i < self->NumberOfAxes; i++)
+  {
+    translation[self->Axes[i]] = parameters[i];
+  }
+
+  double value = self->EvaluateCost(translation, translationGradient);
+  for (int i = 0; i < self->NumberOfAxes; i++)
+  {
+    gradient[i] = translationGradient[self->Axes[i]];
+  }
+
+  return value;
+}
+
+//----------------------------------------------------------------------------
+int vtkImagePyramidRegistration::RegisterLevel(int level)
+{
+  vtkImageData *fixed = this->FixedLevels[level];
+  vtkImageData *moving = this->MovingLevels[level];
+  int fixedExt[6], movingExt[6], extent[6];
+  double spacing[3], brackets[3][2];
+  fixed->GetExtent(fixedExt);
+  moving->GetExtent(movingExt);
+  fixed->GetSpacing(spacing);
+
+  // Search along the axes along which both images have more than one
+  // voxel: within SearchRange at the coarsest level, and within two
+  // voxels at the others, where the start is that close already.
+  this->NumberOfAxes = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    extent[2*i] = (fixedExt[2*i] > movingExt[2*i] ?
+                   fixedExt[2*i] : movingExt[2*i]);
+    extent[2*i+1] = (fixedExt[2*i+1] < movingExt[2*i+1] ?
+                     fixedExt[2*i+1] : movingExt[2*i+1]);
+    if (fixedExt[2*i] == fixedExt[2*i+1] || movingExt[2*i] == movingExt[2*i+1])
+    {
+      continue;
+    }
+
+    double width = this->SearchRange;
+    if (level < this->NumberOfLevels - 1 && 2.0*spacing[i] < width)
+    {
+      width = 2.0*spacing[i];
+    }
+
+    // Only use the voxels of the fixed image that stay within the moving
+    // image over the brackets, with one more voxel for the interpolation
+    // (and the gradient). Where that leaves less than half of the voxels
+    // that overlap, search a smaller range instead.
+    double offset = fabs(this->Translation[i]);
+    int margin = static_cast<int>(ceil((offset + width)/spacing[i])) + 1;
+    int maxMargin = (extent[2*i+1] - extent[2*i] + 1)/4;
+    if (margin > maxMargin)
+    {
+      margin = maxMargin;
+      width = (margin - 1)*spacing[i] - offset;
+      if (width <= 0.0)
+      {
+        vtkErrorMacro("RegisterLevel: The images are too small for the "
+                      "translation at level " << level);
+        return 0;
+      }
+    }
+    brackets[i][0] = this->Translation[i] - width;
+    brackets[i][1] = this->Translation[i] + width;
+    this->Axes[this->NumberOfAxes++] = i;
+
+    if (extent[2*i] < movingExt[2*i] + margin)
+    {
+      extent[2*i] = movingExt[2*i] + margin;
+    }
+    if (extent[2*i+1] > movingExt[2*i+1] - margin)
+    {
+      extent[2*i+1] = movingExt[2*i+1] - margin;
+    }
+  }
+
+  if (this->NumberOfAxes == 0)
+  {
+    vtkErrorMacro("RegisterLevel: The images have a single voxel");
+    return 0;
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    if (extent[2*i] > extent[2*i+1])
+    {
+      vtkErrorMacro("RegisterLevel: The images do not overlap over the "
+                    "search range at level " << level);
+      return 0;
+    }
+  }
+
+  double binWidth[2], binOrigin[2];
+  if ((this->Metric == VTK_PYRAMID_METRIC_MI ||
+       this->Metric == VTK_PYRAMID_METRIC_NMI) &&
+      (!vtkImagePyramidRegistrationBins(moving, this->BinNumber[0],
+                                        binWidth[0], binOrigin[0]) ||
+       !vtkImagePyramidRegistrationBins(fixed, this->BinNumber[1],
+                                        binWidth[1], binOrigin[1])))
+  {
+    vtkErrorMacro("RegisterLevel: The images have values that cannot be "
+                  "binned at level " << level);
+    return 0;
+  }
+
+  switch (this->Metric)
+  {
+  case VTK_PYRAMID_METRIC_NCC:
+  {
+    vtkImageNCCManipulator *manipulator = vtkImageNCCManipulator::New();
+    vtkImagePyramidRegistrationSetUp(manipulator, fixed, moving, extent, this->Sampler);
+    this->Manipulator = manipulator;
+    break;
+  }
+  case VTK_PYRAMID_METRIC_AD:
+  {
+    vtkImageADManipulator *manipulator = vtkImageADManipulator::New();
+    vtkImagePyramidRegistrationSetUp(manipulator, fixed, moving, extent, this->Sampler);
+    this->Manipulator = manipulator;
+    break;
+  }
+  case VTK_PYRAMID_METRIC_SD:
+  {
+    vtkImageSDManipulator *manipulator = vtkImageSDManipulator::New();
+    vtkImagePyramidRegistrationSetUp(manipulator, fixed, moving, extent, this->Sampler);
+    this->Manipulator = manipulator;
+    break;
+  }
+  case VTK_PYRAMID_METRIC_MI:
+  {
+    vtkImageMIManipulator *manipulator = vtkImageMIManipulator::New();
+    manipulator->SetBinNumber(this->BinNumber[0], this->BinNumber[1]);
+    manipulator->SetBinWidth(binWidth);
+    manipulator->SetBinOrigin(binOrigin);
+    vtkImagePyramidRegistrationSetUp(manipulator, fixed, moving, extent, this->Sampler);
+    this->Manipulator = manipulator;
+    break;
+  }
+  case VTK_PYRAMID_METRIC_NMI:
+  {
+    vtkImageNMIManipulator *manipulator = vtkImageNMIManipulator::New();
+    manipulator->SetBinNumber(this->BinNumber[0], this->BinNumber[1]);
+    manipulator->SetBinWidth(binWidth);
+    manipulator->SetBinOrigin(binOrigin);
+    vtkImagePyramidRegistrationSetUp(manipulator, fixed, moving, extent, this->Sampler);
+    this->Manipulator = manipulator;
+    break;
+  }
+  }
+
+  // The gradient of the manipulators needs the next voxel along every
+  // axis, so LBFGS is only used for NCC and MI of 3D images.
+  int optimizer = this->Optimizer;
+  if (optimizer == VTK_PYRAMID_OPTIMIZER_LBFGS &&
+      ((this->Metric != VTK_PYRAMID_METRIC_NCC &&
+        this->Metric != VTK_PYRAMID_METRIC_MI) || this->NumberOfAxes < 3))
+  {
+    vtkWarningMacro("RegisterLevel: LBFGS needs the gradient of NCC or MI "
+                    "over a volume, using Powell instead");
+    optimizer = VTK_PYRAMID_OPTIMIZER_POWELL;
+  }
+
+  double start[3];
+  for (int i = 0; i < this->NumberOfAxes; i++)
+  {
+    start[i] = this->Translation[this->Axes[i]];
+  }
+
+  this->NumberOfEvaluations = 0;
+  if (optimizer == VTK_PYRAMID_OPTIMIZER_LBFGS)
+  {
+    // LBFGS starts at the middle of the brackets
+    vtkLBFGSMinimizer *minimizer = vtkLBFGSMinimizer::New();
+    minimizer->SetFunction(&vtkImagePyramidRegistrationGradientFunction, this);
+    minimizer->SetTolerance(this->Tolerance);
+    minimizer->SetMaxIterations(this->MaxIterations);
+    for (int i = 0; i < this->NumberOfAxes; i++)
+    {
+      int axis = this->Axes[i];
+      minimizer->SetScalarVariableBracket(vtkImagePyramidRegistrationNames[axis],
+                                          brackets[axis]);
+    }
+    minimizer->Minimize();
+    for (int i = 0; i < this->NumberOfAxes; i++)
+    {
+      int axis = this->Axes[i];
+      this->Translation[axis] =
+        minimizer->GetScalarVariableValue(vtkImagePyramidRegistrationNames[axis]);
+    }
+    minimizer->Delete();
+  }
+  else if (optimizer == VTK_PYRAMID_OPTIMIZER_POWELL)
+  {
+    vtkPowellMinimizer *minimizer = vtkPowellMinimizer::New();
+    minimizer->SetThreadedFunction(&vtkImagePyramidRegistrationFunction, this);
+    minimizer->SetNumberOfThreads(1);
+    minimizer->SetTolerance(this->Tolerance);
+    minimizer->SetMaxIterations(this->MaxIterations);
+    for (int i = 0; i < this->NumberOfAxes; i++)
+    {
+      int axis = this->Axes[i];
+      minimizer->SetScalarVariableBracket(vtkImagePyramidRegistrationNames[axis],
+                                          brackets[axis]);
+    }
+    minimizer->AddStartingPoint(start);
+    minimizer->Minimize();
+    for (int i = 0; i < this->NumberOfAxes; i++)
+    {
+      int axis = this->Axes[i];
+      this->Translation[axis] =
+        minimizer->GetScalarVariableValue(vtkImagePyramidRegistrationNames[axis]);
+    }
+    minimizer->Delete();
+  }
+  else
+  {
+    vtkFunctionMinimizer *minimizer = vtkFunctionMinimizer::New();
+    minimizer->SetThreadedFunction(&vtkImagePyramidRegistrationFunction, this);
+    minimizer->SetNumberOfThreads(1);
+    minimizer->SetTolerance(this->Tolerance);
+    minimizer->SetMaxIterations(this->MaxIterations);
+    for (int i = 0; i < this->NumberOfAxes; i++)
+    {
+      int axis = this->Axes[i];
+      minimizer->SetScalarVariableBracket(vtkImagePyramidRegistrationNames[axis],
+                                          brackets[axis]);
+    }
+    minimizer->AddStartingPoint(start);
+    minimizer->Minimize();
+    for (int i = 0; i < this->NumberOfAxes; i++)
+    {
+      int axis = this->Axes[i];
+      this->Translation[axis] =
+        minimizer->GetScalarVariableValue(vtkImagePyramidRegistrationNames[axis]);
+    }
+    minimizer->Delete();
+  }
+
+  // report the metric itself, rather than the smoothed MI of the gradient,
+  // without counting it as an evaluation of the optimizer
+  int numberOfEvaluations = this->NumberOfEvaluations;
+  this->MetricValue = this->EvaluateCost(this->Translation, NULL);
+  this->NumberOfEvaluations = numberOfEvaluations;
+  if (this->Metric == VTK_PYRAMID_METRIC_NCC)
+  {
+    this->MetricValue = 1.0 - this->MetricValue;
+  }
+  else if (this->Metric == VTK_PYRAMID_METRIC_MI ||
+      this->Metric == VTK_PYRAMID_METRIC_NMI)
+  {
+    this->MetricValue = -this->MetricValue;
+  }
+
+  this->Manipulator->Delete();
+  this->Manipulator = NULL;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkImagePyramidRegistration::Update()
+{
+  if (this->FixedImage == NULL || this->MovingImage == NULL)
+  {
+    vtkErrorMacro("Update: Both images must be set");
+    return 0;
+  }
+  if (this->FixedImage->GetScalarType() != this->MovingImage->GetScalarType())
+  {
+    vtkErrorMacro("Update: The images must be of the same ScalarType");
+    return 0;
+  }
+  if ((this->Metric == VTK_PYRAMID_METRIC_MI ||
+       this->Metric == VTK_PYRAMID_METRIC_NMI) &&
+      (this->BinNumber[0] < 2 || this->BinNumber[1] < 2))
+  {
+    vtkErrorMacro("Update: BinNumber must be at least 2");
+    return 0;
+  }
+
+  // build the levels once for as long as the images do not change
+  this->PyramidTime = 0.0;
+  if (static_cast<int>(this->FixedLevels.size()) != this->NumberOfLevels ||
+      this->FixedImage->GetMTime() > this->PyramidUpdateTime.GetMTime() ||
+      this->MovingImage->GetMTime() > this->PyramidUpdateTime.GetMTime())
+  {
+    if (!this->BuildPyramid())
+    {
+      return 0;
+    }
+  }
+
+  this->LevelTimes.assign(this->NumberOfLevels, 0.0);
+  this->LevelMetricValues.assign(this->NumberOfLevels, 0.0);
+  this->LevelEvaluations.assign(this->NumberOfLevels, 0);
+  this->LevelTranslations.assign(3*this->NumberOfLevels, 0.0);
+
+  for (int i = 0; i < 3; i++)
+  {
+    this->Translation[i] = this->InitialTranslation[i];
+  }
+
+  // from the coarsest level to the images themselves
+  for (int level = this->NumberOfLevels - 1; level >= 0; level--)
+  {
+    double startTime = vtkTimerLog::GetUniversalTime();
+    if (!this->RegisterLevel(level))
+    {
+      return 0;
+    }
+    this->LevelTimes[level] = vtkTimerLog::GetUniversalTime() - startTime;
+    this->LevelMetricValues[level] = this->MetricValue;
+    this->LevelEvaluations[level] = this->NumberOfEvaluations;
+    for (int i = 0; i < 3; i++)
+    {
+      this->LevelTranslations[3*level + i] = this->Translation[i];
+    }
+    vtkDebugMacro("Level " << level << ": " << this->LevelTimes[level] << " s, "
+                  << this->GetMetricAsString() << " " << this->MetricValue
+                  << ", translation (" << this->Translation[0] << ", "
+                  << this->Translation[1] << ", " << this->Translation[2] << ")");
+  }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkImagePyramidRegistration::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "FixedImage: " << this->FixedImage << "\n";
+  os << indent << "MovingImage: " << this->MovingImage << "\n";
+  os << indent << "Sampler: " << this->Sampler << "\n";
+  os << indent << "NumberOfLevels: " << this->NumberOfLevels << "\n";
+  os << indent << "Metric: " << this->GetMetricAsString() << "\n";
+  os << indent << "Optimizer: " << this->GetOptimizerAsString() << "\n";
+  os << indent << "BinNumber: " << this->BinNumber[0] << " "
+     << this->BinNumber[1] << "\n";
+  os << indent << "InitialTranslation: " << this->InitialTranslation[0] << " "
+     << this->InitialTranslation[1] << " " << this->InitialTranslation[2] << "\n";
+  os << indent << "SearchRange: " << this->SearchRange << "\n";
+  os << indent << "Tolerance: " << this->Tolerance << "\n";
+  os << indent << "MaxIterations: " << this->MaxIterations << "\n";
+  os << indent << "Translation: " << this->Translation[0] << " "
+     << this->Translation[1] << " " << this->Translation[2] << "\n";
+  os << indent << "MetricValue: " << this->MetricValue << "\n";
+  os << indent << "PyramidTime: " << this->PyramidTime << "\n";
+  for (int level = static_cast<int>(this->LevelTimes.size()) - 1; level >= 0; level--)
+  {
+    os << indent << "Level " << level << ": Time " << this->LevelTimes[level]
+       << ", MetricValue " << this->LevelMetricValues[level]
+       << ", NumberOfEvaluations " << this->LevelEvaluations[level]
+       << ", Translation " << this->LevelTranslations[3*level] << " "
+       << this->LevelTranslations[3*level + 1] << " "
+       << this->LevelTranslations[3*level + 2] << "\n";
+  }
+}
@@ -0,0 +1,237 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImagePyramidRegistration.h,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkImagePyramidRegistration - coarse to fine translation
+// registration with the image manipulators.
+// .SECTION Description
+// vtkImagePyramidRegistration finds the translation of the moving image
+// that best matches the fixed image, as measured by one of the image
+// manipulators (NCC, AD, SD, MI or NMI), by registering images of
+// decreasing voxel size one after the other. Both images must have the
+// same origin and spacing, as the manipulators require.
+//
+// Level 0 is the images themselves, and each level above it halves
+// the number of voxels along every axis that keeps at least 8 voxels, by
+// averaging blocks of 2x2x2 voxels. The levels are built once, and only
+// built again when an image or the number of levels changes. The
+// registration starts at the coarsest level within SearchRange of
+// InitialTranslation, and every finer level starts from the translation
+// found by the level above it, within two voxels of that level. The
+// search range is reduced at levels too small to keep half of their
+// voxels within the moving image over the full range.
+//
+// The time, the value of the metric, the number of evaluations and the
+// translation found are kept for every level, and printed by PrintSelf.
+// .SECTION see also
+// vtkImageNCCManipulator vtkImageMIManipulator vtkPowellMinimizer
+// vtkFunctionMinimizer vtkLBFGSMinimizer
+
+#ifndef __vtkImagePyramidRegistration_h
+#define __vtkImagePyramidRegistration_h
+
+#include "vtkRobartsRegistrationExport.h"
+
+#include "vtkObject.h"
+#include "vtkTimeStamp.h"
+
+#include <vector>
+
+class vtkImageData;
+class vtkImageVoxelSampler;
+
+#define VTK_PYRAMID_METRIC_NCC 0
+#define VTK_PYRAMID_METRIC_AD 1
+#define VTK_PYRAMID_METRIC_SD 2
+#define VTK_PYRAMID_METRIC_MI 3
+#define VTK_PYRAMID_METRIC_NMI 4
+
+#define VTK_PYRAMID_OPTIMIZER_SIMPLEX 0
+#define VTK_PYRAMID_OPTIMIZER_POWELL 1
+#define VTK_PYRAMID_OPTIMIZER_LBFGS 2
+
+class vtkRobartsRegistrationExport vtkImagePyramidRegistration : public vtkObject
+{
+public:
+  static vtkImagePyramidRegistration *New();
+  vtkTypeMacro(vtkImagePyramidRegistration,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Set/get the fixed image (input 2 of the manipulators, over whose
+  // extent the metric is computed) and the moving image (input 1, which
+  // is translated).
+  void SetFixedImage(vtkImageData *image);
+  vtkImageData *GetFixedImage() { return this->FixedImage; };
+  void SetMovingImage(vtkImageData *image);
+  vtkImageData *GetMovingImage() { return this->MovingImage; };
+
+  // Description:
+  // The number of levels of the pyramid. The default is 3.
+  vtkSetClampMacro(NumberOfLevels,int,1,16);
+  vtkGetMacro(NumberOfLevels,int);
+
+  // Description:
+  // The metric to optimize. The default is NCC.
+  vtkSetClampMacro(Metric,int,VTK_PYRAMID_METRIC_NCC,VTK_PYRAMID_METRIC_NMI);
+  vtkGetMacro(Metric,int);
+  void SetMetricToNCC() { this->SetMetric(VTK_PYRAMID_METRIC_NCC); };
+  void SetMetricToAD() { this->SetMetric(VTK_PYRAMID_METRIC_AD); };
+  void SetMetricToSD() { this->SetMetric(VTK_PYRAMID_METRIC_SD); };
+  void SetMetricToMI() { this->SetMetric(VTK_PYRAMID_METRIC_MI); };
+  void SetMetricToNMI() { this->SetMetric(VTK_PYRAMID_METRIC_NMI); };
+  const char *GetMetricAsString();
+
+  // Description:
+  // The optimizer. The default is Powell. LBFGS can only be used with
+  // NCC and MI of volumes, which have a gradient, and Powell is used
+  // instead for the other metrics and for single slices.
+  vtkSetClampMacro(Optimizer,int,VTK_PYRAMID_OPTIMIZER_SIMPLEX,VTK_PYRAMID_OPTIMIZER_LBFGS);
+  vtkGetMacro(Optimizer,int);
+  void SetOptimizerToSimplex() {
+    this->SetOptimizer(VTK_PYRAMID_OPTIMIZER_SIMPLEX); };
+  void SetOptimizerToPowell() {
+    this->SetOptimizer(VTK_PYRAMID_OPTIMIZER_POWELL); };
+  void SetOptimizerToLBFGS() {
+    this->SetOptimizer(VTK_PYRAMID_OPTIMIZER_LBFGS); };
+  const char *GetOptimizerAsString();
+
+  // Description:
+  // The number of bins of the MI and NMI metrics, for the moving and the
+  // fixed image, which must be at least 2. The bins are spread over the
+  // range of the values of each image at every level, so that their width
+  // and origin follow the images. The default is 64 bins.
+  vtkSetVector2Macro(BinNumber,int);
+  vtkGetVector2Macro(BinNumber,int);
+
+  // Description:
+  // An optional sampler, to evaluate the metric over a subset of the
+  // voxels of each level.
+  void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkImageVoxelSampler *GetSampler() { return this->Sampler; };
+
+  // Description:
+  // The translation to start from, and how far from it to search at the
+  // coarsest level, in mm. The defaults are zero and 20.
+  vtkSetVector3Macro(InitialTranslation,double);
+  vtkGetVector3Macro(InitialTranslation,double);
+  vtkSetMacro(SearchRange,double);
+  vtkGetMacro(SearchRange,double);
+
+  // Description:
+  // The tolerance of the optimizer at each level, on the value of the
+  // metric. The default is 1e-5, which is smaller than the defaults of
+  // the simplex and Powell minimizers since NCC is flat near 1.
+  vtkSetMacro(Tolerance,double);
+  vtkGetMacro(Tolerance,double);
+
+  // Description:
+  // The maximum number of iterations of the optimizer at each level.
+  // The default is 1000.
+  vtkSetMacro(MaxIterations,int);
+  vtkGetMacro(MaxIterations,int);
+
+  // Description:
+  // Build the levels if they are out of date, and register the images.
+  // Returns 0 on error.
+  int Update();
+
+  // Description:
+  // The translation of the moving image found at level 0, and the value
+  // of the metric there.
+  vtkGetVector3Macro(Translation,double);
+  vtkGetMacro(MetricValue,double);
+
+  // Description:
+  // The images of a level, once they are built.
+  vtkImageData *GetFixedLevel(int level);
+  vtkImageData *GetMovingLevel(int level);
+
+  // Description:
+  // The time (in seconds) that the last Update took to build the levels,
+  // or zero if they were up to date.
+  vtkGetMacro(PyramidTime,double);
+
+  // Description:
+  // The time (in seconds) taken by a level in the last Update, with the
+  // value of the metric, the number of evaluations of the metric by the
+  // optimizer and the translation at the end of that level. The value of
+  // the metric is evaluated once more at the end of each level, which is
+  // not counted.
+  double GetLevelTime(int level);
+  double GetLevelMetricValue(int level);
+  int GetLevelNumberOfEvaluations(int level);
+  void GetLevelTranslation(int level, double translation[3]);
+
+protected:
+  vtkImagePyramidRegistration();
+  ~vtkImagePyramidRegistration();
+
+  // Build the levels of both images.
+  int BuildPyramid();
+  void ReleasePyramid();
+
+  // Register one level, starting from and updating Translation.
+  int RegisterLevel(int level);
+
+  // Evaluate the metric for a translation, and its gradient if gradient
+  // is not NULL, as a value to be minimized.
+  double EvaluateCost(const double translation[3], double *gradient);
+
+  vtkImageData *FixedImage;
+  vtkImageData *MovingImage;
+  vtkImageVoxelSampler *Sampler;
+  int NumberOfLevels;
+  int Metric;
+  int Optimizer;
+  int BinNumber[2];
+  double InitialTranslation[3];
+  double SearchRange;
+  double Tolerance;
+  int MaxIterations;
+
+  double Translation[3];
+  double MetricValue;
+
+  // The levels, finest first, and when they were built.
+  std::vector<vtkImageData *> FixedLevels;
+  std::vector<vtkImageData *> MovingLevels;
+  vtkTimeStamp PyramidUpdateTime;
+  double PyramidTime;
+
+  // The manipulator of the metric, and the axes along which the images
+  // have more than one voxel, which are the variables of the optimizer.
+  vtkObject *Manipulator;
+  int NumberOfAxes;
+  int Axes[3];
+  int NumberOfEvaluations;
+
+  std::vector<double> LevelTimes;
+  std::vector<double> LevelMetricValues;
+  std::vector<int> LevelEvaluations;
+  std::vector<double> LevelTranslations;
+
+//BTX
+  friend double vtkImagePyramidRegistrationFunction(void *arg, int threadId,
+    const double *parameters);
+  friend double vtkImagePyramidRegistrationGradientFunction(void *arg,
+    const double *parameters, double *gradient);
+//ETX
+
+private:
+  vtkImagePyramidRegistration(const vtkImagePyramidRegistration&);  // Not implemented.
+  void operator=(const vtkImagePyramidRegistration&);  // Not implemented.
+};
+
+#endif
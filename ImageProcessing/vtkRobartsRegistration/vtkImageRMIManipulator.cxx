@@ -17,6 +17,9 @@
 =========================================================================*/
 #include "vtkImageRMIManipulator.h"
 
+#include "vtkImageJointHistogram.h"
+#include "vtkImageVoxelSampler.h"
+
 //--------------------------------------------------------------------------
 // The 'floor' function on x86 and mips is many times slower than these
 // and is used a lot in this code, optimize for different CPU architectures
@@ -82,14 +85,22 @@ vtkImageRMIManipulator::vtkImageRMIManipulator()
   this->MaxIntensities[0] = 4095;
   this->MaxIntensities[1] = 4095;
   this->qValue = 1.5;
+  this->HistS = NULL;
+  this->HistT = NULL;
+  this->HistST = NULL;
+  this->Histogram = vtkImageJointHistogram::New();
+  this->Histogram->SetBinNumber(this->BinNumber[0], this->BinNumber[1]);
+  this->Histogram->SetBinningToRound();
+  this->Histogram->ClampOn();
 }
 
 //----------------------------------------------------------------------------
 vtkImageRMIManipulator::~vtkImageRMIManipulator()
 {
-  delete this->HistS;
-  delete this->HistT;
-  delete this->HistST;
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
+  this->Histogram->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -97,7 +108,6 @@ void vtkImageRMIManipulator::SetInput1(vtkImageData *input)
 {
   input->GetSpacing(this->inSpa);
   input->GetExtent(this->inExt);
-  input->GetIncrements(this->inc[0], this->inc[1], this->inc[2]);
   this->inData[0] = input;
 }
 
@@ -126,9 +136,13 @@ void vtkImageRMIManipulator::SetBinNumber(int numS, int numT)
   this->BinNumber[1] = numT;
   this->BinWidth[0] = (double)this->MaxIntensities[0] / ((double)this->BinNumber[0] - 1.0);
   this->BinWidth[1] = (double)this->MaxIntensities[1] / ((double)this->BinNumber[1] - 1.0);
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
   this->HistS = new long[numS];
   this->HistT = new long[numT];
   this->HistST = new long[numS*numT];
+  this->Histogram->SetBinNumber(numS, numT);
 }
 
 //----------------------------------------------------------------------------
@@ -141,77 +155,67 @@ void vtkImageRMIManipulator::SetMaxIntensities(int maxS, int maxT)
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageRMIManipulatorEntropyT(vtkImageRMIManipulator *self,
-             T  *inPtr, int inc2[2], double count)
+void vtkImageRMIManipulator::SetNumberOfThreads(int numThreads)
 {
-  short b;
-  double temp, entropyT = 0;
- 
-  // Loop over data
-  for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-  {
-    for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-      {
-           b = vtkResliceRound(*inPtr/double(self->BinWidth[1]));
-           self->HistT[b]++;
-        inPtr++;
-      }
-    inPtr += inc2[0];
-  }
-      inPtr += inc2[1];
-    }
+  this->Histogram->SetNumberOfThreads(numThreads);
+}
 
-  for (int i = 0; i < self->BinNumber[1]; i++)
-    {  
-      temp = (double)self->HistT[i];
-      entropyT += pow(temp,self->qValue);
-    }
+//----------------------------------------------------------------------------
+int vtkImageRMIManipulator::GetNumberOfThreads()
+{
+  return this->Histogram->GetNumberOfThreads();
+}
 
-  if ( entropyT > 0 )
-    {
-      self->entropyT = 1.0/(1.0 - self->qValue)*(log(entropyT)-log(pow(count,self->qValue)));
-    }
-  else
-    {
-      cout << "\n ERROR: HistT is all 0's.\n";
-      exit(0);
-    }
+//----------------------------------------------------------------------------
+void vtkImageRMIManipulator::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  this->Histogram->SetSampler(sampler);
+}
 
+//----------------------------------------------------------------------------
+vtkImageVoxelSampler *vtkImageRMIManipulator::GetSampler()
+{
+  return this->Histogram->GetSampler();
 }
 
 //----------------------------------------------------------------------------
 void vtkImageRMIManipulator::SetExtent(int ext[6])
 {
-  void *inPtr;
-
-  if ( this->qValue == 1.0 ) 
-    {
-      vtkErrorMacro( "qValue cannot be 1.0");
-    }
-
-  this->inc2[0] = this->inc[1] - this->inc[0] * (ext[1] - ext[0] + 1);
-  this->inc2[1] = this->inc[2] - this->inc[1] * (ext[3] - ext[2] + 1);
+  if ( this->qValue == 1.0 )
+  {
+    vtkErrorMacro( "qValue cannot be 1.0");
+  }
 
-  this->inPtr[0] = this->inData[0]->GetScalarPointerForExtent(ext);
-  this->inPtr[1] = this->inData[1]->GetScalarPointerForExtent(ext);
-  inPtr = this->inData[1]->GetScalarPointerForExtent(ext);
+  memcpy(this->Extent, ext, sizeof(int)*6);
 
-  this->count = (ext[1]-ext[0]+1) * (ext[3]-ext[2]+1) * (ext[5]-ext[4]+1);
-  if (this->count == 0) vtkErrorMacro( "GetResult: No data to work with.");
+  // Bin image 2 once for all translations, and calculate its entropy
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->SetFixedImage(this->inData[1], NULL, this->Extent))
+  {
+    vtkErrorMacro( "SetExtent: Images have values outside of the bins.");
+    return;
+  }
+  this->count = this->Histogram->GetNumberOfSamples();
+  if (this->count == 0)
+  {
+    vtkErrorMacro( "GetResult: No data to work with.");
+  }
+  memcpy(this->HistT, this->Histogram->GetFixedHistogram(), this->BinNumber[1]*sizeof(long));
 
-  memcpy(this->Extent, ext, sizeof(int)*6);
+  double temp, entropyT = 0, count = this->count;
+  for (int i = 0; i < this->BinNumber[1]; i++)
+    {  
+      temp = (double)this->HistT[i];
+      entropyT += pow(temp,this->qValue);
+    }
 
-  // Calculate the entropy of image 2
-  memset((void *)this->HistT, 0, this->BinNumber[1]*sizeof(long));
-  switch (this->inData[1]->GetScalarType())
+  if ( entropyT > 0 )
+    {
+      this->entropyT = 1.0/(1.0 - this->qValue)*(log(entropyT)-log(pow(count,this->qValue)));
+    }
+  else
     {
-      vtkTemplateMacro(vtkImageRMIManipulatorEntropyT(this, 
-        (VTK_TT *)(inPtr), this->inc2, this->count));
-    default:
-      vtkErrorMacro( "Execute: Unknown ScalarType");
+      vtkErrorMacro( "SetExtent: HistT is all 0's.");
     }
 
 }
@@ -254,190 +258,94 @@ void vtkImageRMIManipulator::SetTranslation(double tran[3])
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageRMIManipulatorExecute(vtkImageRMIManipulator *self,
-           T  *in1Ptr, T *in2Ptr,
-           vtkIdType inc[3], int inc2[2], int inExt[6],
-           int loc000[3], int loc111[3], double count)
+double vtkImageRMIManipulator::GetResult()
 {
-  double V000, V100, V010, V110, V001, V101, V011, V111, Vxyz;
-  double temp, entropyS = 0, entropyST = 0;
-  short a, b;
+  double temp, entropyS = 0, entropyST = 0, count = this->count;
   int i, j;
- 
-  // CASE 1: Check if translation takes us out of the input image, in 
-  // which case set the result to indicate complete dissimilarity and stop.
-  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
-       (self->Extent[2] + loc000[1] < inExt[2]) ||
-       (self->Extent[4] + loc000[2] < inExt[4]) ||
-       (self->Extent[1] + loc111[0] > inExt[1]) ||
-       (self->Extent[3] + loc111[1] > inExt[3]) ||
-       (self->Extent[5] + loc111[2] > inExt[5]) )
+
+  // Check inputs.
+  if (this->inData[0] == NULL)
     {
-      self->Result = 0.5;
-      return;
+      vtkErrorMacro( "Input " << 0 << " must be specified.");
     }
-
-  // CASE 2: Check if no interpolation is necessary.
-  if ( (loc000[0] == 0) && (loc111[0] == 0) &&
-       (loc000[1] == 0) && (loc111[1] == 0) &&
-       (loc000[2] == 0) && (loc111[2] == 0) )
+  if (this->inData[1] == NULL)
     {
-      for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-  {
-    for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
+      vtkErrorMacro( "Input " << 1 << " must be specified.");
+    }
+  if ((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType()))
     {
-      a = vtkResliceRound(*in1Ptr/double(self->BinWidth[0]));
-      b = vtkResliceRound(*in2Ptr/double(self->BinWidth[1]));
-      
-      self->HistS[a]++;
-      self->HistST[b * self->BinNumber[0] + a]++;
-
-      in1Ptr++;
-      in2Ptr++;
+      vtkErrorMacro( "Inputs must be of the same ScalarType");
     }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-    in1Ptr += inc2[1];
-    in2Ptr += inc2[1];
-  }
+  if ( this->qValue == 1.0 ) 
+    {
+      vtkErrorMacro( "qValue cannot be 1.0");
     }
 
-  // CASE 3: If the above two cases don't apply, do the full calculation.
-  else
-    {
-      in1Ptr += inc[2] * loc000[2] + inc[1] * loc000[1] + inc[0] * loc000[0];
+  this->Result = 0;
 
-      for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-  {
-    for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        // Initiate previous data
-        V000 = *in1Ptr;
-        in1Ptr += inc[1];
-        V010 = *in1Ptr;
-        in1Ptr += inc[2];
-        V011 = *in1Ptr;
-        in1Ptr -= inc[1];
-        V001 = *in1Ptr;
-        in1Ptr -= inc[2];
-        
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
+  // Check if translation takes us out of the input image, in 
+  // which case set the result to indicate complete dissimilarity and stop.
+  if ( (this->Extent[0] + this->loc000[0] < this->inExt[0]) ||
+       (this->Extent[2] + this->loc000[1] < this->inExt[2]) ||
+       (this->Extent[4] + this->loc000[2] < this->inExt[4]) ||
+       (this->Extent[1] + this->loc111[0] > this->inExt[1]) ||
+       (this->Extent[3] + this->loc111[1] > this->inExt[3]) ||
+       (this->Extent[5] + this->loc111[2] > this->inExt[5]) )
     {
-      in1Ptr++;
-      V100 = *in1Ptr;
-      in1Ptr += inc[1];
-      V110 = *in1Ptr;
-      in1Ptr += inc[2];
-      V111 = *in1Ptr;
-      in1Ptr -= inc[1];
-      V101 = *in1Ptr;
-      in1Ptr -= inc[2];
-      
-      Vxyz = (V000 * self->F000 + V100 * self->F100 + 
-        V010 * self->F010 + V110 * self->F110 + 
-        V001 * self->F001 + V101 * self->F101 + 
-        V011 * self->F011 + V111 * self->F111);
-      
-      V000 = V100;
-      V010 = V110;
-      V001 = V101;
-      V011 = V111;
-      
-      a = vtkResliceRound(Vxyz/double(self->BinWidth[0]));
-      b = vtkResliceRound(*in2Ptr/double(self->BinWidth[1]));
-
-      self->HistS[a]++;
-      self->HistST[b * self->BinNumber[0] + a]++;
-      
-      in2Ptr++;
+      this->Result = 0.5;
+      return this->Result;
     }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-    in1Ptr += inc2[1];
-    in2Ptr += inc2[1];
+
+  // Accumulate the histograms, interpolating image 1
+  double F[8] = { this->F000, this->F100, this->F010, this->F110,
+                  this->F001, this->F101, this->F011, this->F111 };
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->ComputeJointHistogram(this->inData[0], this->loc000, this->loc111,
+                                              F, this->HistS, this->HistST))
+  {
+    vtkErrorMacro( "GetResult: Images have values outside of the bins.");
+    this->Result = 0.5;
+    return this->Result;
   }
-    }
 
   // Loop over S and ST histograms.
-  for (i = 0; i < self->BinNumber[0]; i++)
+  for (i = 0; i < this->BinNumber[0]; i++)
     {
-      temp = (double)self->HistS[i];
-      entropyS += pow(temp,self->qValue);
-      for (j = 0; j < self->BinNumber[1]; j++) 
+      temp = (double)this->HistS[i];
+      entropyS += pow(temp,this->qValue);
+      for (j = 0; j < this->BinNumber[1]; j++) 
    {
-     temp = (double)self->HistST[j * self->BinNumber[0] + i];
-     entropyST += pow(temp,self->qValue);
+     temp = (double)this->HistST[j * this->BinNumber[0] + i];
+     entropyST += pow(temp,this->qValue);
    }
     }
 
   // Calculate entropies and the RMI
   if ( entropyS > 0 )
     {
-      entropyS = 1.0 / (1.0 - self->qValue) * (log(entropyS) - log(pow(count,self->qValue)));
+      entropyS = 1.0 / (1.0 - this->qValue) * (log(entropyS) - log(pow(count,this->qValue)));
     }
   else
     {
-      cout << "\n ERROR: HistS is all 0's.\n";
-      exit(0);
+      vtkErrorMacro( "GetResult: HistS is all 0's.");
+      this->Result = 0.5;
+      return this->Result;
     }
 
   if ( entropyST > 0 )
     {
-      entropyST = 1.0 / (1.0-self->qValue) * (log(entropyST) - log(pow(count,self->qValue)));
+      entropyST = 1.0 / (1.0-this->qValue) * (log(entropyST) - log(pow(count,this->qValue)));
     }
   else
     {
-      cout << "\n ERROR: HistST is all 0's.\n";
-      exit(0);
+      vtkErrorMacro( "GetResult: HistST is all 0's.");
+      this->Result = 0.5;
+      return this->Result;
     }
  
-  self->Result = entropyS + self->entropyT - entropyST;
-
-}
-
-//----------------------------------------------------------------------------
-double vtkImageRMIManipulator::GetResult()
-{
-  // Check inputs.
-  if (this->inData[0] == NULL)
-    {
-      vtkErrorMacro( "Input " << 0 << " must be specified.");
-    }
-  if (this->inData[1] == NULL)
-    {
-      vtkErrorMacro( "Input " << 1 << " must be specified.");
-    }
-  if ((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType()))
-    {
-      vtkErrorMacro( "Inputs must be of the same ScalarType");
-    }
-  if ( this->qValue == 1.0 ) 
-    {
-      vtkErrorMacro( "qValue cannot be 1.0");
-    }
-
-  // Zero the histograms and result.
-  memset((void *)this->HistS, 0, this->BinNumber[0]*sizeof(long));
-  memset((void *)this->HistST, 0, this->BinNumber[0]*this->BinNumber[1]*sizeof(long));
-  this->Result = 0;
+  this->Result = entropyS + this->entropyT - entropyST;
 
-  // Calculate and return RMI result.
-  switch (this->inData[0]->GetScalarType())
-    {
-      vtkTemplateMacro(vtkImageRMIManipulatorExecute(this, 
-             (VTK_TT *)(this->inPtr[0]), (VTK_TT *)(this->inPtr[1]),
-      this->inc, this->inc2, this->inExt,
-      this->loc000, this->loc111, this->count));
-    default:
-      vtkErrorMacro( "Execute: Unknown ScalarType");
-    }
   return this->Result;
-
 }
 
 //----------------------------------------------------------------------------
@@ -86,6 +86,12 @@ vtkImageSDManipulator::vtkImageSDManipulator()
   }
 }
 
+//----------------------------------------------------------------------------
+vtkImageSDManipulator::~vtkImageSDManipulator()
+{
+  this->SetSampler(NULL);
+}
+
 //----------------------------------------------------------------------------
 void vtkImageSDManipulator::SetInput1(vtkImageData *input)
 {
@@ -113,6 +119,15 @@ vtkImageData *vtkImageSDManipulator::GetInput2()
   return this->inData[1];
 }
 
+//----------------------------------------------------------------------------
+void vtkImageSDManipulator::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  if (this->Samples.SetSampler(sampler, this))
+  {
+    this->Modified();
+  }
+}
+
 //----------------------------------------------------------------------------
 void vtkImageSDManipulator::SetExtent(int ext[6])
 {
@@ -123,6 +138,9 @@ void vtkImageSDManipulator::SetExtent(int ext[6])
   this->inPtr[1] = this->inData[1]->GetScalarPointerForExtent(ext);
 
   memcpy(this->Extent, ext, sizeof(int)*6);
+
+  // Draw the samples from image 2, and keep them with its values
+  this->Samples.Update(this->inData[1], this->Extent);
 }
 
 //----------------------------------------------------------------------------
@@ -266,6 +284,48 @@ void vtkImageSDManipulatorExecute(vtkImageSDManipulator *self,
   }
 }
 
+//----------------------------------------------------------------------------
+// Sum the squared differences at the samples
+struct vtkImageSDManipulatorSampleOp
+{
+  double Sum;
+
+  inline void operator()(double s, double t)
+  {
+    double diff = s - t;
+    this->Sum += diff * diff;
+  }
+};
+
+//----------------------------------------------------------------------------
+// Evaluate over the samples only, interpolating image 1 at each of them.
+template <class T>
+void vtkImageSDManipulatorSampleExecute(vtkImageSDManipulator *self,
+                                        T *in1Ptr, vtkIdType inc[3], int inExt[6],
+                                        int loc000[3], int loc111[3],
+                                        vtkImageMetricSamples *samples)
+{
+  // Check if translation takes us out of the input image, in which case
+  // set the result to indicate complete dissimilarity and stop.
+  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
+       (self->Extent[2] + loc000[1] < inExt[2]) ||
+       (self->Extent[4] + loc000[2] < inExt[4]) ||
+       (self->Extent[1] + loc111[0] > inExt[1]) ||
+       (self->Extent[3] + loc111[1] > inExt[3]) ||
+       (self->Extent[5] + loc111[2] > inExt[5]) )
+  {
+    self->Result = 1E300;
+    return;
+  }
+
+  double F[8] = { self->F000, self->F100, self->F010, self->F110,
+                  self->F001, self->F101, self->F011, self->F111 };
+  vtkImageSDManipulatorSampleOp op = { 0.0 };
+  vtkImageMetricSamplesExecute(in1Ptr, inc, loc000, loc111, F, samples, op);
+
+  self->Result = op.Sum * samples->GetScale();
+}
+
 //----------------------------------------------------------------------------
 double vtkImageSDManipulator::GetResult()
 {
@@ -289,6 +349,19 @@ double vtkImageSDManipulator::GetResult()
 
   this->Result = 0;
 
+  if (this->Samples.GetSampler())
+  {
+    switch (this->inData[0]->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImageSDManipulatorSampleExecute(this,
+                       (VTK_TT *)(this->inPtr[0]), this->inc, this->inExt,
+                       this->loc000, this->loc111, &this->Samples));
+    default:
+      vtkErrorMacro( "Execute: Unknown ScalarType");
+    }
+    return this->Result;
+  }
+
   switch (this->inData[0]->GetScalarType())
   {
     vtkTemplateMacro(vtkImageSDManipulatorExecute(this,
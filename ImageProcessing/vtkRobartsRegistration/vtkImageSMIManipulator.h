@@ -33,6 +33,9 @@
 #include "vtkObjectFactory.h"
 #include "vtkImageData.h"
 
+class vtkImageJointHistogram;
+class vtkImageVoxelSampler;
+
 class vtkRobartsRegistrationExport vtkImageSMIManipulator : public vtkObject
 {
 public:
@@ -72,6 +75,18 @@ public:
   // Set the translation of input 1 in 3D (mm)
   virtual void SetTranslation(double Translation[3]);
 
+  // Description:
+  // Set/get the number of threads used to accumulate the histograms.
+  virtual void SetNumberOfThreads(int numThreads);
+  int GetNumberOfThreads();
+
+  // Description:
+  // Set/get a sampler to only evaluate the metric over a subset of the
+  // voxels of the extent. The samples are drawn from image 2 by
+  // SetExtent, and are kept until it is called again.
+  virtual void SetSampler(vtkImageVoxelSampler *sampler);
+  vtkImageVoxelSampler *GetSampler();
+
   // Description:
   // Get the absolute difference
   double GetResult();
@@ -104,10 +119,6 @@ protected:
 
   // Globals used to speed up repeated execution:
 
-  // Increments to go through the data (calculate on SetExtent)
-  vtkIdType inc[3];
-  int inc2[2];
-
   // Information about inputs (calculate on SetInput1)
   int inExt[6];
   double inSpa[3];
@@ -116,12 +127,14 @@ protected:
   int loc000[3];
   int loc111[3];
 
-  // Number of voxels in Extent
+  // Number of voxels (or samples) in Extent that were binned
   double count;
 
   // Input data
   vtkImageData *inData[2];
-  void *inPtr[2];
+
+  // Bins image 2 and accumulates the histograms
+  vtkImageJointHistogram *Histogram;
 
 };
 
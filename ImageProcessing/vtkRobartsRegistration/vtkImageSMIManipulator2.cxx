@@ -17,6 +17,9 @@
 =========================================================================*/
 #include "vtkImageSMIManipulator2.h"
 
+#include "vtkImageJointHistogram.h"
+#include "vtkImageVoxelSampler.h"
+
 //-----------------------`---------------------------------------------------
 // The 'floor' function on x86 and mips is many times slower than these
 // and is used a lot in this code, optimize for different CPU architectures
@@ -91,14 +94,22 @@ vtkImageSMIManipulator2::vtkImageSMIManipulator2()
   this->MaxIntensities[0] = 4095;
   this->MaxIntensities[1] = 4095;
   this->Metric = 0;
+  this->HistS = NULL;
+  this->HistT = NULL;
+  this->HistST = NULL;
+  this->Histogram = vtkImageJointHistogram::New();
+  this->Histogram->SetBinNumber(this->BinNumber[0], this->BinNumber[1]);
+  this->Histogram->SetBinningToRound();
+  this->Histogram->ClampOn();
 }
 
 //----------------------------------------------------------------------------
 vtkImageSMIManipulator2::~vtkImageSMIManipulator2()
 {
-  delete this->HistS;
-  delete this->HistT;
-  delete this->HistST;
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
+  this->Histogram->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -106,7 +117,6 @@ void vtkImageSMIManipulator2::SetInput1(vtkImageData *input)
 {
   input->GetSpacing(this->inSpa);
   input->GetExtent(this->inExt);
-  input->GetIncrements(this->inc[0], this->inc[1], this->inc[2]);
   this->inData[0] = input;
 }
 
@@ -147,9 +157,13 @@ void vtkImageSMIManipulator2::SetBinNumber(int numS, int numT)
   this->BinNumber[1] = numT;
   this->BinWidth[0] = (double)this->MaxIntensities[0] / ((double)this->BinNumber[0] - 1.0);
   this->BinWidth[1] = (double)this->MaxIntensities[1] / ((double)this->BinNumber[1] - 1.0);
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
   this->HistS = new long[numS];
   this->HistT = new long[numT];
   this->HistST = new long[numS*numT];
+  this->Histogram->SetBinNumber(numS, numT);
 }
 
 //----------------------------------------------------------------------------
@@ -162,88 +176,61 @@ void vtkImageSMIManipulator2::SetMaxIntensities(int maxS, int maxT)
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageSMIManipulator2EntropyT(vtkImageSMIManipulator2 *self,
-                                     T  *inPtr1, T  *inPtr2, int inc2[2])
+void vtkImageSMIManipulator2::SetNumberOfThreads(int numThreads)
+{
+  this->Histogram->SetNumberOfThreads(numThreads);
+}
+
+//----------------------------------------------------------------------------
+int vtkImageSMIManipulator2::GetNumberOfThreads()
+{
+  return this->Histogram->GetNumberOfThreads();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageSMIManipulator2::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  this->Histogram->SetSampler(sampler);
+}
+
+//----------------------------------------------------------------------------
+vtkImageVoxelSampler *vtkImageSMIManipulator2::GetSampler()
+{
+  return this->Histogram->GetSampler();
+}
+
+//----------------------------------------------------------------------------
+void vtkImageSMIManipulator2::SetExtent(int ext[6])
 {
-  short b;
-  double temp, entropyT = 0, count = 0;
+  memcpy(this->Extent, ext, sizeof(int)*6);
 
-  // Loop over data
-  for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
+  // Bin image 2 once for all translations, and calculate its entropy
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->SetFixedImage(this->inData[1], this->inData[2], this->Extent))
   {
-    for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-    {
-      for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-      {
-        if (*inPtr2)
-        {
-          count++;
-          b = vtkResliceRound(*inPtr1/double(self->BinWidth[1]));
-          if (b < 0)
-          {
-            b = 0;
-          }
-          if (b >= self->BinNumber[1])
-          {
-            b = self->BinNumber[1] - 1;
-          }
-          self->HistT[b]++;
-        }
-        inPtr1++;
-        inPtr2++;
-      }
-      inPtr1 += inc2[0];
-      inPtr2 += inc2[0];
-    }
-    inPtr1 += inc2[1];
-    inPtr2 += inc2[1];
+    vtkErrorMacro( "SetExtent: Images have values outside of the bins.");
+    return;
   }
+  memcpy(this->HistT, this->Histogram->GetFixedHistogram(), this->BinNumber[1]*sizeof(long));
 
+  double temp, entropyT = 0, count = this->Histogram->GetNumberOfSamples();
   if (count)
   {
-    for (int i = 0; i < self->BinNumber[1]; i++)
+    for (int i = 0; i < this->BinNumber[1]; i++)
     {
-      temp = (double)self->HistT[i];
+      temp = (double)this->HistT[i];
       if (temp > 0.0)
       {
         entropyT += temp * log(temp);
       }
     }
 
-    self->entropyT = -entropyT / count + log(count);
+    this->entropyT = -entropyT / count + log(count);
   }
   else
   {
-    cout << "ERROR: No data to work with\n";
-    exit(0);
-  }
-}
-
-//----------------------------------------------------------------------------
-void vtkImageSMIManipulator2::SetExtent(int ext[6])
-{
-  //void *inPtr;
-
-  this->inc2[0] = this->inc[1] - this->inc[0] * (ext[1] - ext[0] + 1);
-  this->inc2[1] = this->inc[2] - this->inc[1] * (ext[3] - ext[2] + 1);
-
-  this->inPtr[0] = this->inData[0]->GetScalarPointerForExtent(ext);
-  this->inPtr[1] = this->inData[1]->GetScalarPointerForExtent(ext);
-  this->inPtr[2] = this->inData[2]->GetScalarPointerForExtent(ext);
-
-  memcpy(this->Extent, ext, sizeof(int)*6);
-
-  memset((void *)this->HistT, 0, this->BinNumber[1]*sizeof(long));
-  // Calculate the entropy of image 2
-  switch (this->inData[1]->GetScalarType())
-  {
-    vtkTemplateMacro(vtkImageSMIManipulator2EntropyT(this,
-                     (VTK_TT *)(this->inPtr[1]), (VTK_TT *)(this->inPtr[2]), this->inc2));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
+    vtkErrorMacro( "SetExtent: No data to work with.");
   }
-
 }
 
 //----------------------------------------------------------------------------
@@ -288,183 +275,94 @@ void vtkImageSMIManipulator2::SetTranslation(double tran[3])
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageSMIManipulator2Execute(vtkImageSMIManipulator2 *self,
-                                    T  *in1Ptr, T *in2Ptr, T *in3Ptr,
-                                    vtkIdType inc[3], int inc2[2], int inExt[6],
-                                    int loc000[3], int loc111[3])
+// The result that indicates complete dissimilarity for each metric
+static double vtkImageSMIManipulator2WorstResult(int metric)
+{
+  if (metric == 0)
+  {
+    return 0.5;  // Lowest NMI
+  }
+  if (metric == 1)
+  {
+    return 0.0;  // Lowest MI
+  }
+  if (metric == 2)
+  {
+    return 1.0;  // Highest ECR
+  }
+  return 0.0;
+}
+
+//----------------------------------------------------------------------------
+double vtkImageSMIManipulator2::GetResult()
 {
-  double V000, V100, V010, V110, V001, V101, V011, V111, Vxyz;
-  double temp, entropyS = 0, entropyST = 0, count = 0;
-  short a, b;
+  double temp, entropyS = 0, entropyST = 0, count = this->Histogram->GetNumberOfSamples();
   int i, j;
 
-  // CASE 1: Check if translation takes us out of the input image, in
-  // which case set the result to indicate complete dissimilarity and stop.
-  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
-       (self->Extent[2] + loc000[1] < inExt[2]) ||
-       (self->Extent[4] + loc000[2] < inExt[4]) ||
-       (self->Extent[1] + loc111[0] > inExt[1]) ||
-       (self->Extent[3] + loc111[1] > inExt[3]) ||
-       (self->Extent[5] + loc111[2] > inExt[5]) )
+  // Check inputs.
+  if (this->inData[0] == NULL)
   {
-    if (self->Metric == 0)
-    {
-      self->Result = 0.5;  // Lowest NMI
-    }
-    if (self->Metric == 1)
-    {
-      self->Result = 0.0;  // Lowest MI
-    }
-    if (self->Metric == 2)
-    {
-      self->Result = 1.0;  // Highest ECR
-    }
-    return;
+    vtkErrorMacro( "Input " << 0 << " must be specified.");
+    return 0;
+  }
+  if (this->inData[1] == NULL)
+  {
+    vtkErrorMacro( "Input " << 1 << " must be specified.");
+    return 0;
+  }
+  if (this->inData[2] == NULL)
+  {
+    vtkErrorMacro( "Mask must be specified.");
+    return 0;
   }
 
-  // CASE 2: Check if no interpolation is necessary.
-  if ( (loc000[0] == 0) && (loc111[0] == 0) &&
-       (loc000[1] == 0) && (loc111[1] == 0) &&
-       (loc000[2] == 0) && (loc111[2] == 0) )
+  if (((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType())) |
+      ((this->inData[0]->GetScalarType() != this->inData[2]->GetScalarType())) )
   {
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          if (*in3Ptr)
-          {
-            count++;
-            a = vtkResliceRound(*in1Ptr/double(self->BinWidth[0]));
-            b = vtkResliceRound(*in2Ptr/double(self->BinWidth[1]));
-            if (a < 0)
-            {
-              a = 0;
-            }
-            if (b < 0)
-            {
-              b = 0;
-            }
-            if (a >= self->BinNumber[0])
-            {
-              a = self->BinNumber[0] - 1;
-            }
-            if (b >= self->BinNumber[1])
-            {
-              b = self->BinNumber[1] - 1;
-            }
-            self->HistS[a]++;
-            self->HistST[b * self->BinNumber[0] + a]++;
-          }
-
-          in1Ptr++;
-          in2Ptr++;
-          in3Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-        in3Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-      in3Ptr += inc2[1];
-    }
+    vtkErrorMacro( "Execute: Inputs must be of the same ScalarType");
+    return 0;
   }
 
-  // CASE 3: If the above two cases don't apply, do the full calculation.
-  else
+  this->Result = 0;
+
+  // Check if translation takes us out of the input image, in
+  // which case set the result to indicate complete dissimilarity and stop.
+  if ( (this->Extent[0] + this->loc000[0] < this->inExt[0]) ||
+       (this->Extent[2] + this->loc000[1] < this->inExt[2]) ||
+       (this->Extent[4] + this->loc000[2] < this->inExt[4]) ||
+       (this->Extent[1] + this->loc111[0] > this->inExt[1]) ||
+       (this->Extent[3] + this->loc111[1] > this->inExt[3]) ||
+       (this->Extent[5] + this->loc111[2] > this->inExt[5]) )
   {
-    in1Ptr += inc[2] * loc000[2] + inc[1] * loc000[1] + inc[0] * loc000[0];
+    this->Result = vtkImageSMIManipulator2WorstResult(this->Metric);
+    return this->Result;
+  }
 
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        // Initiate previous data
-        V000 = *in1Ptr;
-        in1Ptr += inc[1];
-        V010 = *in1Ptr;
-        in1Ptr += inc[2];
-        V011 = *in1Ptr;
-        in1Ptr -= inc[1];
-        V001 = *in1Ptr;
-        in1Ptr -= inc[2];
-
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          in1Ptr++;
-          V100 = *in1Ptr;
-          in1Ptr += inc[1];
-          V110 = *in1Ptr;
-          in1Ptr += inc[2];
-          V111 = *in1Ptr;
-          in1Ptr -= inc[1];
-          V101 = *in1Ptr;
-          in1Ptr -= inc[2];
-
-          Vxyz = (V000 * self->F000 + V100 * self->F100 +
-                  V010 * self->F010 + V110 * self->F110 +
-                  V001 * self->F001 + V101 * self->F101 +
-                  V011 * self->F011 + V111 * self->F111);
-
-          V000 = V100;
-          V010 = V110;
-          V001 = V101;
-          V011 = V111;
-
-          if (*in3Ptr)
-          {
-            count++;
-            a = vtkResliceRound(Vxyz/double(self->BinWidth[0]));
-            b = vtkResliceRound(*in2Ptr/double(self->BinWidth[1]));
-            if (a < 0)
-            {
-              a = 0;
-            }
-            if (b < 0)
-            {
-              b = 0;
-            }
-            if (a >= self->BinNumber[0])
-            {
-              a = self->BinNumber[0] - 1;
-            }
-            if (b >= self->BinNumber[1])
-            {
-              b = self->BinNumber[1] - 1;
-            }
-            self->HistS[a]++;
-            self->HistST[b * self->BinNumber[0] + a]++;
-          }
-
-          in2Ptr++;
-          in3Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-        in3Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-      in3Ptr += inc2[1];
-    }
+  // Accumulate the histograms, interpolating image 1
+  double F[8] = { this->F000, this->F100, this->F010, this->F110,
+                  this->F001, this->F101, this->F011, this->F111 };
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->ComputeJointHistogram(this->inData[0], this->loc000, this->loc111,
+                                              F, this->HistS, this->HistST))
+  {
+    vtkErrorMacro( "GetResult: Images have values outside of the bins.");
+    this->Result = vtkImageSMIManipulator2WorstResult(this->Metric);
+    return this->Result;
   }
 
   // Loop over S and ST histograms.
   if (count)
   {
-    for (i = 0; i < self->BinNumber[0]; i++)
+    for (i = 0; i < this->BinNumber[0]; i++)
     {
-      temp = (double)self->HistS[i];
+      temp = (double)this->HistS[i];
       if (temp > 0.0)
       {
         entropyS += temp * log(temp);
       }
-      for (j = 0; j < self->BinNumber[1]; j++)
+      for (j = 0; j < this->BinNumber[1]; j++)
       {
-        temp = (double)self->HistST[j * self->BinNumber[0] + i];
+        temp = (double)this->HistST[j * this->BinNumber[0] + i];
         if (temp > 0.0)
         {
           entropyST += temp * log(temp);
@@ -477,95 +375,50 @@ void vtkImageSMIManipulator2Execute(vtkImageSMIManipulator2 *self,
     entropyST = -entropyST/count + log(count);
 
     // Normalized Mutual Information
-    if (self->Metric == 0)
+    if (this->Metric == 0)
     {
       if (entropyST == 0)
       {
-        self->Result = 1.0;
+        this->Result = 1.0;
       }
       else
       {
-        self->Result = (entropyS + self->entropyT)/entropyST/2.0;
+        this->Result = (entropyS + this->entropyT)/entropyST/2.0;
       }
     }
 
     // Mutual Informaiton
-    else if (self->Metric == 1)
+    else if (this->Metric == 1)
     {
-      self->Result = entropyS + self->entropyT - entropyST;
+      this->Result = entropyS + this->entropyT - entropyST;
     }
 
     // Entropy Correlaiton Coefficient
-    else if (self->Metric == 2)
+    else if (this->Metric == 2)
     {
-      if (entropyS + self->entropyT == 0)
+      if (entropyS + this->entropyT == 0)
       {
-        self->Result = 0.0;
+        this->Result = 0.0;
       }
       else
       {
-        self->Result = sqrt ( 2.0 * (1.0 - entropyST / ( self->entropyT + entropyS ) ) );
+        this->Result = sqrt ( 2.0 * (1.0 - entropyST / ( this->entropyT + entropyS ) ) );
       }
     }
 
     // Error
     else
     {
-      cout << "ERROR: Wrong Metric chosen\n";
-      exit(0);
+      vtkErrorMacro( "GetResult: Wrong Metric chosen.");
     }
   }
   else
   {
-    cout << "ERROR: No data to work with\n";
-    exit(0);
+    vtkErrorMacro( "GetResult: No data to work with.");
+    this->Result = vtkImageSMIManipulator2WorstResult(this->Metric);
   }
-}
 
-//----------------------------------------------------------------------------
-double vtkImageSMIManipulator2::GetResult()
-{
-  // Check inputs.
-  if (this->inData[0] == NULL)
-  {
-    vtkErrorMacro( "Input " << 0 << " must be specified.");
-    return 0;
-  }
-  if (this->inData[1] == NULL)
-  {
-    vtkErrorMacro( "Input " << 1 << " must be specified.");
-    return 0;
-  }
-  if (this->inData[2] == NULL)
-  {
-    vtkErrorMacro( "Mask must be specified.");
-    return 0;
-  }
-
-  if (((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType())) |
-      ((this->inData[0]->GetScalarType() != this->inData[2]->GetScalarType())) )
-  {
-    vtkErrorMacro( "Execute: Inputs must be of the same ScalarType");
-    return 0;
-  }
-
-  // Zero the histograms and result.
-  memset((void *)this->HistS, 0, this->BinNumber[0]*sizeof(long));
-  memset((void *)this->HistST, 0, this->BinNumber[0]*this->BinNumber[1]*sizeof(long));
-  this->Result = 0;
-
-  // Calculate and return SMI result.
-  switch (this->inData[0]->GetScalarType())
-  {
-    vtkTemplateMacro(vtkImageSMIManipulator2Execute(this,
-                     (VTK_TT *)(this->inPtr[0]), (VTK_TT *)(this->inPtr[1]), (VTK_TT *)(this->inPtr[2]),
-                     this->inc, this->inc2, this->inExt,
-                     this->loc000, this->loc111));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
-  }
   return this->Result;
-
 }
 
 //----------------------------------------------------------------------------
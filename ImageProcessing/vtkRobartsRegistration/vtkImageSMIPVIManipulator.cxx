@@ -17,6 +17,9 @@
 =========================================================================*/
 #include "vtkImageSMIPVIManipulator.h"
 
+#include "vtkImageJointHistogram.h"
+#include "vtkImageVoxelSampler.h"
+
 //--------------------------------------------------------------------------
 // The 'floor' function on x86 and mips is many times slower than these
 // and is used a lot in this code, optimize for different CPU architectures
@@ -91,14 +94,23 @@ vtkImageSMIPVIManipulator::vtkImageSMIPVIManipulator()
   this->MaxIntensities[0] = 4095;
   this->MaxIntensities[1] = 4095;
   this->Metric = 0;
+  this->HistS = NULL;
+  this->HistT = NULL;
+  this->HistST = NULL;
+  this->Histogram = vtkImageJointHistogram::New();
+  this->Histogram->SetBinNumber(this->BinNumber[0], this->BinNumber[1]);
+  this->Histogram->SetBinningToRound();
+  this->Histogram->ClampOn();
+  this->Histogram->PartialVolumeOn();
 }
 
 //----------------------------------------------------------------------------
 vtkImageSMIPVIManipulator::~vtkImageSMIPVIManipulator()
 {
-  delete this->HistS;
-  delete this->HistT;
-  delete this->HistST;
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
+  this->Histogram->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -106,7 +118,6 @@ void vtkImageSMIPVIManipulator::SetInput1(vtkImageData *input)
 {
   input->GetSpacing(this->inSpa);
   input->GetExtent(this->inExt);
-  input->GetIncrements(this->inc[0], this->inc[1], this->inc[2]);
   this->inData[0] = input;
 }
 
@@ -135,24 +146,13 @@ void vtkImageSMIPVIManipulator::SetBinNumber(int numS, int numT)
   this->BinNumber[1] = numT;
   this->BinWidth[0] = (double)this->MaxIntensities[0] / ((double)this->BinNumber[0] - 1.0);
   this->BinWidth[1] = (double)this->MaxIntensities[1] / ((double)this->BinNumber[1] - 1.0);
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
   this->HistS = new double[numS];
   this->HistT = new double[numT];
   this->HistST = new double[numS*numT];
-
-  vtkImageShiftScale* scale0 = vtkImageShiftScale::New();
-  scale0->SetInputData(this->inData[0]);
-  scale0->SetShift(0.5*this->BinWidth[0]); // Shift to round not floor
-  scale0->SetScale(1.0/this->BinWidth[0]);
-  scale0->Update();
-  this->inDataScl[0] = scale0->GetOutput();
-  inDataScl[0]->GetIncrements(this->inc[0], this->inc[1], this->inc[2]);
-
-  vtkImageShiftScale* scale1 = vtkImageShiftScale::New();
-  scale1->SetInputData(this->inData[1]);
-  scale1->SetShift(0.5*this->BinWidth[1]); // Shift to round not floor
-  scale1->SetScale(1.0/this->BinWidth[1]);
-  scale1->Update();
-  this->inDataScl[1] = scale1->GetOutput();
+  this->Histogram->SetBinNumber(numS, numT);
 }
 
 //----------------------------------------------------------------------------
@@ -162,85 +162,66 @@ void vtkImageSMIPVIManipulator::SetMaxIntensities(int maxS, int maxT)
   this->MaxIntensities[1] = maxT;
   this->BinWidth[0] = (double)this->MaxIntensities[0] / ((double)this->BinNumber[0] - 1.0);
   this->BinWidth[1] = (double)this->MaxIntensities[1] / ((double)this->BinNumber[1] - 1.0);
-
-  vtkImageShiftScale* scale0 = vtkImageShiftScale::New();
-  scale0->SetInputData(this->inData[0]);
-  scale0->SetShift(0.5*this->BinWidth[0]); // Shift to round not floor
-  scale0->SetScale(1.0/this->BinWidth[0]);
-  scale0->Update();
-  this->inDataScl[0] = scale0->GetOutput();
-  inDataScl[0]->GetIncrements(this->inc[0], this->inc[1], this->inc[2]);
-
-  vtkImageShiftScale* scale1 = vtkImageShiftScale::New();
-  scale1->SetInputData(this->inData[1]);
-  scale1->SetShift(0.5*this->BinWidth[1]); // Shift to round not floor
-  scale1->SetScale(1.0/this->BinWidth[1]);
-  scale1->Update();
-  this->inDataScl[1] = scale1->GetOutput();
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageSMIPVIManipulatorEntropyT(vtkImageSMIPVIManipulator *self,
-                                       T  *inPtr, int inc2[2], double count)
+void vtkImageSMIPVIManipulator::SetNumberOfThreads(int numThreads)
 {
-  short b;
-  double temp, entropyT = 0;
+  this->Histogram->SetNumberOfThreads(numThreads);
+}
 
-  // Loop over data
-  for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-  {
-    for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-    {
-      for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-      {
-        b = (short)*inPtr;
-        self->HistT[b]++;
-        inPtr++;
-      }
-      inPtr += inc2[0];
-    }
-    inPtr += inc2[1];
-  }
+//----------------------------------------------------------------------------
+int vtkImageSMIPVIManipulator::GetNumberOfThreads()
+{
+  return this->Histogram->GetNumberOfThreads();
+}
 
-  for (int i = 0; i < self->BinNumber[1]; i++)
-  {
-    temp = self->HistT[i];
-    if (temp > 0.0)
-    {
-      entropyT += temp * log(temp);
-    }
-  }
+//----------------------------------------------------------------------------
+void vtkImageSMIPVIManipulator::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  this->Histogram->SetSampler(sampler);
+}
 
-  self->entropyT = -entropyT / count + log(count);
+//----------------------------------------------------------------------------
+vtkImageVoxelSampler *vtkImageSMIPVIManipulator::GetSampler()
+{
+  return this->Histogram->GetSampler();
 }
 
 //----------------------------------------------------------------------------
 void vtkImageSMIPVIManipulator::SetExtent(int ext[6])
 {
-  this->inc2[0] = this->inc[1] - this->inc[0] * (ext[1] - ext[0] + 1);
-  this->inc2[1] = this->inc[2] - this->inc[1] * (ext[3] - ext[2] + 1);
-
-  this->inPtr[0] = this->inDataScl[0]->GetScalarPointerForExtent(ext);
-  this->inPtr[1] = this->inDataScl[1]->GetScalarPointerForExtent(ext);
+  memcpy(this->Extent, ext, sizeof(int)*6);
 
-  this->count = (ext[1]-ext[0]+1) * (ext[3]-ext[2]+1) * (ext[5]-ext[4]+1);
+  // Bin image 2 once for all translations, and calculate its entropy
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->SetFixedImage(this->inData[1], NULL, this->Extent))
+  {
+    vtkErrorMacro( "SetExtent: Images have values outside of the bins.");
+    return;
+  }
+  this->count = this->Histogram->GetNumberOfSamples();
   if (this->count == 0)
   {
     vtkErrorMacro( "GetResult: No data to work with.");
   }
+  const long *fixedHist = this->Histogram->GetFixedHistogram();
+  for (int i = 0; i < this->BinNumber[1]; i++)
+  {
+    this->HistT[i] = fixedHist[i];
+  }
 
-  memcpy(this->Extent, ext, sizeof(int)*6);
-
-  memset((void *)this->HistT, 0, this->BinNumber[1]*sizeof(double));
-  // Calculate the entropy of image 2
-  switch (this->inDataScl[1]->GetScalarType())
+  double temp, entropyT = 0, count = this->count;
+  for (int i = 0; i < this->BinNumber[1]; i++)
   {
-    vtkTemplateMacro(vtkImageSMIPVIManipulatorEntropyT(this,
-                     (VTK_TT *)(this->inPtr[1]), this->inc2, this->count));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
+    temp = this->HistT[i];
+    if (temp > 0.0)
+    {
+      entropyT += temp * log(temp);
+    }
   }
+
+  this->entropyT = -entropyT / count + log(count);
 }
 
 //----------------------------------------------------------------------------
@@ -284,122 +265,62 @@ void vtkImageSMIPVIManipulator::SetTranslation(double tran[3])
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageSMIPVIManipulatorExecute(vtkImageSMIPVIManipulator *self,
-                                      T  *in1Ptr, T *in2Ptr,
-                                      vtkIdType inc[3], int inc2[2], int inExt[6],
-                                      int loc000[3], int loc111[3], double count)
+double vtkImageSMIPVIManipulator::GetResult()
 {
-  short V000, V100, V010, V110, V001, V101, V011, V111;
-  double temp1, temp2, entropyS = 0, entropyST = 0;
-  short a, b;
+  double temp1, temp2, entropyS = 0, entropyST = 0, count = this->count;
   int i, j;
 
-  // CASE 1: Check if translation takes us out of the input image, in
-  // which case set the result to indicate complete dissimilarity and stop.
-  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
-       (self->Extent[2] + loc000[1] < inExt[2]) ||
-       (self->Extent[4] + loc000[2] < inExt[4]) ||
-       (self->Extent[1] + loc111[0] > inExt[1]) ||
-       (self->Extent[3] + loc111[1] > inExt[3]) ||
-       (self->Extent[5] + loc111[2] > inExt[5]) )
+  // Check inputs.
+  if (this->inData[0] == NULL)
   {
-    self->Result = 0.5;
-    return;
+    vtkErrorMacro( "Input " << 0 << " must be specified.");
+    return 0;
   }
-
-  // CASE 2: Check if no interpolation is necessary.
-  if ( (loc000[0] == 0) && (loc111[0] == 0) &&
-       (loc000[1] == 0) && (loc111[1] == 0) &&
-       (loc000[2] == 0) && (loc111[2] == 0) )
+  if (this->inData[1] == NULL)
   {
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          a = (short)*in1Ptr;
-          b = (short)*in2Ptr;
-
-          self->HistS[a]++;
-          self->HistST[b * self->BinNumber[0] + a]++;
-
-          in1Ptr++;
-          in2Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-    }
+    vtkErrorMacro( "Input " << 1 << " must be specified.");
+    return 0;
+  }
+  if ((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType()))
+  {
+    vtkErrorMacro( "Execute: Inputs must be of the same ScalarType");
+    return 0;
   }
 
-  // CASE 3: If the above two cases don't apply, do the full calculation.
-  else
+  this->Result = 0;
+
+  // Check if translation takes us out of the input image, in
+  // which case set the result to indicate complete dissimilarity and stop.
+  if ( (this->Extent[0] + this->loc000[0] < this->inExt[0]) ||
+       (this->Extent[2] + this->loc000[1] < this->inExt[2]) ||
+       (this->Extent[4] + this->loc000[2] < this->inExt[4]) ||
+       (this->Extent[1] + this->loc111[0] > this->inExt[1]) ||
+       (this->Extent[3] + this->loc111[1] > this->inExt[3]) ||
+       (this->Extent[5] + this->loc111[2] > this->inExt[5]) )
   {
-    in1Ptr += inc[2] * loc000[2] + inc[1] * loc000[1] + inc[0] * loc000[0];
+    this->Result = 0.5;
+    return this->Result;
+  }
 
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        // Initiate previous data
-        V000 = (short)*in1Ptr;
-        in1Ptr += inc[1];
-        V010 = (short)*in1Ptr;
-        in1Ptr += inc[2];
-        V011 = (short)*in1Ptr;
-        in1Ptr -= inc[1];
-        V001 = (short)*in1Ptr;
-        in1Ptr -= inc[2];
-
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          in1Ptr++;
-          V100 = (short)*in1Ptr;
-          in1Ptr += inc[1];
-          V110 = (short)*in1Ptr;
-          in1Ptr += inc[2];
-          V111 = (short)*in1Ptr;
-          in1Ptr -= inc[1];
-          V101 = (short)*in1Ptr;
-          in1Ptr -= inc[2];
-
-          b = (short)*in2Ptr * self->BinNumber[0];
-
-          self->HistST[b + V000] +=  self->F000;
-          self->HistST[b + V100] +=  self->F100;
-          self->HistST[b + V010] +=  self->F010;
-          self->HistST[b + V110] +=  self->F110;
-          self->HistST[b + V001] +=  self->F001;
-          self->HistST[b + V101] +=  self->F101;
-          self->HistST[b + V011] +=  self->F011;
-          self->HistST[b + V111] +=  self->F111;
-
-          V000 = V100;
-          V010 = V110;
-          V001 = V101;
-          V011 = V111;
-
-          in2Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-    }
+  // Accumulate the histograms, interpolating image 1
+  double F[8] = { this->F000, this->F100, this->F010, this->F110,
+                  this->F001, this->F101, this->F011, this->F111 };
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->ComputeJointHistogram(this->inData[0], this->loc000, this->loc111,
+                                              F, this->HistS, this->HistST))
+  {
+    vtkErrorMacro( "GetResult: Images have values outside of the bins.");
+    this->Result = 0.5;
+    return this->Result;
   }
 
   // Loop over S and ST histograms.
-  for (i = 0; i < self->BinNumber[0]; i++)
+  for (i = 0; i < this->BinNumber[0]; i++)
   {
     temp2 = 0.0;
-    for (j = 0; j < self->BinNumber[1]; j++)
+    for (j = 0; j < this->BinNumber[1]; j++)
     {
-      temp1 = self->HistST[j * self->BinNumber[0] + i];
+      temp1 = this->HistST[j * this->BinNumber[0] + i];
       temp2 += temp1;
       if (temp1 > 0.0)
       {
@@ -417,80 +338,43 @@ void vtkImageSMIPVIManipulatorExecute(vtkImageSMIPVIManipulator *self,
   entropyST = -entropyST/count + log(count);
 
   // Normalized Mutual Information
-  if (self->Metric == 0)
+  if (this->Metric == 0)
   {
     if (entropyST == 0)
     {
-      self->Result = 1.0;
+      this->Result = 1.0;
     }
     else
     {
-      self->Result = (entropyS + self->entropyT)/entropyST/2.0;
+      this->Result = (entropyS + this->entropyT)/entropyST/2.0;
     }
   }
 
   // Mutual Information
-  else if (self->Metric == 1)
+  else if (this->Metric == 1)
   {
-    self->Result = entropyS + self->entropyT - entropyST;
+    this->Result = entropyS + this->entropyT - entropyST;
   }
 
   // Entropy Correlation Coefficient
-  else if (self->Metric == 2)
+  else if (this->Metric == 2)
   {
-    if (entropyS + self->entropyT == 0)
+    if (entropyS + this->entropyT == 0)
     {
-      self->Result = 0.0;
+      this->Result = 0.0;
     }
     else
     {
-      self->Result = sqrt ( 2.0 * (1.0 - entropyST / ( self->entropyT + entropyS ) ) );
+      this->Result = sqrt ( 2.0 * (1.0 - entropyST / ( this->entropyT + entropyS ) ) );
     }
   }
 
   // Error
   else
   {
-    cout << "ERROR: Wrong Metric chosen\n";
-    exit(0);
-  }
-}
-
-//----------------------------------------------------------------------------
-double vtkImageSMIPVIManipulator::GetResult()
-{
-  // Check inputs.
-  if (this->inData[0] == NULL)
-  {
-    vtkErrorMacro( "Input " << 0 << " must be specified.");
-    return 0;
+    vtkErrorMacro( "GetResult: Wrong Metric chosen.");
   }
-  if (this->inData[1] == NULL)
-  {
-    vtkErrorMacro( "Input " << 1 << " must be specified.");
-    return 0;
-  }
-  if ((this->inData[0]->GetScalarType() != this->inData[1]->GetScalarType()))
-  {
-    vtkErrorMacro( "Execute: Inputs must be of the same ScalarType");
-    return 0;
-  }
-
-  // Zero the histograms and result.
-  memset((void *)this->HistS, 0, this->BinNumber[0]*sizeof(double));
-  memset((void *)this->HistST, 0, this->BinNumber[0]*this->BinNumber[1]*sizeof(double));
-  this->Result = 0;
 
-  // Calculate and return SMIPVI result.
-  switch (this->inDataScl[0]->GetScalarType())
-  {
-    vtkTemplateMacro(vtkImageSMIPVIManipulatorExecute(this,
-                     (VTK_TT *)(this->inPtr[0]), (VTK_TT *)(this->inPtr[1]),
-                     this->inc, this->inc2, this->inExt,
-                     this->loc000, this->loc111, this->count));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
-  }
   return this->Result;
 }
 
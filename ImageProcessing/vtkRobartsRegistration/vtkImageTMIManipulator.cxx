@@ -17,6 +17,9 @@
 =========================================================================*/
 #include "vtkImageTMIManipulator.h"
 
+#include "vtkImageJointHistogram.h"
+#include "vtkImageVoxelSampler.h"
+
 //--------------------------------------------------------------------------
 // The 'floor' function on x86 and mips is many times slower than these
 // and is used a lot in this code, optimize for different CPU architectures
@@ -91,14 +94,22 @@ vtkImageTMIManipulator::vtkImageTMIManipulator()
   this->MaxIntensities[0] = 4095;
   this->MaxIntensities[1] = 4095;
   this->qValue = 0.5;
+  this->HistS = NULL;
+  this->HistT = NULL;
+  this->HistST = NULL;
+  this->Histogram = vtkImageJointHistogram::New();
+  this->Histogram->SetBinNumber(this->BinNumber[0], this->BinNumber[1]);
+  this->Histogram->SetBinningToRound();
+  this->Histogram->ClampOn();
 }
 
 //----------------------------------------------------------------------------
 vtkImageTMIManipulator::~vtkImageTMIManipulator()
 {
-  delete this->HistS;
-  delete this->HistT;
-  delete this->HistST;
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
+  this->Histogram->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -106,7 +117,6 @@ void vtkImageTMIManipulator::SetInput1(vtkImageData *input)
 {
   input->GetSpacing(this->inSpa);
   input->GetExtent(this->inExt);
-  input->GetIncrements(this->inc[0], this->inc[1], this->inc[2]);
   this->inData[0] = input;
 }
 
@@ -135,9 +145,13 @@ void vtkImageTMIManipulator::SetBinNumber(int numS, int numT)
   this->BinNumber[1] = numT;
   this->BinWidth[0] = (double)this->MaxIntensities[0] / ((double)this->BinNumber[0] - 1.0);
   this->BinWidth[1] = (double)this->MaxIntensities[1] / ((double)this->BinNumber[1] - 1.0);
+  delete [] this->HistS;
+  delete [] this->HistT;
+  delete [] this->HistST;
   this->HistS = new long[numS];
   this->HistT = new long[numT];
   this->HistST = new long[numS*numT];
+  this->Histogram->SetBinNumber(numS, numT);
 }
 
 //----------------------------------------------------------------------------
@@ -150,73 +164,61 @@ void vtkImageTMIManipulator::SetMaxIntensities(int maxS, int maxT)
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageTMIManipulatorEntropyT(vtkImageTMIManipulator *self,
-                                    T  *inPtr, int inc2[2], double count)
+void vtkImageTMIManipulator::SetNumberOfThreads(int numThreads)
 {
-  short b;
-  double temp, entropyT = 0;
+  this->Histogram->SetNumberOfThreads(numThreads);
+}
 
-  // Loop over data
-  for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-  {
-    for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-    {
-      for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-      {
-        b = vtkResliceRound(*inPtr/double(self->BinWidth[1]));
-        self->HistT[b]++;
-        inPtr++;
-      }
-      inPtr += inc2[0];
-    }
-    inPtr += inc2[1];
-  }
+//----------------------------------------------------------------------------
+int vtkImageTMIManipulator::GetNumberOfThreads()
+{
+  return this->Histogram->GetNumberOfThreads();
+}
 
-  for (int i = 0; i < self->BinNumber[1]; i++)
-  {
-    temp = (double)self->HistT[i];
-    entropyT += pow(temp,self->qValue);
-  }
+//----------------------------------------------------------------------------
+void vtkImageTMIManipulator::SetSampler(vtkImageVoxelSampler *sampler)
+{
+  this->Histogram->SetSampler(sampler);
+}
 
-  self->entropyT = ( 1.0 / (1.0 - self->qValue) * (entropyT / pow(count,self->qValue) - 1) );
+//----------------------------------------------------------------------------
+vtkImageVoxelSampler *vtkImageTMIManipulator::GetSampler()
+{
+  return this->Histogram->GetSampler();
 }
 
 //----------------------------------------------------------------------------
 void vtkImageTMIManipulator::SetExtent(int ext[6])
 {
-  void *inPtr;
-
   if ( this->qValue == 1.0 )
   {
     vtkErrorMacro( "qValue cannot be 1.0");
   }
 
-  this->inc2[0] = this->inc[1] - this->inc[0] * (ext[1] - ext[0] + 1);
-  this->inc2[1] = this->inc[2] - this->inc[1] * (ext[3] - ext[2] + 1);
-
-  this->inPtr[0] = this->inData[0]->GetScalarPointerForExtent(ext);
-  this->inPtr[1] = this->inData[1]->GetScalarPointerForExtent(ext);
-  inPtr = this->inData[1]->GetScalarPointerForExtent(ext);
+  memcpy(this->Extent, ext, sizeof(int)*6);
 
-  this->count = (ext[1]-ext[0]+1) * (ext[3]-ext[2]+1) * (ext[5]-ext[4]+1);
+  // Bin image 2 once for all translations, and calculate its entropy
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->SetFixedImage(this->inData[1], NULL, this->Extent))
+  {
+    vtkErrorMacro( "SetExtent: Images have values outside of the bins.");
+    return;
+  }
+  this->count = this->Histogram->GetNumberOfSamples();
   if (this->count == 0)
   {
     vtkErrorMacro( "GetResult: No data to work with.");
   }
+  memcpy(this->HistT, this->Histogram->GetFixedHistogram(), this->BinNumber[1]*sizeof(long));
 
-  memcpy(this->Extent, ext, sizeof(int)*6);
-
-  // Calculate the entropy of image 2
-  memset((void *)this->HistT, 0, this->BinNumber[1]*sizeof(long));
-  switch (this->inData[1]->GetScalarType())
+  double temp, entropyT = 0, count = this->count;
+  for (int i = 0; i < this->BinNumber[1]; i++)
   {
-    vtkTemplateMacro(vtkImageTMIManipulatorEntropyT(this,
-                     (VTK_TT *)(inPtr), this->inc2, this->count));
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
+    temp = (double)this->HistT[i];
+    entropyT += pow(temp,this->qValue);
   }
 
+  this->entropyT = ( 1.0 / (1.0 - this->qValue) * (entropyT / pow(count,this->qValue) - 1) );
 }
 
 //----------------------------------------------------------------------------
@@ -260,137 +262,11 @@ void vtkImageTMIManipulator::SetTranslation(double tran[3])
 }
 
 //----------------------------------------------------------------------------
-template <class T>
-void vtkImageTMIManipulatorExecute(vtkImageTMIManipulator *self,
-                                   T  *in1Ptr, T *in2Ptr,
-                                   vtkIdType inc[3], int inc2[2], int inExt[6],
-                                   int loc000[3], int loc111[3], double count)
+double vtkImageTMIManipulator::GetResult()
 {
-  double V000, V100, V010, V110, V001, V101, V011, V111, Vxyz;
-  double temp, entropyS = 0, entropyST = 0;
-  short a, b;
+  double temp, entropyS = 0, entropyST = 0, count = this->count;
   int i, j;
 
-  // CASE 1: Check if translation takes us out of the input image, in
-  // which case set the result to indicate complete disimilarity and stop.
-  if ( (self->Extent[0] + loc000[0] < inExt[0]) ||
-       (self->Extent[2] + loc000[1] < inExt[2]) ||
-       (self->Extent[4] + loc000[2] < inExt[4]) ||
-       (self->Extent[1] + loc111[0] > inExt[1]) ||
-       (self->Extent[3] + loc111[1] > inExt[3]) ||
-       (self->Extent[5] + loc111[2] > inExt[5]) )
-  {
-    self->Result = 0.0;
-    return;
-  }
-
-  // CASE 2: Check if no interpolation is neccessary.
-  if ( (loc000[0] == 0) && (loc111[0] == 0) &&
-       (loc000[1] == 0) && (loc111[1] == 0) &&
-       (loc000[2] == 0) && (loc111[2] == 0) )
-  {
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          a = vtkResliceRound(*in1Ptr/double(self->BinWidth[0]));
-          b = vtkResliceRound(*in2Ptr/double(self->BinWidth[1]));
-
-          self->HistS[a]++;
-          self->HistST[b * self->BinNumber[0] + a]++;
-
-          in1Ptr++;
-          in2Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-    }
-  }
-
-  // CASE 3: If the above two cases don't apply, do the full calculation.
-  else
-  {
-    in1Ptr += inc[2] * loc000[2] + inc[1] * loc000[1] + inc[0] * loc000[0];
-
-    for (int idZ = self->Extent[4]; idZ <= self->Extent[5]; idZ++)
-    {
-      for (int idY = self->Extent[2]; idY <= self->Extent[3]; idY++)
-      {
-        // Initiate previous data
-        V000 = *in1Ptr;
-        in1Ptr += inc[1];
-        V010 = *in1Ptr;
-        in1Ptr += inc[2];
-        V011 = *in1Ptr;
-        in1Ptr -= inc[1];
-        V001 = *in1Ptr;
-        in1Ptr -= inc[2];
-
-        for (int idX = self->Extent[0]; idX <= self->Extent[1]; idX++)
-        {
-          in1Ptr++;
-          V100 = *in1Ptr;
-          in1Ptr += inc[1];
-          V110 = *in1Ptr;
-          in1Ptr += inc[2];
-          V111 = *in1Ptr;
-          in1Ptr -= inc[1];
-          V101 = *in1Ptr;
-          in1Ptr -= inc[2];
-
-          Vxyz = (V000 * self->F000 + V100 * self->F100 +
-                  V010 * self->F010 + V110 * self->F110 +
-                  V001 * self->F001 + V101 * self->F101 +
-                  V011 * self->F011 + V111 * self->F111);
-
-          V000 = V100;
-          V010 = V110;
-          V001 = V101;
-          V011 = V111;
-
-          a = vtkResliceRound(Vxyz/double(self->BinWidth[0]));
-          b = vtkResliceRound(*in2Ptr/double(self->BinWidth[1]));
-
-          self->HistS[a]++;
-          self->HistST[b * self->BinNumber[0] + a]++;
-
-          in2Ptr++;
-        }
-        in1Ptr += inc2[0];
-        in2Ptr += inc2[0];
-      }
-      in1Ptr += inc2[1];
-      in2Ptr += inc2[1];
-    }
-  }
-
-  // Loop over S and ST histograms.
-  for (i = 0; i < self->BinNumber[0]; i++)
-  {
-    temp = (double)self->HistS[i];
-    entropyS += pow(temp,self->qValue);
-    for (j = 0; j < self->BinNumber[1]; j++)
-    {
-      temp = (double)self->HistST[j * self->BinNumber[0] + i];
-      entropyST += pow(temp,self->qValue);
-    }
-  }
-
-  // Calculate entropies and the TMI
-  entropyS = ( 1.0 / (1.0 - self->qValue) * (entropyS / pow(count,self->qValue) - 1) );
-  entropyST = ( 1.0 / (1.0 - self->qValue) * (entropyST / pow(count,self->qValue) - 1) );
-
-  self->Result = entropyS+self->entropyT+(1-self->qValue)*entropyS*self->entropyT-entropyST;
-}
-
-//----------------------------------------------------------------------------
-double vtkImageTMIManipulator::GetResult()
-{
   // Check inputs.
   if (this->inData[0] == NULL)
   {
@@ -409,24 +285,52 @@ double vtkImageTMIManipulator::GetResult()
     vtkErrorMacro( "qValue cannot be 1.0");
   }
 
-  // Zero the histograms and result.
-  memset((void *)this->HistS, 0, this->BinNumber[0]*sizeof(long));
-  memset((void *)this->HistST, 0, this->BinNumber[0]*this->BinNumber[1]*sizeof(long));
   this->Result = 0;
 
-  // Calculate and return TMI result.
-  switch (this->inData[0]->GetScalarType())
+  // Check if translation takes us out of the input image, in
+  // which case set the result to indicate complete disimilarity and stop.
+  if ( (this->Extent[0] + this->loc000[0] < this->inExt[0]) ||
+       (this->Extent[2] + this->loc000[1] < this->inExt[2]) ||
+       (this->Extent[4] + this->loc000[2] < this->inExt[4]) ||
+       (this->Extent[1] + this->loc111[0] > this->inExt[1]) ||
+       (this->Extent[3] + this->loc111[1] > this->inExt[3]) ||
+       (this->Extent[5] + this->loc111[2] > this->inExt[5]) )
+  {
+    this->Result = 0.0;
+    return this->Result;
+  }
+
+  // Accumulate the histograms, interpolating image 1
+  double F[8] = { this->F000, this->F100, this->F010, this->F110,
+                  this->F001, this->F101, this->F011, this->F111 };
+  this->Histogram->SetBinWidth(this->BinWidth[0], this->BinWidth[1]);
+  if (!this->Histogram->ComputeJointHistogram(this->inData[0], this->loc000, this->loc111,
+                                              F, this->HistS, this->HistST))
   {
-    vtkTemplateMacro(vtkImageTMIManipulatorExecute(this,
-                     (VTK_TT *)(this->inPtr[0]), (VTK_TT *)(this->inPtr[1]),
-                     this->inc, this->inc2, this->inExt,
-                     this->loc000, this->loc111, this->count)
-                     );
-  default:
-    vtkErrorMacro( "Execute: Unknown ScalarType");
+    vtkErrorMacro( "GetResult: Images have values outside of the bins.");
+    this->Result = 0.0;
+    return this->Result;
   }
-  return this->Result;
 
+  // Loop over S and ST histograms.
+  for (i = 0; i < this->BinNumber[0]; i++)
+  {
+    temp = (double)this->HistS[i];
+    entropyS += pow(temp,this->qValue);
+    for (j = 0; j < this->BinNumber[1]; j++)
+    {
+      temp = (double)this->HistST[j * this->BinNumber[0] + i];
+      entropyST += pow(temp,this->qValue);
+    }
+  }
+
+  // Calculate entropies and the TMI
+  entropyS = ( 1.0 / (1.0 - this->qValue) * (entropyS / pow(count,this->qValue) - 1) );
+  entropyST = ( 1.0 / (1.0 - this->qValue) * (entropyST / pow(count,this->qValue) - 1) );
+
+  this->Result = entropyS+this->entropyT+(1-this->qValue)*entropyS*this->entropyT-entropyST;
+
+  return this->Result;
 }
 
 //----------------------------------------------------------------------------
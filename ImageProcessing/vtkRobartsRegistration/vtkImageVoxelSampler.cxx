@@ -0,0 +1,569 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageVoxelSampler.cxx,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+#include "vtkImageVoxelSampler.h"
+
+#include "vtkImageData.h"
+#include "vtkImageStencilData.h"
+#include "vtkMinimalStandardRandomSequence.h"
+#include "vtkObjectFactory.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+vtkStandardNewMacro(vtkImageVoxelSampler);
+
+//----------------------------------------------------------------------------
+vtkImageVoxelSampler::vtkImageVoxelSampler()
+{
+  this->SamplingMode = VTK_VOXEL_SAMPLING_RANDOM;
+  this->SampleFraction = 0.05;
+  this->RandomSeed = 1;
+  this->Mask = NULL;
+  this->Image = NULL;
+  this->Stencil = NULL;
+  this->ReverseStencil = 0;
+  for (int i = 0; i < 6; i++)
+  {
+    this->Extent[i] = 0;
+  }
+  this->NumberOfCandidates = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkImageVoxelSampler::~vtkImageVoxelSampler()
+{
+  this->SetMask(NULL);
+}
+
+//----------------------------------------------------------------------------
+void vtkImageVoxelSampler::SetMask(vtkImageData *mask)
+{
+  if (mask == this->Mask)
+  {
+    return;
+  }
+  if (this->Mask)
+  {
+    this->Mask->UnRegister(this);
+  }
+  this->Mask = mask;
+  if (this->Mask)
+  {
+    this->Mask->Register(this);
+  }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+const char *vtkImageVoxelSampler::GetSamplingModeAsString()
+{
+  switch (this->SamplingMode)
+  {
+  case VTK_VOXEL_SAMPLING_ALL:
+    return "All";
+  case VTK_VOXEL_SAMPLING_RANDOM:
+    return "Random";
+  case VTK_VOXEL_SAMPLING_STRATIFIED:
+    return "Stratified";
+  case VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED:
+    return "GradientWeighted";
+  }
+  return "Unknown";
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void vtkImageVoxelSamplerMaskRow(const T *maskPtr, vtkIdType inc, int n,
+                                 unsigned char *row)
+{
+  for (int i = 0; i < n; i++, maskPtr += inc)
+  {
+    row[i] &= (*maskPtr != 0);
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkImageVoxelSampler::GetCandidateRow(int y, int z, unsigned char *row)
+{
+  int xMin = this->Extent[0];
+  int xMax = this->Extent[1];
+  int n = xMax - xMin + 1;
+
+  if (this->Stencil)
+  {
+    memset(row, 0, n);
+    int iter = (this->ReverseStencil ? -1 : 0);
+    int r1 = xMin;
+    int r2 = xMax;
+    while (this->Stencil->GetNextExtent(r1, r2, xMin, xMax, y, z, iter))
+    {
+      memset(row + (r1 - xMin), 1, r2 - r1 + 1);
+    }
+  }
+  else
+  {
+    memset(row, 1, n);
+  }
+
+  if (this->Mask)
+  {
+    vtkIdType inc[3];
+    this->Mask->GetIncrements(inc);
+    void *maskPtr = this->Mask->GetScalarPointer(xMin, y, z);
+    switch (this->Mask->GetScalarType())
+    {
+      vtkTemplateMacro(vtkImageVoxelSamplerMaskRow(static_cast<VTK_TT *>(maskPtr),
+                       inc[0], n, row));
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// Compute the gradient magnitude of the image at the candidates of a row,
+// with central differences, or one sided differences at the boundary.
+template <class T>
+void vtkImageVoxelSamplerGradientRow(vtkImageData *image, const T *rowPtr,
+                                     const int extent[6], int y, int z,
+                                     const unsigned char *row, double *weights)
+{
+  int imageExt[6];
+  vtkIdType inc[3];
+  double spacing[3];
+  image->GetExtent(imageExt);
+  image->GetIncrements(inc);
+  image->GetSpacing(spacing);
+
+  int idx[3];
+  idx[1] = y;
+  idx[2] = z;
+  const T *p = rowPtr;
+  for (idx[0] = extent[0]; idx[0] <= extent[1]; idx[0]++, p += inc[0])
+  {
+    double w = 0.0;
+    if (row[idx[0] - extent[0]])
+    {
+      for (int i = 0; i < 3; i++)
+      {
+        vtkIdType lo = (idx[i] > imageExt[2*i] ? inc[i] : 0);
+        vtkIdType hi = (idx[i] < imageExt[2*i+1] ? inc[i] : 0);
+        if (lo || hi)
+        {
+          double d = ((double)p[hi] - (double)p[-lo]) /
+            (((lo != 0) + (hi != 0)) * spacing[i]);
+          w += d*d;
+        }
+      }
+      w = sqrt(w);
+    }
+    weights[idx[0] - extent[0]] = w;
+  }
+}
+
+//----------------------------------------------------------------------------
+static inline double vtkImageVoxelSamplerDraw(vtkMinimalStandardRandomSequence *random)
+{
+  random->Next();
+  return random->GetValue();
+}
+
+//----------------------------------------------------------------------------
+int vtkImageVoxelSampler::SelectSamples()
+{
+  int *ext = this->Extent;
+  this->Points.clear();
+  this->NumberOfCandidates = 0;
+
+  int size[3];
+  vtkIdType numVoxels = 1;
+  for (int i = 0; i < 3; i++)
+  {
+    size[i] = ext[2*i+1] - ext[2*i] + 1;
+    numVoxels *= (size[i] > 0 ? size[i] : 0);
+  }
+  if (numVoxels == 0)
+  {
+    return 1;
+  }
+
+  int mode = this->SamplingMode;
+  double fraction = this->SampleFraction;
+  if (fraction >= 1.0)
+  {
+    mode = VTK_VOXEL_SAMPLING_ALL;
+  }
+
+  std::vector<unsigned char> row(size[0]);
+  std::vector<double> weights;
+  vtkMinimalStandardRandomSequence *random = vtkMinimalStandardRandomSequence::New();
+  random->SetSeed(this->RandomSeed);
+
+  // the number of candidates, and the sum of their weights
+  vtkIdType n = 0;
+  double totalWeight = 0.0;
+  if (mode == VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED)
+  {
+    weights.resize(size[0]);
+  }
+  for (int z = ext[4]; z <= ext[5]; z++)
+  {
+    for (int y = ext[2]; y <= ext[3]; y++)
+    {
+      this->GetCandidateRow(y, z, &row[0]);
+      if (mode == VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED)
+      {
+        void *rowPtr = this->Image->GetScalarPointer(ext[0], y, z);
+        switch (this->Image->GetScalarType())
+        {
+          vtkTemplateMacro(vtkImageVoxelSamplerGradientRow(this->Image,
+                           static_cast<VTK_TT *>(rowPtr), ext, y, z,
+                           &row[0], &weights[0]));
+        default:
+          vtkErrorMacro("Update: Unknown ScalarType");
+          random->Delete();
+          return 0;
+        }
+      }
+      for (int x = 0; x < size[0]; x++)
+      {
+        if (row[x])
+        {
+          n++;
+          if (!weights.empty())
+          {
+            totalWeight += weights[x];
+          }
+        }
+      }
+    }
+  }
+  this->NumberOfCandidates = n;
+
+  vtkIdType m = (vtkIdType)(fraction*n + 0.5);
+  m = ((m > 0 || fraction == 0.0) ? m : 1);
+  m = (m < n ? m : n);
+  if (m == n && mode != VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED)
+  {
+    mode = VTK_VOXEL_SAMPLING_ALL;
+  }
+  if (m == 0)
+  {
+    random->Delete();
+    return 1;
+  }
+
+  if (mode == VTK_VOXEL_SAMPLING_STRATIFIED)
+  {
+    // divide the extent into blocks of nearly equal size, adding one block
+    // at a time along the axis with the longest blocks, for as long as that
+    // brings the number of blocks closer to the number of samples that are
+    // wanted over the whole extent
+    int numBlocks[3] = { 1, 1, 1 };
+    double target = (double)numVoxels*m/n;
+    for (;;)
+    {
+      int axis = -1;
+      for (int i = 0; i < 3; i++)
+      {
+        if (numBlocks[i] < size[i] && (axis < 0 ||
+            (double)size[i]/numBlocks[i] > (double)size[axis]/numBlocks[axis]))
+        {
+          axis = i;
+        }
+      }
+      if (axis < 0)
+      {
+        break;
+      }
+      double blocks = (double)numBlocks[0]*numBlocks[1]*numBlocks[2];
+      double grown = blocks*(numBlocks[axis] + 1)/numBlocks[axis];
+      if (fabs(log(grown/target)) >= fabs(log(blocks/target)))
+      {
+        break;
+      }
+      numBlocks[axis]++;
+    }
+
+    // choose one candidate in each block, uniformly by reservoir sampling
+    vtkIdType totalBlocks = (vtkIdType)numBlocks[0]*numBlocks[1]*numBlocks[2];
+    std::vector<vtkIdType> chosen(totalBlocks, -1);
+    std::vector<vtkIdType> seen(totalBlocks, 0);
+    for (int z = 0; z < size[2]; z++)
+    {
+      for (int y = 0; y < size[1]; y++)
+      {
+        this->GetCandidateRow(y + ext[2], z + ext[4], &row[0]);
+        vtkIdType blockRow = (((vtkIdType)z*numBlocks[2]/size[2])*numBlocks[1] +
+                              (vtkIdType)y*numBlocks[1]/size[1])*numBlocks[0];
+        vtkIdType voxelRow = ((vtkIdType)z*size[1] + y)*size[0];
+        for (int x = 0; x < size[0]; x++)
+        {
+          if (row[x])
+          {
+            vtkIdType k = blockRow + (vtkIdType)x*numBlocks[0]/size[0];
+            if (vtkImageVoxelSamplerDraw(random)*(++seen[k]) < 1.0)
+            {
+              chosen[k] = voxelRow + x;
+            }
+          }
+        }
+      }
+    }
+    std::sort(chosen.begin(), chosen.end());
+    for (vtkIdType k = 0; k < totalBlocks; k++)
+    {
+      vtkIdType l = chosen[k];
+      if (l >= 0)
+      {
+        this->Points.push_back(ext[0] + (int)(l % size[0]));
+        this->Points.push_back(ext[2] + (int)((l / size[0]) % size[1]));
+        this->Points.push_back(ext[4] + (int)(l / ((vtkIdType)size[0]*size[1])));
+      }
+    }
+  }
+  else
+  {
+    // a second pass that keeps all of the candidates, or chooses exactly m
+    // of them uniformly (selection sampling) or with a probability that is
+    // proportional to their weight (systematic sampling)
+    this->Points.reserve(3*m);
+    vtkIdType remaining = n;
+    vtkIdType needed = m;
+    int uniform = (totalWeight <= 0.0);
+    double step = (uniform ? n : totalWeight)/m;
+    double next = vtkImageVoxelSamplerDraw(random)*step;
+    double cumulative = 0.0;
+    for (int z = ext[4]; z <= ext[5] && needed > 0; z++)
+    {
+      for (int y = ext[2]; y <= ext[3] && needed > 0; y++)
+      {
+        this->GetCandidateRow(y, z, &row[0]);
+        if (mode == VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED && !uniform)
+        {
+          void *rowPtr = this->Image->GetScalarPointer(ext[0], y, z);
+          switch (this->Image->GetScalarType())
+          {
+            vtkTemplateMacro(vtkImageVoxelSamplerGradientRow(this->Image,
+                             static_cast<VTK_TT *>(rowPtr), ext, y, z,
+                             &row[0], &weights[0]));
+          }
+        }
+        for (int x = 0; x < size[0] && needed > 0; x++)
+        {
+          if (!row[x])
+          {
+            continue;
+          }
+          int copies = 0;
+          if (mode == VTK_VOXEL_SAMPLING_ALL)
+          {
+            copies = 1;
+          }
+          else if (mode == VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED)
+          {
+            cumulative += (uniform ? 1.0 : weights[x]);
+            while (next < cumulative && copies < needed)
+            {
+              copies++;
+              next += step;
+            }
+          }
+          else
+          {
+            copies = (vtkImageVoxelSamplerDraw(random)*remaining < needed);
+          }
+          remaining--;
+          needed -= (mode == VTK_VOXEL_SAMPLING_ALL ? 0 : copies);
+          for (int c = 0; c < copies; c++)
+          {
+            this->Points.push_back(x + ext[0]);
+            this->Points.push_back(y);
+            this->Points.push_back(z);
+          }
+        }
+      }
+    }
+  }
+
+  random->Delete();
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void vtkImageVoxelSamplerGatherValues(vtkImageData *image, const T *imagePtr,
+                                      const int *points, vtkIdType n,
+                                      double *values)
+{
+  int imageExt[6];
+  vtkIdType inc[3];
+  image->GetExtent(imageExt);
+  image->GetIncrements(inc);
+  for (vtkIdType i = 0; i < n; i++, points += 3)
+  {
+    values[i] = (double)imagePtr[(points[0] - imageExt[0])*inc[0] +
+                                 (points[1] - imageExt[2])*inc[1] +
+                                 (points[2] - imageExt[4])*inc[2]];
+  }
+}
+
+//----------------------------------------------------------------------------
+int vtkImageVoxelSampler::GatherValues()
+{
+  vtkIdType n = (vtkIdType)(this->Points.size()/3);
+  this->Values.resize(n);
+  if (n == 0)
+  {
+    return 1;
+  }
+
+  void *imagePtr = this->Image->GetScalarPointer();
+  switch (this->Image->GetScalarType())
+  {
+    vtkTemplateMacro(vtkImageVoxelSamplerGatherValues(this->Image,
+                     static_cast<VTK_TT *>(imagePtr), &this->Points[0], n,
+                     &this->Values[0]));
+  default:
+    vtkErrorMacro("Update: Unknown ScalarType");
+    this->Values.clear();
+    return 0;
+  }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Find the first sample whose slice is not below z, by bisection.
+static vtkIdType vtkImageVoxelSamplerFindSlice(const std::vector<int> &points,
+                                               int z)
+{
+  vtkIdType lo = 0;
+  vtkIdType hi = (vtkIdType)(points.size()/3);
+  while (lo < hi)
+  {
+    vtkIdType mid = lo + (hi - lo)/2;
+    if (points[3*mid + 2] < z)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+//----------------------------------------------------------------------------
+void vtkImageVoxelSampler::GetSliceRange(int zMin, int zMax, vtkIdType range[2])
+{
+  range[0] = vtkImageVoxelSamplerFindSlice(this->Points, zMin);
+  range[1] = vtkImageVoxelSamplerFindSlice(this->Points, zMax + 1);
+  if (range[1] < range[0])
+  {
+    range[1] = range[0];
+  }
+}
+
+//----------------------------------------------------------------------------
+int vtkImageVoxelSampler::Update(vtkImageData *image, int extent[6],
+                                 vtkImageStencilData *stencil, int reverseStencil)
+{
+  reverseStencil = (reverseStencil != 0);
+  if (image != this->Image || stencil != this->Stencil ||
+      reverseStencil != this->ReverseStencil ||
+      memcmp(extent, this->Extent, sizeof(int)*6) != 0)
+  {
+    this->Image = image;
+    this->Stencil = stencil;
+    this->ReverseStencil = reverseStencil;
+    memcpy(this->Extent, extent, sizeof(int)*6);
+    this->Modified();
+  }
+
+  if (image == NULL)
+  {
+    this->Points.clear();
+    this->Values.clear();
+    this->NumberOfCandidates = 0;
+    return 0;
+  }
+
+  // the samples must lie within the image and the mask
+  int imageExt[6];
+  image->GetExtent(imageExt);
+  int maskExt[6];
+  if (this->Mask)
+  {
+    this->Mask->GetExtent(maskExt);
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    if (extent[2*i] > extent[2*i+1])
+    {
+      continue;
+    }
+    if (extent[2*i] < imageExt[2*i] || extent[2*i+1] > imageExt[2*i+1] ||
+        (this->Mask && (extent[2*i] < maskExt[2*i] || extent[2*i+1] > maskExt[2*i+1])))
+    {
+      vtkErrorMacro("Update: The extent is not within the image and the mask");
+      this->Points.clear();
+      this->Values.clear();
+      this->NumberOfCandidates = 0;
+      return 0;
+    }
+  }
+
+  // only the gradient weighted samples depend on the values of the image
+  if (this->SamplesTime <= this->GetMTime() ||
+      (this->Mask && this->SamplesTime <= this->Mask->GetMTime()) ||
+      (this->Stencil && this->SamplesTime <= this->Stencil->GetMTime()) ||
+      (this->SamplingMode == VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED &&
+       this->SamplesTime <= image->GetMTime()))
+  {
+    if (!this->SelectSamples())
+    {
+      this->Points.clear();
+      this->Values.clear();
+      return 0;
+    }
+    this->SamplesTime.Modified();
+  }
+
+  if (this->ValuesTime <= this->SamplesTime ||
+      this->ValuesTime <= image->GetMTime())
+  {
+    if (!this->GatherValues())
+    {
+      return 0;
+    }
+    this->ValuesTime.Modified();
+  }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkImageVoxelSampler::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "SamplingMode: " << this->GetSamplingModeAsString() << "\n";
+  os << indent << "SampleFraction: " << this->SampleFraction << "\n";
+  os << indent << "RandomSeed: " << this->RandomSeed << "\n";
+  os << indent << "Mask: " << this->Mask << "\n";
+  os << indent << "NumberOfSamples: " << this->GetNumberOfSamples() << "\n";
+  os << indent << "NumberOfCandidates: " << this->NumberOfCandidates << "\n";
+}
@@ -0,0 +1,167 @@
+/*=========================================================================
+
+  Program:   Robarts Visualization Toolkit
+  Module:    $RCSfile: vtkImageVoxelSampler.h,v $
+  Language:  C++
+
+  Copyright (c) 1993-2002 Ken Martin, Will Schroeder, Bill Lorensen
+  All rights reserved.
+  See Copyright.txt or http://www.kitware.com/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+
+=========================================================================*/
+// .NAME vtkImageVoxelSampler - select a subset of the voxels of an image
+// for the registration metrics.
+// .SECTION Description
+// vtkImageVoxelSampler selects the voxels over which a similarity metric
+// is evaluated, so that the metric only reads a small fraction of the
+// images on every evaluation. The samples are drawn once and stored as a
+// compact list of structured coordinates, in the order in which the
+// voxels are stored, with the value of the first component of the image
+// at each of them. They are only drawn again when the image, extent,
+// stencil, mask or sampling parameters change, or when NewSamples is
+// called, e.g. once per iteration of an optimizer. The values are
+// gathered again whenever the image is modified.
+//
+// The voxels are restricted to the extent, to the stencil and to the
+// non-zero voxels of the mask, if given. Of these, SamplingMode selects
+// - All: every voxel, which compacts a sparse stencil or mask.
+// - Random: SampleFraction of the voxels, chosen uniformly at random.
+// - Stratified: one random voxel in each block of about 1/SampleFraction
+//   voxels, which spreads the samples evenly over the extent. The blocks
+//   that hold no candidates give no sample.
+// - GradientWeighted: SampleFraction of the voxels, chosen with a
+//   probability proportional to the gradient magnitude of the image, so
+//   that the samples concentrate on the edges. A voxel may be chosen more
+//   than once, and the samples are not an unbiased estimate of a sum over
+//   the whole extent.
+// .SECTION see also
+// vtkImageJointHistogram vtkImageNCCManipulator
+// vtkImageNormalizedCrossCorrelation
+
+#ifndef __vtkImageVoxelSampler_h
+#define __vtkImageVoxelSampler_h
+
+#include "vtkRobartsRegistrationExport.h"
+
+#include "vtkObject.h"
+#include "vtkTimeStamp.h"
+
+#include <vector>
+
+class vtkImageData;
+class vtkImageStencilData;
+
+#define VTK_VOXEL_SAMPLING_ALL 0
+#define VTK_VOXEL_SAMPLING_RANDOM 1
+#define VTK_VOXEL_SAMPLING_STRATIFIED 2
+#define VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED 3
+
+class vtkRobartsRegistrationExport vtkImageVoxelSampler : public vtkObject
+{
+public:
+  static vtkImageVoxelSampler *New();
+  vtkTypeMacro(vtkImageVoxelSampler,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // How the samples are chosen. The default is Random.
+  vtkSetClampMacro(SamplingMode,int,VTK_VOXEL_SAMPLING_ALL,VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED);
+  vtkGetMacro(SamplingMode,int);
+  void SetSamplingModeToAll() {
+    this->SetSamplingMode(VTK_VOXEL_SAMPLING_ALL); };
+  void SetSamplingModeToRandom() {
+    this->SetSamplingMode(VTK_VOXEL_SAMPLING_RANDOM); };
+  void SetSamplingModeToStratified() {
+    this->SetSamplingMode(VTK_VOXEL_SAMPLING_STRATIFIED); };
+  void SetSamplingModeToGradientWeighted() {
+    this->SetSamplingMode(VTK_VOXEL_SAMPLING_GRADIENT_WEIGHTED); };
+  const char *GetSamplingModeAsString();
+
+  // Description:
+  // The fraction of the voxels to sample. The default is 0.05.
+  vtkSetClampMacro(SampleFraction,double,0.0,1.0);
+  vtkGetMacro(SampleFraction,double);
+
+  // Description:
+  // The seed of the random samples. The same seed gives the same samples.
+  vtkSetMacro(RandomSeed,int);
+  vtkGetMacro(RandomSeed,int);
+
+  // Description:
+  // Draw a new set of random samples, by changing the seed.
+  void NewSamples() { this->SetRandomSeed(this->RandomSeed + 1); };
+
+  // Description:
+  // Only sample the voxels where this image is not zero. It must cover
+  // the extent.
+  void SetMask(vtkImageData *mask);
+  vtkImageData *GetMask() { return this->Mask; };
+
+  // Description:
+  // Draw the samples from the image over the extent, within the stencil
+  // if given (or outside of it if reverseStencil is set), unless they are
+  // up to date. Returns 0 if the image is NULL or of an unknown type.
+  int Update(vtkImageData *image, int extent[6],
+             vtkImageStencilData *stencil = NULL, int reverseStencil = 0);
+
+  // Description:
+  // The samples, as structured coordinates (i,j,k) of the image, and the
+  // value of the image at each of them.
+  vtkIdType GetNumberOfSamples() { return (vtkIdType)this->Values.size(); };
+  const int *GetPoints() { return (this->Points.empty() ? NULL : &this->Points[0]); };
+  const double *GetValues() { return (this->Values.empty() ? NULL : &this->Values[0]); };
+
+  // Description:
+  // Get the samples range[0] <= i < range[1] that lie in the slices from
+  // zMin to zMax, which are contiguous because the samples are sorted.
+  void GetSliceRange(int zMin, int zMax, vtkIdType range[2]);
+
+  // Description:
+  // The number of voxels that the samples were drawn from. A sum over the
+  // samples is scaled by GetNumberOfCandidates()/GetNumberOfSamples() to
+  // estimate the sum over all of them.
+  vtkGetMacro(NumberOfCandidates,vtkIdType);
+
+  // Description:
+  // The time at which the samples were last drawn, to tell whether they
+  // changed since they were copied.
+  vtkMTimeType GetSamplesTime() { return this->SamplesTime.GetMTime(); };
+
+protected:
+  vtkImageVoxelSampler();
+  ~vtkImageVoxelSampler();
+
+  // Draw the samples, and gather their values.
+  int SelectSamples();
+  int GatherValues();
+
+  // Set row[x - Extent[0]] to 1 for the voxels of row (y,z) that may be
+  // sampled, and 0 for the others.
+  void GetCandidateRow(int y, int z, unsigned char *row);
+
+  int SamplingMode;
+  double SampleFraction;
+  int RandomSeed;
+  vtkImageData *Mask;
+
+  vtkImageData *Image;
+  vtkImageStencilData *Stencil;
+  int ReverseStencil;
+  int Extent[6];
+
+  std::vector<int> Points;
+  std::vector<double> Values;
+  vtkIdType NumberOfCandidates;
+  vtkTimeStamp SamplesTime;
+  vtkTimeStamp ValuesTime;
+
+private:
+  vtkImageVoxelSampler(const vtkImageVoxelSampler&);  // Not implemented.
+  void operator=(const vtkImageVoxelSampler&);  // Not implemented.
+};
+
+#endif
@@ -0,0 +1,415 @@
+#include "vtkLBFGSMinimizer.h"
+#include "vtkObjectFactory.h"
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+// sufficient decrease for the line search, and the largest number of
+// times that the step is shortened
+#define VTK_LBFGS_ARMIJO 1.0e-4
+#define VTK_LBFGS_MAX_BACKTRACK 20
+
+vtkStandardNewMacro(vtkLBFGSMinimizer);
+
+//----------------------------------------------------------------------------
+static double vtkLBFGSMinimizerDot(const double *a, const double *b, int n)
+{
+  double sum = 0.0;
+  for (int i = 0; i < n; i++)
+  {
+    sum += a[i]*b[i];
+  }
+  return sum;
+}
+
+//----------------------------------------------------------------------------
+vtkLBFGSMinimizer::vtkLBFGSMinimizer()
+  : Function(NULL)
+  , FunctionArgDelete(NULL)
+  , FunctionArg(NULL)
+  , NumberOfParameters(0)
+  , ParameterNames(NULL)
+  , Parameters(NULL)
+  , ParameterBrackets(NULL)
+  , Gradient(NULL)
+  , ScalarResult(0.0)
+  , Tolerance(1.0e-5)
+  , MaxIterations(1000)
+  , NumberOfCorrections(5)
+  , InitialStepLength(0.25)
+  , Iterations(0)
+  , NumberOfEvaluations(0)
+{
+
+}
+
+//----------------------------------------------------------------------------
+vtkLBFGSMinimizer::~vtkLBFGSMinimizer()
+{
+  if ((this->FunctionArg) && (this->FunctionArgDelete))
+  {
+    (*this->FunctionArgDelete)(this->FunctionArg);
+  }
+  this->FunctionArg = NULL;
+  this->FunctionArgDelete = NULL;
+  this->Function = NULL;
+
+  if (this->ParameterNames)
+  {
+    for (int i = 0; i < this->NumberOfParameters; i++)
+    {
+      if (this->ParameterNames[i])
+      {
+        delete [] this->ParameterNames[i];
+      }
+    }
+    delete [] this->ParameterNames;
+    this->ParameterNames = NULL;
+  }
+  if (this->Parameters)
+  {
+    delete [] this->Parameters;
+    this->Parameters = NULL;
+  }
+  if (this->ParameterBrackets)
+  {
+    delete [] this->ParameterBrackets;
+    this->ParameterBrackets = NULL;
+  }
+  if (this->Gradient)
+  {
+    delete [] this->Gradient;
+    this->Gradient = NULL;
+  }
+
+  this->NumberOfParameters = 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkLBFGSMinimizer::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->vtkObject::PrintSelf(os, indent);
+  os << indent << "ScalarResult: " << this->ScalarResult << "\n";
+  os << indent << "MaxIterations: " << this->MaxIterations << "\n";
+  os << indent << "Iterations: " << this->Iterations << "\n";
+  os << indent << "NumberOfEvaluations: " << this->NumberOfEvaluations << "\n";
+  os << indent << "NumberOfCorrections: " << this->NumberOfCorrections << "\n";
+  os << indent << "InitialStepLength: " << this->InitialStepLength << "\n";
+  os << indent << "Tolerance: " << this->Tolerance << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkLBFGSMinimizer::SetFunction(double (*f)(void *, const double *, double *),
+                                    void *arg)
+{
+  if ( f != this->Function || arg != this->FunctionArg )
+  {
+    // delete the current arg if there is one and a delete meth
+    if ((this->FunctionArg) && (this->FunctionArgDelete))
+    {
+      (*this->FunctionArgDelete)(this->FunctionArg);
+    }
+    this->Function = f;
+    this->FunctionArg = arg;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkLBFGSMinimizer::SetFunctionArgDelete(void (*f)(void *))
+{
+  if ( f != this->FunctionArgDelete)
+  {
+    this->FunctionArgDelete = f;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+double *vtkLBFGSMinimizer::GetScalarVariableBracket(const char *name)
+{
+  static double errval[2] = { 0.0, 0.0 };
+
+  for (int i = 0; i < this->NumberOfParameters; i++)
+  {
+    if (strcmp(name,this->ParameterNames[i]) == 0)
+    {
+      return this->ParameterBrackets[i];
+    }
+  }
+
+  vtkErrorMacro("GetScalarVariableBracket: no parameter named " << name);
+  return errval;
+}
+
+//----------------------------------------------------------------------------
+void vtkLBFGSMinimizer::GetScalarVariableBracket(const char *name, double range[2])
+{
+  double *r = this->GetScalarVariableBracket(name);
+  range[0] = r[0];
+  range[1] = r[1];
+}
+
+//----------------------------------------------------------------------------
+double vtkLBFGSMinimizer::GetScalarVariableValue(const char *name)
+{
+  for (int i = 0; i < this->NumberOfParameters; i++)
+  {
+    if (strcmp(name,this->ParameterNames[i]) == 0)
+    {
+      return this->Parameters[i];
+    }
+  }
+  vtkErrorMacro("GetScalarVariableValue: no parameter named " << name);
+  return 0.0;
+}
+
+//----------------------------------------------------------------------------
+void vtkLBFGSMinimizer::SetScalarVariableBracket(const char *name,
+                                                 double bmin, double bmax)
+{
+  int i;
+
+  for (i = 0; i < this->NumberOfParameters; i++)
+  {
+    if (strcmp(name,this->ParameterNames[i]) == 0)
+    {
+      if (this->ParameterBrackets[i][0] != bmin ||
+          this->ParameterBrackets[i][1] != bmax)
+      {
+        this->ParameterBrackets[i][0] = bmin;
+        this->ParameterBrackets[i][1] = bmax;
+        this->Modified();
+      }
+      return;
+    }
+  }
+
+  int n = this->NumberOfParameters + 1;
+  char **newParameterNames = new char *[n];
+  double *newParameters = new double[n];
+  double (*newParameterBrackets)[2] = new double[n][2];
+  double *newGradient = new double[n];
+
+  for (i = 0; i < this->NumberOfParameters; i++)
+  {
+    newParameterNames[i] = this->ParameterNames[i];
+    newParameters[i] = this->Parameters[i];
+    newParameterBrackets[i][0] = this->ParameterBrackets[i][0];
+    newParameterBrackets[i][1] = this->ParameterBrackets[i][1];
+  }
+
+  char *cp = new char[strlen(name)+8];
+  strcpy(cp, name);
+  newParameterNames[n-1] = cp;
+  newParameters[n-1] = 0.5*(bmin + bmax);
+  newParameterBrackets[n-1][0] = bmin;
+  newParameterBrackets[n-1][1] = bmax;
+
+  if (this->ParameterNames)
+  {
+    delete [] this->ParameterNames;
+  }
+  if (this->Parameters)
+  {
+    delete [] this->Parameters;
+  }
+  if (this->ParameterBrackets)
+  {
+    delete [] this->ParameterBrackets;
+  }
+  if (this->Gradient)
+  {
+    delete [] this->Gradient;
+  }
+
+  this->NumberOfParameters = n;
+  this->ParameterNames = newParameterNames;
+  this->Parameters = newParameters;
+  this->ParameterBrackets = newParameterBrackets;
+  this->Gradient = newGradient;
+
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkLBFGSMinimizer::SetScalarVariableBracket(const char *name, const double range[2])
+{
+  this->SetScalarVariableBracket(name,range[0],range[1]);
+}
+
+//----------------------------------------------------------------------------
+int vtkLBFGSMinimizer::Initialize()
+{
+  if (!this->Function)
+  {
+    vtkErrorMacro("Initialize: Function is NULL!");
+    return 0;
+  }
+
+  this->Iterations = 0;
+  this->NumberOfEvaluations = 0;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+double vtkLBFGSMinimizer::Evaluate(const double *u, double *gradient)
+{
+  int n = this->NumberOfParameters;
+  for (int i = 0; i < n; i++)
+  {
+    double *b = this->ParameterBrackets[i];
+    this->Parameters[i] = 0.5*(b[0] + b[1]) + 0.5*(b[1] - b[0])*u[i];
+  }
+
+  double value = this->Function(this->FunctionArg, this->Parameters, this->Gradient);
+  this->NumberOfEvaluations++;
+
+  for (int i = 0; i < n; i++)
+  {
+    double *b = this->ParameterBrackets[i];
+    gradient[i] = this->Gradient[i]*0.5*(b[1] - b[0]);
+  }
+
+  return value;
+}
+
+//----------------------------------------------------------------------------
+void vtkLBFGSMinimizer::Minimize()
+{
+  if (!this->Initialize())
+  {
+    return;
+  }
+
+  int n = this->NumberOfParameters;
+  int m = this->NumberOfCorrections;
+
+  // the scaled parameters, which are zero at the middle of the brackets
+  std::vector<double> u(n, 0.0), g(n), d(n), un(n), gn(n);
+
+  // the last m steps and changes of the gradient, in a ring
+  std::vector<double> s(m*n), y(m*n), rho(m), alpha(m);
+  int numPairs = 0;
+  int newest = -1;
+
+  double f = this->Evaluate(&u[0], &g[0]);
+
+  for (int iter = 0; iter < this->MaxIterations; iter++)
+  {
+    double gnorm = sqrt(vtkLBFGSMinimizerDot(&g[0], &g[0], n));
+    if (gnorm == 0.0)
+    {
+      break;
+    }
+
+    // the direction from the two loop recursion, or along the gradient
+    // for the first step and whenever that is not a descent direction
+    double gd = 0.0;
+    if (numPairs > 0)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        d[i] = -g[i];
+      }
+      for (int k = 0, j = newest; k < numPairs; k++, j = (j + m - 1) % m)
+      {
+        alpha[j] = rho[j]*vtkLBFGSMinimizerDot(&s[j*n], &d[0], n);
+        for (int i = 0; i < n; i++)
+        {
+          d[i] -= alpha[j]*y[j*n + i];
+        }
+      }
+      double gamma = (vtkLBFGSMinimizerDot(&s[newest*n], &y[newest*n], n)/
+                      vtkLBFGSMinimizerDot(&y[newest*n], &y[newest*n], n));
+      for (int i = 0; i < n; i++)
+      {
+        d[i] *= gamma;
+      }
+      for (int k = 0, j = (newest + m - numPairs + 1) % m; k < numPairs; k++, j = (j + 1) % m)
+      {
+        double beta = rho[j]*vtkLBFGSMinimizerDot(&y[j*n], &d[0], n);
+        for (int i = 0; i < n; i++)
+        {
+          d[i] += (alpha[j] - beta)*s[j*n + i];
+        }
+      }
+      gd = vtkLBFGSMinimizerDot(&g[0], &d[0], n);
+    }
+    if (numPairs == 0 || !(gd < 0.0))
+    {
+      numPairs = 0;
+      for (int i = 0; i < n; i++)
+      {
+        d[i] = -g[i]*this->InitialStepLength/gnorm;
+      }
+      gd = vtkLBFGSMinimizerDot(&g[0], &d[0], n);
+    }
+
+    // backtracking line search for a sufficient decrease, which shortens
+    // the step to the minimum of the quadratic through f, gd and fn
+    double step = 1.0;
+    double fn = f;
+    int accepted = 0;
+    for (int k = 0; k < VTK_LBFGS_MAX_BACKTRACK; k++)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        un[i] = u[i] + step*d[i];
+      }
+      fn = this->Evaluate(&un[0], &gn[0]);
+      if (fn <= f + VTK_LBFGS_ARMIJO*step*gd)
+      {
+        accepted = 1;
+        break;
+      }
+      double t = -gd*step*step/(2.0*(fn - f - gd*step));
+      step = (t > 0.1*step ? (t < 0.5*step ? t : 0.5*step) : 0.1*step);
+    }
+    if (!accepted)
+    {
+      break;
+    }
+    this->Iterations++;
+
+    // keep the step and the change of the gradient if the curvature is
+    // positive, which keeps the approximate inverse Hessian positive
+    double sy = 0.0, ss = 0.0, yy = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+      sy += (un[i] - u[i])*(gn[i] - g[i]);
+      ss += (un[i] - u[i])*(un[i] - u[i]);
+      yy += (gn[i] - g[i])*(gn[i] - g[i]);
+    }
+    if (sy > 1.0e-10*sqrt(ss*yy))
+    {
+      newest = (newest + 1) % m;
+      for (int i = 0; i < n; i++)
+      {
+        s[newest*n + i] = un[i] - u[i];
+        y[newest*n + i] = gn[i] - g[i];
+      }
+      rho[newest] = 1.0/sy;
+      numPairs = (numPairs < m ? numPairs + 1 : m);
+    }
+
+    int converged = (2.0*fabs(f - fn) <= this->Tolerance*(fabs(f) + fabs(fn)) + 1.0e-20);
+    u = un;
+    g = gn;
+    f = fn;
+    if (converged)
+    {
+      break;
+    }
+  }
+
+  // the parameters at the minimum
+  for (int i = 0; i < n; i++)
+  {
+    double *b = this->ParameterBrackets[i];
+    this->Parameters[i] = 0.5*(b[0] + b[1]) + 0.5*(b[1] - b[0])*u[i];
+  }
+  this->ScalarResult = f;
+}
@@ -0,0 +1,131 @@
+// .NAME vtkLBFGSMinimizer - limited memory BFGS minimizer
+// .SECTION Description
+// vtkLBFGSMinimizer minimizes a function whose gradient is known, such as
+// the GetResultAndGradient of vtkImageNCCManipulator and
+// vtkImageMIManipulator, with the limited memory BFGS method and a
+// backtracking line search. The variables are specified by name with a
+// bracket, as for vtkPowellMinimizer: the minimization starts at the
+// middle of the brackets, and each variable is scaled by half the width
+// of its bracket, so that a step of one moves every variable by that
+// much. The brackets do not bound the variables.
+// .SECTION see also
+// vtkPowellMinimizer vtkFunctionMinimizer
+
+#ifndef __vtkLBFGSMinimizer_h
+#define __vtkLBFGSMinimizer_h
+
+#include "vtkRobartsRegistrationExport.h"
+
+#include "vtkObject.h"
+
+class vtkRobartsRegistrationExport vtkLBFGSMinimizer : public vtkObject
+{
+public:
+  static vtkLBFGSMinimizer *New();
+
+  vtkTypeMacro(vtkLBFGSMinimizer,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Specify the function to be minimized. It is given the parameters,
+  // in the order in which the variables were specified, and returns the
+  // value and stores the gradient.
+  void SetFunction(double (*f)(void *arg, const double *parameters, double *gradient),
+                   void *arg);
+
+  // Description:
+  // Set a function to call when a void* argument is being discarded.
+  void SetFunctionArgDelete(void (*f)(void *));
+
+  // Description:
+  // Specify a variable to modify during the minimization.  Only the
+  // variable you specify will be modified.  You must specify estimated
+  // min and max possible values for each variable.
+  void SetScalarVariableBracket(const char *name, double min, double max);
+  void SetScalarVariableBracket(const char *name, const double range[2]);
+  double *GetScalarVariableBracket(const char *name);
+  void GetScalarVariableBracket(const char *name, double range[2]);
+
+  // Description:
+  // Get the value of a variable at the current stage of the minimization.
+  double GetScalarVariableValue(const char *name);
+
+  // Description:
+  // Iterate until the minimum is found to within the specified tolerance.
+  void Minimize();
+
+  // Description:
+  // Initialize the minimization (this is done by Minimize).
+  int Initialize();
+
+  // Description:
+  // Get the value at the minimum.
+  vtkGetMacro(ScalarResult,double);
+
+  // Description:
+  // Specify the fractional tolerance to aim for during the minimization,
+  // on the decrease of the value in one iteration.
+  vtkSetMacro(Tolerance,double);
+  vtkGetMacro(Tolerance,double);
+
+  // Description:
+  // Specify the maximum number of iterations to try.
+  vtkSetMacro(MaxIterations,int);
+  vtkGetMacro(MaxIterations,int);
+
+  // Description:
+  // Specify the number of previous steps that approximate the inverse
+  // Hessian. The default is 5.
+  vtkSetClampMacro(NumberOfCorrections,int,1,100);
+  vtkGetMacro(NumberOfCorrections,int);
+
+  // Description:
+  // Specify the length of the first step, in units of half the bracket
+  // widths. The default is 0.25.
+  vtkSetMacro(InitialStepLength,double);
+  vtkGetMacro(InitialStepLength,double);
+
+  // Description:
+  // Return the number of iterations and of function evaluations of the
+  // last minimization.
+  vtkGetMacro(Iterations,int);
+  vtkGetMacro(NumberOfEvaluations,int);
+
+protected:
+  vtkLBFGSMinimizer();
+  ~vtkLBFGSMinimizer();
+
+  // Description:
+  // Evaluate the function at the scaled parameters u, and store the
+  // gradient with respect to u.
+  double Evaluate(const double *u, double *gradient);
+
+//BTX
+  double (*Function)(void *, const double *, double *);
+  void (*FunctionArgDelete)(void *);
+  void *FunctionArg;
+//ETX
+
+  int NumberOfParameters;
+  char **ParameterNames;
+  double *Parameters;
+//BTX
+  double (*ParameterBrackets)[2];
+//ETX
+  double *Gradient;
+
+  double ScalarResult;
+
+  double Tolerance;
+  int MaxIterations;
+  int NumberOfCorrections;
+  double InitialStepLength;
+  int Iterations;
+  int NumberOfEvaluations;
+
+private:
+  vtkLBFGSMinimizer(const vtkLBFGSMinimizer&);  // Not implemented.
+  void operator=(const vtkLBFGSMinimizer&);  // Not implemented.
+};
+
+#endif
@@ -17,12 +17,565 @@
 =========================================================================*/
 
 #include "vtkPolyDataCorrespondence.h"
+#include "vtkMultiThreader.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <vector>
 
 vtkStandardNewMacro(vtkPolyDataCorrespondence);
 
+//----------------------------------------------------------------------------
+// Only candidates closer than this are considered when the cost includes the
+// normal, shape or curvedness terms.
+#define VTK_CORRESPONDENCE_SEARCH_RADIUS 20.0
+
+namespace
+{
+  //----------------------------------------------------------------------------
+  // Uniform grid over a flat copy of a point set. The points are sorted by cell,
+  // with their coordinates stored per axis, so that each cell is a contiguous run.
+  class vtkPolyDataCorrespondenceGrid
+  {
+  public:
+    void Build(const double *points, int numPoints)
+    {
+      this->CellStart.clear();
+      this->PointIds.resize(numPoints);
+      this->X.resize(numPoints);
+      this->Y.resize(numPoints);
+      this->Z.resize(numPoints);
+
+      double bounds[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+      if( numPoints > 0 )
+      {
+        for(int a = 0; a < 3; a++)
+          bounds[2*a] = bounds[2*a+1] = points[a];
+      }
+      for(int i = 0; i < numPoints; i++)
+      {
+        for(int a = 0; a < 3; a++)
+        {
+          bounds[2*a] = std::min(bounds[2*a], points[3*i+a]);
+          bounds[2*a+1] = std::max(bounds[2*a+1], points[3*i+a]);
+        }
+      }
+
+      // aim for a couple of points per cell, ignoring flat axes
+      double volume = 1.0;
+      int numAxes = 0;
+      for(int a = 0; a < 3; a++)
+      {
+        if( bounds[2*a+1] > bounds[2*a] )
+        {
+          volume *= bounds[2*a+1] - bounds[2*a];
+          numAxes++;
+        }
+      }
+      double cellSize = (numAxes > 0) ? pow(volume / std::max(1, numPoints/2), 1.0 / numAxes) : 1.0;
+
+      // keep the number of cells in proportion to the number of points, since
+      // a nearly flat set of points would otherwise get far too many cells
+      double maxCells = std::min(8.0*numPoints + 4096.0, (double) VTK_INT_MAX - 1.0);
+      for(;;)
+      {
+        double numCells = 1.0;
+        for(int a = 0; a < 3; a++)
+        {
+          double extent = bounds[2*a+1] - bounds[2*a];
+          if( extent > 0.0 )
+            numCells *= std::min(65536.0, std::max(1.0, ceil(extent / cellSize)));
+        }
+        if( numCells <= maxCells )
+          break;
+        cellSize *= pow(numCells / maxCells, 1.0 / numAxes) * (1.0 + 1.0e-9);
+      }
+
+      this->Tolerance = 0.0;
+      for(int a = 0; a < 3; a++)
+      {
+        double extent = bounds[2*a+1] - bounds[2*a];
+        this->Origin[a] = bounds[2*a];
+        this->Dimensions[a] = (extent > 0.0) ? (int) std::min(65536.0, std::max(1.0, ceil(extent / cellSize))) : 1;
+        this->Spacing[a] = (extent > 0.0) ? extent / this->Dimensions[a] : 1.0;
+        this->InverseSpacing[a] = (extent > 0.0) ? this->Dimensions[a] / extent : 0.0;
+        this->Tolerance += 1.0e-9 * (fabs(bounds[2*a]) + fabs(bounds[2*a+1]) + extent);
+      }
+
+      // counting sort of the points into their cells
+      vtkIdType numCells = (vtkIdType) this->Dimensions[0]*this->Dimensions[1]*this->Dimensions[2];
+      std::vector<int> pointCells(numPoints);
+      this->CellStart.assign(numCells+1, 0);
+      for(int i = 0; i < numPoints; i++)
+      {
+        int cell[3];
+        this->GetCell(points + 3*i, cell);
+        pointCells[i] = cell[0] + this->Dimensions[0]*(cell[1] + this->Dimensions[1]*cell[2]);
+        this->CellStart[pointCells[i]+1]++;
+      }
+      for(vtkIdType c = 0; c < numCells; c++)
+        this->CellStart[c+1] += this->CellStart[c];
+      std::vector<int> next(this->CellStart.begin(), this->CellStart.end()-1);
+      for(int i = 0; i < numPoints; i++)
+      {
+        int p = next[pointCells[i]]++;
+        this->PointIds[p] = i;
+        this->X[p] = points[3*i];
+        this->Y[p] = points[3*i+1];
+        this->Z[p] = points[3*i+2];
+      }
+    }
+
+    // Find the closest point, preferring the lowest point ID among equally close
+    // points. The search grows in rings of cells around the query point until no
+    // unvisited cell can hold a closer point.
+    void FindClosestPoint(const double q[3], double &bestDist2, int &bestId) const
+    {
+      bestDist2 = DBL_MAX;
+      bestId = -1;
+      if( this->PointIds.empty() )
+        return;
+
+      int c[3];
+      this->GetCell(q, c);
+      int maxRing = 0;
+      for(int a = 0; a < 3; a++)
+        maxRing = std::max(maxRing, std::max(c[a], this->Dimensions[a]-1-c[a]));
+
+      for(int r = 0; r <= maxRing; r++)
+      {
+        int lo[3], hi[3];
+        for(int a = 0; a < 3; a++)
+        {
+          lo[a] = std::max(c[a]-r, 0);
+          hi[a] = std::min(c[a]+r, this->Dimensions[a]-1);
+        }
+        for(int k = lo[2]; k <= hi[2]; k++)
+        {
+          for(int j = lo[1]; j <= hi[1]; j++)
+          {
+            // only the shell of the ring is new
+            if( abs(k-c[2]) < r && abs(j-c[1]) < r )
+            {
+              if( c[0]-r >= 0 )
+                this->VisitCell(c[0]-r, j, k, q, bestDist2, bestId);
+              if( r > 0 && c[0]+r < this->Dimensions[0] )
+                this->VisitCell(c[0]+r, j, k, q, bestDist2, bestId);
+              continue;
+            }
+            for(int i = lo[0]; i <= hi[0]; i++)
+              this->VisitCell(i, j, k, q, bestDist2, bestId);
+          }
+        }
+
+        // distance to the nearest cell outside of the ring
+        double bound = DBL_MAX;
+        for(int a = 0; a < 3; a++)
+        {
+          if( c[a]-r > 0 )
+            bound = std::min(bound, q[a] - (this->Origin[a] + (c[a]-r)*this->Spacing[a]));
+          if( c[a]+r < this->Dimensions[a]-1 )
+            bound = std::min(bound, this->Origin[a] + (c[a]+r+1)*this->Spacing[a] - q[a]);
+        }
+        bound -= this->Tolerance;
+        if( bound > 0.0 && bestDist2 < bound*bound )
+          break;
+      }
+    }
+
+    // Call visit(id) for every point that may lie within the radius of q.
+    template<class F>
+    void ForEachPointInRadius(const double q[3], double radius, F &visit) const
+    {
+      if( this->PointIds.empty() )
+        return;
+
+      double qlo[3] = {q[0]-radius, q[1]-radius, q[2]-radius};
+      double qhi[3] = {q[0]+radius, q[1]+radius, q[2]+radius};
+      int lo[3], hi[3];
+      this->GetCell(qlo, lo);
+      this->GetCell(qhi, hi);
+      for(int k = lo[2]; k <= hi[2]; k++)
+      {
+        for(int j = lo[1]; j <= hi[1]; j++)
+        {
+          int first = lo[0] + this->Dimensions[0]*(j + this->Dimensions[1]*k);
+          int last = hi[0] + this->Dimensions[0]*(j + this->Dimensions[1]*k);
+          for(int p = this->CellStart[first]; p < this->CellStart[last+1]; p++)
+            visit(this->PointIds[p]);
+        }
+      }
+    }
+
+  private:
+    void GetCell(const double q[3], int cell[3]) const
+    {
+      for(int a = 0; a < 3; a++)
+      {
+        double c = (q[a] - this->Origin[a]) * this->InverseSpacing[a];
+        c = std::max(0.0, std::min(c, (double)(this->Dimensions[a]-1)));
+        cell[a] = (int) c;
+      }
+    }
+
+    void VisitCell(int i, int j, int k, const double q[3], double &bestDist2, int &bestId) const
+    {
+      int cell = i + this->Dimensions[0]*(j + this->Dimensions[1]*k);
+      for(int p = this->CellStart[cell]; p < this->CellStart[cell+1]; p++)
+      {
+        double dist2 = (q[0] - this->X[p]) * (q[0] - this->X[p]) +
+                       (q[1] - this->Y[p]) * (q[1] - this->Y[p]) +
+                       (q[2] - this->Z[p]) * (q[2] - this->Z[p]);
+        if( dist2 < bestDist2 || (dist2 == bestDist2 && this->PointIds[p] < bestId) )
+        {
+          bestDist2 = dist2;
+          bestId = this->PointIds[p];
+        }
+      }
+    }
+
+    double Origin[3];
+    double Spacing[3];
+    double InverseSpacing[3];
+    int Dimensions[3];
+    double Tolerance;
+    std::vector<int> CellStart;
+    std::vector<int> PointIds;
+    std::vector<double> X;
+    std::vector<double> Y;
+    std::vector<double> Z;
+  };
+
+  //----------------------------------------------------------------------------
+  struct vtkPolyDataCorrespondenceThreadStruct
+  {
+    const vtkPolyDataCorrespondenceGrid *Grid;
+    int NumberOfPoints1;
+    int NumberOfPoints2;
+    const double *Points1;
+    const double *Points2;
+    const double *Normals1;
+    const double *Normals2;
+    const double *Shape1;
+    const double *Shape2;
+    const double *Curved1;
+    const double *Curved2;
+    const double *Edges1;
+    const double *Edges2;
+    double ConstantN;
+    double ConstantS;
+    double ConstantC;
+    double *Distances;
+    long *Pairings;
+  };
+
+  //----------------------------------------------------------------------------
+  // Cost of pairing one point of the first surface with nearby points of the
+  // second, combining distance, normals, shape index and curvedness.
+  struct vtkPolyDataCorrespondenceFeatureCost
+  {
+    const vtkPolyDataCorrespondenceThreadStruct *Str;
+    int Point1;
+    double MinimumCost;
+    double MinimumDistance;
+    long Pair;
+
+    void operator()(int j)
+    {
+      const double *pnt1 = this->Str->Points1 + 3*this->Point1;
+      const double *pnt2 = this->Str->Points2 + 3*j;
+      double magn = sqrt( (pnt1[0] - pnt2[0]) * (pnt1[0] - pnt2[0]) +
+                          (pnt1[1] - pnt2[1]) * (pnt1[1] - pnt2[1]) +
+                          (pnt1[2] - pnt2[2]) * (pnt1[2] - pnt2[2]) );
+      if (magn >= VTK_CORRESPONDENCE_SEARCH_RADIUS)
+        return;
+
+      const double *norm1 = this->Str->Normals1 + 3*this->Point1;
+      const double *norm2 = this->Str->Normals2 + 3*j;
+      double normdot = norm1[0]*norm2[0] + norm1[1]*norm2[1] + norm1[2]*norm2[2];
+
+      double cost = ( magn + this->Str->ConstantN * (1.0 - normdot) );
+      if (this->Str->Shape1)
+      {
+        cost = cost +
+          this->Str->ConstantS * fabs(this->Str->Shape1[this->Point1] - this->Str->Shape2[j]) +
+          this->Str->ConstantC * fabs(this->Str->Curved1[this->Point1] - this->Str->Curved2[j]);
+      }
+
+      if (cost < this->MinimumCost || (cost == this->MinimumCost && j < this->Pair))
+      {
+        this->MinimumCost = cost;
+        this->MinimumDistance = magn;
+        this->Pair = j;
+      }
+    }
+  };
+}
+
+//----------------------------------------------------------------------------
+static void vtkPolyDataCorrespondenceGetRange(int numPoints, int threadId, int threadCount, int &first, int &last)
+{
+  first = (int)(((vtkTypeInt64) numPoints * threadId) / threadCount);
+  last = (int)(((vtkTypeInt64) numPoints * (threadId + 1)) / threadCount);
+}
+
+//----------------------------------------------------------------------------
+// Find the squared distance to, and the ID of, the closest point of the second
+// surface for each point of the first.
+static VTK_THREAD_RETURN_TYPE vtkPolyDataCorrespondenceClosestExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkPolyDataCorrespondenceThreadStruct *str = static_cast<vtkPolyDataCorrespondenceThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int first, last;
+  vtkPolyDataCorrespondenceGetRange(str->NumberOfPoints1, threadId, threadCount, first, last);
+  for (int i = first; i < last; i++)
+  {
+    int pair;
+    str->Grid->FindClosestPoint(str->Points1 + 3*i, str->Distances[i], pair);
+    str->Pairings[i] = pair;
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Find the lowest cost pairing among the points of the second surface within
+// the search radius of each point of the first.
+static VTK_THREAD_RETURN_TYPE vtkPolyDataCorrespondenceFeatureExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkPolyDataCorrespondenceThreadStruct *str = static_cast<vtkPolyDataCorrespondenceThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int first, last;
+  vtkPolyDataCorrespondenceGetRange(str->NumberOfPoints1, threadId, threadCount, first, last);
+  for (int i = first; i < last; i++)
+  {
+    vtkPolyDataCorrespondenceFeatureCost cost;
+    cost.Str = str;
+    cost.Point1 = i;
+    cost.MinimumCost = 1E300;
+    cost.MinimumDistance = VTK_CORRESPONDENCE_SEARCH_RADIUS;
+    cost.Pair = -1;
+    str->Grid->ForEachPointInRadius(str->Points1 + 3*i, VTK_CORRESPONDENCE_SEARCH_RADIUS, cost);
+    str->Distances[i] = cost.MinimumDistance;
+    str->Pairings[i] = cost.Pair;
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Pair the points of two contours by in-plane distance and the agreement of the
+// edges on either side of each point. The edge term has no bound, so every pair
+// of points is considered.
+static VTK_THREAD_RETURN_TYPE vtkPolyDataCorrespondenceContourExecute( void *arg )
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkPolyDataCorrespondenceThreadStruct *str = static_cast<vtkPolyDataCorrespondenceThreadStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int first, last;
+  vtkPolyDataCorrespondenceGetRange(str->NumberOfPoints1, threadId, threadCount, first, last);
+  for (int i = first; i < last; i++)
+  {
+    const double *pnt1 = str->Points1 + 3*i;
+    const double *vect1 = str->Edges1 + 6*i;
+    double minMagn = 1E300;
+    double minCost = 1E300;
+    long pair = -1;
+
+    for (int j = 0; j < str->NumberOfPoints2; j++)
+    {
+      const double *pnt2 = str->Points2 + 3*j;
+      const double *vect2 = str->Edges2 + 6*j;
+      double dotProd = ( vect1[0]*vect2[0] + vect1[1]*vect2[1] + vect1[2]*vect2[2] +
+                         vect1[3]*vect2[3] + vect1[4]*vect2[4] + vect1[5]*vect2[5] );
+      double magn = sqrt( (pnt1[0] - pnt2[0]) * (pnt1[0] - pnt2[0]) +
+                          (pnt1[1] - pnt2[1]) * (pnt1[1] - pnt2[1]) +
+                          (pnt1[2] - pnt2[2]) * (pnt1[2] - pnt2[2]) );
+      double cost = (magn + str->ConstantN * (1.0 - dotProd/2.0));
+      if (cost < minCost)
+      {
+        minCost = cost;
+        minMagn = magn;
+        pair = j;
+      }
+    }
+    str->Distances[i] = minMagn;
+    str->Pairings[i] = pair;
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Copy the points into a flat array, zeroing the coordinate along the given
+// axis (if any) so that distances are measured in the remaining plane.
+static void vtkPolyDataCorrespondenceCopyPoints(vtkPoints *points, std::vector<double> &flat, int flatAxis)
+{
+  int n = points->GetNumberOfPoints();
+  flat.resize(3*n);
+  for (int i = 0; i < n; i++)
+  {
+    points->GetPoint(i, &(flat[3*i]));
+    if (flatAxis >= 0 && flatAxis < 3)
+    {
+      flat[3*i+flatAxis] = 0.0;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+static bool vtkPolyDataCorrespondenceCopyNormals(vtkPolyData *poly, std::vector<double> &flat)
+{
+  vtkDataArray *normals = poly->GetPointData()->GetNormals();
+  if (!normals)
+  {
+    return false;
+  }
+  int n = poly->GetNumberOfPoints();
+  flat.resize(3*n);
+  for (int i = 0; i < n; i++)
+  {
+    normals->GetTuple(i, &(flat[3*i]));
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// The edges to the following and preceding point of a contour, stored as six
+// values per point.
+static void vtkPolyDataCorrespondenceContourEdges(vtkPoints *points, std::vector<double> &edges)
+{
+  int n = points->GetNumberOfPoints();
+  edges.resize(6*n);
+  for (int i = 0; i < n; i++)
+  {
+    double pnt[3], pnta[3], pntb[3];
+    points->GetPoint(i, pnt);
+    points->GetPoint((i+1 < n) ? i+1 : 0, pnta);
+    points->GetPoint((i-1 > 0) ? i-1 : n-1, pntb);
+    for (int k = 0; k < 3; k++)
+    {
+      edges[6*i+k] = pnta[k] - pnt[k];
+      edges[6*i+3+k] = pnt[k] - pntb[k];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+// The shape index and curvedness of each point, from its Gaussian and mean
+// curvatures.
+static void vtkPolyDataCorrespondenceShape(vtkPolyData *poly, std::vector<double> &shape, std::vector<double> &curved)
+{
+  vtkCurvatures *gausCurv = vtkCurvatures::New();
+  vtkCurvatures *meanCurv = vtkCurvatures::New();
+  gausCurv->SetCurvatureTypeToGaussian();
+  gausCurv->SetInputData(poly);
+  gausCurv->Update();
+  meanCurv->SetCurvatureTypeToMean();
+  meanCurv->SetInputData(poly);
+  meanCurv->InvertMeanCurvatureOn();
+  meanCurv->Update();
+
+  vtkDataArray *gaus = gausCurv->GetOutput()->GetPointData()->GetScalars();
+  vtkDataArray *mean = meanCurv->GetOutput()->GetPointData()->GetScalars();
+  int n = poly->GetNumberOfPoints();
+  shape.resize(n);
+  curved.resize(n);
+  for (int i = 0; i < n; i++)
+  {
+    double curv[2] = { gaus->GetTuple1(i), mean->GetTuple1(i) };
+
+    double temp = curv[1]*curv[1] - curv[0];
+    if (temp > 0.0)
+    {
+      shape[i] = 0.636619772368 * atan( -curv[1] / sqrt(temp) );
+    }
+    else
+    {
+      shape[i] = (curv[1] <= 0.0) ? 1.0 : -1.0;
+    }
+
+    curved[i] = 0.0;
+    temp = 2.0 * curv[1] * curv[1] - curv[0];
+    if (temp > 0)
+    {
+      curved[i] = sqrt(temp);
+    }
+  }
+
+  gausCurv->Delete();
+  meanCurv->Delete();
+}
+
+//----------------------------------------------------------------------------
+// Summarize the correspondence distances, in the order of the points.
+static void vtkPolyDataCorrespondenceStatistics(vtkDoubleArray *distances, int n1, int printOutput,
+                                                double &mean, double &rms)
+{
+  double ave = 0.0,std = 0.0,min = 1E300,max = 0.0,RMS = 0.0;
+  int big = 0;
+  double magn;
+
+  for (int i = 0; i < n1; i++)
+  {
+    magn = distances->GetValue(i);
+    ave = ave + magn;
+    if (magn < min)
+    {
+      min = magn;
+    }
+    if (magn > max)
+    {
+      max = magn;
+    }
+    RMS = RMS + magn * magn;
+    if (magn > 3)
+    {
+      big = big + 1;
+    }
+  }
+
+  ave = ave / n1;
+  RMS = sqrt(RMS / n1);
+
+  mean = ave;
+  rms = RMS;
+
+  for (int iGN = 0; iGN < n1; iGN++)
+  {
+    magn = distances->GetValue(iGN);
+    std = std + (magn - ave) * (magn - ave);
+  }
+  std = sqrt(std / (n1 - 1));
+
+  if (printOutput)
+  {
+    cout << "\n---------------------------------------\n";
+    cout << " Ave of Difference Magnitude = " << ave << "\n";
+    cout << " STD of Difference Magnitude = " << std << "\n";
+    cout << " Min of Difference Magnitude = " << min << "\n";
+    cout << " Max of Difference Magnitude = " << max << "\n";
+    cout << " RMS of Difference Magnitude = " << RMS << "\n";
+    cout << " Number of Difference Magnitude > 3 = " << big << "\n";
+    cout << " Total Number of Points = " << n1 << "\n";
+    cout << "---------------------------------------\n\n";
+  }
+}
+
 //----------------------------------------------------------------------------
 vtkPolyDataCorrespondence::vtkPolyDataCorrespondence()
 {
+  this->poly1 = NULL;
+  this->poly2 = NULL;
   this->ConstantN = 0.0;
   this->ConstantS = 0.0;
   this->ConstantC = 0.0;
@@ -38,6 +591,17 @@ vtkPolyDataCorrespondence::vtkPolyDataCorrespondence()
   Pairings = vtkLongArray::New();
   Pairings->SetName("Pairings");
   Pairings->SetNumberOfComponents(1);
+
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
+}
+
+//----------------------------------------------------------------------------
+vtkPolyDataCorrespondence::~vtkPolyDataCorrespondence()
+{
+  this->Distances->Delete();
+  this->Pairings->Delete();
+  this->Threader->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -55,17 +619,40 @@ void vtkPolyDataCorrespondence::SetInput2(vtkPolyData *input)
 //----------------------------------------------------------------------------
 void vtkPolyDataCorrespondence::GetAxialCorrespondenceStats()
 {
-  double x,y,z,x1,y1,z1,minMagn,magn;
   double minMagnX,minMagnY,minMagnZ;
   double aveX,aveY,aveZ;
   double minX,minY,minZ;
   double maxX,maxY,maxZ;
   double RMSX,RMSY,RMSZ;
 
+  if (!this->poly1 || !this->poly2 ||
+      this->poly1->GetNumberOfPoints() == 0 || this->poly2->GetNumberOfPoints() == 0)
+  {
+    vtkErrorMacro("Both inputs must have points.");
+    return;
+  }
+
   vtkPoints *points1 = this->poly1->GetPoints();
   vtkPoints *points2 = this->poly2->GetPoints();
   int n1 = points1->GetNumberOfPoints();
-  int n2 = points2->GetNumberOfPoints();
+
+  // pair each point with the closest point of the other surface
+  std::vector<double> flat1, flat2, dist2(n1);
+  std::vector<long> pairs(n1);
+  vtkPolyDataCorrespondenceCopyPoints(points1, flat1, -1);
+  vtkPolyDataCorrespondenceCopyPoints(points2, flat2, -1);
+  vtkPolyDataCorrespondenceGrid grid;
+  grid.Build(&(flat2[0]), (int) flat2.size() / 3);
+
+  vtkPolyDataCorrespondenceThreadStruct str;
+  str.Grid = &grid;
+  str.NumberOfPoints1 = n1;
+  str.Points1 = &(flat1[0]);
+  str.Distances = &(dist2[0]);
+  str.Pairings = &(pairs[0]);
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+  this->Threader->SetSingleMethod(vtkPolyDataCorrespondenceClosestExecute, &str);
+  this->Threader->SingleMethodExecute();
 
   minX = 1E300;
   minY = 1E300;
@@ -81,26 +668,11 @@ void vtkPolyDataCorrespondence::GetAxialCorrespondenceStats()
   aveZ = 0.0;
   for (int i = 0; i < n1; i++)
   {
-    x1 = points1->GetPoint(i)[0];
-    y1 = points1->GetPoint(i)[1];
-    z1 = points1->GetPoint(i)[2];
-    minMagn = 1E300;
-    for (int j = 0; j < n2; j++)
-    {
-      x = x1 - points2->GetPoint(j)[0];
-      y = y1 - points2->GetPoint(j)[1];
-      z = z1 - points2->GetPoint(j)[2];
-
-      magn = x*x + y*y + z*z;
-
-      if (magn < minMagn)
-      {
-        minMagn = magn;
-        minMagnX = fabs(x);
-        minMagnY = fabs(y);
-        minMagnZ = fabs(z);
-      }
-    }
+    const double *pnt1 = &(flat1[3*i]);
+    const double *pnt2 = &(flat2[3*pairs[i]]);
+    minMagnX = fabs(pnt1[0] - pnt2[0]);
+    minMagnY = fabs(pnt1[1] - pnt2[1]);
+    minMagnZ = fabs(pnt1[2] - pnt2[2]);
 
     aveX = aveX + minMagnX;
     aveY = aveY + minMagnY;
@@ -158,14 +730,12 @@ void vtkPolyDataCorrespondence::GetAxialCorrespondenceStats()
 //----------------------------------------------------------------------------
 void vtkPolyDataCorrespondence::Update2D()
 {
-  double pnt1[3],pnt1a[3],pnt1b[3],pnt2[3],pnt2a[3],pnt2b[3];
-  double vect1a[3],vect1b[3],vect2a[3],vect2b[3],dotProd;
-  double minMagn,magn;
-  double cost,minCost;
-  double pair;
-  double ave = 0.0,std = 0.0,min = 1E300,max = 0.0,RMS = 0.0;
-  int big = 0;
-  int i,j,k;
+  if (!this->poly1 || !this->poly2 ||
+      this->poly1->GetNumberOfPoints() == 0 || this->poly2->GetNumberOfPoints() == 0)
+  {
+    vtkErrorMacro("Both inputs must have points.");
+    return;
+  }
 
   vtkPoints *points1 = this->poly1->GetPoints();
   vtkPoints *points2 = this->poly2->GetPoints();
@@ -175,196 +745,60 @@ void vtkPolyDataCorrespondence::Update2D()
   this->Distances->SetNumberOfTuples(n1);
   this->Pairings->SetNumberOfTuples(n1);
 
+  // distances are measured in the slice, so flatten the slice axis
+  std::vector<double> flat1, flat2;
+  vtkPolyDataCorrespondenceCopyPoints(points1, flat1, this->SliceAxis);
+  vtkPolyDataCorrespondenceCopyPoints(points2, flat2, this->SliceAxis);
+
+  vtkPolyDataCorrespondenceThreadStruct str;
+  str.NumberOfPoints1 = n1;
+  str.NumberOfPoints2 = n2;
+  str.Points1 = &(flat1[0]);
+  str.Points2 = &(flat2[0]);
+  str.ConstantN = this->ConstantN;
+  str.Distances = this->Distances->GetPointer(0);
+  str.Pairings = this->Pairings->GetPointer(0);
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+
   // CASE 1: All constants are 0, so do simple magnitude minimization calcultion.
   if ( (this->ConstantN == 0.0) && (this->ConstantS == 0) && (this->ConstantC == 0) )
   {
-    for (i = 0; i < n1; i++)
+    vtkPolyDataCorrespondenceGrid grid;
+    grid.Build(str.Points2, n2);
+    str.Grid = &grid;
+    this->Threader->SetSingleMethod(vtkPolyDataCorrespondenceClosestExecute, &str);
+    this->Threader->SingleMethodExecute();
+    for (int i = 0; i < n1; i++)
     {
-      minMagn = 1E300;
-      minCost = 1E300;
-      memcpy(pnt1, points1->GetPoint(i), sizeof(double)*3);
-
-      for (j = 0; j < n2; j++)
-      {
-        memcpy(pnt2, points2->GetPoint(j), sizeof(double)*3);
-        magn = 0.0;
-        for (k = 0; k < 3; k++)
-        {
-          if (k != this->SliceAxis)
-          {
-            magn = magn + (pnt1[k] - pnt2[k]) * (pnt1[k] - pnt2[k]);
-          }
-        }
-        magn = sqrt(magn);
-
-        cost = (magn);
-        if (cost < minCost)
-        {
-          minCost = cost;
-          minMagn = magn;
-          pair = j;
-        }
-      }
-
-      this->Distances->SetTuple1(i,minMagn);
-      this->Pairings->SetTuple1(i,pair);
-      ave = ave + minMagn;
-      if (minMagn < min)
-      {
-        min = minMagn;
-      }
-      if (minMagn > max)
-      {
-        max = minMagn;
-      }
-      RMS = RMS + minMagn * minMagn;
-      if (minMagn > 3)
-      {
-        big = big + 1;
-      }
+      str.Distances[i] = sqrt(str.Distances[i]);
     }
   }
 
   // CASE 2: Do the complete calculation.
   else
   {
-    for (i = 0; i < n1; i++)
-    {
-      minMagn = 1E300;
-      minCost = 1E300;
-
-      memcpy(pnt1, points1->GetPoint(i), sizeof(double)*3);
-      if (i+1 < n1)
-      {
-        memcpy(pnt1a, points1->GetPoint(i+1 ), sizeof(double)*3);
-      }
-      else
-      {
-        memcpy(pnt1a, points1->GetPoint( 0  ), sizeof(double)*3);
-      }
-      if (i-1 >  0)
-      {
-        memcpy(pnt1b, points1->GetPoint(i-1 ), sizeof(double)*3);
-      }
-      else
-      {
-        memcpy(pnt1b, points1->GetPoint(n1-1), sizeof(double)*3);
-      }
-      vect1a[0] = pnt1a[0] - pnt1[0];
-      vect1a[1] = pnt1a[1] - pnt1[1];
-      vect1a[2] = pnt1a[2] - pnt1[2];
-      vect1b[0] = pnt1[0] - pnt1b[0];
-      vect1b[1] = pnt1[1] - pnt1b[1];
-      vect1b[2] = pnt1[2] - pnt1b[2];
-
-      for (j = 0; j < n2; j++)
-      {
-
-        memcpy(pnt2, points2->GetPoint(j), sizeof(double)*3);
-        if (j+1 < n2)
-        {
-          memcpy(pnt2a, points2->GetPoint(j+1 ), sizeof(double)*3);
-        }
-        else
-        {
-          memcpy(pnt2a, points2->GetPoint( 0  ), sizeof(double)*3);
-        }
-        if (j-1 >  0)
-        {
-          memcpy(pnt2b, points2->GetPoint(j-1 ), sizeof(double)*3);
-        }
-        else
-        {
-          memcpy(pnt2b, points2->GetPoint(n2-1), sizeof(double)*3);
-        }
-        vect2a[0] = pnt2a[0] - pnt2[0];
-        vect2a[1] = pnt2a[1] - pnt2[1];
-        vect2a[2] = pnt2a[2] - pnt2[2];
-        vect2b[0] = pnt2[0] - pnt2b[0];
-        vect2b[1] = pnt2[1] - pnt2b[1];
-        vect2b[2] = pnt2[2] - pnt2b[2];
-
-        dotProd = ( vect1a[0]*vect2a[0] + vect1a[1]*vect2a[1] + vect1a[2]*vect2a[2] +
-                    vect1b[0]*vect2b[0] + vect1b[1]*vect2b[1] + vect1b[2]*vect2b[2] );
-
-        magn = 0.0;
-        for (k = 0; k < 3; k++)
-        {
-          if (k != this->SliceAxis)
-          {
-            magn = magn + (pnt1[k] - pnt2[k]) * (pnt1[k] - pnt2[k]);
-          }
-        }
-
-        magn = sqrt(magn);
-
-        cost = (magn + this->ConstantN * (1.0 - dotProd/2.0));
-
-        if (cost < minCost)
-        {
-          minCost = cost;
-          minMagn = magn;
-          pair = j;
-        }
-      }
-
-      this->Distances->SetTuple1(i,minMagn);
-      this->Pairings->SetTuple1(i,pair);
-      ave = ave + minMagn;
-      if (minMagn < min)
-      {
-        min = minMagn;
-      }
-      if (minMagn > max)
-      {
-        max = minMagn;
-      }
-      RMS = RMS + minMagn * minMagn;
-      if (minMagn > 3)
-      {
-        big = big + 1;
-      }
-    }
-  }
-
-  ave = ave / n1;
-  RMS = sqrt(RMS / n1);
-
-  this->MeanDistance = ave;
-  this->RMSDistance = RMS;
-
-  for (int iGN = 0; iGN < n1; iGN++)
-  {
-    magn = this->Distances->GetTuple1(iGN);
-    std = std + (magn - ave) * (magn - ave);
+    std::vector<double> edges1, edges2;
+    vtkPolyDataCorrespondenceContourEdges(points1, edges1);
+    vtkPolyDataCorrespondenceContourEdges(points2, edges2);
+    str.Edges1 = &(edges1[0]);
+    str.Edges2 = &(edges2[0]);
+    this->Threader->SetSingleMethod(vtkPolyDataCorrespondenceContourExecute, &str);
+    this->Threader->SingleMethodExecute();
   }
-  std = sqrt(std / (n1 - 1));
 
-  if (this->PrintOutput)
-  {
-    cout << "\n---------------------------------------\n";
-    cout << " Ave of Difference Magnitude = " << ave << "\n";
-    cout << " STD of Difference Magnitude = " << std << "\n";
-    cout << " Min of Difference Magnitude = " << min << "\n";
-    cout << " Max of Difference Magnitude = " << max << "\n";
-    cout << " RMS of Difference Magnitude = " << RMS << "\n";
-    cout << " Number of Difference Magnitude > 3 = " << big << "\n";
-    cout << " Total Number of Points = " << n1 << "\n";
-    cout << "---------------------------------------\n\n";
-  }
+  vtkPolyDataCorrespondenceStatistics(this->Distances, n1, this->PrintOutput,
+                                      this->MeanDistance, this->RMSDistance);
 }
 
 //----------------------------------------------------------------------------
 void vtkPolyDataCorrespondence::Update3D()
 {
-  double pnt1[3],pnt2[3],norm1[3],norm2[3],curv1[2],curv2[2];
-  double minMagn,magn,normdot;
-  double temp1,temp2,shape1,shape2,curved1,curved2;
-  double cost,minCost;
-  double pair;
-  double ave = 0.0,std = 0.0,min = 1E300,max = 0.0,RMS = 0.0;
-  int big = 0;
-  int i,j;
+  if (!this->poly1 || !this->poly2 ||
+      this->poly1->GetNumberOfPoints() == 0 || this->poly2->GetNumberOfPoints() == 0)
+  {
+    vtkErrorMacro("Both inputs must have points.");
+    return;
+  }
 
   vtkPoints *points1 = this->poly1->GetPoints();
   vtkPoints *points2 = this->poly2->GetPoints();
@@ -374,293 +808,107 @@ void vtkPolyDataCorrespondence::Update3D()
   this->Distances->SetNumberOfTuples(n1);
   this->Pairings->SetNumberOfTuples(n1);
 
+  std::vector<double> flat1, flat2;
+  vtkPolyDataCorrespondenceCopyPoints(points1, flat1, -1);
+  vtkPolyDataCorrespondenceCopyPoints(points2, flat2, -1);
+  vtkPolyDataCorrespondenceGrid grid;
+  grid.Build(&(flat2[0]), n2);
+
+  vtkPolyDataCorrespondenceThreadStruct str;
+  str.Grid = &grid;
+  str.NumberOfPoints1 = n1;
+  str.NumberOfPoints2 = n2;
+  str.Points1 = &(flat1[0]);
+  str.Points2 = &(flat2[0]);
+  str.Shape1 = str.Shape2 = str.Curved1 = str.Curved2 = 0;
+  str.ConstantN = this->ConstantN;
+  str.ConstantS = this->ConstantS;
+  str.ConstantC = this->ConstantC;
+  str.Distances = this->Distances->GetPointer(0);
+  str.Pairings = this->Pairings->GetPointer(0);
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+
   // CASE 1: All constants are 0, so do simple magnitude minimization calcultion.
   if ( (this->ConstantN == 0.0) && (this->ConstantS == 0) && (this->ConstantC == 0) )
   {
-    for (i = 0; i < n1; i++)
+    this->Threader->SetSingleMethod(vtkPolyDataCorrespondenceClosestExecute, &str);
+    this->Threader->SingleMethodExecute();
+    for (int i = 0; i < n1; i++)
     {
-      minMagn = 1E300;
-      minCost = 1E300;
-      memcpy(pnt1, points1->GetPoint(i), sizeof(double)*3);
-
-      for (j = 0; j < n2; j++)
-      {
-        memcpy(pnt2, points2->GetPoint(j), sizeof(double)*3);
-        magn = sqrt( (pnt1[0] - pnt2[0]) * (pnt1[0] - pnt2[0]) +
-                     (pnt1[1] - pnt2[1]) * (pnt1[1] - pnt2[1]) +
-                     (pnt1[2] - pnt2[2]) * (pnt1[2] - pnt2[2]) );
-
-        cost = (magn);
-
-        if (cost < minCost)
-        {
-          minCost = cost;
-          minMagn = magn;
-          pair = j;
-        }
-      }
-
-      this->Distances->SetTuple1(i,minMagn);
-      this->Pairings->SetTuple1(i,pair);
-      ave = ave + minMagn;
-      if (minMagn < min)
-      {
-        min = minMagn;
-      }
-      if (minMagn > max)
-      {
-        max = minMagn;
-      }
-      RMS = RMS + minMagn * minMagn;
-      if (minMagn > 3)
-      {
-        big = big + 1;
-      }
+      str.Distances[i] = sqrt(str.Distances[i]);
     }
   }
 
-  // CASE 2: As above but with the addition of the normals term.
-  else if ( (this->ConstantN != 0.0) && (this->ConstantS == 0) && (this->ConstantC == 0) )
+  // CASE 2 and 3: As above but with the addition of the normals term, and of
+  // the shape and curvedness terms if they are used. Only points within the
+  // search radius are considered.
+  else
   {
-    vtkDataArray *normals1 = this->poly1->GetPointData()->GetNormals();
-    vtkDataArray *normals2 = this->poly2->GetPointData()->GetNormals();
-
-    for (i = 0; i < n1; i++)
+    std::vector<double> normals1, normals2;
+    if (!vtkPolyDataCorrespondenceCopyNormals(this->poly1, normals1) ||
+        !vtkPolyDataCorrespondenceCopyNormals(this->poly2, normals2))
     {
-      minMagn = 20.0;
-      minCost = 1E300;
-      memcpy(pnt1, points1->GetPoint(i), sizeof(double)*3);
-      memcpy(norm1, normals1->GetTuple3(i), sizeof(double)*3);
-
-      for (j = 0; j < n2; j++)
-      {
-        memcpy(pnt2, points2->GetPoint(j), sizeof(double)*3);
-        magn = sqrt( (pnt1[0] - pnt2[0]) * (pnt1[0] - pnt2[0]) +
-                     (pnt1[1] - pnt2[1]) * (pnt1[1] - pnt2[1]) +
-                     (pnt1[2] - pnt2[2]) * (pnt1[2] - pnt2[2]) );
-        if (magn < 20.0)
-        {
-          memcpy(norm2, normals2->GetTuple3(j), sizeof(double)*3);
-          normdot = norm1[0]*norm2[0] + norm1[1]*norm2[1] + norm1[2]*norm2[2];
-
-          cost = ( magn + this->ConstantN * (1.0 - normdot) );
-
-          if (cost < minCost)
-          {
-            minCost = cost;
-            minMagn = magn;
-            pair = j;
-          }
-        }
-      }
-
-      this->Distances->SetTuple1(i,minMagn);
-      this->Pairings->SetTuple1(i,pair);
-      ave = ave + minMagn;
-      if (minMagn < min)
-      {
-        min = minMagn;
-      }
-      if (minMagn > max)
-      {
-        max = minMagn;
-      }
-      RMS = RMS + minMagn * minMagn;
-      if (minMagn > 3)
-      {
-        big = big + 1;
-      }
+      vtkErrorMacro("Both inputs must have point normals.");
+      return;
     }
-  }
+    str.Normals1 = &(normals1[0]);
+    str.Normals2 = &(normals2[0]);
 
-  // CASE 3: Do the complete calculation.
-  else
-  {
-    vtkDataArray *normals1 = this->poly1->GetPointData()->GetNormals();
-    vtkDataArray *normals2 = this->poly2->GetPointData()->GetNormals();
-
-    vtkCurvatures *gausCurv1 = vtkCurvatures::New();
-    vtkCurvatures *meanCurv1 = vtkCurvatures::New();
-    vtkCurvatures *gausCurv2 = vtkCurvatures::New();
-    vtkCurvatures *meanCurv2 = vtkCurvatures::New();
-
-    gausCurv1->SetCurvatureTypeToGaussian();
-    gausCurv1->SetInputData(this->poly1);
-    gausCurv1->Update();
-    meanCurv1->SetCurvatureTypeToMean();
-    meanCurv1->SetInputData(this->poly1);
-    meanCurv1->InvertMeanCurvatureOn();
-    meanCurv1->Update();
-    gausCurv2->SetCurvatureTypeToGaussian();
-    gausCurv2->SetInputData(this->poly1);
-    gausCurv2->Update();
-    meanCurv2->SetCurvatureTypeToMean();
-    meanCurv2->SetInputData(this->poly1);
-    meanCurv2->InvertMeanCurvatureOn();
-    meanCurv2->Update();
-
-    for (i = 0; i < n1; i++)
+    std::vector<double> shape1, shape2, curved1, curved2;
+    if ( (this->ConstantS != 0) || (this->ConstantC != 0) )
     {
-      minMagn = 20.0;
-      minCost = 1E300;
-      memcpy(pnt1, points1->GetPoint(i), sizeof(double)*3);
-      memcpy(norm1, normals1->GetTuple3(i), sizeof(double)*3);
-      curv1[0] = gausCurv1->GetOutput()->GetPointData()->GetScalars()->GetTuple1(i);
-      curv1[1] = meanCurv1->GetOutput()->GetPointData()->GetScalars()->GetTuple1(i);
-
-      for (j = 0; j < n2; j++)
-      {
-        memcpy(pnt2, points2->GetPoint(j), sizeof(double)*3);
-        magn = sqrt( (pnt1[0] - pnt2[0]) * (pnt1[0] - pnt2[0]) +
-                     (pnt1[1] - pnt2[1]) * (pnt1[1] - pnt2[1]) +
-                     (pnt1[2] - pnt2[2]) * (pnt1[2] - pnt2[2]) );
-        if (magn < 20.0)
-        {
-          memcpy(norm2, normals2->GetTuple3(j), sizeof(double)*3);
-          normdot = norm1[0]*norm2[0] + norm1[1]*norm2[1] + norm1[2]*norm2[2];
-          curv2[0]=gausCurv2->GetOutput()->GetPointData()->GetScalars()->GetTuple1(j);
-          curv2[1]=meanCurv2->GetOutput()->GetPointData()->GetScalars()->GetTuple1(j);
-
-          temp1 = curv1[1]*curv1[1] - curv1[0];
-          if (temp1 > 0.0)
-          {
-            shape1 = 0.636619772368 * atan( -curv1[1] / sqrt(temp1) );
-          }
-          else
-          {
-            if (curv1[1] <= 0.0)
-            {
-              shape1 = 1.0;
-            }
-            if (curv1[1] > 0.0)
-            {
-              shape1 = -1.0;
-            }
-          }
-
-          temp2 = curv2[1]*curv2[1] - curv2[0];
-          if (temp2 > 0.0)
-          {
-            shape2 = 0.636619772368 * atan( -curv2[1] / sqrt(temp2) );
-          }
-          else
-          {
-            if (curv2[1] <= 0.0)
-            {
-              shape2 = 1.0;
-            }
-            if (curv2[1] > 0.0)
-            {
-              shape2 = -1.0;
-            }
-          }
-
-          curved1 = 0.0;
-          temp1 = 2.0 * curv1[1] * curv1[1] - curv1[0];
-          if (temp1 > 0)
-          {
-            curved1 = sqrt(temp1);
-          }
-          curved2 = 0.0;
-          temp2 = 2.0 * curv2[1] * curv2[1] - curv2[0];
-          if (temp2 > 0)
-          {
-            curved2 = sqrt(temp2);
-          }
-
-          cost = ( magn +
-                   this->ConstantN * (1.0 - normdot) +
-                   this->ConstantS * fabs(shape1 - shape2) +
-                   this->ConstantC * fabs(curved1 - curved2) );
-
-          if (cost < minCost)
-          {
-            minCost = cost;
-            minMagn = magn;
-            pair = j;
-          }
-        }
-      }
-
-      this->Distances->SetTuple1(i,minMagn);
-      this->Pairings->SetTuple1(i,pair);
-      ave = ave + minMagn;
-      if (minMagn < min)
-      {
-        min = minMagn;
-      }
-      if (minMagn > max)
-      {
-        max = minMagn;
-      }
-      RMS = RMS + minMagn * minMagn;
-      if (minMagn > 3)
-      {
-        big = big + 1;
-      }
-
+      vtkPolyDataCorrespondenceShape(this->poly1, shape1, curved1);
+      vtkPolyDataCorrespondenceShape(this->poly2, shape2, curved2);
+      str.Shape1 = &(shape1[0]);
+      str.Shape2 = &(shape2[0]);
+      str.Curved1 = &(curved1[0]);
+      str.Curved2 = &(curved2[0]);
     }
-  }
-
-  ave = ave / n1;
-  RMS = sqrt(RMS / n1);
-
-  this->MeanDistance = ave;
-  this->RMSDistance = RMS;
 
-  for (int iGN = 0; iGN < n1; iGN++)
-  {
-    magn = this->Distances->GetTuple1(i);
-    std = std + (magn - ave) * (magn - ave);
-  }
-  std = sqrt(std / (n1 - 1));
-
-  if (this->PrintOutput)
-  {
-    cout << "\n---------------------------------------\n";
-    cout << " Ave of Difference Magnitude = " << ave << "\n";
-    cout << " STD of Difference Magnitude = " << std << "\n";
-    cout << " Min of Difference Magnitude = " << min << "\n";
-    cout << " Max of Difference Magnitude = " << max << "\n";
-    cout << " RMS of Difference Magnitude = " << RMS << "\n";
-    cout << " Number of Difference Magnitude > 3 = " << big << "\n";
-    cout << " Total Number of Points = " << n1 << "\n";
-    cout << "---------------------------------------\n\n";
+    this->Threader->SetSingleMethod(vtkPolyDataCorrespondenceFeatureExecute, &str);
+    this->Threader->SingleMethodExecute();
   }
 
+  vtkPolyDataCorrespondenceStatistics(this->Distances, n1, this->PrintOutput,
+                                      this->MeanDistance, this->RMSDistance);
 };
 
 //----------------------------------------------------------------------------
 void vtkPolyDataCorrespondence::Update3DFast()
 {
-  double pnt1[3],pnt2[3];
-  double minMagnSqrd,magnSqrd,RMS = 0.0;
-  int i,j;
+  if (!this->poly1 || !this->poly2 ||
+      this->poly1->GetNumberOfPoints() == 0 || this->poly2->GetNumberOfPoints() == 0)
+  {
+    vtkErrorMacro("Both inputs must have points.");
+    return;
+  }
 
   vtkPoints *points1 = this->poly1->GetPoints();
   vtkPoints *points2 = this->poly2->GetPoints();
   int n1 = points1->GetNumberOfPoints();
   int n2 = points2->GetNumberOfPoints();
 
-  for (i = 0; i < n1; i++)
+  std::vector<double> flat1, flat2, minMagnSqrd(n1);
+  std::vector<long> pairs(n1);
+  vtkPolyDataCorrespondenceCopyPoints(points1, flat1, -1);
+  vtkPolyDataCorrespondenceCopyPoints(points2, flat2, -1);
+  vtkPolyDataCorrespondenceGrid grid;
+  grid.Build(&(flat2[0]), n2);
+
+  vtkPolyDataCorrespondenceThreadStruct str;
+  str.Grid = &grid;
+  str.NumberOfPoints1 = n1;
+  str.Points1 = &(flat1[0]);
+  str.Distances = &(minMagnSqrd[0]);
+  str.Pairings = &(pairs[0]);
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+  this->Threader->SetSingleMethod(vtkPolyDataCorrespondenceClosestExecute, &str);
+  this->Threader->SingleMethodExecute();
+
+  double RMS = 0.0;
+  for (int i = 0; i < n1; i++)
   {
-    minMagnSqrd = 1E300;
-    memcpy(pnt1, points1->GetPoint(i), sizeof(double)*3);
-
-    for (j = 0; j < n2; j++)
-    {
-      memcpy(pnt2, points2->GetPoint(j), sizeof(double)*3);
-      magnSqrd = ( (pnt1[0] - pnt2[0]) * (pnt1[0] - pnt2[0]) +
-                   (pnt1[1] - pnt2[1]) * (pnt1[1] - pnt2[1]) +
-                   (pnt1[2] - pnt2[2]) * (pnt1[2] - pnt2[2]) );
-
-      if (magnSqrd < minMagnSqrd)
-      {
-        minMagnSqrd = magnSqrd;
-      }
-    }
-
-    RMS = RMS + minMagnSqrd;
+    RMS = RMS + minMagnSqrd[i];
   }
 
   this->RMSDistance = sqrt(RMS / n1);
@@ -695,4 +943,5 @@ double vtkPolyDataCorrespondence::GetRMSDistance()
 void vtkPolyDataCorrespondence::PrintSelf(ostream& os, vtkIndent indent)
 {
   vtkPolyDataAlgorithm::PrintSelf(os,indent);
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
 }
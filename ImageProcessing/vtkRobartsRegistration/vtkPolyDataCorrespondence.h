@@ -32,6 +32,8 @@
 #include "vtkCurvatures.h"
 #include "vtkPolyDataNormals.h"
 
+class vtkMultiThreader;
+
 class vtkRobartsRegistrationExport vtkPolyDataCorrespondence : public vtkPolyDataAlgorithm
 {
 public:
@@ -53,6 +55,11 @@ public:
   vtkSetMacro(SliceAxis,int);
   vtkSetMacro(PrintOutput,int);
 
+  // Description:
+  // Set the number of threads used to find the correspondences.
+  vtkSetClampMacro(NumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads,int);
+
   void Update2D();
   void Update3D();
   void Update3DFast();
@@ -64,7 +71,7 @@ public:
 
 protected:
   vtkPolyDataCorrespondence();
-  ~vtkPolyDataCorrespondence() {};
+  ~vtkPolyDataCorrespondence();
 
   vtkPolyData *poly1;
   vtkPolyData *poly2;
@@ -81,6 +88,9 @@ protected:
   double MeanDistance;
   double RMSDistance;
 
+  vtkMultiThreader *Threader;
+  int NumberOfThreads;
+
 private:
   vtkPolyDataCorrespondence(const vtkPolyDataCorrespondence&);  // Not implemented.
   void operator=(const vtkPolyDataCorrespondence&);  // Not implemented.
@@ -1,6 +1,8 @@
 #include "vtkPowellMinimizer.h"
 #include "vtkObjectFactory.h"
 
+#include <string.h>
+
 
 #define SHFT(a,b,c,d) (a)=(b);(b)=(c);(c)=(d) // for mnbrak and brent
 
@@ -10,34 +12,39 @@
 // This requires the multiplication of each of the parameters passed in curParms
 // by the actual value for the single variable function, placing the results in
 // The *parms vector which can be accessed by the objective function when it is
-// called. It places its result into the *retParm parameter.
+// called. It places its result into the *retParm parameter. The first two
+// points are independent, and are evaluated together by *batch.
 #define GOLD 1.618034
 #define GLIMIT 100.0
 #define TINY 1.0e-20
-static double maxarg1, maxarg2;
-#define FMAX(a,b) (maxarg1=(a),maxarg2=(b), (maxarg1) > (maxarg2) ? (maxarg1) : (maxarg2))
 #define SIGN(a,b) ((b) >= 0.0 ? fabs(a): -fabs(a))
 
+// mnbrak can run on several threads at once, so this must not keep its
+// arguments in statics as the FMAX macro of Numerical Recipes does.
+static inline double vtkPowellMinimizerMax(double a, double b)
+{
+  return (a > b ? a : b);
+}
+
 static void mnbrak(double *ax, double *bx, double *cx, double *fa, double *fb, double *fc,
-                   double *xi, void (*funk)(void *data), double *curParms, double *parms,
-                   double *retParm, int n, void *data)
+                   double *xi, void (*funk)(void *data),
+                   void (*batch)(void *data, int k, const double *points, double *results),
+                   double *curParms, double *parms, double *retParm, int n, void *data)
 {
   double ulim, u,r,q,fu,dum;
+  double fab[2];
   int i;
 
+  double *pab = new double[2*n];
   for (i=0; i<n; i++)
   {
-    parms[i] = curParms[i]+xi[i]*(*ax);
-  }
-  (*funk)(data);
-  *fa = (*retParm);
-
-  for (i=0; i<n; i++)
-  {
-    parms[i] = curParms[i]+xi[i]*(*bx);
+    pab[i] = curParms[i]+xi[i]*(*ax);
+    pab[n+i] = curParms[i]+xi[i]*(*bx);
   }
-  (*funk)(data);
-  *fb = (*retParm);
+  (*batch)(data, 2, pab, fab);
+  *fa = fab[0];
+  *fb = fab[1];
+  delete [] pab;
 
   if (*fb > *fa)
   {
@@ -59,7 +66,7 @@ static void mnbrak(double *ax, double *bx, double *cx, double *fa, double *fb, d
     r = (*bx-*ax)*(*fb-*fc);
     q = (*bx-*cx)*(*fb-*fa);
     u = (*bx)-((*bx-*cx)*q-(*bx-*ax)*r)/
-        (2.0*SIGN(FMAX(fabs(q-r),TINY),q-r));
+        (2.0*SIGN(vtkPowellMinimizerMax(fabs(q-r),TINY),q-r));
     ulim=(*bx)+GLIMIT*(*cx-*bx);
     if ((*bx-u)*(u-*cx) > 0.0)
     {
@@ -141,11 +148,11 @@ static void mnbrak(double *ax, double *bx, double *cx, double *fa, double *fb, d
 
 // a modified brent which knows about the whole multidimensional problem
 // and computes its own parameter sets parametrized by the minimization
-// factor.
+// factor. The value fbx at bx is known from mnbrak.
 #define ITMAX 100
 #define CGOLD 0.3819660
 #define ZEPS 1.0e-10;
-static double brent (double ax, double bx, double cx, double tol, int n,
+static double brent (double ax, double bx, double cx, double fbx, double tol, int n,
                      double *xmin, double *xi, void (*funk)(void *data), double *curParms,
                      double *parms, double *retParm, void *data)
 {
@@ -158,13 +165,7 @@ static double brent (double ax, double bx, double cx, double tol, int n,
   x=w=v=bx;
   //    cout << "curParms ("<<curParms[0]<<","<<curParms[1]<<")";
   //   cout << "a="<<a<<" b="<<b<<" x="<<x<<"\n";
-  for (i=0; i<n; i++)
-  {
-    parms[i] = curParms[i]+xi[i]*x;
-  }
-  //  cout << "call 1\n";
-  (*funk)(data);
-  fw=fv=fx=(*retParm);
+  fw=fv=fx=fbx;
   for(iter=1; iter<=ITMAX; iter++)
   {
     xm=0.5*(a+b);
@@ -265,8 +266,9 @@ static double brent (double ax, double bx, double cx, double tol, int n,
 
 #define TOL 0.005
 static void linmin(double *p, double *xi, int n, double *fret,
-                   void (*funk)(void *data), double *parms, double *retParm,
-                   void *data)
+                   void (*funk)(void *data),
+                   void (*batch)(void *data, int k, const double *points, double *results),
+                   double *parms, double *retParm, void *data)
 {
   int j;
   double xx, xmin, fx, fb, fa, bx, ax;
@@ -274,9 +276,9 @@ static void linmin(double *p, double *xi, int n, double *fret,
   ax = 0.0;
   xx = 1.0;
   //    cout << "before mnbrak\n";
-  mnbrak (&ax, &xx, &bx, &fa, &fx, &fb, xi, funk, p, parms, retParm, n, data);
+  mnbrak (&ax, &xx, &bx, &fa, &fx, &fb, xi, funk, batch, p, parms, retParm, n, data);
   //    cout << "before brent\n";
-  *fret = brent(ax, xx, bx, TOL, n, &xmin, xi, funk, p, parms, retParm, data);
+  *fret = brent(ax, xx, bx, fx, TOL, n, &xmin, xi, funk, p, parms, retParm, data);
   for (j=0; j<n; j++)
   {
     xi[j] *=xmin;
@@ -285,9 +287,10 @@ static void linmin(double *p, double *xi, int n, double *fret,
 }
 
 
-static void powell(double *p, double **xi, int n, double ftol,
-                   int *iter, double *retParm, void (*funk)(void *data),
-                   double *parms, void *data)
+static double powell(double *p, double **xi, int n, double ftol,
+                     int *iter, double *retParm, void (*funk)(void *data),
+                     void (*batch)(void *data, int k, const double *points, double *results),
+                     double *parms, void *data)
 {
   int i, ibig, j;
   double del, fp, fptt, t;
@@ -319,7 +322,7 @@ static void powell(double *p, double **xi, int n, double ftol,
       }
       fptt=fret;
       //           cout << "fret before linmin "<< fret<<"\n";
-      linmin (p, xit, n, &fret, funk, parms, retParm, data);
+      linmin (p, xit, n, &fret, funk, batch, parms, retParm, data);
       //    cout << "fret after linmin "<< fret<<"\n";
       if (fabs(fptt-fret) > del)
       {
@@ -332,7 +335,7 @@ static void powell(double *p, double **xi, int n, double ftol,
       delete [] pt;
       delete [] ptt;
       delete [] xit;
-      return;
+      return fret;
     }
     if (*iter == ITMAX)
     {
@@ -356,7 +359,7 @@ static void powell(double *p, double **xi, int n, double ftol,
       t=2.0*(fp-2.0*fret+fptt)*sqrt(fp-fret-del)-del*sqrt(fp-fptt);
       if (t < 0.0)
       {
-        linmin(p, xit, n, &fret, funk, parms, retParm, data);
+        linmin(p, xit, n, &fret, funk, batch, parms, retParm, data);
         if (ibig>2)
         {
           cout << "bad shit going down\n";
@@ -373,13 +376,101 @@ static void powell(double *p, double **xi, int n, double ftol,
 
 
 
+//----------------------------------------------------------------------------
+namespace
+{
+  // One minimization run, which is passed to the numerical recipes
+  // routines in place of the minimizer. They write the point to evaluate
+  // into Parameters and read the value from Result.
+  struct vtkPowellMinimizerRun
+  {
+    vtkPowellMinimizer *Self;
+    double *Parameters;
+    double Result;
+    int Serial;
+    int ThreadId;
+  };
+
+  struct vtkPowellMinimizerPointsStruct
+  {
+    vtkPowellMinimizer *Self;
+    int NumberOfPoints;
+    const double *Points;
+    double *Results;
+  };
+
+  struct vtkPowellMinimizerStartsStruct
+  {
+    vtkPowellMinimizer *Self;
+    int NumberOfStarts;
+    double *Minima;
+    double *Results;
+    int *Iterations;
+  };
+}
+
+//----------------------------------------------------------------------------
+static void vtkPowellMinimizerGetRange(int n, int threadId, int threadCount,
+                                       int &first, int &last)
+{
+  first = (int)(((vtkTypeInt64) n * threadId) / threadCount);
+  last = (int)(((vtkTypeInt64) n * (threadId + 1)) / threadCount);
+}
+
+//----------------------------------------------------------------------------
 void vtkPowellMinimizerFunction(void *data)
 {
-  vtkPowellMinimizer *self = (vtkPowellMinimizer *)data;
-  if (self->Function)
+  vtkPowellMinimizerRun *run = (vtkPowellMinimizerRun *)data;
+  run->Result = run->Self->EvaluatePoint(run->ThreadId, run->Parameters);
+}
+
+//----------------------------------------------------------------------------
+void vtkPowellMinimizerBatch(void *data, int numberOfPoints, const double *points,
+                             double *results)
+{
+  vtkPowellMinimizerRun *run = (vtkPowellMinimizerRun *)data;
+  run->Self->EvaluatePoints(numberOfPoints, points, results, run->Serial, run->ThreadId);
+}
+
+//----------------------------------------------------------------------------
+// Evaluate a range of the points on each thread.
+VTK_THREAD_RETURN_TYPE vtkPowellMinimizerPointsExecute(void *arg)
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkPowellMinimizerPointsStruct *str = static_cast<vtkPowellMinimizerPointsStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int first, last;
+  vtkPowellMinimizerGetRange(str->NumberOfPoints, threadId, threadCount, first, last);
+  int n = str->Self->NumberOfParameters;
+  for (int i = first; i < last; i++)
   {
-    self->Function(self->FunctionArg);
+    str->Results[i] = str->Self->EvaluatePoint(threadId, &str->Points[i*n]);
   }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Minimize from a range of the starting points on each thread.
+VTK_THREAD_RETURN_TYPE vtkPowellMinimizerStartsExecute(void *arg)
+{
+  int threadId = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->ThreadID;
+  int threadCount = static_cast<vtkMultiThreader::ThreadInfo *>(arg)->NumberOfThreads;
+  vtkPowellMinimizerStartsStruct *str = static_cast<vtkPowellMinimizerStartsStruct *>
+    (static_cast<vtkMultiThreader::ThreadInfo *>(arg)->UserData);
+
+  int first, last;
+  vtkPowellMinimizerGetRange(str->NumberOfStarts, threadId, threadCount, first, last);
+  int n = str->Self->NumberOfParameters;
+  for (int i = first; i < last; i++)
+  {
+    str->Results[i] = str->Self->MinimizeFromPoint(&str->Minima[i*n], 1, threadId,
+                                                   &str->Iterations[i]);
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
 }
 
 //----------------------------------------------------------------------------
@@ -408,8 +499,15 @@ vtkPowellMinimizer::vtkPowellMinimizer()
   , Tolerance(0.005)
   , MaxIterations(1000)
   , Iterations(0)
+  , ThreadedFunction(NULL)
+  , ThreadedFunctionArg(NULL)
+  , BatchFunction(NULL)
+  , BatchFunctionArg(NULL)
+  , NumberOfStartingPoints(0)
+  , StartingPoints(NULL)
 {
-
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
 }
 
 //----------------------------------------------------------------------------
@@ -446,8 +544,16 @@ vtkPowellMinimizer::~vtkPowellMinimizer()
     delete [] this->ParameterBrackets;
     this->ParameterBrackets = NULL;
   }
+  if (this->StartingPoints)
+  {
+    delete [] this->StartingPoints;
+    this->StartingPoints = NULL;
+  }
 
   this->NumberOfParameters = 0;
+  this->NumberOfStartingPoints = 0;
+
+  this->Threader->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -458,6 +564,8 @@ void vtkPowellMinimizer::PrintSelf(ostream& os, vtkIndent indent)
   os << indent << "MaxIterations: " << this->MaxIterations << "\n";
   os << indent << "Iterations: " << this->Iterations << "\n";
   os << indent << "Tolerance: " << this->Tolerance << "\n";
+  os << indent << "NumberOfStartingPoints: " << this->NumberOfStartingPoints << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
 }
 
 //----------------------------------------------------------------------------
@@ -486,6 +594,65 @@ void vtkPowellMinimizer::SetFunctionArgDelete(void (*f)(void *))
   }
 }
 
+//----------------------------------------------------------------------------
+void vtkPowellMinimizer::SetThreadedFunction(double (*f)(void *, int, const double *),
+                                             void *arg)
+{
+  if ( f != this->ThreadedFunction || arg != this->ThreadedFunctionArg )
+  {
+    this->ThreadedFunction = f;
+    this->ThreadedFunctionArg = arg;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkPowellMinimizer::SetBatchFunction(void (*f)(void *, int, const double *, double *),
+                                          void *arg)
+{
+  if ( f != this->BatchFunction || arg != this->BatchFunctionArg )
+  {
+    this->BatchFunction = f;
+    this->BatchFunctionArg = arg;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkPowellMinimizer::AddStartingPoint(const double *parameters)
+{
+  int n = this->NumberOfParameters;
+  double *newStartingPoints = new double[(this->NumberOfStartingPoints + 1)*n];
+  if (this->StartingPoints)
+  {
+    memcpy(newStartingPoints, this->StartingPoints,
+           this->NumberOfStartingPoints*n*sizeof(double));
+    delete [] this->StartingPoints;
+  }
+  memcpy(&newStartingPoints[this->NumberOfStartingPoints*n], parameters, n*sizeof(double));
+  this->StartingPoints = newStartingPoints;
+  this->NumberOfStartingPoints++;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkPowellMinimizer::RemoveAllStartingPoints()
+{
+  if (this->StartingPoints)
+  {
+    delete [] this->StartingPoints;
+    this->StartingPoints = NULL;
+    this->NumberOfStartingPoints = 0;
+    this->Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+int vtkPowellMinimizer::GetNumberOfStartingPoints()
+{
+  return this->NumberOfStartingPoints;
+}
+
 //----------------------------------------------------------------------------
 double *vtkPowellMinimizer::GetScalarVariableBracket(const char *name)
 {
@@ -529,7 +696,7 @@ double vtkPowellMinimizer::GetScalarVariableValue(const char *name)
 // initialize the simplex, also find the indices of the variables
 int vtkPowellMinimizer::Initialize()
 {
-  if (!this->Function)
+  if (!this->Function && !this->ThreadedFunction && !this->BatchFunction)
   {
     vtkErrorMacro("Initialize: Function is NULL!");
     return 0;
@@ -603,6 +770,9 @@ void vtkPowellMinimizer::SetScalarVariableBracket(const char *name,
   this->Parameters = newParameters;
   this->ParameterBrackets = newParameterBrackets;
 
+  // the starting points do not have the new variable
+  this->RemoveAllStartingPoints();
+
   this->Modified();
 }
 
@@ -613,51 +783,171 @@ void vtkPowellMinimizer::SetScalarVariableBracket(const char *name, const double
 }
 
 //----------------------------------------------------------------------------
-void vtkPowellMinimizer::Minimize()
+double vtkPowellMinimizer::EvaluatePoint(int threadId, const double *parameters)
 {
-  if (!this->Initialize())
+  if (this->ThreadedFunction)
   {
-    return;
+    return this->ThreadedFunction(this->ThreadedFunctionArg, threadId, parameters);
+  }
+  if (this->Function)
+  {
+    // the function reads the parameters and sets the result
+    if (parameters != this->Parameters)
+    {
+      memcpy(this->Parameters, parameters, this->NumberOfParameters*sizeof(double));
+    }
+    this->Function(this->FunctionArg);
+    return this->ScalarResult;
   }
+  double result = 0.0;
+  this->BatchFunction(this->BatchFunctionArg, 1, parameters, &result);
+  return result;
+}
 
-  double **Vertices = new double *[this->NumberOfParameters];
-  for (int l = 0; l < this->NumberOfParameters; l++)
+//----------------------------------------------------------------------------
+void vtkPowellMinimizer::EvaluatePoints(int numberOfPoints, const double *points,
+                                        double *results, int serial, int threadId)
+{
+  int n = this->NumberOfParameters;
+  if (!serial && numberOfPoints > 1)
+  {
+    if (this->BatchFunction)
+    {
+      this->BatchFunction(this->BatchFunctionArg, numberOfPoints, points, results);
+      return;
+    }
+    if (this->ThreadedFunction && this->NumberOfThreads > 1)
+    {
+      vtkPowellMinimizerPointsStruct str;
+      str.Self = this;
+      str.NumberOfPoints = numberOfPoints;
+      str.Points = points;
+      str.Results = results;
+
+      int numThreads = this->NumberOfThreads;
+      numThreads = (numThreads < numberOfPoints) ? numThreads : numberOfPoints;
+      this->Threader->SetNumberOfThreads(numThreads);
+      this->Threader->SetSingleMethod(vtkPowellMinimizerPointsExecute, &str);
+      this->Threader->SingleMethodExecute();
+      return;
+    }
+  }
+
+  for (int i = 0; i < numberOfPoints; i++)
+  {
+    results[i] = this->EvaluatePoint(threadId, &points[i*n]);
+  }
+}
+
+//----------------------------------------------------------------------------
+double vtkPowellMinimizer::MinimizeFromPoint(double *point, int serial, int threadId,
+                                             int *iterations)
+{
+  int n = this->NumberOfParameters;
+  double **directions = new double *[n];
+  for (int l = 0; l < n; l++)
   {
-    // initial parameter values are bottom of bracket
-    this->Parameters[l] = this->ParameterBrackets[l][0];
-    Vertices[l] = new double[this->NumberOfParameters];
     // set up the initial matrix
-    for (int m = 0; m < this->NumberOfParameters; m++)
+    directions[l] = new double[n];
+    for (int m = 0; m < n; m++)
     {
-      if (m-l)
-      {
-        Vertices[l][m] = 0.0f;
-      }
-      else
-      {
-        Vertices[l][m] = 1.0f;
-      }
+      directions[l][m] = ((m == l) ? 1.0 : 0.0);
     }
   }
 
-  double *p = new double[this->NumberOfParameters];
-  for (int i=0; i<this->NumberOfParameters; i++)
+  // the point that is being evaluated
+  double *parms = new double[n];
+  memcpy(parms, point, n*sizeof(double));
+
+  vtkPowellMinimizerRun run;
+  run.Self = this;
+  run.Parameters = parms;
+  run.Result = 0.0;
+  run.Serial = serial;
+  run.ThreadId = threadId;
+
+  double result = powell(point, directions, n, this->Tolerance, iterations, &run.Result,
+                         &vtkPowellMinimizerFunction, &vtkPowellMinimizerBatch, parms, &run);
+
+  delete [] parms;
+  for (int l = 0; l < n; l++)
+  {
+    delete [] directions[l];
+  }
+  delete [] directions;
+
+  return result;
+}
+
+//----------------------------------------------------------------------------
+void vtkPowellMinimizer::Minimize()
+{
+  if (!this->Initialize())
   {
-    p[i] = this->Parameters[i];
+    return;
   }
 
-  powell(p, Vertices, this->NumberOfParameters,
-         this->Tolerance, &this->Iterations, &this->ScalarResult,
-         &vtkPowellMinimizerFunction, this->Parameters, this);
+  // initial parameter values are bottom of bracket, unless starting
+  // points were given
+  int n = this->NumberOfParameters;
+  int numStarts = this->NumberOfStartingPoints;
+  double *minima;
+  if (numStarts > 0)
+  {
+    minima = new double[numStarts*n];
+    memcpy(minima, this->StartingPoints, numStarts*n*sizeof(double));
+  }
+  else
+  {
+    numStarts = 1;
+    minima = new double[n];
+    for (int l = 0; l < n; l++)
+    {
+      minima[l] = this->ParameterBrackets[l][0];
+    }
+  }
+  double *results = new double[numStarts];
+  int *iterations = new int[numStarts];
 
-  for (int iGN=0; iGN<this->NumberOfParameters; iGN++)
+  // the starting points are minimized on separate threads if the function
+  // can be called from several threads, or one after the other
+  if (numStarts > 1 && this->ThreadedFunction && this->NumberOfThreads > 1)
   {
-    this->Parameters[iGN] = p[iGN];
+    vtkPowellMinimizerStartsStruct str;
+    str.Self = this;
+    str.NumberOfStarts = numStarts;
+    str.Minima = minima;
+    str.Results = results;
+    str.Iterations = iterations;
+
+    int numThreads = this->NumberOfThreads;
+    numThreads = (numThreads < numStarts) ? numThreads : numStarts;
+    this->Threader->SetNumberOfThreads(numThreads);
+    this->Threader->SetSingleMethod(vtkPowellMinimizerStartsExecute, &str);
+    this->Threader->SingleMethodExecute();
   }
-  delete [] p;
-  for (int lGN=0; lGN < this->NumberOfParameters; lGN++)
+  else
   {
-    delete [] Vertices[lGN];
+    for (int i = 0; i < numStarts; i++)
+    {
+      results[i] = this->MinimizeFromPoint(&minima[i*n], 0, 0, &iterations[i]);
+    }
+  }
+
+  // keep the lowest minimum, the first one if several are equal
+  int best = 0;
+  for (int i = 1; i < numStarts; i++)
+  {
+    if (results[i] < results[best])
+    {
+      best = i;
+    }
   }
-  delete [] Vertices;
-}
\ No newline at end of file
+  memcpy(this->Parameters, &minima[best*n], n*sizeof(double));
+  this->ScalarResult = results[best];
+  this->Iterations = iterations[best];
+
+  delete [] minima;
+  delete [] results;
+  delete [] iterations;
+}
@@ -3,6 +3,7 @@
 
 #include "vtkRobartsRegistrationExport.h"
 
+#include "vtkMultiThreader.h"
 #include "vtkObject.h"
 
 class vtkRobartsRegistrationExport vtkPowellMinimizer : public vtkObject
@@ -21,6 +22,40 @@ public:
   // Set a function to call when a void* argument is being discarded.
   void SetFunctionArgDelete(void (*f)(void *));
 
+  // Description:
+  // Specify the function to be minimized as a function that is given
+  // the parameters, in the order in which the variables were specified,
+  // and returns the value. Unlike SetFunction, this function is called
+  // from NumberOfThreads threads at once, and threadId can be used to
+  // select the state that belongs to the calling thread.
+  void SetThreadedFunction(double (*f)(void *arg, int threadId, const double *parameters),
+                           void *arg);
+
+  // Description:
+  // Specify a function that evaluates the function at numberOfPoints
+  // points at once, which are given one after the other in points, and
+  // stores the values in results. It is used where the minimizer has
+  // independent points to evaluate, and overrides the threaded function
+  // for them.
+  void SetBatchFunction(void (*f)(void *arg, int numberOfPoints, const double *points,
+                                  double *results), void *arg);
+
+  // Description:
+  // Add a point to start the minimization from, in the order in which
+  // the variables were specified. Each starting point is minimized
+  // separately, on its own thread if a threaded function was given, and
+  // the lowest minimum is kept (the first, for equal minima). Without
+  // starting points, the minimization starts at the bottom of the
+  // brackets.
+  void AddStartingPoint(const double *parameters);
+  void RemoveAllStartingPoints();
+  int GetNumberOfStartingPoints();
+
+  // Description:
+  // Set the number of threads used with the threaded function.
+  vtkSetClampMacro(NumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads,int);
+
   // Description:
   // Specify a variable to modify during the minimization.  Only the
   // variable you specify will be modified.  You must specify estimated
@@ -79,8 +114,24 @@ protected:
   void (*Function)(void *);
   void (*FunctionArgDelete)(void *);
   void *FunctionArg;
+  double (*ThreadedFunction)(void *, int, const double *);
+  void *ThreadedFunctionArg;
+  void (*BatchFunction)(void *, int, const double *, double *);
+  void *BatchFunctionArg;
 //ETX
 
+  // Description:
+  // Evaluate the function at one point, or at several points. With
+  // serial set, the points are evaluated one by one with the given
+  // thread id rather than by a batch or by several threads.
+  double EvaluatePoint(int threadId, const double *parameters);
+  void EvaluatePoints(int numberOfPoints, const double *points, double *results,
+                      int serial, int threadId);
+
+  // Description:
+  // Minimize from one starting point, which is replaced by the minimum.
+  double MinimizeFromPoint(double *point, int serial, int threadId, int *iterations);
+
   int NumberOfParameters;
   char **ParameterNames;
   double *Parameters;
@@ -90,12 +141,22 @@ protected:
 
   double ScalarResult;
 
+  int NumberOfStartingPoints;
+  double *StartingPoints;
+
+  vtkMultiThreader *Threader;
+  int NumberOfThreads;
+
   double Tolerance;
   int MaxIterations;
   int Iterations;
 
 //BTX
   friend void vtkPowellMinimizerFunction(void *data);
+  friend void vtkPowellMinimizerBatch(void *data, int numberOfPoints,
+                                      const double *points, double *results);
+  friend VTK_THREAD_RETURN_TYPE vtkPowellMinimizerPointsExecute(void *arg);
+  friend VTK_THREAD_RETURN_TYPE vtkPowellMinimizerStartsExecute(void *arg);
 //ETX
 };
 